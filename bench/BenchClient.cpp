@@ -0,0 +1,142 @@
+// ===== file: bench/BenchClient.cpp =====
+#include "BenchClient.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace proto;
+
+namespace {
+const size_t RECV_CHUNK = 256 * 1024;
+} // namespace
+
+BenchClient::~BenchClient() {
+    close();
+}
+
+bool BenchClient::connect_to(const string &host, int port) {
+    close();
+    fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) return false;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+        ::connect(fd_, (sockaddr *)&addr, sizeof(addr)) != 0) {
+        close();
+        return false;
+    }
+    int one = 1;
+    ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+}
+
+void BenchClient::close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    rbuf_.clear();
+    rpos_ = 0;
+}
+
+int BenchClient::register_user(const string &user, const string &pass) {
+    Request req;
+    req.op   = Op::Register;
+    req.user = user;
+    req.pass = pass;
+    Reply rep;
+    return command(req, rep);
+}
+
+int BenchClient::auth(const string &user, const string &pass) {
+    Request req;
+    req.op   = Op::Auth;
+    req.user = user;
+    req.pass = pass;
+    Reply rep;
+    return command(req, rep);
+}
+
+int BenchClient::upload(Op op, const string &path, const char *data, uint64_t len) {
+    Request req;
+    req.op   = op;
+    req.path = path;
+    req.size = len;
+    Reply rep;
+    int code = command(req, rep);
+    if (code != 100) return code;
+    if (len > 0 && !send_all(fd_, data, len)) return 0;
+    return read_reply(rep) ? rep.code : 0;
+}
+
+int BenchClient::download(Op op, const string &path, uint64_t &bytes) {
+    Request req;
+    req.op   = op;
+    req.path = path;
+    Reply rep;
+    bytes = 0;
+    int code = command(req, rep);
+    if (code != 100) return code;
+    if (!skip_body(rep.size)) return 0;
+    bytes = rep.size;
+    return 200;
+}
+
+int BenchClient::stats() {
+    Request req;
+    req.op = Op::Stats;
+    Reply rep;
+    return command(req, rep);
+}
+
+int BenchClient::command(const Request &req, Reply &rep) {
+    if (fd_ < 0) return 0;
+    if (!send_line(fd_, format_text_request(req))) return 0;
+    return read_reply(rep) ? rep.code : 0;
+}
+
+bool BenchClient::read_reply(Reply &rep) {
+    string line;
+    return read_line(line) && parse_text_reply(line, rep);
+}
+
+bool BenchClient::read_line(string &line) {
+    while (true) {
+        size_t nl = rbuf_.find('\n', rpos_);
+        if (nl != string::npos) {
+            line.assign(rbuf_, rpos_, nl - rpos_);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            rpos_ = nl + 1;
+            return true;
+        }
+        rbuf_.erase(0, rpos_);
+        rpos_ = 0;
+        char buf[4096];
+        ssize_t n = ::recv(fd_, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        rbuf_.append(buf, (size_t)n);
+    }
+}
+
+bool BenchClient::skip_body(uint64_t len) {
+    uint64_t buffered = rbuf_.size() - rpos_;
+    if (buffered >= len) {
+        rpos_ += (size_t)len;
+        return true;
+    }
+    len -= buffered;
+    rbuf_.clear();
+    rpos_ = 0;
+    static thread_local string scratch(RECV_CHUNK, '\0');
+    while (len > 0) {
+        size_t want = len < RECV_CHUNK ? (size_t)len : RECV_CHUNK;
+        ssize_t n = ::recv(fd_, &scratch[0], want, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        len -= (uint64_t)n;
+    }
+    return true;
+}
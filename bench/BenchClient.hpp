@@ -0,0 +1,39 @@
+// ===== file: bench/BenchClient.hpp =====
+#pragma once
+#include <string>
+#include <cstdint>
+#include "../common/Protocol.hpp"
+
+using namespace std;
+
+// Kết nối blocking nói giao thức text v1, mỗi lúc 1 lệnh: đo đúng 1 lệnh của
+// server (NetworkClient tự đổi PUT_TEXT thành delta, dùng stream v2...).
+// Mỗi lệnh trả mã reply của server, 0 nếu kết nối lỗi.
+class BenchClient {
+public:
+    BenchClient() = default;
+    ~BenchClient();
+    BenchClient(const BenchClient &) = delete;
+    BenchClient &operator=(const BenchClient &) = delete;
+
+    bool connect_to(const string &host, int port);
+    void close();
+
+    int register_user(const string &user, const string &pass);
+    int auth(const string &user, const string &pass);
+    // UPLOAD / PUT_TEXT: gửi len byte từ data sau "OK 100".
+    int upload(proto::Op op, const string &path, const char *data, uint64_t len);
+    // DOWNLOAD / GET_TEXT: đọc rồi bỏ body; bytes = số byte body nhận.
+    int download(proto::Op op, const string &path, uint64_t &bytes);
+    int stats();
+
+private:
+    int  command(const proto::Request &req, proto::Reply &rep);
+    bool read_reply(proto::Reply &rep);
+    bool read_line(string &line);
+    bool skip_body(uint64_t len);
+
+    int    fd_ = -1;
+    string rbuf_;     // byte đã nhận chưa dùng
+    size_t rpos_ = 0;
+};
@@ -0,0 +1,351 @@
+// ===== file: bench/MicroBench.cpp =====
+// Microbenchmark (Google Benchmark) cho các vòng lặp trong: giao thức dòng
+// lệnh qua socketpair, xử lý path trên thư mục tạm, QuotaManager nhiều thread
+// và từng hàm của DbSqlite. So với baseline bằng bench/compare_micro.py.
+#include <benchmark/benchmark.h>
+#include "../common/Protocol.hpp"
+#include "../common/Utils.hpp"
+#include "QuotaManager.hpp"
+#include "DbSqlite.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <cstdlib>
+#include <memory>
+
+using namespace std;
+using namespace proto;
+
+namespace {
+
+// Thư mục tạm, xóa cả cây khi hủy.
+class TempDir {
+public:
+    TempDir() {
+        char tmpl[] = "/tmp/fileshare_micro.XXXXXX";
+        path_ = ::mkdtemp(tmpl) ? tmpl : "";
+    }
+    ~TempDir() {
+        if (path_.empty()) return;
+        ::nftw(path_.c_str(), [](const char *p, const struct stat *, int, FTW *) {
+            return ::remove(p);
+        }, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    const string &path() const { return path_; }
+
+private:
+    string path_;
+};
+
+struct SocketPair {
+    int fd[2] = {-1, -1};
+    SocketPair()  { ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fd); }
+    ~SocketPair() { ::close(fd[0]); ::close(fd[1]); }
+};
+
+string make_line(size_t len) {
+    string line = "PUT_TEXT ";
+    while (line.size() + 8 < len) line += "dir/sub/";
+    line += " 1234";
+    return line;
+}
+
+// ---- Giao thức ----
+
+void BM_SendLine(benchmark::State &state) {
+    SocketPair sp;
+    string line = make_line((size_t)state.range(0));
+    char sink[65536];
+    for (auto _ : state) {
+        send_line(sp.fd[0], line);
+        benchmark::DoNotOptimize(::recv(sp.fd[1], sink, sizeof(sink), 0));
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t)(line.size() + 1));
+}
+BENCHMARK(BM_SendLine)->Arg(16)->Arg(128)->Arg(1024);
+
+void BM_RecvLine(benchmark::State &state) {
+    SocketPair sp;
+    string wire = make_line((size_t)state.range(0)) + "\n";
+    string line;
+    for (auto _ : state) {
+        send_all(sp.fd[0], wire.data(), wire.size());
+        benchmark::DoNotOptimize(recv_line(sp.fd[1], line));
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t)wire.size());
+}
+BENCHMARK(BM_RecvLine)->Arg(16)->Arg(128)->Arg(1024);
+
+void BM_SplitTokens(benchmark::State &state) {
+    string line = "UPLOAD";
+    for (int i = 1; i < state.range(0); ++i) line += " token" + to_string(i);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(split_tokens(line));
+    }
+}
+BENCHMARK(BM_SplitTokens)->Arg(2)->Arg(4)->Arg(16);
+
+void BM_ParseTextRequest(benchmark::State &state) {
+    const char *lines[] = {"AUTH alice secret", "UPLOAD docs/report.pdf 1048576",
+                           "DOWNLOAD docs/report.pdf 0 65536", "STATS"};
+    string line = lines[state.range(0)];
+    Request req;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(parse_text_request(line, req));
+    }
+}
+BENCHMARK(BM_ParseTextRequest)->DenseRange(0, 3);
+
+void BM_FormatTextReply(benchmark::State &state) {
+    Reply rep;
+    rep.code = 200;
+    rep.msg  = "Upload completed";
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(format_text_reply(rep));
+    }
+}
+BENCHMARK(BM_FormatTextReply);
+
+// msg của reply body ("<size> <total> <codec>") dựng trong buffer cố định.
+void BM_MsgBuf(benchmark::State &state) {
+    uint64_t size = 1048576, total = 4194304;
+    for (auto _ : state) {
+        MsgBuf msg;
+        msg.add(size).add(' ').add(total).add(' ').add("zstd");
+        benchmark::DoNotOptimize(msg.view().data());
+    }
+}
+BENCHMARK(BM_MsgBuf);
+
+// ---- Path ----
+
+void BM_JoinPath(benchmark::State &state) {
+    string a = "./data/alice/", b = "/docs/2024/report.pdf";
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utils::join_path(a, b));
+    }
+}
+BENCHMARK(BM_JoinPath);
+
+void BM_SplitPath(benchmark::State &state) {
+    string path;
+    for (int i = 0; i < state.range(0); ++i) path += "/level" + to_string(i);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utils::split_path(path));
+    }
+}
+BENCHMARK(BM_SplitPath)->Arg(1)->Arg(4)->Arg(16);
+
+// Thư mục đã có (trường hợp thường gặp khi upload vào thư mục cũ).
+void BM_EnsureDirExisting(benchmark::State &state) {
+    TempDir tmp;
+    string dir = tmp.path();
+    for (int i = 0; i < state.range(0); ++i) dir += "/d" + to_string(i);
+    utils::ensure_dir(dir);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utils::ensure_dir(dir));
+    }
+}
+BENCHMARK(BM_EnsureDirExisting)->Arg(1)->Arg(4)->Arg(8);
+
+void BM_EnsureDirNew(benchmark::State &state) {
+    TempDir tmp;
+    uint64_t n = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utils::ensure_dir(tmp.path() + "/n" + to_string(n++) + "/a/b"));
+    }
+}
+BENCHMARK(BM_EnsureDirNew);
+
+// ---- Quota ----
+// range(0) = 0: mọi thread cùng 1 user (tranh chấp 1 account), 1: mỗi thread 1 user.
+
+QuotaManager g_quota;
+
+void BM_QuotaAccount(benchmark::State &state) {
+    int user = state.range(0) ? state.thread_index() + 1 : 1;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(&g_quota.account(user));
+    }
+}
+BENCHMARK(BM_QuotaAccount)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_QuotaReserveRelease(benchmark::State &state) {
+    int user = state.range(0) ? state.thread_index() + 1 : 1;
+    UserQuota &q = g_quota.account(user);
+    q.set_limit(0);
+    for (auto _ : state) {
+        if (q.reserve(4096)) q.release(4096);
+    }
+}
+BENCHMARK(BM_QuotaReserveRelease)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_QuotaCommit(benchmark::State &state) {
+    int user = state.range(0) ? state.thread_index() + 1 : 1;
+    UserQuota &q = g_quota.account(user);
+    for (auto _ : state) {
+        q.reserve(4096);
+        q.commit(4096, 0);
+    }
+}
+BENCHMARK(BM_QuotaCommit)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+// ---- DbSqlite ----
+// Mỗi benchmark 1 DB mới trong thư mục tạm, group commit mặc định.
+
+struct DbFixture {
+    TempDir tmp;
+    unique_ptr<DbSqlite> db;
+    int user_id = 0;
+
+    DbFixture() {
+        db.reset(new DbSqlite(tmp.path() + "/bench.db", GroupCommitOptions{}, 2));
+        string err;
+        UserRecord rec;
+        db->init_schema(err);
+        db->create_user("bench", "pw", 1ull << 30, err);
+        db->sync(err);
+        db->get_user_by_username("bench", rec, err);
+        user_id = rec.id;
+    }
+};
+
+vector<ChunkRef> make_chunks(size_t n, uint64_t seed) {
+    vector<ChunkRef> chunks(n);
+    for (size_t i = 0; i < n; ++i) {
+        char hex[65];
+        snprintf(hex, sizeof(hex), "%064llx", (unsigned long long)(seed * 1000003 + i));
+        chunks[i].hash = hex;
+        chunks[i].size = 65536;
+    }
+    return chunks;
+}
+
+const int FILES = 1000;
+
+void BM_DbGetUser(benchmark::State &state) {
+    DbFixture f;
+    UserRecord rec;
+    string err;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f.db->get_user_by_username("bench", rec, err));
+    }
+}
+BENCHMARK(BM_DbGetUser);
+
+void BM_DbCreateUser(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    uint64_t n = 0;
+    for (auto _ : state) {
+        f.db->create_user("user" + to_string(n++), "pw", 1ull << 30, err);
+    }
+}
+BENCHMARK(BM_DbCreateUser);
+
+void BM_DbUpdateUsedBytes(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    uint64_t n = 0;
+    for (auto _ : state) {
+        f.db->update_used_bytes(f.user_id, n++, err);
+    }
+}
+BENCHMARK(BM_DbUpdateUsedBytes);
+
+void BM_DbInsertLog(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    for (auto _ : state) {
+        f.db->insert_log(f.user_id, "UPLOAD", "docs/report.pdf size=1048576", "127.0.0.1", err);
+    }
+}
+BENCHMARK(BM_DbInsertLog);
+
+void BM_DbUpsertFileEntry(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    uint64_t n = 0;
+    for (auto _ : state) {
+        f.db->upsert_file_entry(f.user_id, "file" + to_string(n % FILES), n, false,
+                                (int64_t)(n & 0xffffffff), err);
+        ++n;
+    }
+}
+BENCHMARK(BM_DbUpsertFileEntry);
+
+void BM_DbGetFileCrc(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    for (int i = 0; i < FILES; ++i) {
+        f.db->upsert_file_entry(f.user_id, "file" + to_string(i), i, false, i, err);
+    }
+    uint64_t size = 0, n = 0;
+    uint32_t crc = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            f.db->get_file_crc(f.user_id, "file" + to_string(n++ % FILES), size, crc, err));
+    }
+}
+BENCHMARK(BM_DbGetFileCrc);
+
+void BM_DbPutFileChunks(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    vector<string> released;
+    uint64_t n = 0;
+    for (auto _ : state) {
+        vector<ChunkRef> chunks = make_chunks((size_t)state.range(0), n);
+        f.db->put_file_chunks(f.user_id, "file" + to_string(n % FILES),
+                              chunks.size() * 65536, chunks, released, err);
+        ++n;
+    }
+}
+BENCHMARK(BM_DbPutFileChunks)->Arg(1)->Arg(16);
+
+void BM_DbGetFileChunks(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    vector<string> released;
+    for (int i = 0; i < FILES; ++i) {
+        vector<ChunkRef> chunks = make_chunks((size_t)state.range(0), (uint64_t)i);
+        f.db->put_file_chunks(f.user_id, "file" + to_string(i), chunks.size() * 65536,
+                              chunks, released, err);
+    }
+    vector<ChunkRef> out;
+    uint64_t size = 0, n = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            f.db->get_file_chunks(f.user_id, "file" + to_string(n++ % FILES), size, out, err));
+    }
+}
+BENCHMARK(BM_DbGetFileChunks)->Arg(1)->Arg(16);
+
+void BM_DbGetChunkRefcount(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    vector<string> released;
+    vector<ChunkRef> chunks = make_chunks(64, 7);
+    f.db->put_file_chunks(f.user_id, "file", chunks.size() * 65536, chunks, released, err);
+    uint64_t refs = 0, n = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f.db->get_chunk_refcount(chunks[n++ % 64].hash, refs, err));
+    }
+}
+BENCHMARK(BM_DbGetChunkRefcount);
+
+// 1 thay đổi rồi chờ nó bền: chi phí 1 lần COMMIT (fsync) của group commit.
+void BM_DbSync(benchmark::State &state) {
+    DbFixture f;
+    string err;
+    uint64_t n = 0;
+    for (auto _ : state) {
+        f.db->update_used_bytes(f.user_id, n++, err);
+        f.db->sync(err);
+    }
+}
+BENCHMARK(BM_DbSync)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
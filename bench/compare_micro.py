@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""So kết quả fileshare_microbench (JSON của Google Benchmark) với baseline.
+
+  ./build/fileshare_microbench --benchmark_repetitions=5 \
+      --benchmark_out=current.json --benchmark_out_format=json
+  bench/compare_micro.py baseline.json current.json [--threshold=10]
+  bench/compare_micro.py --save current.json baseline.json   # cập nhật baseline
+
+Có repetitions thì dùng median, không thì dùng lần chạy duy nhất. Trả về 1
+nếu có benchmark chậm hơn baseline quá threshold % (theo real_time).
+"""
+import json
+import shutil
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    plain, median = {}, {}
+    for b in data.get("benchmarks", []):
+        if b.get("aggregate_name") == "median":
+            median[b["run_name"]] = b
+        elif b.get("run_type", "iteration") == "iteration":
+            plain.setdefault(b.get("run_name", b["name"]), b)
+    plain.update(median)
+    return {name: b["real_time"] * unit_ns(b) for name, b in plain.items()}
+
+
+def unit_ns(b):
+    return {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}[b.get("time_unit", "ns")]
+
+
+def main(argv):
+    threshold = 10.0
+    args = []
+    for a in argv[1:]:
+        if a.startswith("--threshold="):
+            threshold = float(a.split("=", 1)[1])
+        else:
+            args.append(a)
+
+    if len(args) == 3 and args[0] == "--save":
+        load(args[1])  # kiểm tra đúng định dạng trước khi ghi đè
+        shutil.copyfile(args[1], args[2])
+        print("baseline saved to %s" % args[2])
+        return 0
+    if len(args) != 2:
+        print(__doc__)
+        return 2
+
+    base, cur = load(args[0]), load(args[1])
+    regressions = 0
+    width = max([len(n) for n in cur] + [10])
+    print("%-*s %14s %14s %9s" % (width, "benchmark", "baseline ns", "current ns", "change"))
+    for name in sorted(cur):
+        if name not in base:
+            print("%-*s %14s %14.1f %9s" % (width, name, "-", cur[name], "new"))
+            continue
+        change = (cur[name] - base[name]) / base[name] * 100 if base[name] else 0.0
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-*s %14.1f %14.1f %+8.1f%%%s" % (width, name, base[name], cur[name], change, flag))
+    for name in sorted(set(base) - set(cur)):
+        print("%-*s %14.1f %14s %9s" % (width, name, base[name], "-", "missing"))
+
+    if regressions:
+        print("%d benchmark(s) slower than baseline by more than %.1f%%" % (regressions, threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,381 @@
+// ===== file: bench/main.cpp =====
+// Máy tạo tải cho fileshare_server: N kết nối, mỗi kết nối đăng nhập 1 user
+// tổng hợp rồi chạy hỗn hợp lệnh theo trọng số; in kết quả dạng JSON.
+#include "BenchClient.hpp"
+#include "Metrics.hpp"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+using namespace proto;
+
+namespace {
+using Clock = chrono::steady_clock;
+
+// Kích thước body: lo == hi thì cố định, không thì phân bố log-uniform trên
+// [lo, hi] (nhiều file nhỏ, ít file lớn).
+struct SizeDist {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    uint64_t sample(mt19937_64 &rng) const {
+        if (lo >= hi) return lo;
+        double a = log((double)(lo ? lo : 1)), b = log((double)hi);
+        uniform_real_distribution<double> d(a, b);
+        return min<uint64_t>(hi, (uint64_t)exp(d(rng)));
+    }
+};
+
+struct BenchConfig {
+    string   host    = "127.0.0.1";
+    int      port    = 5051;
+    int      conns   = 16;
+    int      users   = 4;
+    double   seconds = 10;
+    double   rate    = 0;     // lệnh/giây cho cả bench (open loop), 0 = closed loop
+    bool     poisson = true;  // khoảng cách giữa 2 lệnh: mũ (Poisson) hay đều
+    int      files   = 8;     // file mỗi user cho DOWNLOAD/GET_TEXT, mỗi kết nối cho UPLOAD/PUT_TEXT
+    string   prefix  = "bench";
+    string   pass    = "benchpw";
+    string   mix_spec  = "upload:1,download:4,get_text:4,put_text:1,stats:0";
+    string   size_spec = "4K-1M";
+    string   text_spec = "256-16K";
+    double   weight[OP_COUNT] = {};
+    SizeDist size;
+    SizeDist text_size;
+};
+
+// "64K", "1M", "512" -> byte.
+bool parse_size(const string &s, uint64_t &out) {
+    if (s.empty()) return false;
+    uint64_t mult = 1;
+    string num = s;
+    char last = (char)toupper((unsigned char)s.back());
+    if (last == 'K' || last == 'M' || last == 'G') {
+        mult = last == 'K' ? 1ull << 10 : last == 'M' ? 1ull << 20 : 1ull << 30;
+        num.pop_back();
+    }
+    if (!parse_u64(num, out)) return false;
+    out *= mult;
+    return true;
+}
+
+// "4K" (cố định) hoặc "4K-1M".
+bool parse_dist(const string &s, SizeDist &out) {
+    size_t dash = s.find('-');
+    if (dash == string::npos) {
+        if (!parse_size(s, out.lo)) return false;
+        out.hi = out.lo;
+        return true;
+    }
+    return parse_size(s.substr(0, dash), out.lo) &&
+           parse_size(s.substr(dash + 1), out.hi) && out.lo <= out.hi;
+}
+
+// "upload:1,download:4,..." theo tên lệnh viết thường.
+bool parse_mix(const string &s, double weight[OP_COUNT]) {
+    for (size_t i = 0; i < OP_COUNT; ++i) weight[i] = 0;
+    size_t pos = 0;
+    double total = 0;
+    while (pos < s.size()) {
+        size_t comma = s.find(',', pos);
+        string item = s.substr(pos, comma == string::npos ? string::npos : comma - pos);
+        pos = comma == string::npos ? s.size() : comma + 1;
+        size_t colon = item.find(':');
+        if (colon == string::npos) return false;
+        string name = item.substr(0, colon);
+        for (char &c : name) c = (char)toupper((unsigned char)c);
+        Op op = Op::None;
+        for (Op o : {Op::Upload, Op::Download, Op::GetText, Op::PutText, Op::Stats}) {
+            if (name == op_name(o)) op = o;
+        }
+        if (op == Op::None) return false;
+        weight[(size_t)op] = atof(item.c_str() + colon + 1);
+        total += weight[(size_t)op];
+    }
+    return total > 0;
+}
+
+// Thời điểm đến của lệnh (giây từ lúc bắt đầu), chung cho mọi kết nối: lệnh
+// nào đến thì kết nối rảnh nhận. Độ trễ tính từ thời điểm đến chứ không từ
+// lúc gửi, nên server chậm làm lệnh xếp hàng thì độ trễ tăng theo
+// (không bị coordinated omission).
+class Arrivals {
+public:
+    Arrivals(double rate, bool poisson) : rate_(rate), poisson_(poisson), rng_(12345) {}
+
+    double take() {
+        lock_guard<mutex> lock(mtx_);
+        double t = next_;
+        next_ += poisson_ ? exponential_distribution<double>(rate_)(rng_) : 1.0 / rate_;
+        return t;
+    }
+
+private:
+    mutex       mtx_;
+    double      rate_;
+    bool        poisson_;
+    mt19937_64  rng_;
+    double      next_ = 0;
+};
+
+struct Shared {
+    const BenchConfig *cfg = nullptr;
+    string   payload;   // byte ngẫu nhiên (không nén được) cho UPLOAD
+    string   text;      // văn bản cho PUT_TEXT
+    Arrivals *arrivals = nullptr;
+    Clock::time_point start;
+    atomic<uint64_t> failed_conns{0};
+};
+
+string user_name(const BenchConfig &cfg, int u) {
+    return cfg.prefix + "_" + to_string(u);
+}
+
+bool login(BenchClient &c, const BenchConfig &cfg, int u) {
+    return c.connect_to(cfg.host, cfg.port) && c.auth(user_name(cfg, u), cfg.pass) == 200;
+}
+
+// Tạo user (đã có thì thôi) và các file DOWNLOAD/GET_TEXT sẽ đọc.
+bool setup_user(const Shared &sh, int u) {
+    const BenchConfig &cfg = *sh.cfg;
+    BenchClient c;
+    if (!c.connect_to(cfg.host, cfg.port)) {
+        cerr << "cannot connect to " << cfg.host << ":" << cfg.port << "\n";
+        return false;
+    }
+    int code = c.register_user(user_name(cfg, u), cfg.pass);
+    if (code != 201 && code != 409) {
+        cerr << "REGISTER " << user_name(cfg, u) << " failed: " << code << "\n";
+        return false;
+    }
+    code = c.auth(user_name(cfg, u), cfg.pass);
+    if (code != 200) {
+        cerr << "AUTH " << user_name(cfg, u) << " failed: " << code << "\n";
+        return false;
+    }
+    mt19937_64 rng((uint64_t)u + 1);
+    for (int k = 0; k < cfg.files; ++k) {
+        uint64_t n = max<uint64_t>(1, cfg.size.sample(rng));
+        uint64_t t = max<uint64_t>(1, cfg.text_size.sample(rng));
+        if (c.upload(Op::Upload, "seed_" + to_string(k) + ".bin", sh.payload.data(), n) != 200 ||
+            c.upload(Op::PutText, "seed_" + to_string(k) + ".txt", sh.text.data(), t) != 200) {
+            cerr << "seeding files for " << user_name(cfg, u) << " failed\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+Op pick_op(const BenchConfig &cfg, mt19937_64 &rng) {
+    double total = 0;
+    for (size_t i = 0; i < OP_COUNT; ++i) total += cfg.weight[i];
+    double x = uniform_real_distribution<double>(0, total)(rng);
+    for (size_t i = 0; i < OP_COUNT; ++i) {
+        if (x < cfg.weight[i]) return (Op)i;
+        x -= cfg.weight[i];
+    }
+    return Op::Stats;
+}
+
+void run_conn(Shared &sh, int k) {
+    const BenchConfig &cfg = *sh.cfg;
+    int u = k % cfg.users;
+    BenchClient c;
+    if (!login(c, cfg, u)) {
+        sh.failed_conns.fetch_add(1);
+        return;
+    }
+    mt19937_64 rng((uint64_t)k * 7919 + 17);
+    auto deadline = sh.start + chrono::duration_cast<Clock::duration>(
+                                   chrono::duration<double>(cfg.seconds));
+
+    while (true) {
+        Clock::time_point due;
+        if (sh.arrivals) {
+            double t = sh.arrivals->take();
+            if (t >= cfg.seconds) break;
+            due = sh.start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(t));
+            this_thread::sleep_until(due);
+        } else {
+            due = Clock::now();
+            if (due >= deadline) break;
+        }
+
+        Op op = pick_op(cfg, rng);
+        int file = uniform_int_distribution<int>(0, cfg.files - 1)(rng);
+        string mine = "up_" + to_string(k) + "_" + to_string(file);
+        uint64_t bytes = 0;
+        int code = 0;
+        switch (op) {
+        case Op::Upload:
+            bytes = max<uint64_t>(1, cfg.size.sample(rng));
+            code = c.upload(op, mine + ".bin", sh.payload.data(), bytes);
+            break;
+        case Op::PutText:
+            bytes = max<uint64_t>(1, cfg.text_size.sample(rng));
+            code = c.upload(op, mine + ".txt", sh.text.data(), bytes);
+            break;
+        case Op::Download:
+            code = c.download(op, "seed_" + to_string(file) + ".bin", bytes);
+            break;
+        case Op::GetText:
+            code = c.download(op, "seed_" + to_string(file) + ".txt", bytes);
+            break;
+        default:
+            code = c.stats();
+            break;
+        }
+        uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                          Clock::now() - due).count();
+        bool err = code == 0 || code >= 400;
+        metrics::record_command(op, ns, err, err ? 0 : bytes);
+
+        // Mất kết nối (hoặc server đóng sau lỗi): nối lại rồi chạy tiếp.
+        if (code == 0 || code == 401 || code == 403) {
+            if (!login(c, cfg, u)) {
+                sh.failed_conns.fetch_add(1);
+                return;
+            }
+        }
+    }
+}
+
+string fmt(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", v);
+    return buf;
+}
+
+string json_report(const BenchConfig &cfg, double elapsed, uint64_t failed_conns) {
+    metrics::Snapshot s = metrics::snapshot();
+    uint64_t ops = 0, errors = 0, bytes = 0;
+    string per_op;
+    for (size_t i = 1; i < OP_COUNT; ++i) {
+        const metrics::Series &x = s.ops[i];
+        if (x.count == 0) continue;
+        ops    += x.count;
+        errors += x.errors;
+        bytes  += x.bytes;
+        if (!per_op.empty()) per_op += ",\n";
+        per_op += string("    \"") + op_name((Op)i) + "\": {\"count\": " + to_string(x.count) +
+                  ", \"errors\": " + to_string(x.errors) +
+                  ", \"bytes\": " + to_string(x.bytes) +
+                  ", \"ops_per_s\": " + fmt(x.count / elapsed) +
+                  ", \"mb_per_s\": " + fmt(x.bytes / elapsed / 1e6) +
+                  ", \"latency_us\": {\"mean\": " + fmt(x.sum_ns / 1e3 / x.count) +
+                  ", \"p50\": " + fmt(x.quantile(0.5) / 1e3) +
+                  ", \"p90\": " + fmt(x.quantile(0.9) / 1e3) +
+                  ", \"p99\": " + fmt(x.quantile(0.99) / 1e3) +
+                  ", \"p999\": " + fmt(x.quantile(0.999) / 1e3) +
+                  ", \"max\": " + fmt(x.quantile(1.0) / 1e3) + "}}";
+    }
+    string out = "{\n";
+    out += "  \"config\": {\"host\": \"" + cfg.host + "\", \"port\": " + to_string(cfg.port) +
+           ", \"conns\": " + to_string(cfg.conns) + ", \"users\": " + to_string(cfg.users) +
+           ", \"seconds\": " + fmt(cfg.seconds) + ", \"rate\": " + fmt(cfg.rate) +
+           ", \"arrival\": \"" + (cfg.rate <= 0 ? "closed" : cfg.poisson ? "poisson" : "uniform") +
+           "\", \"mix\": \"" + cfg.mix_spec + "\", \"size\": \"" + cfg.size_spec +
+           "\", \"text_size\": \"" + cfg.text_spec + "\", \"files\": " + to_string(cfg.files) +
+           "},\n";
+    out += "  \"elapsed_s\": " + fmt(elapsed) + ",\n";
+    out += "  \"failed_conns\": " + to_string(failed_conns) + ",\n";
+    out += "  \"total\": {\"ops\": " + to_string(ops) + ", \"errors\": " + to_string(errors) +
+           ", \"ops_per_s\": " + fmt(ops / elapsed) +
+           ", \"mb_per_s\": " + fmt(bytes / elapsed / 1e6) + "},\n";
+    out += "  \"ops\": {\n" + per_op + "\n  }\n}\n";
+    return out;
+}
+} // namespace
+
+static void usage(const char *prog) {
+    cerr << "Usage: " << prog << " [--host=127.0.0.1] [--port=5051] [--conns=N] [--users=N]\n"
+         << "       [--seconds=S] [--rate=ops/s] [--arrival=poisson|uniform]\n"
+         << "       [--mix=upload:1,download:4,get_text:4,put_text:1,stats:0]\n"
+         << "       [--size=4K-1M] [--text-size=256-16K] [--files=N]\n"
+         << "       [--prefix=bench] [--pass=benchpw]\n";
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig cfg;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--host=", 0) == 0) {
+            cfg.host = arg.substr(strlen("--host="));
+        } else if (arg.rfind("--port=", 0) == 0) {
+            cfg.port = stoi(arg.substr(strlen("--port=")));
+        } else if (arg.rfind("--conns=", 0) == 0) {
+            cfg.conns = max(1, stoi(arg.substr(strlen("--conns="))));
+        } else if (arg.rfind("--users=", 0) == 0) {
+            cfg.users = max(1, stoi(arg.substr(strlen("--users="))));
+        } else if (arg.rfind("--seconds=", 0) == 0) {
+            cfg.seconds = stod(arg.substr(strlen("--seconds=")));
+        } else if (arg.rfind("--rate=", 0) == 0) {
+            cfg.rate = stod(arg.substr(strlen("--rate=")));
+        } else if (arg == "--arrival=poisson") {
+            cfg.poisson = true;
+        } else if (arg == "--arrival=uniform") {
+            cfg.poisson = false;
+        } else if (arg.rfind("--mix=", 0) == 0) {
+            cfg.mix_spec = arg.substr(strlen("--mix="));
+        } else if (arg.rfind("--size=", 0) == 0) {
+            cfg.size_spec = arg.substr(strlen("--size="));
+        } else if (arg.rfind("--text-size=", 0) == 0) {
+            cfg.text_spec = arg.substr(strlen("--text-size="));
+        } else if (arg.rfind("--files=", 0) == 0) {
+            cfg.files = max(1, stoi(arg.substr(strlen("--files="))));
+        } else if (arg.rfind("--prefix=", 0) == 0) {
+            cfg.prefix = arg.substr(strlen("--prefix="));
+        } else if (arg.rfind("--pass=", 0) == 0) {
+            cfg.pass = arg.substr(strlen("--pass="));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!parse_mix(cfg.mix_spec, cfg.weight) || !parse_dist(cfg.size_spec, cfg.size) ||
+        !parse_dist(cfg.text_spec, cfg.text_size)) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.users = min(cfg.users, cfg.conns);
+
+    Shared sh;
+    sh.cfg = &cfg;
+    sh.payload.resize(max<uint64_t>(1, cfg.size.hi));
+    mt19937_64 rng(42);
+    for (char &ch : sh.payload) ch = (char)(rng() & 0xff);
+    sh.text.resize(max<uint64_t>(1, cfg.text_size.hi));
+    for (size_t i = 0; i < sh.text.size(); ++i) {
+        sh.text[i] = (i % 64 == 63) ? '\n' : (char)('a' + rng() % 26);
+    }
+
+    for (int u = 0; u < cfg.users; ++u) {
+        if (!setup_user(sh, u)) return 1;
+    }
+
+    unique_ptr<Arrivals> arrivals;
+    if (cfg.rate > 0) {
+        arrivals.reset(new Arrivals(cfg.rate, cfg.poisson));
+        sh.arrivals = arrivals.get();
+    }
+    sh.start = Clock::now();
+    vector<thread> workers;
+    for (int k = 0; k < cfg.conns; ++k) {
+        workers.emplace_back([&sh, k]() { run_conn(sh, k); });
+    }
+    for (auto &t : workers) t.join();
+    double elapsed = chrono::duration<double>(Clock::now() - sh.start).count();
+
+    cout << json_report(cfg, elapsed, sh.failed_conns.load());
+    return 0;
+}
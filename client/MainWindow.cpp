@@ -8,7 +8,9 @@ MainWindow::MainWindow(NetworkClient &&client, const string &username)
       username_(username),
       vbox_(Gtk::ORIENTATION_VERTICAL),
       btn_load_("Load"),
-      btn_save_("Save") {
+      btn_save_("Save"),
+      btn_upload_("Upload..."),
+      btn_download_("Download...") {
 
     set_title("File Share - " + username_);
     set_default_size(600, 400);
@@ -26,10 +28,13 @@ MainWindow::MainWindow(NetworkClient &&client, const string &username)
     hbox->pack_start(entry_path_, Gtk::PACK_EXPAND_WIDGET);
     hbox->pack_start(btn_load_, Gtk::PACK_SHRINK);
     hbox->pack_start(btn_save_, Gtk::PACK_SHRINK);
+    hbox->pack_start(btn_upload_, Gtk::PACK_SHRINK);
+    hbox->pack_start(btn_download_, Gtk::PACK_SHRINK);
 
     vbox_.pack_start(*hbox, Gtk::PACK_SHRINK);
     vbox_.pack_start(scroll_, Gtk::PACK_EXPAND_WIDGET);
     vbox_.pack_start(lbl_status_, Gtk::PACK_SHRINK);
+    vbox_.pack_start(lbl_transfers_, Gtk::PACK_SHRINK);
 
     scroll_.add(text_view_);
 
@@ -37,6 +42,19 @@ MainWindow::MainWindow(NetworkClient &&client, const string &username)
         sigc::mem_fun(*this, &MainWindow::on_btn_load_clicked));
     btn_save_.signal_clicked().connect(
         sigc::mem_fun(*this, &MainWindow::on_btn_save_clicked));
+    btn_upload_.signal_clicked().connect(
+        sigc::mem_fun(*this, &MainWindow::on_btn_upload_clicked));
+    btn_download_.signal_clicked().connect(
+        sigc::mem_fun(*this, &MainWindow::on_btn_download_clicked));
+
+    // Upload/download chạy trên cùng kết nối, xen với Load/Save.
+    bool mux = client_.is_v2();
+    btn_upload_.set_sensitive(mux);
+    btn_download_.set_sensitive(mux);
+    if (mux) {
+        Glib::signal_timeout().connect(
+            sigc::mem_fun(*this, &MainWindow::on_pump_timer), 50);
+    }
 
     show_all_children();
 }
@@ -63,3 +81,71 @@ void MainWindow::on_btn_save_clicked() {
     }
     lbl_status_.set_text("Saved " + path);
 }
+
+bool MainWindow::choose_local_file(bool save, string &path) {
+    Gtk::FileChooserDialog dialog(*this, save ? "Save as" : "Choose file",
+                                  save ? Gtk::FILE_CHOOSER_ACTION_SAVE
+                                       : Gtk::FILE_CHOOSER_ACTION_OPEN);
+    dialog.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    dialog.add_button(save ? "_Save" : "_Open", Gtk::RESPONSE_OK);
+    if (dialog.run() != Gtk::RESPONSE_OK) return false;
+    path = dialog.get_filename();
+    return !path.empty();
+}
+
+void MainWindow::on_btn_upload_clicked() {
+    string remote = entry_path_.get_text();
+    string local, err;
+    if (remote.empty()) {
+        lbl_status_.set_text("Enter remote path first");
+        return;
+    }
+    if (!choose_local_file(false, local)) return;
+    if (client_.start_upload(local, remote, err) == 0) {
+        lbl_status_.set_text("Upload failed: " + err);
+        return;
+    }
+    lbl_status_.set_text("Uploading " + remote);
+}
+
+void MainWindow::on_btn_download_clicked() {
+    string remote = entry_path_.get_text();
+    string local, err;
+    if (remote.empty()) {
+        lbl_status_.set_text("Enter remote path first");
+        return;
+    }
+    if (!choose_local_file(true, local)) return;
+    if (client_.start_download(remote, local, err) == 0) {
+        lbl_status_.set_text("Download failed: " + err);
+        return;
+    }
+    lbl_status_.set_text("Downloading " + remote);
+}
+
+bool MainWindow::on_pump_timer() {
+    vector<NetworkClient::TransferStatus> done;
+    bool ok = client_.pump(0, done);
+    for (const auto &st : done) {
+        string what = (st.upload ? "Upload " : "Download ") + st.remote;
+        lbl_status_.set_text(st.err.empty() ? what + " completed" : what + " failed: " + st.err);
+    }
+
+    vector<NetworkClient::TransferStatus> active;
+    client_.transfers(active);
+    string text;
+    for (const auto &st : active) {
+        if (!text.empty()) text += "   ";
+        text += (st.upload ? "up " : "down ") + st.remote + " " +
+                to_string(st.done / 1024) + "/" + to_string(st.size / 1024) + " KB";
+    }
+    lbl_transfers_.set_text(text);
+
+    if (!ok) {
+        lbl_status_.set_text("Connection lost");
+        btn_upload_.set_sensitive(false);
+        btn_download_.set_sensitive(false);
+        return false; // dừng timer
+    }
+    return true;
+}
@@ -13,6 +13,11 @@ public:
 protected:
     void on_btn_load_clicked();
     void on_btn_save_clicked();
+    void on_btn_upload_clicked();
+    void on_btn_download_clicked();
+    // Timer chạy I/O cho upload/download nền, không chặn GUI.
+    bool on_pump_timer();
+    bool choose_local_file(bool save, string &path);
 
     NetworkClient client_;
     string username_;
@@ -21,7 +26,10 @@ protected:
     Gtk::Entry entry_path_;
     Gtk::Button btn_load_;
     Gtk::Button btn_save_;
+    Gtk::Button btn_upload_;
+    Gtk::Button btn_download_;
     Gtk::ScrolledWindow scroll_;
     Gtk::TextView text_view_;
     Gtk::Label lbl_status_;
+    Gtk::Label lbl_transfers_;
 };
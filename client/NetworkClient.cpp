@@ -1,21 +1,126 @@
 // ===== file: client/NetworkClient.cpp =====
 #include "NetworkClient.hpp"
 #include "../common/Protocol.hpp"
+#include "../common/Chunker.hpp"
+#include "../common/Sha256.hpp"
+#include "../common/Crc32c.hpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
 
 using namespace std;
 using namespace proto;
 
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+namespace {
+const size_t UPLOAD_QUEUE_MAX = 512 * 1024;      // dữ liệu upload xếp sẵn tối đa
+const size_t PUMP_BUDGET      = 8 * 1024 * 1024; // byte tối đa mỗi lần pump()
+const size_t HAVE_BATCH       = 128;             // hash mỗi lệnh HAVE_CHUNKS (vừa 1 dòng lệnh)
+const size_t DELTA_MIN_TEXT   = 4 * 1024;        // văn bản nhỏ hơn gửi cả file rẻ hơn 1 vòng SIGNATURE
+const size_t RECV_SLICE       = 64 * 1024;       // v1: đọc body mỗi lần
+const size_t DECODE_SLICE     = 16 * 1024;       // byte nén giải mỗi lần (giới hạn output)
+const uint64_t RESERVE_MAX    = 16 * 1024 * 1024; // không cấp trước theo size server báo quá mức này
+
+// Nối vào string, cấp trước theo size server báo nhưng có giới hạn.
+NetworkClient::ChunkSink append_to(string &content, uint64_t size) {
+    content.clear();
+    content.reserve((size_t)min(size, RESERVE_MAX));
+    return [&content](const char *p, size_t n) {
+        content.append(p, n);
+        return true;
+    };
+}
+
+// Reply "OK 100 <size> <total> <codec>": body nén (chỉ v2).
+Codec reply_codec(const Reply &rep) {
+    vector<string> tokens = split_tokens(rep.msg);
+    Codec c = Codec::None;
+    if (tokens.size() >= 3 && parse_codec(tokens[2], c) && codec_available(c)) return c;
+    return Codec::None;
+}
+
+// Reply "OK 100 <size> <total> <codec> <crc>": CRC32C của cả file (v2, đã
+// thỏa thuận crc32c); -1 nếu server không gửi.
+int64_t reply_crc(const Reply &rep) {
+    vector<string> tokens = split_tokens(rep.msg);
+    uint32_t crc = 0;
+    if (tokens.size() >= 4 && parse_crc32c(tokens[3], crc)) return crc;
+    return -1;
+}
+
+// CRC để kiểm body: chỉ khi body là cả file (size == total).
+int64_t body_crc(const Reply &rep) {
+    vector<string> tokens = split_tokens(rep.msg);
+    uint64_t total = 0;
+    if (tokens.size() < 2 || !parse_u64(tokens[1], total) || total != rep.size) return -1;
+    return reply_crc(rep);
+}
+} // namespace
+
 NetworkClient::NetworkClient() {}
 
 NetworkClient::~NetworkClient() {
     close();
 }
 
-bool NetworkClient::connect_to(const string &host, int port) {
+NetworkClient::NetworkClient(NetworkClient &&other) noexcept
+    : sockfd_(other.sockfd_),
+      conn_(std::move(other.conn_)),
+      v2_(other.v2_),
+      codecs_(std::move(other.codecs_)),
+      crc_(other.crc_),
+      want_codec_(other.want_codec_),
+      level_(other.level_),
+      next_id_(other.next_id_),
+      transfers_(std::move(other.transfers_)),
+      finished_(std::move(other.finished_)),
+      host_(std::move(other.host_)),
+      port_(other.port_),
+      user_(std::move(other.user_)),
+      pass_(std::move(other.pass_)),
+      body_bytes_(other.body_bytes_.load()) {
+    other.sockfd_ = -1;
+    other.conn_.reset(-1);
+}
+
+NetworkClient &NetworkClient::operator=(NetworkClient &&other) noexcept {
+    if (this != &other) {
+        close();
+        sockfd_  = other.sockfd_;
+        conn_    = std::move(other.conn_);
+        v2_      = other.v2_;
+        codecs_  = std::move(other.codecs_);
+        crc_     = other.crc_;
+        want_codec_ = other.want_codec_;
+        level_   = other.level_;
+        next_id_ = other.next_id_;
+        transfers_ = std::move(other.transfers_);
+        finished_  = std::move(other.finished_);
+        host_      = std::move(other.host_);
+        port_      = other.port_;
+        user_      = std::move(other.user_);
+        pass_      = std::move(other.pass_);
+        body_bytes_.store(other.body_bytes_.load());
+        other.transfers_.clear();
+        other.finished_.clear();
+        other.sockfd_ = -1;
+        other.conn_.reset(-1);
+    }
+    return *this;
+}
+
+bool NetworkClient::open_socket(const string &host, int port) {
     close();
     sockfd_ = ::socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd_ < 0) return false;
@@ -35,138 +140,1347 @@ bool NetworkClient::connect_to(const string &host, int port) {
         return false;
     }
 
+    conn_.reset(sockfd_);
     return true;
 }
 
+bool NetworkClient::connect_to(const string &host, int port) {
+    host_ = host;
+    port_ = port;
+    if (!open_socket(host, port)) return false;
+    if (negotiate()) return true;
+    // Server cũ không biết HELLO (và đóng kết nối chưa xác thực): nối lại ở v1.
+    return open_socket(host, port);
+}
+
+bool NetworkClient::negotiate() {
+    conn_.queue_line("HELLO v2 " + available_codecs() + " crc32c");
+    string line;
+    if (!conn_.flush_all() || !conn_.read_line(line)) return false;
+    // "OK 200 v2 [codec...] [crc32c]": server cũ chỉ trả "v2" => không nén,
+    // không kiểm CRC.
+    vector<string> tokens = split_tokens(line);
+    v2_ = tokens.size() >= 3 && tokens[0] == "OK" && tokens[1] == "200" && tokens[2] == "v2";
+    codecs_.clear();
+    crc_ = false;
+    for (size_t i = 3; v2_ && i < tokens.size(); ++i) {
+        Codec c;
+        if (parse_codec(tokens[i], c) && c != Codec::None && codec_available(c)) {
+            codecs_.push_back(c);
+        } else if (tokens[i] == "crc32c") {
+            crc_ = true;
+        }
+    }
+    return v2_;
+}
+
+void NetworkClient::set_compression(Codec codec, int level) {
+    want_codec_ = codec;
+    level_      = level;
+}
+
+Codec NetworkClient::compression() const {
+    if (!v2_ || want_codec_ == Codec::None || codecs_.empty()) return Codec::None;
+    for (Codec c : codecs_) {
+        if (c == want_codec_) return c;
+    }
+    return codecs_.front();
+}
+
+void NetworkClient::set_encoding(Request &req) const {
+    Codec c = compression();
+    req.codec = (uint8_t)c;
+    req.level = c == Codec::None ? 0 : (uint8_t)min(max(level_, 0), 255);
+}
+
 void NetworkClient::close() {
+    close_transfers();
     if (sockfd_ >= 0) {
         ::close(sockfd_);
         sockfd_ = -1;
     }
+    conn_.reset(-1);
+    v2_ = false;
+    codecs_.clear();
+    crc_ = false;
+    next_id_ = 1;
 }
 
-bool NetworkClient::auth(const string &user, const string &pass, string &err) {
-    if (sockfd_ < 0) {
-        err = "Not connected";
-        return false;
+void NetworkClient::queue_request(Request &req) {
+    if (!v2_) {
+        conn_.queue_line(format_text_request(req));
+        return;
     }
+    req.id = next_id_++;
+    FrameHeader h;
+    string payload;
+    encode_request(req, h, payload);
+    conn_.queue_frame(h, payload);
+}
 
-    string cmd = "AUTH " + user + " " + pass;
-    if (!send_line(sockfd_, cmd)) {
+bool NetworkClient::flush(string &err) {
+    if (!conn_.flush_all()) {
         err = "Send error";
         return false;
     }
+    return true;
+}
 
-    string line;
-    if (!recv_line(sockfd_, line)) {
+bool NetworkClient::read_reply(Reply &rep, string &err) {
+    if (!v2_) {
+        string line;
+        if (!conn_.read_line(line)) {
+            err = "No response";
+            return false;
+        }
+        if (!parse_text_reply(line, rep)) {
+            err = "Invalid response: " + line;
+            return false;
+        }
+        return true;
+    }
+
+    FrameHeader h;
+    string payload;
+    if (!read_own_frame(h, payload)) {
         err = "No response";
         return false;
     }
+    if (!decode_reply(h, payload, rep)) {
+        err = "Invalid response frame";
+        return false;
+    }
+    return true;
+}
 
-    if (line.rfind("OK", 0) == 0) return true;
-    err = line;
+// Đọc frame kế tiếp của lệnh đang chờ; frame của các transfer chạy nền nhận
+// được trong lúc đó được xử lý luôn.
+bool NetworkClient::read_own_frame(FrameHeader &h, string &payload) {
+    while (conn_.read_frame(h, payload)) {
+        if (!handle_stream_frame(h, payload)) return true;
+    }
     return false;
 }
 
-bool NetworkClient::register_user(const string &user, const string &pass, string &err) {
+// v1: byte thô; v2: các frame DATA, frame cuối có FLAG_END (đã thỏa thuận
+// crc32c: kết thúc bằng frame CRC). crc: CRC của nội dung gốc khi data là
+// bản nén; -1 = tính trên chính data lúc gửi.
+bool NetworkClient::send_body(const string &data, string &err, int64_t crc) {
+    if (!v2_) {
+        conn_.queue(data.data(), data.size());
+        if (!conn_.flush_all()) {
+            err = "Send body error";
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t c = 0;
+    size_t off = 0;
+    do {
+        size_t chunk = min<size_t>(data.size() - off, DATA_CHUNK);
+        bool last = off + chunk == data.size();
+        FrameHeader h;
+        h.opcode = OP_DATA;
+        h.id     = next_id_ - 1;
+        h.length = (uint32_t)chunk;
+        if (last && !crc_) h.flags = FLAG_END;
+        conn_.queue_header(h);
+        conn_.queue(data.data() + off, chunk);
+        if (crc_ && crc < 0) c = crc32c(c, data.data() + off, chunk);
+        if (crc_ && last) queue_crc_frame(h.id, crc < 0 ? c : (uint32_t)crc);
+        if (!conn_.flush_all()) {
+            err = "Send body error";
+            return false;
+        }
+        off += chunk;
+    } while (off < data.size());
+    return true;
+}
+
+// Frame kết thúc body upload kèm CRC32C, thay cho FLAG_END trên frame cuối.
+void NetworkClient::queue_crc_frame(uint32_t id, uint32_t crc) {
+    FrameHeader h;
+    h.opcode = OP_DATA;
+    h.flags  = FLAG_END | FLAG_CRC;
+    h.id     = id;
+    h.length = 4;
+    char p[4] = {(char)(crc >> 24), (char)(crc >> 16), (char)(crc >> 8), (char)crc};
+    conn_.queue_header(h);
+    conn_.queue(p, sizeof(p));
+}
+
+bool NetworkClient::read_body(uint64_t size, string &content, string &err, Codec codec,
+                              int64_t crc) {
+    return read_body_to(size, append_to(content, size), err, codec, crc);
+}
+
+// Đưa body ra sink theo từng frame (v1: từng 64 KiB), không giữ cả body.
+// Body nén được giải từng 16 KiB nên output mỗi lần cũng có giới hạn.
+// crc >= 0: kiểm CRC32C của nội dung (sau giải nén), tính dần theo từng đoạn.
+bool NetworkClient::read_body_to(uint64_t size, const ChunkSink &sink, string &err,
+                                 Codec codec, int64_t crc) {
+    uint64_t got = 0;
+    uint32_t c = 0;
+    bool sink_ok = true;
+    auto deliver = [&](const char *p, size_t n) {
+        if (got + n > size) return false;
+        got += n;
+        if (crc >= 0) c = crc32c(c, p, n);
+        sink_ok = sink(p, n);
+        return sink_ok;
+    };
+
+    if (!v2_) {
+        static thread_local vector<char> buf(RECV_SLICE);
+        for (uint64_t left = size; left > 0;) {
+            size_t chunk = (size_t)min<uint64_t>(left, buf.size());
+            if (!conn_.read_exact(buf.data(), chunk)) {
+                err = "Receive error";
+                return false;
+            }
+            left -= chunk;
+            if (sink_ok) deliver(buf.data(), chunk); // lỗi ghi: vẫn đọc hết body
+        }
+        if (!sink_ok) err = "Write error";
+        return sink_ok;
+    }
+
+    unique_ptr<Decoder> dec = make_decoder(codec);
+    bool ok = true;
+    FrameHeader h;
+    string payload, out;
+    do {
+        if (!read_own_frame(h, payload) || h.opcode != OP_DATA) {
+            err = "Receive error";
+            return false;
+        }
+        if (!ok) continue; // đọc nốt frame của body lỗi để kết nối còn dùng được
+        if (!dec) {
+            ok = deliver(payload.data(), payload.size());
+            continue;
+        }
+        for (size_t off = 0; ok && off < payload.size(); off += DECODE_SLICE) {
+            out.clear();
+            size_t n = min(payload.size() - off, DECODE_SLICE);
+            ok = dec->update(payload.data() + off, n, out) && deliver(out.data(), out.size());
+        }
+    } while (!(h.flags & FLAG_END));
+
+    if (!sink_ok) {
+        err = "Write error";
+        return false;
+    }
+    if (!ok || got != size || (dec && !dec->finished())) {
+        err = "Receive error";
+        return false;
+    }
+    if (crc >= 0 && c != (uint32_t)crc) {
+        err = "Checksum mismatch";
+        return false;
+    }
+    return true;
+}
+
+bool NetworkClient::auth(const string &user, const string &pass, string &err) {
     if (sockfd_ < 0) {
         err = "Not connected";
         return false;
     }
 
-    string cmd = "REGISTER " + user + " " + pass;
-    if (!send_line(sockfd_, cmd)) {
-        err = "Send error";
+    Request req;
+    req.op   = Op::Auth;
+    req.user = user;
+    req.pass = pass;
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    if (!read_reply(rep, err)) return false;
+    if (rep.code < 400) {
+        user_ = user;
+        pass_ = pass;
+        return true;
+    }
+    err = format_text_reply(rep);
+    return false;
+}
+
+bool NetworkClient::open_sibling(NetworkClient &out, string &err) const {
+    if (host_.empty()) {
+        err = "Not connected";
         return false;
     }
+    NetworkClient c;
+    if (!c.connect_to(host_, port_)) {
+        err = "Cannot connect to " + host_;
+        return false;
+    }
+    if (!user_.empty() && !c.auth(user_, pass_, err)) return false;
+    out = std::move(c);
+    return true;
+}
 
-    string line;
-    if (!recv_line(sockfd_, line)) {
-        err = "No response";
+bool NetworkClient::register_user(const string &user, const string &pass, string &err) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
         return false;
     }
 
-    if (line.rfind("OK 201", 0) == 0) return true;
-    err = line;
+    Request req;
+    req.op   = Op::Register;
+    req.user = user;
+    req.pass = pass;
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    if (!read_reply(rep, err)) return false;
+    if (rep.code == 201) return true;
+    err = format_text_reply(rep);
     return false;
 }
 
 bool NetworkClient::get_text(const string &path, string &content, string &err) {
+    string text;
+    bool ok = get_text(path, append_to(text, 0), err);
+    if (ok) content = move(text);
+    return ok;
+}
+
+bool NetworkClient::get_text(const string &path, const ChunkSink &sink, string &err) {
     if (sockfd_ < 0) {
         err = "Not connected";
         return false;
     }
 
-    string cmd = "GET_TEXT " + path;
-    if (!send_line(sockfd_, cmd)) {
-        err = "Send error";
+    Request req;
+    req.op   = Op::GetText;
+    req.path = path;
+    set_encoding(req);
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    return read_text_reply(sink, err);
+}
+
+bool NetworkClient::get_texts(const vector<string> &paths,
+                              vector<string> &contents,
+                              vector<string> &errs) {
+    contents.assign(paths.size(), string());
+    errs.assign(paths.size(), string());
+    if (sockfd_ < 0) {
+        for (auto &e : errs) e = "Not connected";
         return false;
     }
 
-    string line;
-    if (!recv_line(sockfd_, line)) {
-        err = "No response";
+    vector<uint32_t> ids;
+    for (const auto &path : paths) {
+        Request req;
+        req.op   = Op::GetText;
+        req.path = path;
+        set_encoding(req);
+        queue_request(req);
+        ids.push_back(req.id);
+    }
+    string err;
+    if (!flush(err)) {
+        for (auto &e : errs) e = err;
         return false;
     }
 
-    if (line.rfind("OK 100", 0) != 0) {
-        err = line;
+    if (v2_) return read_text_replies(ids, contents, errs);
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (read_text_reply(append_to(contents[i], 0), errs[i])) continue;
+        // Lỗi do server trả (ERR ...) thì vẫn đọc tiếp các reply sau.
+        if (errs[i].rfind("ERR", 0) != 0) {
+            for (size_t j = i + 1; j < paths.size(); ++j) errs[j] = errs[i];
+            return false;
+        }
+    }
+    return true;
+}
+
+// v2: server xử lý các GET_TEXT song song nên reply và frame DATA của chúng
+// có thể xen nhau; ghép lại theo request id.
+bool NetworkClient::read_text_replies(const vector<uint32_t> &ids,
+                                      vector<string> &contents,
+                                      vector<string> &errs) {
+    map<uint32_t, size_t> index;
+    for (size_t i = 0; i < ids.size(); ++i) index[ids[i]] = i;
+    vector<uint64_t> sizes(ids.size(), 0);
+    vector<unique_ptr<Decoder>> decs(ids.size());
+    vector<int64_t>  want(ids.size(), -1);
+    vector<uint32_t> crcs(ids.size(), 0);
+
+    size_t left = ids.size();
+    FrameHeader h;
+    string payload;
+    while (left > 0) {
+        if (!read_own_frame(h, payload)) {
+            for (auto &kv : index) errs[kv.second] = "Receive error";
+            return false;
+        }
+        auto it = index.find(h.id);
+        if (it == index.end()) continue;
+        size_t i = it->second;
+
+        bool done = false;
+        if (h.opcode == OP_REPLY) {
+            Reply rep;
+            if (!decode_reply(h, payload, rep)) {
+                errs[i] = "Invalid response frame";
+                done = true;
+            } else if (rep.code != 100) {
+                errs[i] = format_text_reply(rep);
+                done = true;
+            } else {
+                sizes[i] = rep.size;
+                contents[i].reserve((size_t)min(rep.size, RESERVE_MAX));
+                decs[i] = make_decoder(reply_codec(rep));
+                want[i] = body_crc(rep);
+            }
+        } else if (h.opcode == OP_DATA) {
+            bool ok = true;
+            size_t before = contents[i].size();
+            if (!decs[i]) contents[i] += payload;
+            else ok = decs[i]->update(payload.data(), payload.size(), contents[i]);
+            if (want[i] >= 0) {
+                crcs[i] = crc32c(crcs[i], contents[i].data() + before, contents[i].size() - before);
+            }
+            if (!ok || (h.flags & FLAG_END)) {
+                if (!ok || contents[i].size() != sizes[i] || (decs[i] && !decs[i]->finished())) {
+                    errs[i] = "Receive error";
+                } else if (want[i] >= 0 && crcs[i] != (uint32_t)want[i]) {
+                    errs[i] = "Checksum mismatch";
+                }
+                done = true;
+            }
+        }
+        if (done) {
+            index.erase(it);
+            --left;
+        }
+    }
+    return true;
+}
+
+// Đọc reply của 1 GET_TEXT: "OK 100 <size>" + body, hoặc 1 reply lỗi.
+bool NetworkClient::read_text_reply(const ChunkSink &sink, string &err) {
+    Reply rep;
+    if (!read_reply(rep, err)) return false;
+
+    if (rep.code != 100) {
+        err = format_text_reply(rep);
         return false;
     }
 
-    vector<string> tokens = split_tokens(line);
-    if (tokens.size() < 3) {
-        err = "Invalid response: " + line;
+    return read_body_to(rep.size, sink, err, reply_codec(rep), body_crc(rep));
+}
+
+bool NetworkClient::put_text(const string &path, const string &content, string &err) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
         return false;
     }
 
-    uint64_t size = stoull(tokens[2]);
-    content.clear();
-    content.resize(size);
+    if (content.size() >= DELTA_MIN_TEXT) {
+        uint64_t sent = 0;
+        int r = send_delta(path, content.data(), content.size(), true, sent, err);
+        if (r != 0) return r > 0;
+    }
+
+    Request req;
+    req.op   = Op::PutText;
+    req.path = path;
+    req.size = content.size();
+    set_encoding(req);
+    // Nén cả văn bản trước (đã nằm trong bộ nhớ); không lợi thì gửi thô.
+    string packed;
+    unique_ptr<Encoder> enc;
+    if (req.codec != 0 && worth_compressing(content.data(), content.size())) {
+        enc = make_encoder((Codec)req.codec, req.level);
+    }
+    if (!enc || !enc->update(content.data(), content.size(), packed) || !enc->finish(packed)) {
+        req.codec = 0;
+        req.level = 0;
+    }
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    if (!read_reply(rep, err)) return false;
+    if (rep.code != 100) {
+        err = format_text_reply(rep);
+        return false;
+    }
+
+    int64_t crc = req.codec && crc_ ? (int64_t)crc32c(0, content.data(), content.size()) : -1;
+    if (!send_body(req.codec ? packed : content, err, crc)) return false;
+
+    if (!read_reply(rep, err)) {
+        err = "No final response";
+        return false;
+    }
+
+    if (rep.code == 200) return true;
+    err = format_text_reply(rep);
+    return false;
+}
+
+void NetworkClient::close_transfers() {
+    for (auto &kv : transfers_) {
+        Transfer &t = kv.second;
+        if (t.fd >= 0) ::close(t.fd);
+        if (!t.st.upload && t.offset == 0) ::unlink(t.local_path.c_str());
+    }
+    transfers_.clear();
+    finished_.clear();
+}
+
+uint32_t NetworkClient::start_upload(const string &local_path, const string &remote,
+                                     string &err) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
+        return 0;
+    }
+    if (!v2_) {
+        err = "Server does not support concurrent transfers";
+        return 0;
+    }
+
+    int fd = ::open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        err = "Cannot open " + local_path;
+        return 0;
+    }
+
+    Request req;
+    req.op   = Op::Upload;
+    req.path = remote;
+    req.size = (uint64_t)st.st_size;
+    set_encoding(req);
+    unique_ptr<Encoder> enc;
+    if (req.codec != 0 && worth_compressing([fd](uint64_t off, char *buf, size_t len) {
+            return ::pread(fd, buf, len, (off_t)off) == (ssize_t)len;
+        }, req.size)) {
+        enc = make_encoder((Codec)req.codec, req.level);
+    }
+    if (!enc) {
+        req.codec = 0;
+        req.level = 0;
+    }
+    queue_request(req);
+
+    Transfer &t = transfers_[req.id];
+    t.st.id     = req.id;
+    t.st.upload = true;
+    t.st.remote = remote;
+    t.st.size   = req.size;
+    t.fd        = fd;
+    t.local_path = local_path;
+    t.enc       = move(enc);
+    return req.id;
+}
+
+uint32_t NetworkClient::start_download(const string &remote, const string &local_path,
+                                       string &err, uint64_t offset, uint64_t length) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
+        return 0;
+    }
+    if (!v2_) {
+        err = "Server does not support concurrent transfers";
+        return 0;
+    }
 
-    if (!recv_exact(sockfd_, &content[0], size)) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0);
+    int fd = ::open(local_path.c_str(), flags, 0644);
+    if (fd < 0) {
+        err = "Cannot create " + local_path;
+        return 0;
+    }
+
+    Request req;
+    req.op     = Op::Download;
+    req.path   = remote;
+    req.offset = offset;
+    req.length = length;
+    set_encoding(req);
+    queue_request(req);
+
+    Transfer &t = transfers_[req.id];
+    t.st.id     = req.id;
+    t.st.remote = remote;
+    t.fd        = fd;
+    t.offset    = offset;
+    t.local_path = local_path;
+    return req.id;
+}
+
+bool NetworkClient::upload_status(uint64_t upload_id, uint64_t &committed, uint64_t &size,
+                                  string &err) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
+        return false;
+    }
+
+    Request req;
+    req.op        = Op::UploadStatus;
+    req.upload_id = upload_id;
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    if (!read_reply(rep, err)) return false;
+    if (rep.code != 200) {
+        err = format_text_reply(rep);
+        return false;
+    }
+    // msg: "<committed> <size> active|parked"
+    vector<string> tokens = split_tokens(rep.msg);
+    if (tokens.size() < 2 || !parse_u64(tokens[0], committed) || !parse_u64(tokens[1], size)) {
+        err = "Invalid response: " + rep.msg;
+        return false;
+    }
+    return true;
+}
+
+uint32_t NetworkClient::resume_upload(uint64_t upload_id, const string &local_path,
+                                      string &err) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
+        return 0;
+    }
+    if (!v2_) {
+        err = "Server does not support concurrent transfers";
+        return 0;
+    }
+
+    uint64_t committed = 0, size = 0;
+    if (!upload_status(upload_id, committed, size, err)) return 0;
+
+    int fd = ::open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || ::fstat(fd, &st) != 0 || (uint64_t)st.st_size != size) {
+        if (fd >= 0) ::close(fd);
+        err = "Local file does not match upload " + to_string(upload_id);
+        return 0;
+    }
+
+    Request req;
+    req.op        = Op::UploadResume;
+    req.upload_id = upload_id;
+    req.offset    = committed;
+    queue_request(req);
+
+    Transfer &t = transfers_[req.id];
+    t.st.id        = req.id;
+    t.st.upload    = true;
+    t.st.size      = size;
+    t.st.done      = committed;
+    t.st.upload_id = upload_id;
+    t.fd           = fd;
+    t.local_path   = local_path;
+    return req.id;
+}
+
+void NetworkClient::transfers(vector<TransferStatus> &out) const {
+    out.clear();
+    for (const auto &kv : transfers_) out.push_back(kv.second.st);
+}
+
+// Đóng transfer, chuyển trạng thái sang finished_ để pump() trả về.
+void NetworkClient::end_transfer(Transfer &t, const string &err) {
+    bool ok = err.empty();
+    if (t.fd >= 0 && ::close(t.fd) != 0 && ok && !t.st.upload) {
+        ok = false;
+        t.st.err = "Write error";
+    }
+    t.fd = -1;
+    if (!ok && t.st.err.empty()) t.st.err = err;
+    // Tải đoạn (offset > 0) thì không xóa phần đã có trong file.
+    if (!ok && !t.st.upload && t.offset == 0) ::unlink(t.local_path.c_str());
+
+    t.st.finished = true;
+    finished_.push_back(t.st);
+    transfers_.erase(t.st.id);
+}
+
+// Frame thuộc 1 transfer chạy nền: xử lý và trả về true.
+bool NetworkClient::handle_stream_frame(const FrameHeader &h, const string &payload) {
+    auto it = transfers_.find(h.id);
+    if (it == transfers_.end()) return false;
+    Transfer &t = it->second;
+
+    if (h.opcode == OP_REPLY) {
+        Reply rep;
+        if (!decode_reply(h, payload, rep)) {
+            end_transfer(t, "Invalid response frame");
+        } else if (rep.code == 100) {
+            // Upload: bắt đầu gửi DATA (size = upload id). Download: biết size, chờ DATA.
+            if (t.st.upload) {
+                t.ready = true;
+                t.st.upload_id = rep.size;
+            } else {
+                t.st.size = rep.size;
+                t.dec     = make_decoder(reply_codec(rep));
+                t.expect_crc = body_crc(rep);
+            }
+        } else if (rep.code == 200 && t.st.upload) {
+            end_transfer(t, string());
+        } else {
+            end_transfer(t, format_text_reply(rep));
+        }
+        return true;
+    }
+
+    if (h.opcode != OP_DATA || t.st.upload) return false;
+
+    const string *data = &payload;
+    string plain;
+    if (t.dec) {
+        if (!t.dec->update(payload.data(), payload.size(), plain) ||
+            t.st.done + plain.size() > t.st.size) {
+            end_transfer(t, "Receive error");
+            return true;
+        }
+        data = &plain;
+    }
+    size_t off = 0;
+    while (off < data->size()) {
+        ssize_t n = ::pwrite(t.fd, data->data() + off, data->size() - off,
+                             (off_t)(t.offset + t.st.done + off));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            end_transfer(t, "Write error");
+            return true;
+        }
+        off += (size_t)n;
+    }
+    if (t.expect_crc >= 0) t.crc = crc32c(t.crc, data->data(), data->size());
+    t.st.done += data->size();
+    if (h.flags & FLAG_END) {
+        bool ok = t.st.done == t.st.size && (!t.dec || t.dec->finished());
+        if (!ok) end_transfer(t, "Receive error");
+        else if (t.expect_crc >= 0 && t.crc != (uint32_t)t.expect_crc) {
+            end_transfer(t, "Checksum mismatch");
+        } else {
+            end_transfer(t, string());
+        }
+    }
+    return true;
+}
+
+// Xếp frame DATA cho các upload đã được server chấp nhận, mỗi upload 1 chunk
+// mỗi vòng để chia đều. Trả về số byte đã xếp.
+size_t NetworkClient::queue_upload_data() {
+    size_t queued = 0;
+    bool progress = true;
+    string chunk;
+    while (progress && conn_.pending() < UPLOAD_QUEUE_MAX) {
+        progress = false;
+        for (auto &kv : transfers_) {
+            Transfer &t = kv.second;
+            if (!t.st.upload || !t.ready || t.end_queued) continue;
+            if (conn_.pending() >= UPLOAD_QUEUE_MAX) break;
+
+            bool last = false;
+            if (!next_upload_payload(t, chunk, last)) {
+                // File bị cắt ngắn giữa chừng: không còn giữ được framing.
+                t.st.err = "Read error";
+                ::shutdown(sockfd_, SHUT_RDWR);
+                return queued;
+            }
+
+            FrameHeader h;
+            h.opcode = OP_DATA;
+            h.id     = t.st.id;
+            h.length = (uint32_t)chunk.size();
+            t.end_queued = last;
+            if (last && !crc_) h.flags = FLAG_END;
+            conn_.queue_header(h);
+            conn_.queue(chunk.data(), chunk.size());
+            if (last && crc_) queue_crc_frame(t.st.id, t.crc);
+            queued += chunk.size();
+            progress = true;
+        }
+    }
+    return queued;
+}
+
+// Payload frame DATA kế tiếp của upload t: đọc thẳng từ file, hoặc nén dần
+// (done tính theo byte đã đọc từ file).
+bool NetworkClient::next_upload_payload(Transfer &t, string &payload, bool &last) {
+    if (!t.enc) {
+        size_t len = (size_t)min<uint64_t>(t.st.size - t.st.done, DATA_CHUNK);
+        payload.resize(len);
+        ssize_t n = len > 0 ? ::pread(t.fd, &payload[0], len, (off_t)t.st.done) : 0;
+        if (n < 0 || (size_t)n != len) return false;
+        if (crc_) t.crc = crc32c(t.crc, payload.data(), len);
+        t.st.done += len;
+        last = t.st.done == t.st.size;
+        return true;
+    }
+
+    static thread_local vector<char> buf(DATA_CHUNK);
+    while (!t.zdone && t.zbuf.size() < DATA_CHUNK) {
+        size_t len = (size_t)min<uint64_t>(t.st.size - t.st.done, DATA_CHUNK);
+        if (len == 0) {
+            if (!t.enc->finish(t.zbuf)) return false;
+            t.zdone = true;
+            break;
+        }
+        ssize_t n = ::pread(t.fd, buf.data(), len, (off_t)t.st.done);
+        if (n < 0 || (size_t)n != len || !t.enc->update(buf.data(), len, t.zbuf)) return false;
+        if (crc_) t.crc = crc32c(t.crc, buf.data(), len);
+        t.st.done += len;
+    }
+    size_t take = min<size_t>(t.zbuf.size(), DATA_CHUNK);
+    payload.assign(t.zbuf, 0, take);
+    t.zbuf.erase(0, take);
+    last = t.zdone && t.zbuf.empty();
+    return true;
+}
+
+bool NetworkClient::pump(int timeout_ms, vector<TransferStatus> &done) {
+    using clock = chrono::steady_clock;
+    auto deadline = clock::now() + chrono::milliseconds(timeout_ms);
+    size_t moved = 0;
+    bool ok = sockfd_ >= 0;
+
+    while (ok && moved < PUMP_BUDGET) {
+        bool progress = false;
+
+        moved += queue_upload_data();
+        size_t before = conn_.pending();
+        if (conn_.flush(MSG_DONTWAIT) < 0) {
+            ok = false;
+            break;
+        }
+        if (conn_.pending() < before) progress = true;
+
+        int r = conn_.fill(MSG_DONTWAIT);
+        if (r < 0) {
+            ok = false;
+            break;
+        }
+        FrameHeader h;
+        string payload;
+        while (conn_.next_frame(h, payload)) {
+            moved += payload.size();
+            if (!handle_stream_frame(h, payload)) {
+                ok = false; // frame không thuộc stream nào
+                break;
+            }
+        }
+        if (r > 0) progress = true;
+        if (progress) continue;
+        if (transfers_.empty()) break;
+
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - clock::now()).count();
+        if (left <= 0) break;
+        pollfd pfd{};
+        pfd.fd     = sockfd_;
+        pfd.events = POLLIN | (conn_.pending() > 0 ? POLLOUT : 0);
+        if (::poll(&pfd, 1, (int)left) < 0 && errno != EINTR) ok = false;
+    }
+
+    if (!ok) {
+        for (auto &kv : transfers_) {
+            kv.second.st.finished = true;
+            if (kv.second.st.err.empty()) kv.second.st.err = "Connection lost";
+            finished_.push_back(kv.second.st);
+        }
+        for (auto &st : finished_) done.push_back(st);
+        close();
+        return false;
+    }
+
+    for (auto &st : finished_) done.push_back(st);
+    finished_.clear();
+    return true;
+}
+
+// Đọc reply, báo lỗi nếu code khác mong đợi.
+bool NetworkClient::expect_reply(int code, Reply &rep, string &err) {
+    if (!read_reply(rep, err)) return false;
+    if (rep.code == code) return true;
+    err = format_text_reply(rep);
+    return false;
+}
+
+// Gửi [offset, offset+len) của fd làm body: v1 byte thô, v2 các frame DATA.
+bool NetworkClient::send_file_body(int fd, uint64_t offset, uint64_t len, string &err) {
+    static thread_local vector<char> buf(DATA_CHUNK);
+    uint64_t sent = 0;
+    uint32_t crc = 0;
+    do {
+        size_t chunk = (size_t)min<uint64_t>(len - sent, DATA_CHUNK);
+        ssize_t n = chunk > 0 ? ::pread(fd, buf.data(), chunk, (off_t)(offset + sent)) : 0;
+        if (n != (ssize_t)chunk) {
+            err = "Read local file error";
+            return false;
+        }
+        bool last = sent + chunk == len;
+        if (v2_) {
+            FrameHeader h;
+            h.opcode = OP_DATA;
+            h.id     = next_id_ - 1;
+            h.length = (uint32_t)chunk;
+            if (last && !crc_) h.flags = FLAG_END;
+            conn_.queue_header(h);
+        }
+        conn_.queue(buf.data(), chunk);
+        if (crc_) {
+            crc = crc32c(crc, buf.data(), chunk);
+            if (last) queue_crc_frame(next_id_ - 1, crc);
+        }
+        if (!conn_.flush_all()) {
+            err = "Send body error";
+            return false;
+        }
+        sent += chunk;
+        body_bytes_.fetch_add(chunk, memory_order_relaxed);
+    } while (sent < len);
+    return true;
+}
+
+// Nhận body len byte, ghi vào fd bắt đầu từ offset; crc nhận CRC32C của body.
+bool NetworkClient::recv_file_body(int fd, uint64_t offset, uint64_t len, string &err,
+                                   uint32_t *crc) {
+    uint64_t got = 0;
+    uint32_t c = 0;
+    if (!v2_) {
+        static thread_local vector<char> buf(DATA_CHUNK);
+        while (got < len) {
+            size_t chunk = (size_t)min<uint64_t>(len - got, DATA_CHUNK);
+            if (!conn_.read_exact(buf.data(), chunk)) {
+                err = "Receive error";
+                return false;
+            }
+            if (::pwrite(fd, buf.data(), chunk, (off_t)(offset + got)) != (ssize_t)chunk) {
+                err = "Write local file error";
+                return false;
+            }
+            if (crc) c = crc32c(c, buf.data(), chunk);
+            got += chunk;
+            body_bytes_.fetch_add(chunk, memory_order_relaxed);
+        }
+        if (crc) *crc = c;
+        return true;
+    }
+
+    FrameHeader h;
+    string payload;
+    do {
+        if (!read_own_frame(h, payload) || h.opcode != OP_DATA ||
+            payload.size() > len - got) {
+            err = "Receive error";
+            return false;
+        }
+        if (!payload.empty() &&
+            ::pwrite(fd, payload.data(), payload.size(), (off_t)(offset + got)) !=
+                (ssize_t)payload.size()) {
+            err = "Write local file error";
+            return false;
+        }
+        if (crc) c = crc32c(c, payload.data(), payload.size());
+        got += payload.size();
+        body_bytes_.fetch_add(payload.size(), memory_order_relaxed);
+    } while (!(h.flags & FLAG_END));
+
+    if (got != len) {
         err = "Receive error";
         return false;
     }
+    if (crc) *crc = c;
+    return true;
+}
+
+bool NetworkClient::upload_open(const string &remote, uint64_t size, uint64_t &upload_id,
+                                string &err) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
+        return false;
+    }
+
+    Request req;
+    req.op   = Op::UploadOpen;
+    req.path = remote;
+    req.size = size;
+    queue_request(req);
+    if (!flush(err)) return false;
 
+    Reply rep;
+    if (!expect_reply(200, rep, err)) return false;
+    upload_id = rep.size;
     return true;
 }
 
-bool NetworkClient::put_text(const string &path, const string &content, string &err) {
+bool NetworkClient::upload_part(uint64_t upload_id, int fd, uint64_t offset, uint64_t len,
+                                string &err) {
     if (sockfd_ < 0) {
         err = "Not connected";
         return false;
     }
 
-    uint64_t size = content.size();
-    string cmd = "PUT_TEXT " + path + " " + to_string(size);
-    if (!send_line(sockfd_, cmd)) {
-        err = "Send error";
+    Request req;
+    req.op        = Op::UploadPart;
+    req.upload_id = upload_id;
+    req.offset    = offset;
+    req.length    = len;
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    if (!expect_reply(100, rep, err)) return false;
+    if (!send_file_body(fd, offset, len, err)) return false;
+    return expect_reply(200, rep, err);
+}
+
+bool NetworkClient::upload_commit(uint64_t upload_id, string &err) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
         return false;
     }
 
-    string line;
-    if (!recv_line(sockfd_, line)) {
-        err = "No response";
+    Request req;
+    req.op        = Op::UploadCommit;
+    req.upload_id = upload_id;
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    return expect_reply(200, rep, err);
+}
+
+bool NetworkClient::download_range(const string &remote, int fd, uint64_t offset,
+                                   uint64_t len, string &err, uint32_t *crc) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
+        return false;
+    }
+
+    Request req;
+    req.op     = Op::Download;
+    req.path   = remote;
+    req.offset = offset;
+    req.length = len;
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    if (!expect_reply(100, rep, err)) return false;
+    if (rep.size != len) {
+        // Server cắt đoạn ở cuối file: file đã đổi kích thước.
+        string rest;
+        if (read_body(rep.size, rest, err)) err = "Remote file changed";
+        return false;
+    }
+    int64_t want = body_crc(rep);
+    uint32_t c = 0;
+    if (!recv_file_body(fd, offset, len, err, &c)) return false;
+    if (want >= 0 && c != (uint32_t)want) {
+        err = "Checksum mismatch";
+        return false;
+    }
+    if (crc) *crc = c;
+    return true;
+}
+
+// Kích thước file trên server: tải thử 1 byte, reply ranged có "<len> <total>".
+bool NetworkClient::remote_size(const string &remote, uint64_t &size, string &err,
+                                int64_t *crc) {
+    if (sockfd_ < 0) {
+        err = "Not connected";
+        return false;
+    }
+
+    Request req;
+    req.op     = Op::Download;
+    req.path   = remote;
+    req.offset = 0;
+    req.length = 1;
+    queue_request(req);
+    if (!flush(err)) return false;
+
+    Reply rep;
+    if (!expect_reply(100, rep, err)) return false;
+    size = rep.size;
+    vector<string> tokens = split_tokens(rep.msg);
+    if (tokens.size() >= 2 && !parse_u64(tokens[1], size)) {
+        err = "Invalid response: " + rep.msg;
+        return false;
+    }
+    if (crc) *crc = reply_crc(rep);
+    string one;
+    return read_body(rep.size, one, err);
+}
+
+bool NetworkClient::upload_dedup(const string &local_path, const string &remote,
+                                 uint64_t &sent, string &err) {
+    sent = 0;
+    if (sockfd_ < 0) {
+        err = "Not connected";
         return false;
     }
 
-    if (line.rfind("OK 100", 0) != 0) {
-        err = line;
+    int fd = ::open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err = "Cannot open " + local_path;
         return false;
     }
+    struct Span {
+        uint64_t offset;
+        uint64_t size;
+    };
+    vector<ChunkRef> chunks;
+    map<string, Span> spans; // chunk lặp lại trong file chỉ gửi 1 lần
+    uint64_t size = 0;
+    bool ok = for_each_chunk(fd, [&](const ChunkRef &c, const char *) {
+        chunks.push_back(c);
+        spans.emplace(c.hash, Span{size, c.size});
+        size += c.size;
+        return true;
+    });
+    if (!ok || chunks.empty()) {
+        ::close(fd);
+        err = ok ? "Empty file" : "Read local file error";
+        return false;
+    }
+
+    string recipe;
+    recipe.reserve(chunks.size() * 40);
+    for (const auto &c : chunks) {
+        unsigned char d[Sha256::DIGEST_SIZE];
+        hex_to_digest(c.hash, d);
+        recipe.append(reinterpret_cast<const char *>(d), sizeof(d));
+        for (int i = 7; i >= 0; --i) recipe += (char)(c.size >> (8 * i));
+    }
+
+    // Chunk có thể bị xóa giữa HAVE_CHUNKS và UPLOAD_RECIPE (file khác ghi
+    // đè): server trả 409 thì hỏi lại và gửi bù 1 lần.
+    Reply rep;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        // Gửi dồn mọi HAVE_CHUNKS rồi đọc các reply theo thứ tự.
+        vector<string> hashes;
+        for (const auto &kv : spans) hashes.push_back(kv.first);
+        for (size_t i = 0; i < hashes.size(); i += HAVE_BATCH) {
+            Request req;
+            req.op = Op::HaveChunks;
+            req.hashes.assign(hashes.begin() + i,
+                              hashes.begin() + min(hashes.size(), i + HAVE_BATCH));
+            queue_request(req);
+        }
+        ok = flush(err);
+
+        vector<string> missing;
+        for (size_t i = 0; ok && i < hashes.size(); i += HAVE_BATCH) {
+            size_t n = min(hashes.size() - i, HAVE_BATCH);
+            ok = expect_reply(200, rep, err);
+            if (ok && rep.msg.size() != n) {
+                err = "Invalid response: " + rep.msg;
+                ok = false;
+            }
+            for (size_t j = 0; ok && j < n; ++j) {
+                if (rep.msg[j] == '0') missing.push_back(hashes[i + j]);
+            }
+        }
+
+        for (size_t i = 0; ok && i < missing.size(); ++i) {
+            const Span &sp = spans[missing[i]];
+            Request req;
+            req.op   = Op::PutChunk;
+            req.size = sp.size;
+            req.hashes.push_back(missing[i]);
+            queue_request(req);
+            ok = flush(err) && read_reply(rep, err);
+            if (!ok || rep.code == 200) continue; // 200: vừa có người khác gửi
+            if (rep.code != 100) {
+                err = format_text_reply(rep);
+                ok = false;
+                continue;
+            }
+            ok = send_file_body(fd, sp.offset, sp.size, err) && expect_reply(200, rep, err);
+            if (ok) sent += sp.size;
+        }
+        if (!ok) break;
+
+        Request req;
+        req.op     = Op::UploadRecipe;
+        req.path   = remote;
+        req.size   = size;
+        req.length = chunks.size();
+        queue_request(req);
+        ok = flush(err) && expect_reply(100, rep, err) && send_body(recipe, err) &&
+             read_reply(rep, err);
+        if (!ok || rep.code == 200) break;
+        err = format_text_reply(rep);
+        ok = false;
+        if (rep.code != 409) break;
+    }
+    ::close(fd);
+    return ok;
+}
+
+// SIGNATURE <remote>. false chỉ khi kết nối lỗi; code: 100 (sig hợp lệ),
+// 404 (server chưa có file) hoặc mã lỗi khác (server không hỗ trợ, err).
+bool NetworkClient::fetch_signature(const string &remote, Signature &sig, int &code,
+                                    string &err) {
+    Request req;
+    req.op   = Op::Signature;
+    req.path = remote;
+    queue_request(req);
+    Reply rep;
+    if (!flush(err) || !read_reply(rep, err)) return false;
+    code = rep.code;
+    if (rep.code != 100) {
+        err = format_text_reply(rep);
+        return true;
+    }
+    string body;
+    if (!read_body(rep.size, body, err)) return false;
+    if (!parse_signature(body, sig)) {
+        err  = "Invalid signature";
+        code = 500;
+    }
+    return true;
+}
+
+// Gửi data thành file remote bằng UPLOAD_DELTA.
+// 1: xong; 0: nên gửi cả file (server không hỗ trợ, hoặc need_basis mà
+// server chưa có file); -1: lỗi (err).
+int NetworkClient::send_delta(const string &remote, const char *data, size_t size,
+                              bool need_basis, uint64_t &sent, string &err) {
+    sent = 0;
+    // File trên server đổi giữa SIGNATURE và UPLOAD_DELTA => 409: lấy chữ ký
+    // mới thử lại 1 lần, lần cuối gửi toàn literal.
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        Signature sig;
+        if (attempt < 2) {
+            int code = 0;
+            if (!fetch_signature(remote, sig, code, err)) return -1;
+            if (code == 404) {
+                if (need_basis) return 0;
+                sig = Signature{};
+            } else if (code != 100) {
+                return 0;
+            }
+        }
+
+        vector<DeltaOp> ops;
+        make_delta(data, size, sig, ops);
+        uint32_t bs = sig.block_size ? sig.block_size : delta_block_size(size);
+        uint64_t len = delta_encoded_size(ops);
 
-    if (!send_all(sockfd_, content.data(), content.size())) {
+        Request req;
+        req.op     = Op::UploadDelta;
+        req.path   = remote;
+        req.size   = size;
+        req.length = len;
+        queue_request(req);
+        Reply rep;
+        if (!flush(err) || !read_reply(rep, err)) return -1;
+        if (rep.code != 100) {
+            err = format_text_reply(rep);
+            return rep.code == 400 || rep.code == 413 ? 0 : -1;
+        }
+        if (!send_delta_body(data, size, bs, ops, len, err) || !read_reply(rep, err)) {
+            return -1;
+        }
+        sent += len;
+        if (rep.code == 200) return 1;
+        err = format_text_reply(rep);
+        if (rep.code != 409) return -1;
+    }
+    return -1;
+}
+
+// Body UPLOAD_DELTA mã hóa dần vào buffer DATA_CHUNK (literal có thể lớn,
+// không dựng cả delta trong bộ nhớ).
+bool NetworkClient::send_delta_body(const char *data, size_t size, uint32_t block_size,
+                                    const vector<DeltaOp> &ops, uint64_t len, string &err) {
+    string buf;
+    buf.reserve(DATA_CHUNK);
+    uint64_t sent = 0;
+    uint32_t crc = 0;
+    auto send_buf = [&]() {
+        bool last = sent + buf.size() == len;
+        if (v2_) {
+            FrameHeader h;
+            h.opcode = OP_DATA;
+            h.id     = next_id_ - 1;
+            h.length = (uint32_t)buf.size();
+            if (last && !crc_) h.flags = FLAG_END;
+            conn_.queue_header(h);
+        }
+        conn_.queue(buf.data(), buf.size());
+        if (crc_) {
+            crc = crc32c(crc, buf.data(), buf.size());
+            if (last) queue_crc_frame(next_id_ - 1, crc);
+        }
+        if (!conn_.flush_all()) return false;
+        sent += buf.size();
+        body_bytes_.fetch_add(buf.size(), memory_order_relaxed);
+        buf.clear();
+        return true;
+    };
+
+    bool ok = encode_delta(data, size, block_size, ops, [&](const char *p, size_t n) {
+        while (n > 0) {
+            size_t take = min(n, DATA_CHUNK - buf.size());
+            buf.append(p, take);
+            p += take;
+            n -= take;
+            // Frame cuối (FLAG_END) để dành cho lần gửi sau cùng.
+            if (buf.size() == DATA_CHUNK && sent + buf.size() < len && !send_buf()) {
+                return false;
+            }
+        }
+        return true;
+    });
+    if (!ok || sent + buf.size() != len || !send_buf()) {
         err = "Send body error";
         return false;
     }
+    return true;
+}
 
-    if (!recv_line(sockfd_, line)) {
-        err = "No final response";
+bool NetworkClient::upload_delta(const string &local_path, const string &remote,
+                                 uint64_t &sent, string &err) {
+    sent = 0;
+    if (sockfd_ < 0) {
+        err = "Not connected";
         return false;
     }
 
-    if (line.rfind("OK 200", 0) == 0) return true;
-    err = line;
-    return false;
+    int fd = ::open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        err = "Cannot open " + local_path;
+        return false;
+    }
+    // Dò checksum cuộn cần truy cập ngẫu nhiên cả file: map thay vì đọc vào buffer.
+    size_t size = (size_t)st.st_size;
+    void *map = nullptr;
+    if (size > 0) {
+        map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ::close(fd);
+            err = "Cannot map " + local_path;
+            return false;
+        }
+        ::madvise(map, size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+
+    int r = send_delta(remote, static_cast<const char *>(map), size, false, sent, err);
+    if (map) ::munmap(map, size);
+    if (r == 0 && err.empty()) err = "Delta not supported";
+    return r > 0;
 }
@@ -1,22 +1,190 @@
 // ===== file: client/NetworkClient.hpp =====
 #pragma once
 #include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "../common/Protocol.hpp"
+#include "../common/Delta.hpp"
+#include "../common/Compress.hpp"
 
 using namespace std;
 
 class NetworkClient {
 public:
+    // Nhận nội dung body theo từng đoạn; trả false để dừng (lỗi ghi).
+    using ChunkSink = function<bool(const char *p, size_t n)>;
+
+    // Trạng thái 1 upload/download chạy nền (xem start_upload/start_download).
+    struct TransferStatus {
+        uint32_t id       = 0;
+        bool     upload   = false;
+        string   remote;
+        uint64_t size     = 0;
+        uint64_t done     = 0;       // upload nối tiếp: tính cả phần đã có
+        uint64_t upload_id = 0;      // server cấp; dùng cho resume_upload
+        bool     finished = false;
+        string   err;               // rỗng nếu thành công
+    };
+
     NetworkClient();
     ~NetworkClient();
 
+    // Chuyển quyền sở hữu socket (buffer đọc/ghi đi theo kết nối).
+    NetworkClient(NetworkClient &&other) noexcept;
+    NetworkClient &operator=(NetworkClient &&other) noexcept;
+    NetworkClient(const NetworkClient &) = delete;
+    NetworkClient &operator=(const NetworkClient &) = delete;
+
+    // Kết nối và thử bắt tay giao thức nhị phân v2; server cũ thì dùng v1.
     bool connect_to(const string &host, int port);
     void close();
+    bool is_v2() const { return v2_; }
+
+    // Nén body (chỉ v2, server phải có codec): áp dụng cho các lệnh gửi sau
+    // đó (UPLOAD/PUT_TEXT/DOWNLOAD/GET_TEXT). Codec::None tắt nén; codec
+    // server không có thì dùng codec tốt nhất server có. level 0 = mặc định.
+    // Dữ liệu không nén được (thử mẫu) vẫn đi thô.
+    void set_compression(Codec codec, int level = 0);
+    Codec compression() const;
+
+    // Mở thêm 1 kết nối tới cùng server, đăng nhập cùng tài khoản
+    // (dùng cho truyền song song nhiều kết nối, xem ParallelTransfer).
+    bool open_sibling(NetworkClient &out, string &err) const;
 
     bool auth(const string &user, const string &pass, string &err);
     bool register_user(const string &user, const string &pass, string &err);
     bool get_text(const string &path, string &content, string &err);
+    // Như trên nhưng đưa nội dung ra sink theo từng đoạn khi nhận (văn bản
+    // lớn): bộ nhớ dùng không phụ thuộc kích thước file.
+    bool get_text(const string &path, const ChunkSink &sink, string &err);
+    // Văn bản đủ lớn và đã có trên server: chỉ gửi phần thay đổi (delta),
+    // server không hỗ trợ thì gửi cả file như cũ.
     bool put_text(const string &path, const string &content, string &err);
 
+    // Pipelining: gửi dồn mọi GET_TEXT rồi mới đọc các reply (v1 theo thứ tự,
+    // v2 ghép theo request id).
+    // errs[i] rỗng nếu paths[i] đọc thành công. Trả về false nếu kết nối lỗi.
+    bool get_texts(const vector<string> &paths,
+                   vector<string> &contents,
+                   vector<string> &errs);
+
+    // Transfer song song (chỉ v2): mỗi transfer là 1 stream trên cùng kết nối,
+    // server gửi/nhận xen kẽ frame của các stream. Trả về stream id, 0 nếu lỗi.
+    // Các lệnh ở trên vẫn gọi được trong lúc transfer đang chạy.
+    uint32_t start_upload(const string &local_path, const string &remote, string &err);
+    // offset/length: chỉ tải 1 đoạn, ghi vào local_path tại cùng offset
+    // (offset > 0 thì không xóa nội dung cũ, dùng để tải tiếp phần còn thiếu).
+    uint32_t start_download(const string &remote, const string &local_path, string &err,
+                            uint64_t offset = 0, uint64_t length = 0);
+    // Upload bị đứt (kể cả ở kết nối trước): hỏi server phần đã ghi rồi gửi
+    // tiếp phần còn lại của local_path.
+    bool upload_status(uint64_t upload_id, uint64_t &committed, uint64_t &size, string &err);
+    uint32_t resume_upload(uint64_t upload_id, const string &local_path, string &err);
+    // Chạy I/O cho các transfer đang mở, chờ tối đa timeout_ms nếu chưa có gì
+    // làm được (0: không chờ, hợp với timer của GUI). Transfer kết thúc (thành
+    // công hoặc lỗi) được thêm vào done. Trả về false nếu kết nối lỗi.
+    bool pump(int timeout_ms, vector<TransferStatus> &done);
+    void transfers(vector<TransferStatus> &out) const;
+    size_t active_transfers() const { return transfers_.size(); }
+
+    // Lệnh blocking cho truyền theo đoạn (1 đoạn mỗi lệnh, body đọc/ghi thẳng
+    // giữa file và socket). Upload song song: upload_open -> các upload_part
+    // (từ nhiều kết nối) -> upload_commit.
+    bool upload_open(const string &remote, uint64_t size, uint64_t &upload_id, string &err);
+    bool upload_part(uint64_t upload_id, int fd, uint64_t offset, uint64_t len, string &err);
+    bool upload_commit(uint64_t upload_id, string &err);
+    // Tải [offset, offset+len) của remote, ghi vào fd tại cùng offset. crc nhận
+    // CRC32C của đoạn (ghép lại để kiểm cả file); đoạn là cả file thì tự kiểm.
+    bool download_range(const string &remote, int fd, uint64_t offset, uint64_t len,
+                        string &err, uint32_t *crc = nullptr);
+    // crc: CRC32C server lưu cho file, -1 nếu không có.
+    bool remote_size(const string &remote, uint64_t &size, string &err,
+                     int64_t *crc = nullptr);
+
+    // Upload khử trùng lặp (server chạy --store=chunks): cắt file giống server,
+    // hỏi HAVE_CHUNKS, chỉ gửi chunk server chưa có rồi UPLOAD_RECIPE.
+    // sent: số byte chunk thực sự gửi đi.
+    bool upload_dedup(const string &local_path, const string &remote, uint64_t &sent,
+                      string &err);
+
+    // Ghi đè file đã có kiểu rsync: lấy SIGNATURE của bản trên server, chỉ gửi
+    // byte mới và tham chiếu block cũ (UPLOAD_DELTA). Chưa có file thì delta
+    // toàn literal. sent: độ dài body delta đã gửi.
+    bool upload_delta(const string &local_path, const string &remote, uint64_t &sent,
+                      string &err);
+
+    // Tổng byte body đã gửi/nhận trên kết nối này; đọc được từ thread khác
+    // để đo throughput.
+    uint64_t body_bytes() const { return body_bytes_.load(memory_order_relaxed); }
+
 private:
+    struct Transfer {
+        TransferStatus st;
+        int      fd         = -1;
+        bool     ready      = false; // upload: server đã trả "100"
+        bool     end_queued = false; // upload: đã xếp frame DATA cuối
+        uint64_t offset     = 0;     // download: vị trí ghi byte đầu tiên
+        string   local_path;
+        unique_ptr<Encoder> enc;     // upload nén: zbuf giữ phần đã nén chưa gửi
+        unique_ptr<Decoder> dec;     // download nén
+        string   zbuf;
+        bool     zdone      = false; // đã nén hết file
+        uint32_t crc        = 0;     // CRC32C của nội dung đã gửi/nhận
+        int64_t  expect_crc = -1;    // download: CRC cả file server báo
+    };
+
+    bool open_socket(const string &host, int port);
+    bool negotiate();
+
+    void queue_request(proto::Request &req);
+    bool flush(string &err);
+    bool read_reply(proto::Reply &rep, string &err);
+    bool send_body(const string &data, string &err, int64_t crc = -1);
+    void queue_crc_frame(uint32_t id, uint32_t crc);
+    bool read_body(uint64_t size, string &content, string &err,
+                   Codec codec = Codec::None, int64_t crc = -1);
+    bool read_body_to(uint64_t size, const ChunkSink &sink, string &err,
+                      Codec codec = Codec::None, int64_t crc = -1);
+    bool read_text_reply(const ChunkSink &sink, string &err);
+    bool send_file_body(int fd, uint64_t offset, uint64_t len, string &err);
+    bool recv_file_body(int fd, uint64_t offset, uint64_t len, string &err,
+                        uint32_t *crc = nullptr);
+    bool expect_reply(int code, proto::Reply &rep, string &err);
+    bool fetch_signature(const string &remote, Signature &sig, int &code, string &err);
+    int  send_delta(const string &remote, const char *data, size_t size, bool need_basis,
+                    uint64_t &sent, string &err);
+    bool send_delta_body(const char *data, size_t size, uint32_t block_size,
+                         const vector<DeltaOp> &ops, uint64_t len, string &err);
+    bool read_text_replies(const vector<uint32_t> &ids,
+                           vector<string> &contents,
+                           vector<string> &errs);
+    bool read_own_frame(proto::FrameHeader &h, string &payload);
+    bool handle_stream_frame(const proto::FrameHeader &h, const string &payload);
+    void end_transfer(Transfer &t, const string &err);
+    size_t queue_upload_data();
+    bool next_upload_payload(Transfer &t, string &payload, bool &last);
+    void set_encoding(proto::Request &req) const;
+    void close_transfers();
+
     int sockfd_ = -1;
+    proto::Conn conn_;
+    bool v2_ = false;
+    vector<Codec> codecs_;          // codec server nhận trong HELLO
+    bool crc_ = false;              // server nhận "crc32c" trong HELLO
+    Codec want_codec_ = Codec::Zstd;
+    int   level_      = 0;
+    uint32_t next_id_ = 1;
+    map<uint32_t, Transfer> transfers_;
+    vector<TransferStatus> finished_; // xong trong lúc chờ reply lệnh khác
+
+    // Để open_sibling mở kết nối giống hệt.
+    string host_;
+    int    port_ = 0;
+    string user_;
+    string pass_;
+    atomic<uint64_t> body_bytes_{0};
 };
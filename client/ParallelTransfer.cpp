@@ -0,0 +1,289 @@
+// ===== file: client/ParallelTransfer.cpp =====
+#include "ParallelTransfer.hpp"
+#include "../common/Crc32c.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace {
+using Clock = chrono::steady_clock;
+
+double seconds_since(Clock::time_point t) {
+    return chrono::duration<double>(Clock::now() - t).count();
+}
+
+struct Chunk {
+    uint64_t offset = 0;
+    uint64_t len    = 0;
+    int      tries  = 0;
+};
+
+// 1 kết nối phụ. mtx bảo vệ conn khi worker mở lại kết nối trong lúc
+// controller đọc bộ đếm byte.
+struct Worker {
+    mutex         mtx;
+    NetworkClient conn;
+    uint64_t      bytes_before = 0; // byte của các kết nối đã đóng
+    Clock::time_point started;
+    double        seconds = 0;
+    thread        th;
+
+    uint64_t bytes() {
+        lock_guard<mutex> lock(mtx);
+        return bytes_before + conn.body_bytes();
+    }
+};
+} // namespace
+
+struct ParallelTransfer::Job {
+    bool     upload = false;
+    string   remote;
+    int      fd = -1;
+    uint64_t size = 0;
+    uint64_t upload_id = 0;
+    uint64_t chunk_size = 0;
+    vector<uint32_t> crcs; // CRC32C từng đoạn download, ghép lại để kiểm cả file
+
+    mutex              mtx;
+    condition_variable cv;
+    deque<Chunk>       queue;
+    size_t             outstanding = 0; // đoạn chưa xong (trong hàng đợi + đang chạy)
+    int                live = 0;        // worker đang có kết nối
+    int                starting = 0;    // worker đang mở kết nối
+    bool               failed = false;
+    string             err;
+};
+
+ParallelTransfer::ParallelTransfer(NetworkClient &control, const ParallelOptions &opt)
+    : control_(control),
+      opt_(opt) {}
+
+bool ParallelTransfer::upload(const string &local_path, const string &remote,
+                              ParallelReport &report, string &err) {
+    Job job;
+    job.upload = true;
+    job.remote = remote;
+    job.fd = ::open(local_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (job.fd < 0 || ::fstat(job.fd, &st) != 0) {
+        if (job.fd >= 0) ::close(job.fd);
+        err = "Cannot open " + local_path;
+        return false;
+    }
+    job.size = (uint64_t)st.st_size;
+
+    bool ok = control_.upload_open(remote, job.size, job.upload_id, err) &&
+              run(job, report, err) &&
+              control_.upload_commit(job.upload_id, err);
+    ::close(job.fd);
+    return ok;
+}
+
+bool ParallelTransfer::download(const string &remote, const string &local_path,
+                                ParallelReport &report, string &err) {
+    Job job;
+    job.remote = remote;
+    int64_t file_crc = -1;
+    if (!control_.remote_size(remote, job.size, err, &file_crc)) return false;
+
+    string part_path = local_path + ".part";
+    job.fd = ::open(part_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (job.fd < 0 || ::ftruncate(job.fd, (off_t)job.size) != 0) {
+        if (job.fd >= 0) ::close(job.fd);
+        err = "Cannot create " + part_path;
+        return false;
+    }
+
+    bool ok = run(job, report, err);
+    if (ok && file_crc >= 0) {
+        uint32_t crc = 0;
+        for (size_t i = 0; i < job.crcs.size(); ++i) {
+            uint64_t off = (uint64_t)i * job.chunk_size;
+            crc = crc32c_combine(crc, job.crcs[i], min(job.chunk_size, job.size - off));
+        }
+        if (crc != (uint32_t)file_crc) {
+            err = "Checksum mismatch";
+            ok = false;
+        }
+    }
+    if (::close(job.fd) != 0 && ok) {
+        err = "Write local file error";
+        ok = false;
+    }
+    if (ok && ::rename(part_path.c_str(), local_path.c_str()) != 0) {
+        err = "Cannot rename " + part_path;
+        ok = false;
+    }
+    if (!ok) ::unlink(part_path.c_str());
+    return ok;
+}
+
+bool ParallelTransfer::run(Job &job, ParallelReport &report, string &err) {
+    report = ParallelReport();
+    uint64_t chunk_size = max<uint64_t>(opt_.chunk_size, 1);
+    for (uint64_t off = 0; off < job.size; off += chunk_size) {
+        Chunk c;
+        c.offset = off;
+        c.len    = min(chunk_size, job.size - off);
+        job.queue.push_back(c);
+    }
+    job.outstanding = job.queue.size();
+    job.chunk_size = chunk_size;
+    job.crcs.assign(job.outstanding, 0);
+    if (job.outstanding == 0) return true;
+
+    int max_conns = max(1, (int)min<size_t>(opt_.max_conns, job.outstanding));
+
+    auto work = [this, &job](Worker *w) {
+        string err;
+        bool connected = control_.open_sibling(w->conn, err);
+        {
+            lock_guard<mutex> lock(job.mtx);
+            --job.starting;
+            if (connected) {
+                ++job.live;
+            } else if (job.live == 0 && job.starting == 0 && !job.failed) {
+                // Không mở được kết nối nào: bỏ cuộc. Còn kết nối khác thì
+                // chỉ là server không cho thêm, các worker kia làm tiếp.
+                job.failed = true;
+                job.err = err;
+                job.cv.notify_all();
+            }
+        }
+
+        while (connected) {
+            Chunk c;
+            {
+                unique_lock<mutex> lock(job.mtx);
+                job.cv.wait(lock, [&job] {
+                    return job.failed || !job.queue.empty() || job.outstanding == 0;
+                });
+                if (job.failed || job.queue.empty()) break;
+                c = job.queue.front();
+                job.queue.pop_front();
+            }
+
+            uint32_t crc = 0;
+            bool ok = job.upload
+                ? w->conn.upload_part(job.upload_id, job.fd, c.offset, c.len, err)
+                : w->conn.download_range(job.remote, job.fd, c.offset, c.len, err, &crc);
+
+            if (ok) {
+                lock_guard<mutex> lock(job.mtx);
+                job.crcs[c.offset / job.chunk_size] = crc;
+                if (--job.outstanding == 0) job.cv.notify_all();
+                continue;
+            }
+
+            // Đoạn lỗi: đưa lại vào hàng đợi, mở kết nối mới rồi làm tiếp.
+            NetworkClient fresh;
+            connected = control_.open_sibling(fresh, err);
+            {
+                lock_guard<mutex> lock(w->mtx);
+                w->bytes_before += w->conn.body_bytes();
+                w->conn = std::move(fresh);
+            }
+            lock_guard<mutex> lock(job.mtx);
+            if (!connected) --job.live;
+            if (++c.tries > opt_.max_retries || job.live == 0) {
+                if (!job.failed) {
+                    job.failed = true;
+                    job.err = err;
+                }
+            } else {
+                job.queue.push_front(c);
+            }
+            job.cv.notify_all();
+        }
+
+        w->conn.close();
+        lock_guard<mutex> lock(job.mtx);
+        w->seconds = seconds_since(w->started);
+        job.cv.notify_all();
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    auto spawn = [&workers, &work, &job] {
+        {
+            lock_guard<mutex> lock(job.mtx);
+            ++job.starting;
+        }
+        workers.push_back(unique_ptr<Worker>(new Worker()));
+        Worker *w = workers.back().get();
+        w->started = Clock::now();
+        w->th = thread(work, w);
+    };
+
+    Clock::time_point start = Clock::now();
+    int initial = max(1, min(opt_.initial_conns, max_conns));
+    for (int i = 0; i < initial; ++i) spawn();
+
+    // Thêm kết nối chừng nào throughput tổng còn tăng ít nhất min_gain so
+    // với mức tốt nhất đã đo; lần đầu không tăng nữa thì giữ nguyên K.
+    bool growing = (int)workers.size() < max_conns;
+    double best = 0;
+    uint64_t last_bytes = 0;
+    Clock::time_point last = start;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(job.mtx);
+            bool finished = job.cv.wait_for(lock, chrono::milliseconds(opt_.probe_ms), [&job] {
+                return job.failed || job.outstanding == 0;
+            });
+            if (finished || !growing) {
+                if (!growing) {
+                    job.cv.wait(lock, [&job] { return job.failed || job.outstanding == 0; });
+                }
+                break;
+            }
+            if (job.queue.empty()) continue;
+        }
+
+        uint64_t total = 0;
+        for (auto &w : workers) total += w->bytes();
+        double dt = seconds_since(last);
+        double rate = dt > 0 ? (double)(total - last_bytes) / dt : 0;
+        last_bytes = total;
+        last = Clock::now();
+
+        if (rate > best * (1.0 + opt_.min_gain)) {
+            best = rate;
+            spawn();
+            growing = (int)workers.size() < max_conns;
+        } else {
+            growing = false;
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(job.mtx);
+        job.cv.notify_all();
+    }
+    for (auto &w : workers) w->th.join();
+
+    report.seconds = seconds_since(start);
+    for (auto &w : workers) {
+        ParallelReport::Conn c;
+        c.bytes   = w->bytes();
+        c.seconds = w->seconds;
+        c.rate    = c.seconds > 0 ? (double)c.bytes / c.seconds : 0;
+        report.bytes += c.bytes;
+        report.conns.push_back(c);
+    }
+
+    if (job.failed) {
+        err = job.err.empty() ? "Transfer failed" : job.err;
+        return false;
+    }
+    return true;
+}
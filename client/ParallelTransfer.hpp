@@ -0,0 +1,52 @@
+// ===== file: client/ParallelTransfer.hpp =====
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "NetworkClient.hpp"
+
+using namespace std;
+
+// Chia file thành các đoạn cố định, truyền qua K kết nối song song (mỗi kết
+// nối 1 thread, lấy đoạn từ hàng đợi chung). K bắt đầu nhỏ rồi tăng dần
+// chừng nào throughput tổng còn tăng đáng kể; đoạn lỗi được gửi lại trên
+// kết nối mới.
+struct ParallelOptions {
+    uint64_t chunk_size    = 8 * 1024 * 1024;
+    int      initial_conns = 2;
+    int      max_conns     = 8;
+    int      probe_ms      = 500;   // chu kỳ đo throughput để quyết định tăng K
+    double   min_gain      = 0.10;  // tăng K khi throughput tăng hơn 10%
+    int      max_retries   = 3;     // số lần gửi lại 1 đoạn trước khi bỏ cuộc
+};
+
+struct ParallelReport {
+    struct Conn {
+        uint64_t bytes   = 0;
+        double   seconds = 0;
+        double   rate    = 0;  // byte/s
+    };
+    uint64_t     bytes   = 0;
+    double       seconds = 0;
+    vector<Conn> conns;
+};
+
+class ParallelTransfer {
+public:
+    // control: kết nối đã đăng nhập; các kết nối phụ mở bằng open_sibling().
+    explicit ParallelTransfer(NetworkClient &control,
+                              const ParallelOptions &opt = ParallelOptions());
+
+    bool upload(const string &local_path, const string &remote,
+                ParallelReport &report, string &err);
+    // Ghi vào local_path + ".part", xong hết mới đổi tên thành local_path.
+    bool download(const string &remote, const string &local_path,
+                  ParallelReport &report, string &err);
+
+private:
+    struct Job;
+    bool run(Job &job, ParallelReport &report, string &err);
+
+    NetworkClient &control_;
+    ParallelOptions opt_;
+};
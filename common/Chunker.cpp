@@ -0,0 +1,82 @@
+// ===== file: common/Chunker.cpp =====
+#include "Chunker.hpp"
+#include "Sha256.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <vector>
+
+namespace {
+// Bảng gear cố định (splitmix64 từ seed hằng) để mọi bản build cắt giống nhau.
+struct GearTable {
+    uint64_t v[256];
+    GearTable() {
+        uint64_t x = 0x6a09e667f3bcc908ULL;
+        for (auto &g : v) {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            g = z ^ (z >> 31);
+        }
+    }
+};
+const GearTable GEAR;
+
+// Normalized chunking: trước mốc trung bình dùng mask khó hơn (22 bit),
+// sau mốc dùng mask dễ hơn (18 bit) nên kích thước chunk dồn quanh 1 MiB.
+// Lấy bit cao vì sau phép dịch trái chúng phụ thuộc vào nhiều byte nhất.
+const uint64_t MASK_HARD = ((1ULL << 22) - 1) << 42;
+const uint64_t MASK_EASY = ((1ULL << 18) - 1) << 46;
+} // namespace
+
+size_t cdc_cut(const unsigned char *p, size_t n) {
+    if (n <= CDC_MIN_SIZE) return n;
+    size_t limit = n < CDC_MAX_SIZE ? n : CDC_MAX_SIZE;
+    size_t normal = limit < CDC_AVG_SIZE ? limit : CDC_AVG_SIZE;
+
+    uint64_t fp = 0;
+    size_t i = CDC_MIN_SIZE;
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + GEAR.v[p[i]];
+        if ((fp & MASK_HARD) == 0) return i + 1;
+    }
+    for (; i < limit; ++i) {
+        fp = (fp << 1) + GEAR.v[p[i]];
+        if ((fp & MASK_EASY) == 0) return i + 1;
+    }
+    return limit;
+}
+
+bool for_each_chunk(int fd, const function<bool(const ChunkRef &, const char *)> &cb) {
+    // Gấp đôi chunk tối đa: phần còn lại chỉ phải dời về đầu buffer sau khi
+    // đã cắt qua nửa đầu, mỗi byte bị copy nhiều nhất 1 lần.
+    vector<char> buf(2 * CDC_MAX_SIZE);
+    size_t start = 0, end = 0;
+    bool eof = false;
+
+    for (;;) {
+        if (!eof && end - start < CDC_MAX_SIZE) {
+            if (end + CDC_MAX_SIZE > buf.size()) {
+                memmove(buf.data(), buf.data() + start, end - start);
+                end  -= start;
+                start = 0;
+            }
+            while (!eof && end - start < CDC_MAX_SIZE) {
+                ssize_t n = ::read(fd, buf.data() + end, buf.size() - end);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) return false;
+                if (n == 0) eof = true;
+                end += (size_t)n;
+            }
+        }
+        if (end == start) return true;
+
+        const char *p = buf.data() + start;
+        size_t len = cdc_cut(reinterpret_cast<const unsigned char *>(p), end - start);
+        ChunkRef c;
+        c.hash = Sha256::hex(p, len);
+        c.size = len;
+        if (!cb(c, p)) return false;
+        start += len;
+    }
+}
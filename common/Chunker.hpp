@@ -0,0 +1,30 @@
+// ===== file: common/Chunker.hpp =====
+#pragma once
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+// Chia file theo nội dung (content-defined chunking, kiểu FastCDC): ranh giới
+// chunk phụ thuộc vào 64 byte dữ liệu gần nhất chứ không vào vị trí, nên
+// chèn/xóa vài byte chỉ làm đổi 1-2 chunk quanh chỗ sửa. Client và server
+// phải dùng cùng tham số để ra cùng danh sách chunk.
+const size_t CDC_MIN_SIZE = 256 * 1024;
+const size_t CDC_AVG_SIZE = 1024 * 1024;
+const size_t CDC_MAX_SIZE = 4 * 1024 * 1024;
+
+struct ChunkRef {
+    string   hash;      // SHA-256 hex của nội dung chunk
+    uint64_t size = 0;
+};
+
+// Độ dài chunk đầu tiên của [p, p+n). n < CDC_MAX_SIZE mà chưa gặp ranh
+// giới thì trả n (chỉ đúng là chunk cuối nếu đã hết dữ liệu).
+size_t cdc_cut(const unsigned char *p, size_t n);
+
+// Đọc fd từ vị trí hiện tại đến hết, gọi cb cho từng chunk kèm dữ liệu của
+// nó (hợp lệ trong lúc gọi). cb trả false thì dừng. false nếu lỗi đọc hoặc
+// cb dừng giữa chừng.
+bool for_each_chunk(int fd, const function<bool(const ChunkRef &, const char *)> &cb);
@@ -0,0 +1,232 @@
+// ===== file: common/Compress.cpp =====
+#include "Compress.hpp"
+#include <zlib.h>
+#include <vector>
+#include <algorithm>
+#ifdef FILESHARE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+const size_t OUT_STEP     = 64 * 1024;
+const size_t PROBE_SAMPLE = 16 * 1024;
+const size_t PROBE_MIN    = 512;   // nhỏ hơn: header nén không đáng
+const double PROBE_RATIO  = 0.9;   // nén thử phải giảm được ít nhất 10%
+
+class ZlibEncoder : public Encoder {
+public:
+    explicit ZlibEncoder(int level) {
+        ok_ = deflateInit(&zs_, level) == Z_OK;
+    }
+    ~ZlibEncoder() override { deflateEnd(&zs_); }
+
+    bool update(const char *p, size_t n, string &out) override {
+        return ok_ && run(p, n, Z_NO_FLUSH, out);
+    }
+    bool finish(string &out) override {
+        return ok_ && run(nullptr, 0, Z_FINISH, out);
+    }
+
+private:
+    bool run(const char *p, size_t n, int flush, string &out) {
+        zs_.next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(p));
+        zs_.avail_in = (uInt)n;
+        while (true) {
+            size_t old = out.size();
+            out.resize(old + OUT_STEP);
+            zs_.next_out  = reinterpret_cast<Bytef *>(&out[old]);
+            zs_.avail_out = (uInt)OUT_STEP;
+            int r = deflate(&zs_, flush);
+            out.resize(old + OUT_STEP - zs_.avail_out);
+            if (r == Z_STREAM_END) return true;
+            if (r != Z_OK && r != Z_BUF_ERROR) return false;
+            if (zs_.avail_out > 0 && zs_.avail_in == 0 && flush == Z_NO_FLUSH) return true;
+        }
+    }
+
+    z_stream zs_{};
+    bool ok_ = false;
+};
+
+class ZlibDecoder : public Decoder {
+public:
+    ZlibDecoder() { ok_ = inflateInit(&zs_) == Z_OK; }
+    ~ZlibDecoder() override { inflateEnd(&zs_); }
+
+    bool update(const char *p, size_t n, string &out) override {
+        if (!ok_ || (done_ && n > 0)) return false;
+        zs_.next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(p));
+        zs_.avail_in = (uInt)n;
+        while (zs_.avail_in > 0 || zs_.avail_out == 0) {
+            size_t old = out.size();
+            out.resize(old + OUT_STEP);
+            zs_.next_out  = reinterpret_cast<Bytef *>(&out[old]);
+            zs_.avail_out = (uInt)OUT_STEP;
+            int r = inflate(&zs_, Z_NO_FLUSH);
+            out.resize(old + OUT_STEP - zs_.avail_out);
+            if (r == Z_STREAM_END) {
+                done_ = true;
+                return zs_.avail_in == 0;
+            }
+            if (r != Z_OK && r != Z_BUF_ERROR) return false;
+            if (r == Z_BUF_ERROR && zs_.avail_out > 0) break;
+        }
+        return true;
+    }
+    bool finished() const override { return done_; }
+
+private:
+    z_stream zs_{};
+    bool ok_   = false;
+    bool done_ = false;
+};
+
+#ifdef FILESHARE_HAVE_ZSTD
+class ZstdEncoder : public Encoder {
+public:
+    explicit ZstdEncoder(int level) : cctx_(ZSTD_createCCtx()) {
+        if (cctx_) ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+    }
+    ~ZstdEncoder() override { ZSTD_freeCCtx(cctx_); }
+
+    bool update(const char *p, size_t n, string &out) override {
+        return run(p, n, ZSTD_e_continue, out);
+    }
+    bool finish(string &out) override { return run(nullptr, 0, ZSTD_e_end, out); }
+
+private:
+    bool run(const char *p, size_t n, ZSTD_EndDirective mode, string &out) {
+        if (!cctx_) return false;
+        ZSTD_inBuffer in{p, n, 0};
+        while (true) {
+            size_t old = out.size();
+            out.resize(old + OUT_STEP);
+            ZSTD_outBuffer ob{&out[old], OUT_STEP, 0};
+            size_t left = ZSTD_compressStream2(cctx_, &ob, &in, mode);
+            out.resize(old + ob.pos);
+            if (ZSTD_isError(left)) return false;
+            if (mode == ZSTD_e_end ? left == 0 : in.pos == in.size) return true;
+        }
+    }
+
+    ZSTD_CCtx *cctx_;
+};
+
+class ZstdDecoder : public Decoder {
+public:
+    ZstdDecoder() : dctx_(ZSTD_createDCtx()) {}
+    ~ZstdDecoder() override { ZSTD_freeDCtx(dctx_); }
+
+    bool update(const char *p, size_t n, string &out) override {
+        if (!dctx_ || (done_ && n > 0)) return false;
+        ZSTD_inBuffer in{p, n, 0};
+        while (in.pos < in.size) {
+            size_t old = out.size();
+            out.resize(old + OUT_STEP);
+            ZSTD_outBuffer ob{&out[old], OUT_STEP, 0};
+            size_t r = ZSTD_decompressStream(dctx_, &ob, &in);
+            out.resize(old + ob.pos);
+            if (ZSTD_isError(r)) return false;
+            if (r == 0) {
+                done_ = true;
+                return in.pos == in.size;
+            }
+        }
+        return true;
+    }
+    bool finished() const override { return done_; }
+
+private:
+    ZSTD_DCtx *dctx_;
+    bool done_ = false;
+};
+#endif
+} // namespace
+
+const char *codec_name(Codec c) {
+    switch (c) {
+    case Codec::Zlib: return "zlib";
+    case Codec::Zstd: return "zstd";
+    default:          return "none";
+    }
+}
+
+bool parse_codec(const string &name, Codec &c) {
+    if (name == "zlib") c = Codec::Zlib;
+    else if (name == "zstd") c = Codec::Zstd;
+    else if (name == "none") c = Codec::None;
+    else return false;
+    return true;
+}
+
+bool codec_available(Codec c) {
+    if (c == Codec::Zlib) return true;
+#ifdef FILESHARE_HAVE_ZSTD
+    if (c == Codec::Zstd) return true;
+#endif
+    return false;
+}
+
+string available_codecs() {
+#ifdef FILESHARE_HAVE_ZSTD
+    return "zstd zlib";
+#else
+    return "zlib";
+#endif
+}
+
+int clamp_level(Codec c, int level) {
+    if (c == Codec::Zlib) return level <= 0 ? Z_DEFAULT_COMPRESSION : min(level, 9);
+#ifdef FILESHARE_HAVE_ZSTD
+    if (c == Codec::Zstd) return level <= 0 ? 3 : min(level, ZSTD_maxCLevel());
+#endif
+    return level;
+}
+
+unique_ptr<Encoder> make_encoder(Codec c, int level) {
+    level = clamp_level(c, level);
+    if (c == Codec::Zlib) return unique_ptr<Encoder>(new ZlibEncoder(level));
+#ifdef FILESHARE_HAVE_ZSTD
+    if (c == Codec::Zstd) return unique_ptr<Encoder>(new ZstdEncoder(level));
+#endif
+    return nullptr;
+}
+
+unique_ptr<Decoder> make_decoder(Codec c) {
+    if (c == Codec::Zlib) return unique_ptr<Decoder>(new ZlibDecoder());
+#ifdef FILESHARE_HAVE_ZSTD
+    if (c == Codec::Zstd) return unique_ptr<Decoder>(new ZstdDecoder());
+#endif
+    return nullptr;
+}
+
+bool worth_compressing(const function<bool(uint64_t off, char *buf, size_t len)> &read,
+                       uint64_t size) {
+    if (size < PROBE_MIN) return false;
+
+    // File nhỏ: thử cả file; lớn: 3 mẫu rải đều (header của nhiều định dạng
+    // nén được dù phần thân thì không).
+    vector<uint64_t> offs;
+    if (size <= 3 * PROBE_SAMPLE) offs.push_back(0);
+    else offs = {0, size / 2 - PROBE_SAMPLE / 2, size - PROBE_SAMPLE};
+
+    vector<char> buf;
+    string out;
+    uint64_t in_total = 0;
+    ZlibEncoder enc(1);
+    for (uint64_t off : offs) {
+        size_t n = (size_t)min<uint64_t>(offs.size() == 1 ? size : PROBE_SAMPLE, size - off);
+        buf.resize(n);
+        if (!read(off, buf.data(), n) || !enc.update(buf.data(), n, out)) return false;
+        in_total += n;
+    }
+    if (!enc.finish(out)) return false;
+    return (double)out.size() < (double)in_total * PROBE_RATIO;
+}
+
+bool worth_compressing(const char *data, size_t size) {
+    return worth_compressing([data](uint64_t off, char *buf, size_t len) {
+        copy(data + off, data + off + len, buf);
+        return true;
+    }, size);
+}
@@ -0,0 +1,53 @@
+// ===== file: common/Compress.hpp =====
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+// Nén body theo luồng (chỉ giao thức v2: frame DATA cho biết chỗ kết thúc nên
+// không cần biết trước kích thước sau nén). zlib luôn có; zstd khi build với
+// FILESHARE_HAVE_ZSTD.
+enum class Codec : uint8_t {
+    None = 0,
+    Zlib = 1,
+    Zstd = 2,
+};
+
+const char *codec_name(Codec c);
+bool parse_codec(const string &name, Codec &c);
+bool codec_available(Codec c);
+// Các codec build được, cách nhau bởi dấu cách (zstd trước: tốt hơn).
+string available_codecs();
+// level = 0: mức mặc định của codec; ngoài khoảng thì bị kẹp lại.
+int clamp_level(Codec c, int level);
+
+class Encoder {
+public:
+    virtual ~Encoder() = default;
+    // Nén thêm n byte, nối phần output đã có vào out.
+    virtual bool update(const char *p, size_t n, string &out) = 0;
+    // Kết thúc luồng (đẩy nốt phần còn giữ trong encoder).
+    virtual bool finish(string &out) = 0;
+};
+
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+    virtual bool update(const char *p, size_t n, string &out) = 0;
+    // Đã gặp cuối luồng nén (dữ liệu sau đó là lỗi).
+    virtual bool finished() const = 0;
+};
+
+// nullptr nếu codec không có trong bản build.
+unique_ptr<Encoder> make_encoder(Codec c, int level);
+unique_ptr<Decoder> make_decoder(Codec c);
+
+// Nén thử vài mẫu (đầu/giữa/cuối, 16 KiB mỗi mẫu) bằng zlib mức nhanh nhất;
+// false nếu dữ liệu gần như không nén được (ảnh, video, file đã nén...).
+bool worth_compressing(const function<bool(uint64_t off, char *buf, size_t len)> &read,
+                       uint64_t size);
+bool worth_compressing(const char *data, size_t size);
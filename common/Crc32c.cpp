@@ -0,0 +1,201 @@
+// ===== file: common/Crc32c.cpp =====
+#include "Crc32c.hpp"
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace {
+const uint32_t POLY = 0x82f63b78;  // đa thức Castagnoli, dạng đảo bit
+const size_t   LANE = 8 * 1024;    // độ dài mỗi luồng khi tính 3 luồng song song
+
+// a * b mod P (đa thức trên GF(2), dạng đảo bit như zlib).
+uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = (uint32_t)1 << 31, p = 0;
+    while (true) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+struct Tables {
+    uint32_t t[8][256];  // slicing-by-8
+    uint32_t x2n[72];    // x^(2^k) mod P, đủ cho độ dài 64 bit tính theo bit
+
+    Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+        x2n[0] = (uint32_t)1 << 30;  // x^1
+        for (size_t k = 1; k < sizeof(x2n) / sizeof(x2n[0]); ++k) {
+            x2n[k] = multmodp(x2n[k - 1], x2n[k - 1]);
+        }
+    }
+};
+
+const Tables &tables() {
+    static const Tables tb;
+    return tb;
+}
+
+// x^(n * 2^k) mod P.
+uint32_t x2nmodp(uint64_t n, unsigned k) {
+    const Tables &tb = tables();
+    uint32_t p = (uint32_t)1 << 31;  // x^0
+    while (n) {
+        if (n & 1) p = multmodp(tb.x2n[k], p);
+        n >>= 1;
+        ++k;
+    }
+    return p;
+}
+
+// Thanh ghi CRC sau khi đẩy thêm len byte 0.
+uint32_t shift_bytes(uint32_t crc, uint64_t len) {
+    return multmodp(x2nmodp(len, 3), crc);
+}
+
+inline uint64_t load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Các hàm dưới đây làm việc trên thanh ghi (đã đảo bit ở crc32c()).
+uint32_t crc_table(uint32_t c, const unsigned char *p, size_t n) {
+    const auto &t = tables().t;
+    while (n >= 8) {
+        uint32_t lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 |
+                      (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^
+            t[4][lo >> 24] ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+            t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) c = t[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+#ifdef CRC32C_X86
+// Lệnh crc32 trễ 3 chu kỳ nhưng mỗi chu kỳ nhận được 1 lệnh mới: chạy 3 chuỗi
+// độc lập trên 3 đoạn liền nhau rồi ghép lại mới đạt tốc độ bộ nhớ.
+__attribute__((target("sse4.2")))
+uint32_t crc_sse42(uint32_t c, const unsigned char *p, size_t n) {
+    while (n > 0 && ((uintptr_t)p & 7) != 0) {
+        c = _mm_crc32_u8(c, *p++);
+        --n;
+    }
+    if (n >= 3 * LANE) {
+        static const uint32_t k1 = x2nmodp(LANE, 3);
+        static const uint32_t k2 = x2nmodp(2 * LANE, 3);
+        while (n >= 3 * LANE) {
+            uint64_t c0 = c, c1 = 0, c2 = 0;
+            for (size_t i = 0; i < LANE; i += 8) {
+                c0 = _mm_crc32_u64(c0, load64(p + i));
+                c1 = _mm_crc32_u64(c1, load64(p + LANE + i));
+                c2 = _mm_crc32_u64(c2, load64(p + 2 * LANE + i));
+            }
+            c = multmodp(k2, (uint32_t)c0) ^ multmodp(k1, (uint32_t)c1) ^ (uint32_t)c2;
+            p += 3 * LANE;
+            n -= 3 * LANE;
+        }
+    }
+    uint64_t c64 = c;
+    while (n >= 8) {
+        c64 = _mm_crc32_u64(c64, load64(p));
+        p += 8;
+        n -= 8;
+    }
+    c = (uint32_t)c64;
+    while (n--) c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+#endif
+
+#ifdef CRC32C_ARM
+uint32_t crc_armv8(uint32_t c, const unsigned char *p, size_t n) {
+    while (n >= 8) {
+        c = __crc32cd(c, load64(p));
+        p += 8;
+        n -= 8;
+    }
+    while (n--) c = __crc32cb(c, *p++);
+    return c;
+}
+#endif
+
+using CrcFn = uint32_t (*)(uint32_t, const unsigned char *, size_t);
+
+CrcFn pick_impl() {
+#ifdef CRC32C_X86
+    if (__builtin_cpu_supports("sse4.2")) return crc_sse42;
+#endif
+#ifdef CRC32C_ARM
+    return crc_armv8;
+#endif
+    return crc_table;
+}
+
+CrcFn impl() {
+    static const CrcFn fn = pick_impl();
+    return fn;
+}
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    return ~impl()(~crc, static_cast<const unsigned char *>(data), len);
+}
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b) {
+    return shift_bytes(crc_a, len_b) ^ crc_b;
+}
+
+const char *crc32c_impl() {
+#ifdef CRC32C_X86
+    if (impl() == crc_sse42) return "sse4.2";
+#endif
+#ifdef CRC32C_ARM
+    if (impl() == crc_armv8) return "armv8";
+#endif
+    return "table";
+}
+
+string crc32c_hex(uint32_t crc) {
+    char buf[9];
+    snprintf(buf, sizeof(buf), "%08x", crc);
+    return buf;
+}
+
+bool parse_crc32c(const string &hex, uint32_t &crc) {
+    if (hex.size() != 8) return false;
+    uint32_t v = 0;
+    for (char ch : hex) {
+        int d;
+        if (ch >= '0' && ch <= '9') d = ch - '0';
+        else if (ch >= 'a' && ch <= 'f') d = ch - 'a' + 10;
+        else if (ch >= 'A' && ch <= 'F') d = ch - 'A' + 10;
+        else return false;
+        v = (v << 4) | (uint32_t)d;
+    }
+    crc = v;
+    return true;
+}
@@ -0,0 +1,25 @@
+// ===== file: common/Crc32c.hpp =====
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+// CRC-32C (Castagnoli) kiểm tra toàn vẹn body, tính ngay trong vòng nhận/gửi.
+// Dùng lệnh crc32 của CPU khi có (SSE4.2 trên x86-64, chọn lúc chạy; CRC của
+// ARMv8 khi build có hỗ trợ), không thì bảng slicing-by-8.
+//
+// Nối tiếp được: crc32c(crc32c(0, a), b) == crc32c(0, a + b).
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+// CRC của a + b từ CRC của a, CRC của b và độ dài b (ghép các đoạn upload
+// song song, các lần nối tiếp upload) mà không đọc lại dữ liệu.
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+// Cài đặt đang dùng: "sse4.2", "armv8" hoặc "table".
+const char *crc32c_impl();
+
+// 8 ký tự hex thường <-> giá trị.
+string crc32c_hex(uint32_t crc);
+bool parse_crc32c(const string &hex, uint32_t &crc);
@@ -0,0 +1,363 @@
+// ===== file: common/Delta.cpp =====
+#include "Delta.hpp"
+#include "Crc32c.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+const uint32_t MIN_BLOCK = 512;
+const uint32_t MAX_BLOCK = 128 * 1024;
+const uint16_t CHAR_OFFSET = 31;
+
+void put_be(string &out, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) out += (char)(v >> (8 * i));
+}
+
+uint64_t get_be(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+void strong_hash(const char *p, size_t n, unsigned char out[DELTA_STRONG_SIZE]) {
+    Sha256 sha;
+    sha.update(p, n);
+    unsigned char d[Sha256::DIGEST_SIZE];
+    sha.finish(d);
+    memcpy(out, d, DELTA_STRONG_SIZE);
+}
+
+bool write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+// Đọc tuần tự từ fd qua buffer (delta thường gồm nhiều lệnh nhỏ).
+class FdReader {
+public:
+    explicit FdReader(int fd) : fd_(fd), buf_(256 * 1024) {}
+
+    // false nếu hết dữ liệu trước khi đủ n byte hoặc lỗi đọc.
+    bool read(char *out, size_t n) {
+        while (n > 0) {
+            if (off_ == len_) {
+                ssize_t r = ::read(fd_, buf_.data(), buf_.size());
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) return false;
+                off_ = 0;
+                len_ = (size_t)r;
+            }
+            size_t take = min(n, len_ - off_);
+            memcpy(out, buf_.data() + off_, take);
+            off_ += take;
+            out  += take;
+            n    -= take;
+        }
+        return true;
+    }
+
+    bool at_end() {
+        if (off_ < len_) return false;
+        ssize_t r;
+        do {
+            r = ::read(fd_, buf_.data(), buf_.size());
+        } while (r < 0 && errno == EINTR);
+        if (r <= 0) return true;
+        off_ = 0;
+        len_ = (size_t)r;
+        return false;
+    }
+
+private:
+    int fd_;
+    vector<char> buf_;
+    size_t off_ = 0;
+    size_t len_ = 0;
+};
+} // namespace
+
+uint32_t delta_block_size(uint64_t file_size) {
+    uint64_t b = (uint64_t)std::sqrt((double)file_size);
+    b = (b + 63) & ~(uint64_t)63;
+    if (b < MIN_BLOCK) b = MIN_BLOCK;
+    if (b > MAX_BLOCK) b = MAX_BLOCK;
+    return (uint32_t)b;
+}
+
+// Checksum cuộn của rsync: a = tổng byte, b = tổng có trọng số, mỗi nửa 16 bit.
+uint32_t weak_checksum(const unsigned char *p, size_t n) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < n; ++i) {
+        a += p[i] + CHAR_OFFSET;
+        b += (uint32_t)(n - i) * (p[i] + CHAR_OFFSET);
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+bool make_signature(uint64_t file_size, const BasisReader &read, string &out) {
+    SignatureWriter w(file_size, read);
+    out.clear();
+    out.reserve((size_t)w.size());
+    while (!w.done()) {
+        if (!w.next(out)) return false;
+    }
+    return true;
+}
+
+// Đọc nhiều block mỗi lần để file cũ nằm trong chunk store/đĩa chậm không
+// phải đọc từng mẩu nhỏ.
+SignatureWriter::SignatureWriter(uint64_t file_size, BasisReader read)
+    : file_size_(file_size),
+      read_(move(read)),
+      bs_(delta_block_size(file_size)),
+      batch_(max<size_t>(bs_, 1024 * 1024) / bs_ * bs_) {}
+
+uint64_t SignatureWriter::size() const {
+    return 12 + (file_size_ + bs_ - 1) / bs_ * (4 + DELTA_STRONG_SIZE);
+}
+
+bool SignatureWriter::next(string &out) {
+    if (!started_) {
+        put_be(out, bs_, 4);
+        put_be(out, file_size_, 8);
+        started_ = true;
+    }
+    if (off_ >= file_size_) return true;
+    size_t n = (size_t)min<uint64_t>(batch_, file_size_ - off_);
+    buf_.resize(batch_);
+    if (!read_(off_, buf_.data(), n)) return false;
+    for (size_t p = 0; p < n; p += bs_) {
+        size_t len = min<size_t>(bs_, n - p);
+        const unsigned char *u = reinterpret_cast<const unsigned char *>(buf_.data() + p);
+        put_be(out, weak_checksum(u, len), 4);
+        unsigned char strong[DELTA_STRONG_SIZE];
+        strong_hash(buf_.data() + p, len, strong);
+        out.append(reinterpret_cast<const char *>(strong), DELTA_STRONG_SIZE);
+    }
+    off_ += n;
+    return true;
+}
+
+bool parse_signature(const string &data, Signature &sig) {
+    const size_t entry = 4 + DELTA_STRONG_SIZE;
+    if (data.size() < 12 || (data.size() - 12) % entry != 0) return false;
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data.data());
+    sig.block_size = (uint32_t)get_be(p, 4);
+    sig.file_size  = get_be(p + 4, 8);
+    size_t count = (data.size() - 12) / entry;
+    if (sig.block_size == 0 ||
+        count != (sig.file_size + sig.block_size - 1) / sig.block_size) return false;
+
+    sig.blocks.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char *e = p + 12 + i * entry;
+        sig.blocks[i].weak = (uint32_t)get_be(e, 4);
+        memcpy(sig.blocks[i].strong, e + 4, DELTA_STRONG_SIZE);
+    }
+    return true;
+}
+
+void make_delta(const char *data, size_t size, const Signature &sig, vector<DeltaOp> &ops) {
+    ops.clear();
+    auto literal = [&](size_t from, size_t to) {
+        while (from < to) {
+            size_t n = min(to - from, DELTA_MAX_LITERAL);
+            DeltaOp op;
+            op.pos = from;
+            op.len = n;
+            ops.push_back(op);
+            from += n;
+        }
+    };
+    auto copy = [&](uint64_t index) {
+        if (!ops.empty() && ops.back().copy && ops.back().pos + ops.back().len == index) {
+            ++ops.back().len;
+            return;
+        }
+        DeltaOp op;
+        op.copy = true;
+        op.pos  = index;
+        op.len  = 1;
+        ops.push_back(op);
+    };
+
+    const size_t bs = sig.block_size;
+    size_t full = bs ? (size_t)(sig.file_size / bs) : 0; // số block đủ kích thước
+    if (full == 0 || size < bs) {
+        literal(0, size);
+        return;
+    }
+
+    // weak -> các block có weak đó (chuỗi qua next).
+    unordered_map<uint32_t, uint32_t> head;
+    vector<uint32_t> next(full, UINT32_MAX);
+    head.reserve(full);
+    for (uint32_t i = (uint32_t)full; i-- > 0;) {
+        auto it = head.find(sig.blocks[i].weak);
+        if (it != head.end()) next[i] = it->second;
+        head[sig.blocks[i].weak] = i;
+    }
+
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(data);
+    size_t lit = 0, pos = 0;
+    uint32_t weak = weak_checksum(u, bs);
+    uint32_t a = weak & 0xffff, b = weak >> 16;
+    // Gợi ý: block kế tiếp trong file cũ thường là block khớp tiếp theo.
+    uint64_t expect = UINT64_MAX;
+
+    while (pos + bs <= size) {
+        uint32_t w = (a & 0xffff) | (b << 16);
+        auto it = head.find(w);
+        uint32_t found = UINT32_MAX;
+        if (it != head.end()) {
+            unsigned char strong[DELTA_STRONG_SIZE];
+            strong_hash(data + pos, bs, strong);
+            for (uint32_t i = it->second; i != UINT32_MAX; i = next[i]) {
+                if (memcmp(sig.blocks[i].strong, strong, DELTA_STRONG_SIZE) == 0) {
+                    found = i;
+                    if (i == expect) break;
+                }
+            }
+        }
+        if (found != UINT32_MAX) {
+            literal(lit, pos);
+            copy(found);
+            expect = (uint64_t)found + 1;
+            pos += bs;
+            lit  = pos;
+            if (pos + bs <= size) {
+                weak = weak_checksum(u + pos, bs);
+                a = weak & 0xffff;
+                b = weak >> 16;
+            }
+            continue;
+        }
+        if (pos + bs == size) break;
+        // Cuộn cửa sổ sang phải 1 byte.
+        uint32_t out = u[pos] + CHAR_OFFSET, in = u[pos + bs] + CHAR_OFFSET;
+        a = a - out + in;
+        b = b - (uint32_t)bs * out + a;
+        ++pos;
+    }
+
+    // Block cuối ngắn của file cũ chỉ khớp được ở đúng cuối file mới.
+    size_t tail = (size_t)(sig.file_size - (uint64_t)full * bs);
+    if (tail > 0 && size - lit >= tail) {
+        const BlockSig &t = sig.blocks[full];
+        size_t at = size - tail;
+        if (weak_checksum(u + at, tail) == t.weak) {
+            unsigned char strong[DELTA_STRONG_SIZE];
+            strong_hash(data + at, tail, strong);
+            if (memcmp(strong, t.strong, DELTA_STRONG_SIZE) == 0) {
+                literal(lit, at);
+                copy(full);
+                return;
+            }
+        }
+    }
+    literal(lit, size);
+}
+
+uint64_t delta_encoded_size(const vector<DeltaOp> &ops) {
+    uint64_t n = DELTA_HEADER_SIZE;
+    for (const auto &op : ops) n += op.copy ? 1 + 8 + 4 : 1 + 4 + op.len;
+    return n;
+}
+
+bool encode_delta(const char *data, size_t size, uint32_t block_size,
+                  const vector<DeltaOp> &ops,
+                  const function<bool(const char *, size_t)> &emit) {
+    unsigned char digest[Sha256::DIGEST_SIZE];
+    Sha256 sha;
+    sha.update(data, size);
+    sha.finish(digest);
+
+    string hdr(reinterpret_cast<const char *>(digest), sizeof(digest));
+    put_be(hdr, block_size, 4);
+    if (!emit(hdr.data(), hdr.size())) return false;
+
+    for (const auto &op : ops) {
+        string h;
+        if (op.copy) {
+            h += 'C';
+            put_be(h, op.pos, 8);
+            put_be(h, op.len, 4);
+            if (!emit(h.data(), h.size())) return false;
+            continue;
+        }
+        h += 'L';
+        put_be(h, op.len, 4);
+        if (!emit(h.data(), h.size()) || !emit(data + op.pos, (size_t)op.len)) return false;
+    }
+    return true;
+}
+
+int apply_delta(int delta_fd, uint64_t basis_size, const BasisReader &read, int out_fd,
+                uint64_t expected_size, uint32_t *crc) {
+    FdReader in(delta_fd);
+    char hdr[DELTA_HEADER_SIZE];
+    if (!in.read(hdr, sizeof(hdr))) return 400;
+    const unsigned char *uh = reinterpret_cast<const unsigned char *>(hdr);
+    uint32_t bs = (uint32_t)get_be(uh + Sha256::DIGEST_SIZE, 4);
+    if (bs == 0 || bs > MAX_BLOCK) return 400;
+
+    Sha256 sha;
+    uint64_t written = 0;
+    vector<char> buf(DELTA_MAX_LITERAL);
+    if (crc) *crc = 0;
+    auto put = [&](const char *p, size_t n) {
+        sha.update(p, n);
+        if (crc) *crc = crc32c(*crc, p, n);
+        written += n;
+        return write_all(out_fd, p, n);
+    };
+
+    char op;
+    while (!in.at_end()) {
+        if (!in.read(&op, 1)) return 400;
+        if (op == 'C') {
+            char f[12];
+            if (!in.read(f, sizeof(f))) return 400;
+            const unsigned char *uf = reinterpret_cast<const unsigned char *>(f);
+            uint64_t index = get_be(uf, 8);
+            uint64_t count = get_be(uf + 8, 4);
+            if (count == 0 || index > basis_size / bs) return 409;
+            uint64_t from = index * bs;
+            uint64_t len  = min<uint64_t>(count * bs, basis_size - from);
+            // Chỉ block cuối của file cũ được ngắn; tham chiếu vượt file => file cũ đã đổi.
+            if (len == 0 || (len < count * bs && index + count != (basis_size + bs - 1) / bs)) {
+                return 409;
+            }
+            if (written + len > expected_size) return 400;
+            while (len > 0) {
+                size_t n = (size_t)min<uint64_t>(len, buf.size());
+                if (!read(from, buf.data(), n) || !put(buf.data(), n)) return 500;
+                from += n;
+                len  -= n;
+            }
+        } else if (op == 'L') {
+            char f[4];
+            if (!in.read(f, sizeof(f))) return 400;
+            uint64_t len = get_be(reinterpret_cast<const unsigned char *>(f), 4);
+            if (len > DELTA_MAX_LITERAL || written + len > expected_size) return 400;
+            if (!in.read(buf.data(), (size_t)len)) return 400;
+            if (!put(buf.data(), (size_t)len)) return 500;
+        } else {
+            return 400;
+        }
+    }
+
+    unsigned char digest[Sha256::DIGEST_SIZE];
+    sha.finish(digest);
+    if (written != expected_size || memcmp(digest, hdr, sizeof(digest)) != 0) return 409;
+    return 0;
+}
@@ -0,0 +1,90 @@
+// ===== file: common/Delta.hpp =====
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include "Sha256.hpp"
+
+using namespace std;
+
+// Đồng bộ kiểu rsync: server gửi chữ ký từng block của file cũ (checksum
+// cuộn + hash mạnh), client dò file mới tìm các block trùng và chỉ gửi phần
+// khác (literal) kèm tham chiếu block; server dựng lại file mới từ file cũ.
+//
+// Chữ ký:  block_size u32 | file_size u64 | mỗi block: weak u32 | strong 16 byte
+// Delta:   sha256 file mới (32) | block_size u32 | các lệnh:
+//          'C' index u64 count u32   chép count block liên tiếp từ file cũ
+//          'L' len u32 + len byte    dữ liệu mới
+// Số nguyên đều big-endian. Block cuối của file cũ có thể ngắn hơn block_size.
+
+const size_t DELTA_STRONG_SIZE = 16;        // 16 byte đầu của SHA-256
+const size_t DELTA_HEADER_SIZE = Sha256::DIGEST_SIZE + 4;
+const size_t DELTA_MAX_LITERAL = 1024 * 1024;
+
+struct BlockSig {
+    uint32_t      weak = 0;
+    unsigned char strong[DELTA_STRONG_SIZE];
+};
+
+struct Signature {
+    uint32_t         block_size = 0;
+    uint64_t         file_size  = 0;
+    vector<BlockSig> blocks;
+};
+
+struct DeltaOp {
+    bool     copy = false;
+    uint64_t pos  = 0;  // copy: index block đầu; literal: offset trong file mới
+    uint64_t len  = 0;  // copy: số block; literal: số byte
+};
+
+// Đọc [off, off+len) của file cũ vào buf.
+using BasisReader = function<bool(uint64_t off, char *buf, size_t len)>;
+
+// Block ~ căn bậc hai kích thước file (như rsync), trong [512 B, 128 KiB].
+uint32_t delta_block_size(uint64_t file_size);
+
+uint32_t weak_checksum(const unsigned char *p, size_t n);
+
+bool make_signature(uint64_t file_size, const BasisReader &read, string &out);
+
+// Chữ ký sinh dần: mỗi next() đọc và hash ≤ 1 MiB file cũ, để server gửi
+// chữ ký file lớn mà không phải đọc cả file trong 1 lần.
+class SignatureWriter {
+public:
+    SignatureWriter(uint64_t file_size, BasisReader read);
+
+    // Tổng kích thước chữ ký (biết trước từ file_size).
+    uint64_t size() const;
+    bool done() const { return started_ && off_ >= file_size_; }
+    // Nối phần kế tiếp vào out (lần đầu có cả header). false: đọc file lỗi.
+    bool next(string &out);
+
+private:
+    uint64_t    file_size_;
+    BasisReader read_;
+    uint32_t    bs_;
+    size_t      batch_;
+    uint64_t    off_     = 0;
+    bool        started_ = false;
+    vector<char> buf_;
+};
+bool parse_signature(const string &data, Signature &sig);
+
+// Dò data theo chữ ký (sig rỗng => toàn bộ là literal).
+void make_delta(const char *data, size_t size, const Signature &sig, vector<DeltaOp> &ops);
+
+// Kích thước body delta (gồm header) và mã hóa từng phần qua emit.
+uint64_t delta_encoded_size(const vector<DeltaOp> &ops);
+bool encode_delta(const char *data, size_t size, uint32_t block_size,
+                  const vector<DeltaOp> &ops,
+                  const function<bool(const char *, size_t)> &emit);
+
+// Dựng file mới vào out_fd từ delta (đọc tuần tự từ delta_fd) và file cũ.
+// 0: ok, 400: delta sai định dạng, 409: kết quả không khớp hash (file cũ
+// đã đổi từ lúc lấy chữ ký), 500: lỗi I/O. crc (nếu có) nhận CRC32C của file
+// mới, tính ngay lúc ghi.
+int apply_delta(int delta_fd, uint64_t basis_size, const BasisReader &read, int out_fd,
+                uint64_t expected_size, uint32_t *crc = nullptr);
@@ -1,5 +1,8 @@
 // ===== file: common/Protocol.cpp =====
 #include "Protocol.hpp"
+#include <errno.h>
+#include <cstring>
+#include <charconv>
 
 using namespace std;
 
@@ -62,4 +65,708 @@ vector<string> split_tokens(const string &s) {
     return tokens;
 }
 
+bool parse_u64(string_view s, uint64_t &out) {
+    if (s.empty()) return false;
+    uint64_t v = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+        uint64_t d = (uint64_t)(c - '0');
+        if (v > (UINT64_MAX - d) / 10) return false;
+        v = v * 10 + d;
+    }
+    out = v;
+    return true;
+}
+
+namespace {
+const size_t BLOCK_SIZE = 64 * 1024;
+
+struct OpName {
+    Op op;
+    const char *name;
+};
+
+const OpName OP_NAMES[] = {
+    {Op::Auth,     "AUTH"},
+    {Op::Register, "REGISTER"},
+    {Op::Upload,   "UPLOAD"},
+    {Op::Download, "DOWNLOAD"},
+    {Op::GetText,  "GET_TEXT"},
+    {Op::PutText,  "PUT_TEXT"},
+    {Op::Stats,    "STATS"},
+    {Op::UploadStatus, "UPLOAD_STATUS"},
+    {Op::UploadResume, "UPLOAD_RESUME"},
+    {Op::UploadOpen,   "UPLOAD_OPEN"},
+    {Op::UploadPart,   "UPLOAD_PART"},
+    {Op::UploadCommit, "UPLOAD_COMMIT"},
+    {Op::HaveChunks,   "HAVE_CHUNKS"},
+    {Op::PutChunk,     "PUT_CHUNK"},
+    {Op::UploadRecipe, "UPLOAD_RECIPE"},
+    {Op::Signature,    "SIGNATURE"},
+    {Op::UploadDelta,  "UPLOAD_DELTA"},
+};
+// op_name tra theo chỉ số: bảng phải đủ và đúng thứ tự giá trị Op.
+static_assert(sizeof(OP_NAMES) / sizeof(OP_NAMES[0]) == OP_COUNT - 1, "OP_NAMES out of sync");
+} // namespace
+
+const char *op_name(Op op) {
+    size_t i = (size_t)op;
+    return i >= 1 && i < OP_COUNT ? OP_NAMES[i - 1].name : "";
+}
+
+Op op_from_name(string_view n) {
+    // Mỗi nhánh còn đúng 1 lần so sánh chuỗi.
+    auto match = [n](const char *name, Op op) { return n == name ? op : Op::None; };
+    switch (n.size()) {
+    case 4:  return match("AUTH", Op::Auth);
+    case 5:  return match("STATS", Op::Stats);
+    case 6:  return match("UPLOAD", Op::Upload);
+    case 8:
+        switch (n[0]) {
+        case 'R': return match("REGISTER", Op::Register);
+        case 'D': return match("DOWNLOAD", Op::Download);
+        case 'G': return match("GET_TEXT", Op::GetText);
+        case 'P': return match("PUT_TEXT", Op::PutText);
+        default:  return Op::None;
+        }
+    case 9:
+        return n[0] == 'P' ? match("PUT_CHUNK", Op::PutChunk) : match("SIGNATURE", Op::Signature);
+    case 11:
+        if (n[0] == 'H') return match("HAVE_CHUNKS", Op::HaveChunks);
+        return n[7] == 'O' ? match("UPLOAD_OPEN", Op::UploadOpen)
+                           : match("UPLOAD_PART", Op::UploadPart);
+    case 12: return match("UPLOAD_DELTA", Op::UploadDelta);
+    case 13:
+        switch (n[7]) {
+        case 'S': return match("UPLOAD_STATUS", Op::UploadStatus);
+        case 'C': return match("UPLOAD_COMMIT", Op::UploadCommit);
+        case 'R': return n[9] == 'S' ? match("UPLOAD_RESUME", Op::UploadResume)
+                                     : match("UPLOAD_RECIPE", Op::UploadRecipe);
+        default:  return Op::None;
+        }
+    default:
+        return Op::None;
+    }
+}
+
+namespace {
+// Token kế tiếp (tách theo space/tab) dưới dạng view; false nếu hết dòng.
+bool next_token(string_view &rest, string_view &tok) {
+    size_t i = 0;
+    while (i < rest.size() && (rest[i] == ' ' || rest[i] == '\t')) ++i;
+    size_t j = i;
+    while (j < rest.size() && rest[j] != ' ' && rest[j] != '\t') ++j;
+    tok = rest.substr(i, j - i);
+    rest.remove_prefix(j);
+    return !tok.empty();
+}
+
+// Đưa Request về mặc định nhưng giữ dung lượng các chuỗi để dùng lại.
+void clear_request(Request &req) {
+    req.op    = Op::None;
+    req.id    = 0;
+    req.valid = false;
+    req.user.clear();
+    req.pass.clear();
+    req.path.clear();
+    req.size      = 0;
+    req.offset    = 0;
+    req.length    = 0;
+    req.upload_id = 0;
+    req.hashes.clear();
+    req.codec = 0;
+    req.level = 0;
+}
+} // namespace
+
+// ---- v1 ----
+
+bool parse_text_request(string_view line, Request &req) {
+    clear_request(req);
+    // Lệnh + tối đa 3 tham số; HAVE_CHUNKS đọc tiếp phần còn lại của dòng.
+    string_view rest = line, t[4];
+    size_t n = 0;
+    while (n < 4 && next_token(rest, t[n])) ++n;
+    if (n == 0) return false;
+    req.op = op_from_name(t[0]);
+
+    switch (req.op) {
+    case Op::Auth:
+    case Op::Register:
+        req.valid = n >= 3;
+        if (req.valid) {
+            req.user.assign(t[1]);
+            req.pass.assign(t[2]);
+        }
+        break;
+    case Op::Upload:
+    case Op::PutText:
+    case Op::UploadOpen:
+        req.valid = n >= 3 && parse_u64(t[2], req.size);
+        if (req.valid) req.path.assign(t[1]);
+        break;
+    case Op::Download:
+        // DOWNLOAD <path> [<offset> <len>]
+        req.valid = n == 2 ||
+                    (n >= 4 && parse_u64(t[2], req.offset) && parse_u64(t[3], req.length));
+        if (req.valid) req.path.assign(t[1]);
+        break;
+    case Op::GetText:
+    case Op::Signature:
+        req.valid = n >= 2;
+        if (req.valid) req.path.assign(t[1]);
+        break;
+    case Op::Stats:
+        req.valid = true;
+        break;
+    case Op::UploadStatus:
+    case Op::UploadCommit:
+        req.valid = n >= 2 && parse_u64(t[1], req.upload_id);
+        break;
+    case Op::UploadPart:
+        req.valid = n >= 4 && parse_u64(t[1], req.upload_id) &&
+                    parse_u64(t[2], req.offset) && parse_u64(t[3], req.length);
+        break;
+    case Op::UploadResume:
+        req.valid = n >= 3 && parse_u64(t[1], req.upload_id) && parse_u64(t[2], req.offset);
+        break;
+    case Op::HaveChunks: {
+        req.valid = n >= 2;
+        for (size_t i = 1; i < n; ++i) req.hashes.emplace_back(t[i]);
+        string_view tok;
+        while (next_token(rest, tok)) req.hashes.emplace_back(tok);
+        break;
+    }
+    case Op::PutChunk:
+        req.valid = n >= 3 && parse_u64(t[2], req.size);
+        if (req.valid) req.hashes.emplace_back(t[1]);
+        break;
+    case Op::UploadRecipe:
+    case Op::UploadDelta:
+        req.valid = n >= 4 && parse_u64(t[2], req.size) && parse_u64(t[3], req.length);
+        if (req.valid) req.path.assign(t[1]);
+        break;
+    case Op::None:
+        break;
+    }
+    return true;
+}
+
+string format_text_request(const Request &req) {
+    string line = op_name(req.op);
+    switch (req.op) {
+    case Op::Auth:
+    case Op::Register:
+        line += " " + req.user + " " + req.pass;
+        break;
+    case Op::Upload:
+    case Op::PutText:
+    case Op::UploadOpen:
+        line += " " + req.path + " " + to_string(req.size);
+        break;
+    case Op::Download:
+        line += " " + req.path;
+        if (req.offset > 0 || req.length > 0) {
+            line += " " + to_string(req.offset) + " " + to_string(req.length);
+        }
+        break;
+    case Op::GetText:
+    case Op::Signature:
+        line += " " + req.path;
+        break;
+    case Op::UploadStatus:
+    case Op::UploadCommit:
+        line += " " + to_string(req.upload_id);
+        break;
+    case Op::UploadPart:
+        line += " " + to_string(req.upload_id) + " " + to_string(req.offset) +
+                " " + to_string(req.length);
+        break;
+    case Op::UploadResume:
+        line += " " + to_string(req.upload_id) + " " + to_string(req.offset);
+        break;
+    case Op::HaveChunks:
+        for (const auto &h : req.hashes) line += " " + h;
+        break;
+    case Op::PutChunk:
+        line += " " + (req.hashes.empty() ? string() : req.hashes[0]) + " " +
+                to_string(req.size);
+        break;
+    case Op::UploadRecipe:
+    case Op::UploadDelta:
+        line += " " + req.path + " " + to_string(req.size) + " " + to_string(req.length);
+        break;
+    default:
+        break;
+    }
+    return line;
+}
+
+string format_text_reply(const Reply &rep) {
+    string line = rep.code < 400 ? "OK " : "ERR ";
+    line += to_string(rep.code);
+    if (!rep.msg.empty()) line += " " + rep.msg;
+    return line;
+}
+
+MsgBuf &MsgBuf::add(string_view s) {
+    size_t n = s.size() < CAP - len_ ? s.size() : CAP - len_;
+    memcpy(buf_ + len_, s.data(), n);
+    len_ += n;
+    return *this;
+}
+
+MsgBuf &MsgBuf::add(char c) {
+    if (len_ < CAP) buf_[len_++] = c;
+    return *this;
+}
+
+MsgBuf &MsgBuf::add(uint64_t v) {
+    auto r = to_chars(buf_ + len_, buf_ + CAP, v);
+    if (r.ec == errc()) len_ = (size_t)(r.ptr - buf_);
+    return *this;
+}
+
+bool parse_text_reply(const string &line, Reply &rep) {
+    rep = Reply{};
+    bool ok  = line.rfind("OK ", 0) == 0;
+    bool err = line.rfind("ERR ", 0) == 0;
+    if (!ok && !err) return false;
+
+    size_t code_start = ok ? 3 : 4;
+    size_t sp = line.find(' ', code_start);
+    uint64_t code = 0;
+    if (!parse_u64(line.substr(code_start, sp == string::npos ? string::npos : sp - code_start), code)) {
+        return false;
+    }
+    rep.code = (int)code;
+    if (sp != string::npos) rep.msg = line.substr(sp + 1);
+    parse_u64(rep.msg.substr(0, rep.msg.find(' ')), rep.size);
+    return true;
+}
+
+// ---- v2 ----
+
+void encode_header(const FrameHeader &h, char out[FRAME_HEADER_SIZE]) {
+    out[0] = (char)h.opcode;
+    out[1] = (char)h.flags;
+    out[2] = 0;
+    out[3] = 0;
+    for (int i = 0; i < 4; ++i) {
+        out[4 + i] = (char)((h.id >> (24 - 8 * i)) & 0xff);
+        out[8 + i] = (char)((h.length >> (24 - 8 * i)) & 0xff);
+    }
+}
+
+FrameHeader decode_header(const char *p) {
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+    FrameHeader h;
+    h.opcode = u[0];
+    h.flags  = u[1];
+    for (int i = 0; i < 4; ++i) {
+        h.id     = (h.id << 8) | u[4 + i];
+        h.length = (h.length << 8) | u[8 + i];
+    }
+    return h;
+}
+
+void FrameWriter::put_u16(uint16_t v) {
+    buf_.push_back((char)(v >> 8));
+    buf_.push_back((char)(v & 0xff));
+}
+
+void FrameWriter::put_u64(uint64_t v) {
+    for (int i = 7; i >= 0; --i) buf_.push_back((char)((v >> (8 * i)) & 0xff));
+}
+
+void FrameWriter::put_str(const string &s) {
+    uint32_t n = (uint32_t)s.size();
+    for (int i = 3; i >= 0; --i) buf_.push_back((char)((n >> (8 * i)) & 0xff));
+    buf_ += s;
+}
+
+bool FrameReader::need(size_t n) {
+    if (!ok_ || (size_t)(end_ - p_) < n) ok_ = false;
+    return ok_;
+}
+
+uint16_t FrameReader::get_u16() {
+    if (!need(2)) return 0;
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p_);
+    p_ += 2;
+    return (uint16_t)((u[0] << 8) | u[1]);
+}
+
+uint64_t FrameReader::get_u64() {
+    if (!need(8)) return 0;
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p_);
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = (v << 8) | u[i];
+    p_ += 8;
+    return v;
+}
+
+string FrameReader::get_str() {
+    if (!need(4)) return string();
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p_);
+    uint32_t n = ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+                 ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+    p_ += 4;
+    if (!need(n)) return string();
+    string s(p_, n);
+    p_ += n;
+    return s;
+}
+
+void FrameReader::get_str(string &out) {
+    out.clear();
+    if (!need(4)) return;
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p_);
+    uint32_t n = ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+                 ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+    p_ += 4;
+    if (!need(n)) return;
+    out.assign(p_, n);
+    p_ += n;
+}
+
+namespace {
+// Lệnh có body mang trường mã hóa tùy chọn (codec << 8 | level) ở cuối payload.
+bool has_encoding(Op op) {
+    return op == Op::Upload || op == Op::PutText || op == Op::Download || op == Op::GetText;
+}
+} // namespace
+
+bool decode_request(const FrameHeader &h, const string &payload, Request &req) {
+    clear_request(req);
+    req.id = h.id;
+    if (op_name((Op)h.opcode)[0] == '\0') return true;
+    req.op = (Op)h.opcode;
+
+    FrameReader r(payload.data(), payload.size());
+    switch (req.op) {
+    case Op::Auth:
+    case Op::Register:
+        r.get_str(req.user);
+        r.get_str(req.pass);
+        break;
+    case Op::Upload:
+    case Op::PutText:
+    case Op::UploadOpen:
+        r.get_str(req.path);
+        req.size = r.get_u64();
+        break;
+    case Op::Download:
+        r.get_str(req.path);
+        // Đoạn [offset, offset+length) là tùy chọn.
+        if (r.more()) {
+            req.offset = r.get_u64();
+            req.length = r.get_u64();
+        }
+        break;
+    case Op::GetText:
+    case Op::Signature:
+        r.get_str(req.path);
+        break;
+    case Op::UploadStatus:
+    case Op::UploadCommit:
+        req.upload_id = r.get_u64();
+        break;
+    case Op::UploadPart:
+        req.upload_id = r.get_u64();
+        req.offset    = r.get_u64();
+        req.length    = r.get_u64();
+        break;
+    case Op::UploadResume:
+        req.upload_id = r.get_u64();
+        req.offset    = r.get_u64();
+        break;
+    case Op::HaveChunks: {
+        uint16_t n = r.get_u16();
+        for (uint16_t i = 0; i < n && r.ok(); ++i) req.hashes.push_back(r.get_str());
+        break;
+    }
+    case Op::PutChunk:
+        req.hashes.push_back(r.get_str());
+        req.size = r.get_u64();
+        break;
+    case Op::UploadRecipe:
+    case Op::UploadDelta:
+        r.get_str(req.path);
+        req.size   = r.get_u64();
+        req.length = r.get_u64();
+        break;
+    default:
+        break;
+    }
+    if (has_encoding(req.op) && r.more()) {
+        uint16_t e = r.get_u16();
+        req.codec = (uint8_t)(e >> 8);
+        req.level = (uint8_t)e;
+    }
+    req.valid = r.ok();
+    return true;
+}
+
+void encode_request(const Request &req, FrameHeader &h, string &payload) {
+    FrameWriter w;
+    switch (req.op) {
+    case Op::Auth:
+    case Op::Register:
+        w.put_str(req.user);
+        w.put_str(req.pass);
+        break;
+    case Op::Upload:
+    case Op::PutText:
+    case Op::UploadOpen:
+        w.put_str(req.path);
+        w.put_u64(req.size);
+        break;
+    case Op::Download:
+        w.put_str(req.path);
+        if (req.offset > 0 || req.length > 0) {
+            w.put_u64(req.offset);
+            w.put_u64(req.length);
+        }
+        break;
+    case Op::GetText:
+    case Op::Signature:
+        w.put_str(req.path);
+        break;
+    case Op::UploadStatus:
+    case Op::UploadCommit:
+        w.put_u64(req.upload_id);
+        break;
+    case Op::UploadPart:
+        w.put_u64(req.upload_id);
+        w.put_u64(req.offset);
+        w.put_u64(req.length);
+        break;
+    case Op::UploadResume:
+        w.put_u64(req.upload_id);
+        w.put_u64(req.offset);
+        break;
+    case Op::HaveChunks:
+        w.put_u16((uint16_t)req.hashes.size());
+        for (const auto &h : req.hashes) w.put_str(h);
+        break;
+    case Op::PutChunk:
+        w.put_str(req.hashes.empty() ? string() : req.hashes[0]);
+        w.put_u64(req.size);
+        break;
+    case Op::UploadRecipe:
+    case Op::UploadDelta:
+        w.put_str(req.path);
+        w.put_u64(req.size);
+        w.put_u64(req.length);
+        break;
+    default:
+        break;
+    }
+    if (req.codec != 0 && has_encoding(req.op)) {
+        // DOWNLOAD: đoạn tùy chọn đứng trước nên phải có mặt (0 0 = cả file).
+        if (req.op == Op::Download && req.offset == 0 && req.length == 0) {
+            w.put_u64(0);
+            w.put_u64(0);
+        }
+        w.put_u16((uint16_t)(req.codec << 8 | req.level));
+    }
+    h = FrameHeader{};
+    h.opcode = (uint8_t)req.op;
+    h.id     = req.id;
+    payload  = w.payload();
+    h.length = (uint32_t)payload.size();
+}
+
+bool decode_reply(const FrameHeader &h, const string &payload, Reply &rep) {
+    rep = Reply{};
+    if (h.opcode != OP_REPLY) return false;
+    FrameReader r(payload.data(), payload.size());
+    rep.id   = h.id;
+    rep.code = r.get_u16();
+    rep.msg  = r.get_str();
+    rep.size = r.get_u64();
+    return r.ok();
+}
+
+void encode_reply(const Reply &rep, FrameHeader &h, string &payload) {
+    FrameWriter w;
+    w.put_u16((uint16_t)rep.code);
+    w.put_str(rep.msg);
+    w.put_u64(rep.size);
+    h = FrameHeader{};
+    h.opcode = OP_REPLY;
+    h.id     = rep.id;
+    payload  = w.payload();
+    h.length = (uint32_t)payload.size();
+}
+
+void Conn::reset(int sockfd) {
+    fd_ = sockfd;
+    string().swap(in_);
+    string().swap(out_);
+    in_off_  = 0;
+    out_off_ = 0;
+}
+
+// Bỏ phần đã tiêu thụ; buffer rỗng thì trả lại bộ nhớ để kết nối idle nhẹ.
+void Conn::compact() {
+    if (in_off_ == in_.size()) {
+        if (in_.capacity() > BLOCK_SIZE) string().swap(in_);
+        else in_.clear();
+        in_off_ = 0;
+    } else if (in_off_ > BLOCK_SIZE) {
+        in_.erase(0, in_off_);
+        in_off_ = 0;
+    }
+}
+
+int Conn::fill(int flags) {
+    compact();
+    // Đọc qua buffer tạm của thread để không giữ sẵn 1 khối cho mỗi kết nối.
+    static thread_local vector<char> scratch(BLOCK_SIZE);
+    ssize_t n;
+    do {
+        n = ::recv(fd_, scratch.data(), scratch.size(), flags);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) {
+        in_.append(scratch.data(), (size_t)n);
+        return 1;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    return -1;
+}
+
+bool Conn::has_line() const {
+    return in_.find('\n', in_off_) != string::npos;
+}
+
+bool Conn::next_line(string &line) {
+    size_t pos = in_.find('\n', in_off_);
+    if (pos == string::npos) return false;
+    line.assign(in_, in_off_, pos - in_off_);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    in_off_ = pos + 1;
+    return true;
+}
+
+bool Conn::next_line(string_view &line) {
+    size_t pos = in_.find('\n', in_off_);
+    if (pos == string::npos) return false;
+    line = string_view(in_.data() + in_off_, pos - in_off_);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    in_off_ = pos + 1;
+    return true;
+}
+
+bool Conn::has_frame() const {
+    if (!has_header()) return false;
+    return buffered() - FRAME_HEADER_SIZE >= peek_header().length;
+}
+
+bool Conn::next_frame(FrameHeader &h, string &payload) {
+    if (!has_frame()) return false;
+    h = peek_header();
+    payload.assign(data() + FRAME_HEADER_SIZE, h.length);
+    consume(FRAME_HEADER_SIZE + h.length);
+    return true;
+}
+
+bool Conn::read_frame(FrameHeader &h, string &payload) {
+    while (!next_frame(h, payload)) {
+        if (fill() <= 0) return false;
+    }
+    return true;
+}
+
+bool Conn::read_line(string &line) {
+    while (!next_line(line)) {
+        if (fill() <= 0) return false;
+    }
+    return true;
+}
+
+bool Conn::read_exact(void *buf, size_t len) {
+    char *p = static_cast<char*>(buf);
+    size_t have = buffered() < len ? buffered() : len;
+    if (have > 0) {
+        memcpy(p, data(), have);
+        consume(have);
+    }
+    // Phần còn lại lớn thì nhận thẳng vào buf, không qua buffer.
+    return recv_exact(fd_, p + have, len - have);
+}
+
+void Conn::queue_line(const string &line) {
+    out_ += line;
+    if (line.empty() || line.back() != '\n') out_.push_back('\n');
+}
+
+void Conn::queue(const void *buf, size_t len) {
+    out_.append(static_cast<const char*>(buf), len);
+}
+
+void Conn::queue_header(const FrameHeader &h) {
+    char hdr[FRAME_HEADER_SIZE];
+    encode_header(h, hdr);
+    out_.append(hdr, sizeof(hdr));
+}
+
+void Conn::queue_frame(const FrameHeader &h, const string &payload) {
+    queue_header(h);
+    out_ += payload;
+}
+
+void Conn::queue_text_reply(int code, string_view msg) {
+    char num[16];
+    auto r = to_chars(num, num + sizeof(num), code);
+    out_ += code < 400 ? "OK " : "ERR ";
+    out_.append(num, (size_t)(r.ptr - num));
+    if (!msg.empty()) {
+        out_.push_back(' ');
+        out_ += msg;
+    }
+    out_.push_back('\n');
+}
+
+// Cùng bố cục với encode_reply: code(u16) msg(str) size(u64).
+void Conn::queue_reply_frame(uint32_t id, int code, string_view msg, uint64_t size) {
+    FrameHeader h;
+    h.opcode = OP_REPLY;
+    h.id     = id;
+    h.length = (uint32_t)(2 + 4 + msg.size() + 8);
+    queue_header(h);
+    char buf[8];
+    buf[0] = (char)((code >> 8) & 0xff);
+    buf[1] = (char)(code & 0xff);
+    out_.append(buf, 2);
+    uint32_t n = (uint32_t)msg.size();
+    for (int i = 0; i < 4; ++i) buf[i] = (char)((n >> (24 - 8 * i)) & 0xff);
+    out_.append(buf, 4);
+    out_ += msg;
+    for (int i = 0; i < 8; ++i) buf[i] = (char)((size >> (56 - 8 * i)) & 0xff);
+    out_.append(buf, 8);
+}
+
+int Conn::flush(int flags) {
+    while (out_off_ < out_.size()) {
+        ssize_t n = ::send(fd_, out_.data() + out_off_, out_.size() - out_off_, flags);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        out_off_ += (size_t)n;
+    }
+    if (out_.capacity() > BLOCK_SIZE) string().swap(out_);
+    else out_.clear();
+    out_off_ = 0;
+    return 1;
+}
+
+bool Conn::flush_all() {
+    return flush() == 1;
+}
+
 } // namespace proto
@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -8,7 +10,8 @@ using namespace std;
 
 namespace proto {
 
-// Đọc 1 dòng kết thúc bằng '\n'
+// Đọc 1 dòng kết thúc bằng '\n' (recv từng byte, không đọc lố; với kết nối
+// dài hạn nên dùng Conn).
 bool recv_line(int sockfd, string &line);
 
 // Gửi đủ len bytes
@@ -23,4 +26,222 @@ bool send_line(int sockfd, const string &line);
 // Tách token theo space/tab
 vector<string> split_tokens(const string &s);
 
+// Parse số nguyên không dấu, không ném exception như stoull.
+bool parse_u64(string_view s, uint64_t &out);
+
+// ---- Lệnh và reply, dùng chung cho giao thức text (v1) và nhị phân (v2) ----
+
+enum class Op : uint8_t {
+    None     = 0,
+    Auth     = 1,
+    Register = 2,
+    Upload   = 3,
+    Download = 4,
+    GetText  = 5,
+    PutText  = 6,
+    Stats    = 7,
+    UploadStatus = 8,
+    UploadResume = 9,
+    UploadOpen   = 10,
+    UploadPart   = 11,
+    UploadCommit = 12,
+    HaveChunks   = 13,
+    PutChunk     = 14,
+    UploadRecipe = 15,
+    Signature    = 16,
+    UploadDelta  = 17,
+};
+const size_t OP_COUNT = 18;
+
+// Tên lệnh ("UPLOAD"...), "" nếu không biết.
+const char *op_name(Op op);
+// Ngược lại: tên lệnh -> Op (switch theo độ dài + ký tự đầu), None nếu không biết.
+Op op_from_name(string_view name);
+
+struct Request {
+    Op       op    = Op::None;
+    uint32_t id    = 0;     // request id (v2); v1 luôn 0
+    bool     valid = false; // đủ và đúng kiểu tham số
+    string   user;          // AUTH / REGISTER
+    string   pass;
+    string   path;          // UPLOAD / DOWNLOAD / GET_TEXT / PUT_TEXT / UPLOAD_OPEN / UPLOAD_RECIPE /
+                            // SIGNATURE / UPLOAD_DELTA
+    uint64_t size  = 0;     // UPLOAD / PUT_TEXT / UPLOAD_OPEN / PUT_CHUNK / UPLOAD_RECIPE /
+                            // UPLOAD_DELTA (kích thước file mới)
+    uint64_t offset = 0;    // DOWNLOAD (đoạn) / UPLOAD_RESUME / UPLOAD_PART
+    uint64_t length = 0;    // DOWNLOAD (đoạn), 0 = đến hết file / UPLOAD_PART /
+                            // UPLOAD_RECIPE (số chunk) / UPLOAD_DELTA (độ dài delta)
+    uint64_t upload_id = 0; // UPLOAD_STATUS / UPLOAD_RESUME / UPLOAD_PART / UPLOAD_COMMIT
+    vector<string> hashes;  // HAVE_CHUNKS / PUT_CHUNK (1 hash): SHA-256 hex
+    uint8_t  codec = 0;     // v2, UPLOAD / PUT_TEXT: body đã nén bằng codec này;
+    uint8_t  level = 0;     // DOWNLOAD / GET_TEXT: client nhận được body nén
+                            // (giá trị của Codec, level 0 = mặc định)
+};
+
+struct Reply {
+    uint32_t id   = 0;
+    int      code = 0;      // 1xx/2xx: OK, 4xx/5xx: ERR
+    string   msg;
+    uint64_t size = 0;      // số đầu của msg: size body, upload id, offset...
+};
+
+// v1: "UPLOAD a.bin 10" <-> Request. Lệnh không biết => op None.
+// Tách token thành string_view trên line, chỉ chép vào các chuỗi của req
+// (giữ dung lượng cũ) nên dùng lại 1 Request thì không cấp phát. false nếu
+// dòng rỗng.
+bool parse_text_request(string_view line, Request &req);
+string format_text_request(const Request &req);
+// v1: "OK 200 msg" / "ERR 403 msg" <-> Reply.
+string format_text_reply(const Reply &rep);
+bool parse_text_reply(const string &line, Reply &rep);
+
+// msg ngắn của reply dựng trong buffer cố định (thay cho to_string + operator+),
+// không cấp phát; phần vượt quá CAP bị cắt.
+class MsgBuf {
+public:
+    static const size_t CAP = 256;
+    MsgBuf &add(string_view s);
+    MsgBuf &add(char c);
+    MsgBuf &add(uint64_t v);
+    string_view view() const { return string_view(buf_, len_); }
+
+private:
+    char   buf_[CAP];
+    size_t len_ = 0;
+};
+
+// ---- Giao thức v2: frame nhị phân, bật bằng dòng "HELLO v2" ----
+// Header 12 byte, big-endian: opcode(1) flags(1) reserved(2) request_id(4)
+// length(4), sau đó là payload gồm các trường có kiểu theo thứ tự cố định:
+// u16/u64 big-endian, chuỗi = u32 độ dài + byte (tên file có dấu cách được).
+// Opcode 1..0x7f là lệnh (giá trị của Op). Body đi bằng các frame DATA cùng
+// request id, frame cuối có FLAG_END.
+
+const size_t   FRAME_HEADER_SIZE = 12;
+const uint32_t MAX_CONTROL_FRAME = 16 * 1024;  // payload tối đa của frame lệnh/reply
+const uint32_t DATA_CHUNK        = 256 * 1024; // payload tối đa của frame DATA
+
+const uint8_t OP_REPLY = 0x80; // code(u16) msg(str) size(u64)
+const uint8_t OP_DATA  = 0x81; // byte body
+
+const uint8_t FLAG_END = 0x01;
+// Frame kết thúc body upload kèm kiểm tra toàn vẹn (chỉ khi HELLO đã thỏa
+// thuận "crc32c"): thay cho FLAG_END trên frame dữ liệu cuối, client gửi thêm
+// 1 frame DATA có FLAG_END | FLAG_CRC, payload đúng 4 byte = CRC32C (u32 BE)
+// của nội dung body (sau giải nén). Server so trước khi commit.
+const uint8_t FLAG_CRC = 0x02;
+
+struct FrameHeader {
+    uint8_t  opcode = 0;
+    uint8_t  flags  = 0;
+    uint32_t id     = 0;
+    uint32_t length = 0;
+};
+
+void encode_header(const FrameHeader &h, char out[FRAME_HEADER_SIZE]);
+FrameHeader decode_header(const char *p);
+
+class FrameWriter {
+public:
+    void put_u16(uint16_t v);
+    void put_u64(uint64_t v);
+    void put_str(const string &s);
+    const string &payload() const { return buf_; }
+
+private:
+    string buf_;
+};
+
+class FrameReader {
+public:
+    FrameReader(const char *p, size_t len) : p_(p), end_(p + len) {}
+    uint16_t get_u16();
+    uint64_t get_u64();
+    string   get_str();
+    // Như get_str nhưng ghi vào out có sẵn (giữ dung lượng).
+    void     get_str(string &out);
+    // false nếu đọc vượt quá payload ở bất kỳ trường nào.
+    bool ok() const { return ok_; }
+    // Còn byte chưa đọc (trường tùy chọn ở cuối payload).
+    bool more() const { return ok_ && p_ < end_; }
+
+private:
+    bool need(size_t n);
+
+    const char *p_;
+    const char *end_;
+    bool ok_ = true;
+};
+
+// Request/Reply <-> payload của frame.
+bool decode_request(const FrameHeader &h, const string &payload, Request &req);
+void encode_request(const Request &req, FrameHeader &h, string &payload);
+bool decode_reply(const FrameHeader &h, const string &payload, Reply &rep);
+void encode_reply(const Reply &rep, FrameHeader &h, string &payload);
+
+// Buffer đọc/ghi cho 1 kết nối. Đọc socket theo khối lớn rồi trả ra từng dòng
+// lệnh hoặc từng đoạn body từ cùng buffer, nên nhiều lệnh gửi dồn (pipelining)
+// không bị mất; ghi thì gom nhiều dòng thành 1 lần send.
+// Dùng được với socket blocking (read_line/read_exact/flush_all) lẫn
+// non-blocking (fill/next_line/flush).
+class Conn {
+public:
+    explicit Conn(int sockfd = -1) : fd_(sockfd) {}
+
+    int fd() const { return fd_; }
+    // Gắn socket mới, bỏ mọi dữ liệu đang đệm (không đóng fd cũ).
+    void reset(int sockfd);
+
+    // ---- đọc ----
+    // Đọc thêm 1 khối. 1: có dữ liệu, 0: chưa có (EAGAIN), -1: đóng/lỗi.
+    // flags = MSG_DONTWAIT: thử đọc không chờ cả với socket blocking.
+    int fill(int flags = 0);
+    // Lấy 1 dòng đã có trọn trong buffer (bỏ '\r'); false nếu chưa đủ dòng.
+    bool next_line(string &line);
+    // Như trên nhưng trả view vào buffer, không chép; hết hiệu lực ở lần
+    // fill()/consume() kế tiếp.
+    bool next_line(string_view &line);
+    bool has_line() const;
+
+    // Truy cập trực tiếp phần đã đệm (body đọc lố cùng dòng lệnh).
+    size_t buffered() const { return in_.size() - in_off_; }
+    const char *data() const { return in_.data() + in_off_; }
+    void consume(size_t n) { in_off_ += n; }
+
+    // Frame v2 đã có trọn trong buffer.
+    bool has_header() const { return buffered() >= FRAME_HEADER_SIZE; }
+    bool has_frame() const;
+    FrameHeader peek_header() const { return decode_header(data()); }
+    bool next_frame(FrameHeader &h, string &payload);
+
+    // Blocking: đọc đến khi đủ 1 dòng / đủ len byte / đủ 1 frame.
+    bool read_line(string &line);
+    bool read_exact(void *buf, size_t len);
+    bool read_frame(FrameHeader &h, string &payload);
+
+    // ---- ghi ----
+    void queue_line(const string &line);
+    void queue(const void *buf, size_t len);
+    void queue_frame(const FrameHeader &h, const string &payload);
+    void queue_header(const FrameHeader &h);
+    // Reply ghi thẳng vào buffer gửi, không qua Reply/chuỗi trung gian:
+    // v1 "OK 200 msg\n", v2 frame OP_REPLY.
+    void queue_text_reply(int code, string_view msg);
+    void queue_reply_frame(uint32_t id, int code, string_view msg, uint64_t size);
+    size_t pending() const { return out_.size() - out_off_; }
+    // Gửi phần đang chờ. 1: hết, 0: socket đầy (EAGAIN), -1: lỗi.
+    int flush(int flags = 0);
+    // Blocking: gửi hết phần đang chờ.
+    bool flush_all();
+
+private:
+    void compact();
+
+    int fd_;
+    string in_;
+    size_t in_off_ = 0;
+    string out_;
+    size_t out_off_ = 0;
+};
+
 } // namespace proto
@@ -0,0 +1,135 @@
+// ===== file: common/Sha256.cpp =====
+#include "Sha256.hpp"
+#include <cstring>
+#include <algorithm>
+
+namespace {
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t load_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+} // namespace
+
+Sha256::Sha256() {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(h_, init, sizeof(h_));
+}
+
+void Sha256::block(const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) w[i] = load_be32(p + 4 * i);
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3];
+    uint32_t e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + K[i] + w[i];
+        uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t mj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + mj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+    h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+}
+
+void Sha256::update(const void *data, size_t len) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    total_ += len;
+    if (buf_len_ > 0) {
+        size_t take = min(len, sizeof(buf_) - buf_len_);
+        memcpy(buf_ + buf_len_, p, take);
+        buf_len_ += take;
+        p   += take;
+        len -= take;
+        if (buf_len_ < sizeof(buf_)) return;
+        block(buf_);
+        buf_len_ = 0;
+    }
+    // Khối đủ 64 byte xử lý thẳng từ dữ liệu vào, không copy.
+    while (len >= 64) {
+        block(p);
+        p   += 64;
+        len -= 64;
+    }
+    memcpy(buf_, p, len);
+    buf_len_ = len;
+}
+
+void Sha256::finish(unsigned char out[DIGEST_SIZE]) {
+    uint64_t bits = total_ * 8;
+    unsigned char pad[72] = {0x80};
+    size_t pad_len = (buf_len_ < 56 ? 56 : 120) - buf_len_;
+    for (int i = 0; i < 8; ++i) pad[pad_len + i] = (unsigned char)(bits >> (56 - 8 * i));
+    update(pad, pad_len + 8);
+    for (int i = 0; i < 8; ++i) {
+        out[4 * i]     = (unsigned char)(h_[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(h_[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(h_[i] >> 8);
+        out[4 * i + 3] = (unsigned char)h_[i];
+    }
+}
+
+string Sha256::hex(const void *data, size_t len) {
+    Sha256 s;
+    s.update(data, len);
+    unsigned char d[DIGEST_SIZE];
+    s.finish(d);
+    return digest_to_hex(d);
+}
+
+string digest_to_hex(const unsigned char digest[Sha256::DIGEST_SIZE]) {
+    static const char digits[] = "0123456789abcdef";
+    string out(2 * Sha256::DIGEST_SIZE, '0');
+    for (size_t i = 0; i < Sha256::DIGEST_SIZE; ++i) {
+        out[2 * i]     = digits[digest[i] >> 4];
+        out[2 * i + 1] = digits[digest[i] & 0xf];
+    }
+    return out;
+}
+
+bool hex_to_digest(const string &hex, unsigned char out[Sha256::DIGEST_SIZE]) {
+    if (hex.size() != 2 * Sha256::DIGEST_SIZE) return false;
+    for (size_t i = 0; i < Sha256::DIGEST_SIZE; ++i) {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hex_value(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return true;
+}
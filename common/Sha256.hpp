@@ -0,0 +1,33 @@
+// ===== file: common/Sha256.hpp =====
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+// SHA-256 (FIPS 180-4), dùng làm địa chỉ chunk trong chunk store.
+class Sha256 {
+public:
+    static const size_t DIGEST_SIZE = 32;
+
+    Sha256();
+    void update(const void *data, size_t len);
+    // Kết thúc và ghi 32 byte digest; sau đó object không dùng lại được.
+    void finish(unsigned char out[DIGEST_SIZE]);
+
+    // Digest dạng hex thường (64 ký tự).
+    static string hex(const void *data, size_t len);
+
+private:
+    void block(const unsigned char *p);
+
+    uint32_t      h_[8];
+    unsigned char buf_[64];
+    size_t        buf_len_ = 0;
+    uint64_t      total_   = 0;
+};
+
+// "0a1b..." <-> 32 byte. false nếu chuỗi không đúng 64 ký tự hex.
+string digest_to_hex(const unsigned char digest[Sha256::DIGEST_SIZE]);
+bool hex_to_digest(const string &hex, unsigned char out[Sha256::DIGEST_SIZE]);
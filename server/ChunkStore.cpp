@@ -0,0 +1,325 @@
+// ===== file: server/ChunkStore.cpp =====
+#include "ChunkStore.hpp"
+#include "../common/Sha256.hpp"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+// Body download ghép từ nhiều file chunk đã mở; mỗi chunk gửi bằng backend
+// thường (sendfile nếu có) qua make_file_source.
+class ChunkSource : public BodySource {
+public:
+    ChunkSource(shared_ptr<const ChunkFiles> files, uint64_t offset, uint64_t size,
+                const TransferOptions &opt)
+        : files_(move(files)), skip_(offset), remaining_(size), opt_(opt) {
+        // Chunk ~1 MiB: dựng ring io_uring cho từng chunk không đáng.
+        opt_.use_uring = false;
+    }
+
+    ssize_t send_to(int sockfd, uint64_t max) override {
+        if (remaining_ == 0) return 0;
+        if ((!cur_ || cur_->remaining() == 0) && !open_next()) return -1;
+        uint64_t want = max < cur_->remaining() ? max : cur_->remaining();
+        ssize_t n = cur_->send_to(sockfd, want);
+        if (n > 0) remaining_ -= (uint64_t)n;
+        return n;
+    }
+
+    uint64_t remaining() const override { return remaining_; }
+
+private:
+    bool open_next() {
+        const vector<ChunkFiles::Part> &parts = files_->parts();
+        // Bỏ qua các chunk nằm trọn trước offset.
+        while (idx_ < parts.size() && skip_ >= parts[idx_].offset + parts[idx_].size) ++idx_;
+        if (idx_ >= parts.size()) return false;
+
+        const ChunkFiles::Part &c = parts[idx_++];
+        uint64_t from = skip_ > c.offset ? skip_ - c.offset : 0;
+        uint64_t len  = min(c.size - from, remaining_);
+        cur_ = make_file_source(c.fd, from, len, opt_);
+        skip_ = c.offset + from + len;
+        return true;
+    }
+
+    shared_ptr<const ChunkFiles> files_;
+    size_t   idx_  = 0;
+    uint64_t skip_;      // vị trí trong file của byte kế tiếp
+    uint64_t remaining_;
+    TransferOptions opt_;
+    unique_ptr<BodySource> cur_;
+};
+
+bool write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+} // namespace
+
+ChunkStore::ChunkStore(const string &root_dir, Db &db)
+    : root_(root_dir),
+      dir_(root_dir + "/.chunks"),
+      db_(db) {}
+
+void ChunkStore::init() {
+    ::mkdir(root_.c_str(), 0755);
+    ::mkdir(dir_.c_str(), 0755);
+    ::mkdir((dir_ + "/tmp").c_str(), 0755);
+
+    // File tạm còn sót từ lần chạy trước.
+    if (DIR *d = ::opendir((dir_ + "/tmp").c_str())) {
+        while (dirent *e = ::readdir(d)) {
+            if (e->d_name[0] != '.') ::unlink((dir_ + "/tmp/" + e->d_name).c_str());
+        }
+        ::closedir(d);
+    }
+
+    // Chunk mồ côi: có trên đĩa nhưng refcount = 0.
+    DIR *top = ::opendir(dir_.c_str());
+    if (!top) return;
+    while (dirent *e = ::readdir(top)) {
+        string name = e->d_name;
+        if (name.size() != 2) continue;
+        string sub = dir_ + "/" + name;
+        DIR *d = ::opendir(sub.c_str());
+        if (!d) continue;
+        while (dirent *f = ::readdir(d)) {
+            string hash = f->d_name;
+            if (!valid_hash(hash)) continue;
+            uint64_t refs = 0;
+            string err;
+            if (db_.get_chunk_refcount(hash, refs, err) && refs == 0) {
+                ::unlink((sub + "/" + hash).c_str());
+            }
+        }
+        ::closedir(d);
+    }
+    ::closedir(top);
+}
+
+bool ChunkStore::valid_hash(const string &hash) {
+    unsigned char d[Sha256::DIGEST_SIZE];
+    // Chỉ nhận hex thường để 1 chunk có đúng 1 tên file.
+    return hex_to_digest(hash, d) && digest_to_hex(d) == hash;
+}
+
+string ChunkStore::chunk_path(const string &hash) const {
+    return dir_ + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+bool ChunkStore::has_chunk(const string &hash) const {
+    struct stat st{};
+    return ::stat(chunk_path(hash).c_str(), &st) == 0;
+}
+
+string ChunkStore::temp_path() {
+    return dir_ + "/tmp/" + to_string(::getpid()) + "." + to_string(++tmp_seq_);
+}
+
+bool ChunkStore::lookup(int owner_id, const string &path, uint64_t &size,
+                        vector<ChunkRef> &chunks) {
+    string err;
+    return db_.get_file_chunks(owner_id, path, size, chunks, err);
+}
+
+// Ghi qua file tạm rồi đổi tên: người đọc chỉ thấy chunk đầy đủ; 2 upload
+// cùng ghi 1 chunk thì bản nào thắng cũng có cùng nội dung.
+bool ChunkStore::write_chunk(const string &hash, const char *data, size_t len) {
+    string tmp = temp_path();
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, data, len);
+    if (::close(fd) != 0) ok = false;
+    ::mkdir((dir_ + "/" + hash.substr(0, 2)).c_str(), 0755);
+    if (ok && ::rename(tmp.c_str(), chunk_path(hash).c_str()) == 0) {
+        bytes_stored_ += len;
+        return true;
+    }
+    ::unlink(tmp.c_str());
+    return false;
+}
+
+bool ChunkStore::put_locked(int owner_id, const string &path, uint64_t size,
+                            const vector<ChunkRef> &chunks, string &err) {
+    vector<string> released;
+    if (!db_.put_file_chunks(owner_id, path, size, chunks, released, err)) return false;
+    // Chỉ xóa chunk khi refcount mới đã nằm trên đĩa; lô lỗi thì bản cũ vẫn cần chúng.
+    if (!released.empty() && !db_.sync(err)) return false;
+    for (const auto &h : released) ::unlink(chunk_path(h).c_str());
+    return true;
+}
+
+bool ChunkStore::import_file(int owner_id, const string &path, const string &src_path,
+                             string &err) {
+    int fd = ::open(src_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err = "Cannot open " + src_path;
+        return false;
+    }
+
+    // Ghi chunk mới ngoài khóa (phần tốn thời gian); chunk đã có thì bỏ qua.
+    vector<ChunkRef> chunks;
+    vector<uint64_t> offsets;
+    uint64_t size = 0;
+    bool ok = for_each_chunk(fd, [&](const ChunkRef &c, const char *data) {
+        chunks.push_back(c);
+        offsets.push_back(size);
+        size += c.size;
+        if (has_chunk(c.hash)) {
+            bytes_deduped_ += c.size;
+            return true;
+        }
+        return write_chunk(c.hash, data, (size_t)c.size);
+    });
+    if (!ok) {
+        ::close(fd);
+        err = "Cannot store chunks";
+        return false;
+    }
+
+    lock_guard<mutex> lock(mtx_);
+    // Chunk tưởng đã có có thể vừa bị xóa (file khác ghi đè): ghi lại từ src.
+    vector<char> buf;
+    for (size_t i = 0; i < chunks.size() && ok; ++i) {
+        if (has_chunk(chunks[i].hash)) continue;
+        buf.resize((size_t)chunks[i].size);
+        ok = ::pread(fd, buf.data(), buf.size(), (off_t)offsets[i]) == (ssize_t)buf.size() &&
+             write_chunk(chunks[i].hash, buf.data(), buf.size());
+    }
+    ::close(fd);
+    if (!ok) {
+        err = "Cannot store chunks";
+        return false;
+    }
+    return put_locked(owner_id, path, size, chunks, err);
+}
+
+bool ChunkStore::commit_recipe(int owner_id, const string &path, uint64_t size,
+                               const vector<ChunkRef> &chunks, vector<string> &missing,
+                               string &err) {
+    lock_guard<mutex> lock(mtx_);
+    missing.clear();
+    for (const auto &c : chunks) {
+        if (!has_chunk(c.hash)) missing.push_back(c.hash);
+    }
+    if (!missing.empty()) {
+        err = "Missing chunks";
+        return false;
+    }
+    return put_locked(owner_id, path, size, chunks, err);
+}
+
+bool ChunkStore::remove_file(int owner_id, const string &path, string &err) {
+    lock_guard<mutex> lock(mtx_);
+    return put_locked(owner_id, path, 0, vector<ChunkRef>(), err);
+}
+
+bool ChunkStore::add_chunk(const string &tmp_path, const string &hash, uint64_t size,
+                           string &err) {
+    int fd = ::open(tmp_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err = "Cannot open chunk";
+        return false;
+    }
+    Sha256 sha;
+    vector<char> buf(64 * 1024);
+    uint64_t total = 0;
+    ssize_t n;
+    while ((n = ::read(fd, buf.data(), buf.size())) > 0) {
+        sha.update(buf.data(), (size_t)n);
+        total += (uint64_t)n;
+    }
+    ::close(fd);
+    unsigned char d[Sha256::DIGEST_SIZE];
+    sha.finish(d);
+
+    if (n < 0 || total != size || digest_to_hex(d) != hash) {
+        ::unlink(tmp_path.c_str());
+        err = "Hash mismatch";
+        return false;
+    }
+    ::mkdir((dir_ + "/" + hash.substr(0, 2)).c_str(), 0755);
+    if (::rename(tmp_path.c_str(), chunk_path(hash).c_str()) != 0) {
+        ::unlink(tmp_path.c_str());
+        err = "Cannot store chunk";
+        return false;
+    }
+    bytes_stored_ += size;
+    return true;
+}
+
+ChunkFiles::~ChunkFiles() {
+    for (const Part &p : parts_) ::close(p.fd);
+}
+
+bool ChunkFiles::read(uint64_t offset, char *buf, size_t len) const {
+    for (const Part &p : parts_) {
+        if (len == 0) break;
+        if (offset >= p.offset + p.size) continue;
+        if (offset < p.offset) return false;
+        size_t n = (size_t)min<uint64_t>(len, p.offset + p.size - offset);
+        if (::pread(p.fd, buf, n, (off_t)(offset - p.offset)) != (ssize_t)n) return false;
+        buf    += n;
+        len    -= n;
+        offset += n;
+    }
+    return len == 0;
+}
+
+// Mở dưới mtx_: put_locked xóa chunk cũng dưới mtx_, nên hoặc mở được đủ các
+// chunk của bản đã đọc, hoặc biết ngay là file đã bị thay.
+shared_ptr<const ChunkFiles> ChunkStore::open_range(const vector<ChunkRef> &chunks,
+                                                    uint64_t offset, uint64_t size) {
+    shared_ptr<ChunkFiles> files = make_shared<ChunkFiles>();
+    lock_guard<mutex> lock(mtx_);
+    uint64_t pos = 0;
+    for (const ChunkRef &c : chunks) {
+        uint64_t at = pos;
+        pos += c.size;
+        if (pos <= offset || c.size == 0) continue;
+        if (at >= offset + size) break;
+        int fd = ::open(chunk_path(c.hash).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        files->parts_.push_back(ChunkFiles::Part{at, c.size, fd});
+    }
+    return files;
+}
+
+unique_ptr<BodySource> ChunkStore::open_source(shared_ptr<const ChunkFiles> files,
+                                               uint64_t offset, uint64_t size,
+                                               const TransferOptions &opt) const {
+    return unique_ptr<BodySource>(new ChunkSource(move(files), offset, size, opt));
+}
+
+bool ChunkStore::read_range(const vector<ChunkRef> &chunks, uint64_t offset, char *buf,
+                            size_t len) const {
+    for (size_t i = 0; i < chunks.size() && len > 0; ++i) {
+        if (offset >= chunks[i].size) {
+            offset -= chunks[i].size;
+            continue;
+        }
+        size_t n = (size_t)min<uint64_t>(len, chunks[i].size - offset);
+        int fd = ::open(chunk_path(chunks[i].hash).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        ssize_t got = ::pread(fd, buf, n, (off_t)offset);
+        ::close(fd);
+        if (got != (ssize_t)n) return false;
+        buf    += n;
+        len    -= n;
+        offset  = 0;
+    }
+    return len == 0;
+}
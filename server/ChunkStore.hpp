@@ -0,0 +1,107 @@
+// ===== file: server/ChunkStore.hpp =====
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "Db.hpp"
+#include "Transfer.hpp"
+#include "../common/Chunker.hpp"
+
+using namespace std;
+
+// Các chunk phủ 1 đoạn của file, mở sẵn khi bắt đầu đọc: chunk bị xóa sau đó
+// (file bị ghi đè, user khác bỏ tham chiếu cuối) vẫn đọc được qua fd, như file
+// thường giữ inode sau rename.
+class ChunkFiles {
+public:
+    struct Part {
+        uint64_t offset; // vị trí chunk trong file
+        uint64_t size;
+        int      fd;
+    };
+
+    ChunkFiles() = default;
+    ChunkFiles(const ChunkFiles &) = delete;
+    ChunkFiles &operator=(const ChunkFiles &) = delete;
+    ~ChunkFiles();
+
+    const vector<Part> &parts() const { return parts_; }
+    // Đọc [offset, offset+len) của file; phải nằm trong đoạn đã mở.
+    bool read(uint64_t offset, char *buf, size_t len) const;
+
+private:
+    friend class ChunkStore;
+    vector<Part> parts_;
+};
+
+// Kho chunk dùng chung cho mọi user (bật bằng --store=chunks): file được cắt
+// theo nội dung, mỗi chunk lưu 1 lần ở <root>/.chunks/<2 ký tự đầu>/<sha256>,
+// file_entry trỏ tới danh sách chunk, bảng chunk giữ refcount. Quota vẫn tính
+// theo kích thước file của từng user.
+class ChunkStore {
+public:
+    ChunkStore(const string &root_dir, Db &db);
+
+    // Tạo thư mục và dọn chunk không file nào dùng (PUT_CHUNK nhưng chưa
+    // UPLOAD_RECIPE, hoặc server dừng giữa chừng).
+    void init();
+
+    static bool valid_hash(const string &hash);
+    bool has_chunk(const string &hash) const;
+
+    // Danh sách chunk của file; false nếu file không nằm trong store.
+    bool lookup(int owner_id, const string &path, uint64_t &size, vector<ChunkRef> &chunks);
+
+    // Cắt file src_path, thêm các chunk chưa có rồi gán cho (owner, path).
+    bool import_file(int owner_id, const string &path, const string &src_path, string &err);
+
+    // Gán danh sách chunk client gửi (UPLOAD_RECIPE). Thiếu chunk nào thì
+    // không đổi gì, missing nhận các hash đó.
+    bool commit_recipe(int owner_id, const string &path, uint64_t size,
+                       const vector<ChunkRef> &chunks, vector<string> &missing, string &err);
+
+    // File được ghi đè bằng file thường (rỗng): bỏ danh sách chunk cũ.
+    bool remove_file(int owner_id, const string &path, string &err);
+
+    // File tạm mới trong store cho PUT_CHUNK; add_chunk kiểm tra hash rồi
+    // chuyển vào chỗ (file tạm luôn bị xóa/đổi tên).
+    string temp_path();
+    bool add_chunk(const string &tmp_path, const string &hash, uint64_t size, string &err);
+
+    // Mở các chunk phủ [offset, offset+size) của file; nullptr nếu có chunk
+    // đã bị xóa (file vừa bị ghi đè sau khi đọc danh sách chunk).
+    shared_ptr<const ChunkFiles> open_range(const vector<ChunkRef> &chunks, uint64_t offset,
+                                            uint64_t size);
+
+    // Body download ghép từ các chunk đã mở, [offset, offset+size) của file.
+    unique_ptr<BodySource> open_source(shared_ptr<const ChunkFiles> files, uint64_t offset,
+                                       uint64_t size, const TransferOptions &opt) const;
+
+    // Byte chunk mới ghi xuống đĩa / byte trùng không phải ghi (cho STATS).
+    uint64_t bytes_stored() const { return bytes_stored_.load(); }
+    uint64_t bytes_deduped() const { return bytes_deduped_.load(); }
+
+    // Đọc [offset, offset+len) của file ghép từ chunks (file gốc của delta).
+    bool read_range(const vector<ChunkRef> &chunks, uint64_t offset, char *buf,
+                    size_t len) const;
+
+    string chunk_path(const string &hash) const;
+
+private:
+    bool write_chunk(const string &hash, const char *data, size_t len);
+    bool put_locked(int owner_id, const string &path, uint64_t size,
+                    const vector<ChunkRef> &chunks, string &err);
+
+    string root_;
+    string dir_;
+    Db    &db_;
+    // Kiểm tra chunk còn trên đĩa + cập nhật refcount + xóa chunk về 0 phải
+    // đi cùng nhau, nếu không 1 chunk vừa được tham chiếu có thể bị xóa.
+    mutex  mtx_;
+    atomic<uint64_t> tmp_seq_{0};
+    atomic<uint64_t> bytes_stored_{0};
+    atomic<uint64_t> bytes_deduped_{0};
+};
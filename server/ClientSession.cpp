@@ -1,13 +1,24 @@
 // ===== file: server/ClientSession.cpp =====
 #include "ClientSession.hpp"
 #include "FileServer.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 #include "../common/Protocol.hpp"
+#include "../common/Sha256.hpp"
+#include "../common/Crc32c.hpp"
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <cstring>
 #include <fstream>
 #include <mutex>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 
 using namespace std;
 using namespace proto;
@@ -22,6 +33,25 @@ string hash_password(const string &raw) {
     return ss.str();
 }
 
+// Cấp phát trước file tạm của upload song song: các đoạn ghi ở offset bất kỳ
+// không làm file thưa/phân mảnh, và hết chỗ đĩa thì báo ngay từ đầu.
+bool preallocate(int fd, uint64_t size) {
+    if (size == 0) return true;
+#ifdef __linux__
+    if (::posix_fallocate(fd, 0, (off_t)size) == 0) return true;
+#endif
+    return ::ftruncate(fd, (off_t)size) == 0;
+}
+
+// mtime (ns) của file: commit đổi tên file mới vào chỗ nên luôn đổi.
+uint64_t file_tag(const struct stat &st) {
+#ifdef __linux__
+    return (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+#else
+    return (uint64_t)st.st_mtime * 1000000000ull;
+#endif
+}
+
 bool is_txt_file(const string &path) {
     const string ext = ".txt";
     if (path.size() < ext.size()) return false;
@@ -29,74 +59,414 @@ bool is_txt_file(const string &path) {
 }
 } // namespace
 
-ClientSession::ClientSession(int sockfd, FileServer &server)
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+namespace {
+const size_t MAX_LINE        = 16 * 1024;   // dòng lệnh dài hơn => đóng kết nối
+const size_t OUT_HIGH_WATER  = 256 * 1024;  // reply dồn quá mức này thì tạm dừng đọc lệnh
+const size_t MAX_STREAMS     = 16;          // upload + download đồng thời trên 1 kết nối
+const size_t MUX_CHUNK       = 64 * 1024;   // frame DATA khi nhiều download chia nhau kết nối
+const size_t MAX_V2_BUFFERED = 1024 * 1024; // input đệm tối đa khi output đang nghẽn (v2)
+const size_t MAX_HAVE_CHUNKS = 256;         // hash tối đa mỗi lệnh HAVE_CHUNKS
+const size_t RECIPE_ENTRY    = 40;          // body UPLOAD_RECIPE: sha256(32) + size u64 BE
+const uint64_t MAX_RECIPE_CHUNKS = 1u << 20;
+const uint64_t DELTA_SLACK       = 64 * 1024;   // body delta tối đa: size + size/16 + slack
+} // namespace
+
+ClientSession::ClientSession(int sockfd, FileServer &server, int io_eventfd)
     : sockfd_(sockfd),
-      server_(server) {}
+      server_(server),
+      conn_(sockfd),
+      xfer_(server.transfer_options()) {
+    xfer_.io_eventfd = io_eventfd;
+}
 
+ClientSession::~ClientSession() {
+    close_bodies();
+    server_.shaper().detach(shape_);
+}
+
+// Kết nối đứt giữa chừng: đóng file, bỏ file tạm chưa commit.
+void ClientSession::close_bodies() {
+    rx_ = nullptr;
+    settling_.clear();
+    for (auto &kv : recvs_) {
+        InBody &b = *kv.second;
+        // Đang commit trên thread nền (bg_): job tự làm nốt.
+        if (!b.sink) continue;
+        // Body nén: phần đã giải nén không được tính là đã ghi (remaining giữ nguyên).
+        int64_t crc = b.compressed ? (b.crc_known ? (int64_t)b.base_crc : -1)
+                                   : received_crc(b, b.part_len - b.remaining);
+        if (!b.sink->settled()) {
+            // Còn lệnh ghi io_uring: chờ trên thread nền rồi mới ghi nhận.
+            shared_ptr<InBody> hold(move(kv.second));
+            UploadTable *uploads = &server_.uploads();
+            run_detached([hold, uploads, crc] {
+                drop_upload(*uploads, *hold, hold->sink->finish(), crc);
+            });
+            continue;
+        }
+        drop_upload(server_.uploads(), b, b.sink->finish(), crc);
+    }
+    recvs_.clear();
+    for (auto &b : sends_) {
+        b->src.reset();
+        if (b->fd >= 0) ::close(b->fd);
+    }
+    sends_.clear();
+}
+
+// Giữ phần đã ghi để client nối tiếp bằng UPLOAD_RESUME.
+void ClientSession::drop_upload(UploadTable &uploads, InBody &b, bool ok, int64_t crc) {
+    b.sink.reset();
+    if (::close(b.fd) != 0) ok = false;
+    if (b.chunk) {
+        ::unlink(b.tmp_path.c_str());
+    } else if (b.part) {
+        uploads.end_part(b.upload_id, b.part_offset, ok ? b.part_len - b.remaining : 0, crc);
+    } else if (ok && !b.recipe && !b.delta) {
+        uploads.park(b.upload_id, b.size - b.remaining, crc);
+    } else {
+        ::unlink(b.tmp_path.c_str());
+        uploads.finish(b.upload_id);
+    }
+}
+
+// Socket blocking: drive() chỉ trả về sớm khi shaper bắt chờ, ngủ tới
+// wake_ns_ rồi chạy tiếp.
 void ClientSession::run() {
-    string line;
-    while (recv_line(sockfd_, line)) {
-        if (!handle_command(line)) break;
+    while (drive() && wake_ns_ != 0) {
+        uint64_t now = metrics::now_ns();
+        if (wake_ns_ > now) this_thread::sleep_for(chrono::nanoseconds(wake_ns_ - now));
     }
 }
 
-bool ClientSession::handle_command(const string &line) {
-    vector<string> tokens = split_tokens(line);
-    if (tokens.empty()) {
-        send_line(sockfd_, "ERR 400 Empty command");
-        return true;
+bool ClientSession::on_readable() {
+    return drive();
+}
+
+bool ClientSession::on_writable() {
+    return drive();
+}
+
+// Vòng lặp chính: xử lý dữ liệu đã có, gửi ra hết mức có thể, rồi đọc thêm.
+// Với socket blocking hàm chỉ trả về khi session kết thúc hoặc shaper bắt
+// chờ; với non-blocking hàm trả về true khi phải chờ EPOLLIN/EPOLLOUT, tới
+// wake_ns_ hoặc tới khi io_uring báo (io_wait_).
+bool ClientSession::drive() {
+    while (true) {
+        wake_ns_   = 0;
+        io_wait_   = false;
+        rx_paused_ = false;
+        tx_paused_ = false;
+        if (!process_input()) return false;
+        if (!flush_output()) return false;
+
+        bool sending  = conn_.pending() > 0 || !sends_.empty();
+        bool out_wait = out_blocked_ || tx_paused_;
+        if (closing_) {
+            if (!sending) return false;
+            if (out_wait) return true;
+            continue;
+        }
+        if (has_input_work()) continue;
+
+        if (sending) {
+            // v1: lệnh kế tiếp chỉ đọc khi đã gửi xong body.
+            if (!v2_ || rx_paused_ || conn_.buffered() > MAX_V2_BUFFERED) {
+                if (out_wait) return true;
+                continue;
+            }
+            // v2: vẫn nhận lệnh/DATA mới (không chờ) để upload và lệnh nhỏ
+            // không phải đợi download lớn, và 2 chiều không chặn lẫn nhau.
+            int r = read_input(MSG_DONTWAIT);
+            if (r < 0) return false;
+            if (r == 0 && out_wait) return true;
+            continue;
+        }
+        // Upload đang chờ token/đĩa: không đọc thêm body từ socket.
+        if (rx_paused_) return true;
+
+        int r = read_input();
+        if (r < 0) return false;
+        if (r == 0) return true;
     }
+}
 
-    string cmd = tokens[0];
+// 1: đọc được dữ liệu, 0: chưa có dữ liệu (EAGAIN), -1: đóng/lỗi.
+int ClientSession::read_input(int flags) {
+    if (!rx_) {
+        if (!v2_ && conn_.buffered() > MAX_LINE) return -1;
+        if (v2_ && conn_.has_header()) {
+            FrameHeader h = conn_.peek_header();
+            if (h.opcode != OP_DATA && h.length > MAX_CONTROL_FRAME) return -1;
+        }
+    }
+    TRACE_SPAN("net", "recv");
+    return conn_.fill(flags);
+}
 
-    if (cmd == "AUTH") {
-        return cmd_auth(tokens);
+bool ClientSession::has_input_work() const {
+    if (closing_ || !settling_.empty() || bg_) return false;
+    if (rx_) return !rx_paused_ && conn_.buffered() > 0;
+    if (!v2_) {
+        return sends_.empty() && conn_.pending() <= OUT_HIGH_WATER && conn_.has_line();
     }
-    if (cmd == "REGISTER") {
-        return cmd_register(tokens);
+    if (!conn_.has_header()) return false;
+    FrameHeader h = conn_.peek_header();
+    if (h.opcode == OP_DATA) return !(h.flags & FLAG_CRC) || conn_.has_frame();
+    return conn_.pending() <= OUT_HIGH_WATER && conn_.has_frame();
+}
+
+// Byte body được gửi/nhận ngay (≤ want) theo shaper; 0: hết token, session
+// chờ tới wake_ns_ (EventLoop hẹn giờ, thread-per-connection thì ngủ).
+uint64_t ClientSession::shape(Direction d, uint64_t want) {
+    uint64_t wake = 0;
+    uint64_t n = server_.shaper().grant(shape_, d, want, metrics::now_ns(), wake);
+    if (n == 0) {
+        wake_ns_ = wake_ns_ == 0 ? wake : min(wake_ns_, wake);
+        (d == Direction::In ? rx_paused_ : tx_paused_) = true;
     }
+    return n;
+}
+
+// Body chờ đĩa (io_uring): EventLoop gọi lại khi eventfd báo completion.
+void ClientSession::pause_io(Direction d) {
+    io_wait_ = true;
+    (d == Direction::In ? rx_paused_ : tx_paused_) = true;
+}
+
+void ClientSession::charge(Direction d, uint64_t n) {
+    server_.shaper().charge(shape_, d, n);
+}
+
+void ClientSession::reply(int code, string_view msg) {
+    send_reply(code, msg);
+}
+
+// "OK 100 <upload_id> Ready to receive": client giữ id để nối lại nếu đứt.
+void ClientSession::reply_ready(uint64_t upload_id) {
+    if (v2_) {
+        send_reply(100, "Ready to receive", upload_id);
+        return;
+    }
+    MsgBuf msg;
+    msg.add(upload_id).add(" Ready to receive");
+    send_reply(100, msg.view(), upload_id);
+}
+
+// "OK 100 <size>" trước body của DOWNLOAD / GET_TEXT; tải 1 đoạn thì thêm
+// kích thước cả file: "OK 100 <size> <total>". Body nén (v2):
+// "<size> <total> <codec>", size vẫn là byte sau giải nén. Biết CRC32C của cả
+// file (v2, đã thỏa thuận crc32c): "<size> <total> <codec|none> <crc hex>".
+void ClientSession::reply_body(uint64_t size, uint64_t total, Codec codec, int64_t crc) {
+    MsgBuf msg;
+    if (crc >= 0) {
+        msg.add(size).add(' ').add(total).add(' ').add(codec_name(codec)).add(' ')
+           .add(crc32c_hex((uint32_t)crc));
+    } else if (codec != Codec::None) {
+        msg.add(size).add(' ').add(total).add(' ').add(codec_name(codec));
+    } else if (size != total) msg.add(size).add(' ').add(total);
+    else if (!v2_) msg.add(size);
+    send_reply(100, msg.view(), size);
+}
+
+// Reply ghi thẳng vào buffer gửi của conn_, không dựng Reply/chuỗi trung gian.
+void ClientSession::send_reply(int code, string_view msg, uint64_t size) {
+    last_code_ = code;
+    metrics::record_reply(code);
+    if (!v2_) conn_.queue_text_reply(code, msg);
+    else conn_.queue_reply_frame(cur_id_, code, msg, size);
+}
+
+bool ClientSession::process_input() {
+    string_view line;
+    FrameHeader h;
+    // Lệnh sau chỉ chạy khi upload trước đã reply.
+    if (!settle_uploads()) return true;
+    while (!closing_ && settling_.empty() && !bg_) {
+        if (rx_) {
+            if (!feed_body()) return false;
+            if (rx_) break;
+            continue;
+        }
+        if (!v2_ && !sends_.empty()) break;
+
+        // Frame DATA không sinh reply nên không bị giới hạn bởi OUT_HIGH_WATER.
+        if (v2_ && conn_.has_header() && conn_.peek_header().opcode == OP_DATA) {
+            if (conn_.peek_header().flags & FLAG_CRC) {
+                // Frame CRC kết thúc body: nhỏ, chờ đủ cả frame rồi xử lý.
+                if (!conn_.next_frame(h, frame_buf_)) break;
+                if (!end_body_crc(h, frame_buf_)) return false;
+                continue;
+            }
+            if (!begin_data_frame(conn_.peek_header())) return false;
+            continue;
+        }
+        if (conn_.pending() > OUT_HIGH_WATER) break;
+
+        bool keep;
+        if (v2_) {
+            if (!conn_.next_frame(h, frame_buf_)) break;
+            decode_request(h, frame_buf_, req_);
+            keep = dispatch(req_);
+        } else {
+            if (!conn_.next_line(line)) break;
+            keep = handle_command(line);
+        }
+        if (!keep) closing_ = true;
+    }
+    return true;
+}
+
+// Gửi reply đang chờ rồi tới body. Ở v2 mỗi download gửi 1 frame rồi xoay
+// vòng nên các stream chia đều đường truyền, và reply của lệnh nhỏ chen được
+// vào giữa các frame thay vì chờ download lớn xong.
+bool ClientSession::flush_output() {
+    TRACE_SPAN("net", "send");
+    out_blocked_ = false;
+    size_t frames = 0;
+    while (true) {
+        // Frame đang gửi dở phải xong trước khi gửi bất cứ gì khác.
+        if (!sends_.empty() && sends_.front()->in_frame) {
+            int r = send_frame(*sends_.front());
+            if (r < 0) return false;
+            if (r == 0 || r == 2) {
+                out_blocked_ = r == 0;
+                return true;
+            }
+            ++frames;
+            continue;
+        }
+
+        // Header "OK 100 <size>" đi chung segment với đầu body.
+        int r = conn_.flush(sends_.empty() ? 0 : MSG_MORE);
+        if (r < 0) return false;
+        if (r == 0) {
+            out_blocked_ = true;
+            return true;
+        }
+        if (sends_.empty()) return true;
+        // Mỗi stream đã được 1 frame: nhường cho drive() đọc lệnh mới.
+        if (v2_ && frames >= sends_.size()) return true;
+        if (!start_frame(*sends_.front())) return true;
+    }
+}
+
+// line là view vào buffer của conn_: parse chép ngay vào req_ nên handler
+// không còn dùng tới line.
+bool ClientSession::handle_command(string_view line) {
+    cur_id_ = 0;
+    if (!parse_text_request(line, req_)) {
+        reply(400, "Empty command");
+        return true;
+    }
+    // Bắt tay chuyển sang giao thức nhị phân; dữ liệu sau dòng này là frame.
+    if (req_.op == Op::None) {
+        vector<string> tokens = split_tokens(string(line));
+        if (tokens[0] == "HELLO") return cmd_hello(tokens);
+    }
+    return dispatch(req_);
+}
+
+// Điểm vào chung của v1 và v2: mọi handler chỉ làm việc với Request.
+// Độ trễ tính từ đây tới reply cuối; lệnh mở body tính tới khi body xong.
+bool ClientSession::dispatch(const Request &req) {
+    cur_id_       = req.id;
+    cmd_op_       = req.op;
+    cmd_start_    = metrics::now_ns();
+    cmd_bytes_    = 0;
+    cmd_deferred_ = false;
+    last_code_    = 0;
+    bool keep;
+    {
+        TRACE_SPAN_ID("cmd", op_name(req.op), req.id);
+        keep = run_command(req);
+    }
+    if (!cmd_deferred_) {
+        metrics::record_command(req.op, metrics::now_ns() - cmd_start_, last_code_ >= 400,
+                                cmd_bytes_);
+    }
+    return keep;
+}
+
+bool ClientSession::run_command(const Request &req) {
+    if (req.op == Op::Auth)     return cmd_auth(req);
+    if (req.op == Op::Register) return cmd_register(req);
 
     if (!ensure_authenticated()) return false;
 
-    if (cmd == "UPLOAD")    return cmd_upload(tokens);
-    if (cmd == "DOWNLOAD")  return cmd_download(tokens);
-    if (cmd == "GET_TEXT")  return cmd_get_text(tokens);
-    if (cmd == "PUT_TEXT")  return cmd_put_text(tokens);
-    if (cmd == "STATS")     return cmd_stats();
+    switch (req.op) {
+    case Op::Upload:   return cmd_upload(req);
+    case Op::Download: return cmd_download(req);
+    case Op::GetText:  return cmd_get_text(req);
+    case Op::PutText:  return cmd_put_text(req);
+    case Op::Stats:    return cmd_stats();
+    case Op::UploadStatus: return cmd_upload_status(req);
+    case Op::UploadResume: return cmd_upload_resume(req);
+    case Op::UploadOpen:   return cmd_upload_open(req);
+    case Op::UploadPart:   return cmd_upload_part(req);
+    case Op::UploadCommit: return cmd_upload_commit(req);
+    case Op::HaveChunks:   return cmd_have_chunks(req);
+    case Op::PutChunk:     return cmd_put_chunk(req);
+    case Op::UploadRecipe: return cmd_upload_recipe(req);
+    case Op::Signature:    return cmd_signature(req);
+    case Op::UploadDelta:  return cmd_upload_delta(req);
+    default:
+        break;
+    }
 
-    send_line(sockfd_, "ERR 400 Unknown command");
+    reply(400, "Unknown command");
+    return true;
+}
+
+// HELLO v2 [codec...] [crc32c]: reply liệt kê các codec client đề nghị mà
+// server có, client chỉ gửi/nhận body nén bằng các codec đó. "crc32c": body
+// upload kết thúc bằng frame CRC, reply body download kèm CRC của file.
+bool ClientSession::cmd_hello(const vector<string> &tokens) {
+    if (tokens.size() >= 2 && tokens[1] == "v2") {
+        string msg = "v2";
+        for (size_t i = 2; i < tokens.size(); ++i) {
+            Codec c;
+            if (parse_codec(tokens[i], c) && c != Codec::None && codec_available(c)) {
+                msg += " " + tokens[i];
+            } else if (tokens[i] == "crc32c" && xfer_.checksum) {
+                msg += " crc32c";
+                crc_ = true;
+            }
+        }
+        reply(200, msg);
+        v2_ = true;
+        return true;
+    }
+    reply(400, "Unsupported protocol version");
     return true;
 }
 
 bool ClientSession::ensure_authenticated() {
     if (!authenticated_) {
-        send_line(sockfd_, "ERR 401 Not authenticated");
+        reply(401, "Not authenticated");
         return false;
     }
     return true;
 }
 
-bool ClientSession::cmd_auth(const vector<string> &tokens) {
-    if (tokens.size() < 3) {
-        send_line(sockfd_, "ERR 400 Usage: AUTH <user> <pass>");
+bool ClientSession::cmd_auth(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: AUTH <user> <pass>");
         return true;
     }
 
-    string user = tokens[1];
-    string pass = tokens[2];
+    const string &user = req.user;
+    const string &pass = req.pass;
 
     UserRecord rec;
     string err;
     if (!server_.db().get_user_by_username(user, rec, err)) {
         server_.logger().log(user, "Login failed (user not found)");
-        send_line(sockfd_, "ERR 403 Invalid credentials");
-        return false;
-    }
-
-    // Demo: pass == password_hash
-    if (pass != rec.password_hash) {
-        server_.logger().log(user, "Login failed (wrong password)");
-        send_line(sockfd_, "ERR 403 Invalid credentials");
+        reply(403, "Invalid credentials");
         return false;
     }
 
@@ -104,7 +474,13 @@ bool ClientSession::cmd_auth(const vector<string> &tokens) {
     string pass_hashed = hash_password(pass);
     if (!(pass_hashed == rec.password_hash || pass == rec.password_hash)) {
         server_.logger().log(user, "Login failed (wrong password)");
-        send_line(sockfd_, "ERR 403 Invalid credentials");
+        reply(403, "Invalid credentials");
+        return false;
+    }
+
+    if (!server_.shaper().attach(shape_, rec.id)) {
+        server_.logger().log(user, "Login rejected (too many sessions)");
+        reply(429, "Too many sessions");
         return false;
     }
 
@@ -112,290 +488,1335 @@ bool ClientSession::cmd_auth(const vector<string> &tokens) {
     username_      = rec.username;
     user_id_       = rec.id;
 
-    server_.quota_mgr().set_limit(username_, rec.quota_bytes);
-    server_.quota_mgr().add_usage(username_, rec.used_bytes);
+    UserQuota &quota = server_.quota_mgr().account(user_id_);
+    quota.set_limit(rec.quota_bytes);
+    quota.load_usage(rec.used_bytes);
 
     server_.logger().log(user, "Login success");
     server_.db().insert_log(user_id_, "login", "Login success", "0.0.0.0", err);
 
-    send_line(sockfd_, "OK 200 Authenticated");
+    reply(200, "Authenticated");
     return true;
 }
 
-bool ClientSession::cmd_register(const vector<string> &tokens) {
-    if (tokens.size() < 3) {
-        send_line(sockfd_, "ERR 400 Usage: REGISTER <user> <pass>");
+// Tra cứu, tạo tài khoản và chờ nó bền trên đĩa (sync) chạy nền, reply khi xong.
+bool ClientSession::cmd_register(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: REGISTER <user> <pass>");
         return true;
     }
 
-    string user = tokens[1];
-    string pass = tokens[2];
+    FileServer *server = &server_;
+    string user        = req.user;
+    string pass_hashed = hash_password(req.pass);
+    start_job(nullptr, true, [server, user, pass_hashed](BgJob &job) {
+        UserRecord rec;
+        string err;
+        if (server->db().get_user_by_username(user, rec, err)) {
+            job.code = 409;
+            job.msg  = "User already exists";
+            return;
+        }
+        if (!err.empty()) {
+            job.code = 500;
+            job.msg  = "DB error: " + err;
+            return;
+        }
 
-    UserRecord rec;
-    string err;
-    if (server_.db().get_user_by_username(user, rec, err)) {
-        send_line(sockfd_, "ERR 409 User already exists");
+        const uint64_t default_quota = 100ull * 1024ull * 1024ull; // 100 MB
+        if (!server->db().create_user(user, pass_hashed, default_quota, err)) {
+            job.code = err.find("UNIQUE") != string::npos ? 409 : 500;
+            job.msg  = job.code == 409 ? "User already exists" : "DB error: " + err;
+            return;
+        }
+        // Tài khoản phải bền trước khi báo đăng ký thành công.
+        if (!server->db().sync(err)) {
+            job.code = 500;
+            job.msg  = "DB error: " + err;
+            return;
+        }
+
+        static mutex file_mtx;
+        {
+            lock_guard<mutex> lock(file_mtx);
+            ofstream ofs("user_account.txt", ios::app);
+            if (!ofs) {
+                job.code = 500;
+                job.msg  = "Cannot open user_account.txt";
+                return;
+            }
+            // Lưu username + hash (không lưu plaintext).
+            ofs << user << " " << pass_hashed << "\n";
+        }
+
+        server->logger().log(user, "REGISTER success");
+        job.code = 201;
+        job.msg  = "Registered";
+    });
+    return true;
+}
+
+uint64_t ClientSession::file_size(const string &path) {
+    struct stat st{};
+    if (::stat(path.c_str(), &st) == 0) return (uint64_t)st.st_size;
+    return 0;
+}
+
+// root_dir/<user>/<rel_path> dựng trong path_buf_ (giữ dung lượng giữa các
+// lệnh); chỉ dùng được tới lần gọi kế tiếp.
+const string &ClientSession::user_path(const string &rel_path) {
+    path_buf_.assign(server_.root_dir());
+    path_buf_ += '/';
+    path_buf_ += username_;
+    path_buf_ += '/';
+    path_buf_ += rel_path;
+    return path_buf_;
+}
+
+// File của user nằm trong chunk store (chunks được điền) hay là file thường
+// dưới root_dir/<user>/ (file cũ từ trước khi bật chunk store vẫn đọc được).
+// tag: đổi mỗi khi nội dung file đổi (khóa phụ của ContentCache): mtime của
+// file thường, hash danh sách chunk với file trong chunk store.
+bool ClientSession::stat_file(const string &rel_path, uint64_t &size, vector<ChunkRef> *chunks,
+                              uint64_t *tag) {
+    vector<ChunkRef> list;
+    ChunkStore *store = server_.chunk_store();
+    if (store && store->lookup(user_id_, rel_path, size, list)) {
+        if (tag) {
+            string ids;
+            for (const ChunkRef &c : list) ids += c.hash;
+            *tag = std::hash<string>()(ids);
+        }
+        if (chunks) *chunks = move(list);
         return true;
     }
-    if (!err.empty()) {
-        send_line(sockfd_, "ERR 500 DB error: " + err);
+    struct stat st{};
+    if (::stat(user_path(rel_path).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size = (uint64_t)st.st_size;
+    if (tag) *tag = file_tag(st);
+    return true;
+}
+
+// Mở file hiện tại làm gốc cho delta: file thường đọc bằng pread (fd do người
+// gọi đóng), file trong chunk store đọc qua các chunk.
+bool ClientSession::open_basis(const string &rel_path, uint64_t &size, int &fd,
+                               BasisReader &read) {
+    fd = -1;
+    vector<ChunkRef> chunks;
+    if (!stat_file(rel_path, size, &chunks)) return false;
+    if (!chunks.empty()) {
+        shared_ptr<const ChunkFiles> files = server_.chunk_store()->open_range(chunks, 0, size);
+        if (!files) return false;
+        read = [files](uint64_t off, char *buf, size_t len) {
+            return files->read(off, buf, len);
+        };
         return true;
     }
+    fd = ::open(user_path(rel_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    int f = fd;
+    read = [f](uint64_t off, char *buf, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::pread(f, buf, len, (off_t)off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buf += n;
+            len -= (size_t)n;
+            off += (uint64_t)n;
+        }
+        return true;
+    };
+    return true;
+}
 
-    const uint64_t default_quota = 100ull * 1024ull * 1024ull; // 100 MB
-    string pass_hashed = hash_password(pass);
-
-    if (!server_.db().create_user(user, pass_hashed, default_quota, err)) {
-        if (err.find("UNIQUE") != string::npos) {
-            send_line(sockfd_, "ERR 409 User already exists");
-        } else {
-            send_line(sockfd_, "ERR 500 DB error: " + err);
+// Kiểm tra trước khi mở stream mới: v2 giới hạn số stream và không cho trùng id.
+bool ClientSession::can_open_stream() {
+    if (recvs_.size() + sends_.size() >= MAX_STREAMS) {
+        reply(429, "Too many concurrent transfers");
+        return false;
+    }
+    if (recvs_.count(cur_id_)) {
+        reply(400, "Stream id in use");
+        return false;
+    }
+    for (const auto &b : sends_) {
+        if (b->id == cur_id_) {
+            reply(400, "Stream id in use");
+            return false;
         }
+    }
+    return true;
+}
+
+// Đăng ký upload mới với UploadTable (giữ chỗ quota ngay từ đầu để các upload
+// song song không cùng vượt quota). false: đã trả lỗi cho client.
+bool ClientSession::register_upload(PartialUpload &u, const string &rel_path, uint64_t size,
+                                    bool is_text, bool parallel) {
+    string base_dir = server_.root_dir() + "/" + username_;
+    u.user      = username_;
+    u.user_id   = user_id_;
+    u.rel_path  = rel_path;
+    u.full_path = user_path(rel_path);
+    u.tmp_path  = u.full_path + ".tmp";
+    u.size      = size;
+    u.old_size  = 0;
+    stat_file(rel_path, u.old_size, nullptr);
+    u.is_text   = is_text;
+    u.parallel  = parallel;
+
+    int code = server_.uploads().start(u);
+    if (code == 403) {
+        reply(403, "Quota exceeded");
+        return false;
+    }
+    if (code == 409) {
+        reply(409, "Upload in progress");
+        return false;
+    }
+
+    ::mkdir(server_.root_dir().c_str(), 0755);
+    ::mkdir(base_dir.c_str(), 0755);
+    return true;
+}
+
+bool ClientSession::begin_upload(const string &rel_path, uint64_t size, bool is_text,
+                                 const Request &req) {
+    Codec codec = (Codec)req.codec;
+    if (codec != Codec::None && (!v2_ || !codec_available(codec))) {
+        reply(415, "Unsupported encoding");
         return true;
     }
+    if (!can_open_stream()) return true;
+
+    PartialUpload u;
+    if (!register_upload(u, rel_path, size, is_text, false)) return true;
 
-    static mutex file_mtx;
+    int fd;
     {
-        lock_guard<mutex> lock(file_mtx);
-        ofstream ofs("user_account.txt", ios::app);
-        if (!ofs) {
-            send_line(sockfd_, "ERR 500 Cannot open user_account.txt");
+        TRACE_SPAN("disk", "open_tmp");
+        fd = ::open(u.tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        server_.uploads().finish(u.id);
+        reply(500, "Cannot open temp file");
+        return true;
+    }
+    open_in_body(u, fd, 0, size, false);
+    if (codec != Codec::None) {
+        InBody &b = *recvs_[cur_id_];
+        b.sink.reset(new CompressedSink(unique_ptr<BodySink>(new PlainFileSink(fd, 0)),
+                                        make_decoder(codec), size));
+        if (xfer_.checksum) b.sink->enable_checksum();
+        b.compressed = true;
+    }
+    return true;
+}
+
+// Bắt đầu nhận body [offset, offset+len) vào file tạm: cả file, phần nối
+// tiếp, hoặc 1 đoạn của upload song song.
+bool ClientSession::open_in_body(const PartialUpload &u, int fd, uint64_t offset,
+                                 uint64_t len, bool part) {
+    unique_ptr<InBody> b(new InBody);
+    b->fd          = fd;
+    b->sink        = make_file_sink(fd, offset, len, xfer_);
+    b->rel_path    = u.rel_path;
+    b->full_path   = u.full_path;
+    b->tmp_path    = u.tmp_path;
+    b->size        = u.size;
+    b->old_size    = u.old_size;
+    b->remaining   = len;
+    b->is_text     = u.is_text;
+    b->id          = cur_id_;
+    b->upload_id   = u.id;
+    b->part        = part;
+    b->part_offset = offset;
+    b->part_len    = len;
+    // Nối tiếp đúng chỗ đã ghi: CRC cả file = CRC phần cũ ghép với body này.
+    b->base_crc    = part ? 0 : u.crc;
+    b->crc_known   = part || (u.crc_ok && offset == u.committed);
+    b->op          = cmd_op_;
+    b->started_ns  = cmd_start_;
+    cmd_deferred_  = true;
+
+    reply_ready(u.id);
+
+    InBody &ref = *b;
+    recvs_[cur_id_] = move(b);
+    // v1: body là luồng byte thô đúng size ngay sau lệnh; v2: body đến trong
+    // các frame DATA mang id của lệnh, có thể xen với frame của stream khác.
+    if (!v2_) {
+        ref.frame_left = ref.remaining;
+        ref.end_seen   = true;
+        rx_ = &ref;
+    }
+    return true;
+}
+
+// Header frame DATA v2: chọn upload nhận payload theo stream id.
+// Sai id hoặc vượt size đã khai báo => sai giao thức, đóng kết nối.
+bool ClientSession::begin_data_frame(const FrameHeader &h) {
+    auto it = recvs_.find(h.id);
+    if (it == recvs_.end()) return false;
+    InBody &b = *it->second;
+    bool end = (h.flags & FLAG_END) != 0;
+    // Body nén: chưa biết trước tổng byte trên dây, CompressedSink kiểm tra
+    // kích thước sau giải nén.
+    if (b.compressed ? h.length > DATA_CHUNK
+                     : h.length > b.remaining || (end && h.length != b.remaining)) {
+        return false;
+    }
+
+    conn_.consume(FRAME_HEADER_SIZE);
+    b.frame_left = h.length;
+    b.end_seen   = end;
+    rx_ = &b;
+    return true;
+}
+
+// Frame DATA có FLAG_CRC: kết thúc body thay cho FLAG_END trên frame dữ liệu
+// cuối, payload là CRC32C của nội dung body. Phải đủ byte như đã khai báo.
+bool ClientSession::end_body_crc(const FrameHeader &h, const string &payload) {
+    auto it = recvs_.find(h.id);
+    if (it == recvs_.end()) return false;
+    InBody &b = *it->second;
+    if (!(h.flags & FLAG_END) || payload.size() != 4 || (!b.compressed && b.remaining != 0)) {
+        return false;
+    }
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(payload.data());
+    b.expect_crc = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    b.has_crc    = true;
+    finish_upload(b);
+    return true;
+}
+
+// Chuyển phần payload đã có trong buffer vào file tạm, sau đó nhận tiếp thẳng
+// từ socket vào sink (không qua buffer lệnh).
+bool ClientSession::feed_body() {
+    InBody &b = *rx_;
+    while (b.frame_left > 0) {
+        uint64_t allow = shape(Direction::In, b.frame_left);
+        if (allow == 0) return true;
+        size_t avail = conn_.buffered();
+        size_t chunk = allow < avail ? (size_t)allow : avail;
+        if (chunk > 0) {
+            b.sink->write(conn_.data(), chunk);
+            conn_.consume(chunk);
+            charge(Direction::In, chunk);
+            b.frame_left -= chunk;
+            server_.add_bytes_in(chunk);
+            if (!b.compressed) {
+                b.remaining -= chunk;
+                server_.add_logical_in(chunk);
+            }
+            continue;
+        }
+
+        // Reply "OK 100" phải ra khỏi buffer trước khi chờ body (socket blocking).
+        if (conn_.pending() > 0) return true;
+        ssize_t n = b.sink->recv_from(sockfd_, allow);
+        if (n < 0) return false;
+        if (n == 0) {
+            if (b.sink->io_pending()) pause_io(Direction::In);
             return true;
         }
-        // Lưu username + hash (không lưu plaintext).
-        ofs << user << " " << pass_hashed << "\n";
+        charge(Direction::In, (uint64_t)n);
+        b.frame_left -= (uint64_t)n;
+        server_.add_bytes_in((uint64_t)n);
+        if (!b.compressed) {
+            b.remaining -= (uint64_t)n;
+            server_.add_logical_in((uint64_t)n);
+        }
     }
 
-    server_.logger().log(user, "REGISTER success");
-    send_line(sockfd_, "OK 201 Registered");
+    rx_ = nullptr;
+    if (b.end_seen) finish_upload(b);
     return true;
 }
 
-uint64_t ClientSession::file_size(const string &path) {
-    struct stat st{};
-    if (::stat(path.c_str(), &st) == 0) return (uint64_t)st.st_size;
-    return 0;
+// Upload đã đủ body nhưng còn lệnh ghi io_uring đang chạy, hoặc commit còn
+// chạy nền: chưa reply.
+bool ClientSession::settle_uploads() {
+    if (bg_) {
+        if (!bg_->done.load(memory_order_acquire)) {
+            pause_io(Direction::In);
+            return false;
+        }
+        end_job();
+    }
+    for (size_t i = 0; i < settling_.size() && !bg_;) {
+        auto it = recvs_.find(settling_[i]);
+        if (it != recvs_.end() && !it->second->sink->settled()) {
+            ++i;
+            continue;
+        }
+        settling_.erase(settling_.begin() + (ptrdiff_t)i);
+        if (it != recvs_.end()) finish_upload(*it->second);
+    }
+    if (settling_.empty() && !bg_) return true;
+    pause_io(Direction::In);
+    return false;
 }
 
-bool ClientSession::cmd_upload(const vector<string> &tokens) {
-    if (tokens.size() < 3) {
-        send_line(sockfd_, "ERR 400 Usage: UPLOAD <path> <size>");
-        return true;
+ClientSession::CommitInfo ClientSession::commit_info(const string &rel_path,
+                                                     const string &full_path, uint64_t size,
+                                                     uint64_t old_size,
+                                                     uint64_t upload_id) const {
+    CommitInfo c;
+    c.server    = &server_;
+    c.user_id   = user_id_;
+    c.rel_path  = rel_path;
+    c.full_path = full_path;
+    c.size      = size;
+    c.old_size  = old_size;
+    c.upload_id = upload_id;
+    return c;
+}
+
+// Job của body b (nullptr: của lệnh hiện tại, đo độ trễ tới khi reply).
+// Trên EventLoop: job xong thì báo eventfd của loop, settle_uploads() reply;
+// tới lúc đó session không đọc lệnh mới. Với b, reply xong mới bỏ recvs_[id]
+// nên b không được dùng sau khi gọi hàm này.
+void ClientSession::start_job(InBody *b, bool background, function<void(BgJob &)> work) {
+    auto job = make_shared<BgJob>();
+    job->id = cur_id_;
+    if (b) {
+        job->body       = true;
+        job->op         = b->op;
+        job->started_ns = b->started_ns;
+        job->bytes      = b->part_len;
+    } else {
+        job->op         = cmd_op_;
+        job->started_ns = cmd_start_;
+        cmd_deferred_   = true;
     }
+    bg_ = job;
+    if (!background || xfer_.io_eventfd < 0) {
+        work(*job);
+        end_job();
+        return;
+    }
+    int efd = xfer_.io_eventfd;
+    run_worker([job, work, efd] {
+        work(*job);
+        job->done.store(true, memory_order_release);
+        uint64_t one = 1;
+        ssize_t w = ::write(efd, &one, sizeof(one));
+        (void)w;
+    });
+    pause_io(Direction::In);
+}
 
-    string rel_path = tokens[1];
-    uint64_t size   = stoull(tokens[2]);
+void ClientSession::end_job() {
+    shared_ptr<BgJob> job = move(bg_);
+    cur_id_    = job->id;
+    last_code_ = 0;
+    if (job->code < 400 && !job->log.empty()) server_.logger().log(username_, job->log);
+    reply(job->code, job->msg);
+    metrics::record_command(job->op, metrics::now_ns() - job->started_ns, job->code >= 400,
+                            job->bytes);
+    if (job->body) {
+        TRACE_ASYNC("stream", op_name(job->op), job->started_ns, stream_key(job->id));
+        recvs_.erase(job->id);
+    }
+}
 
-    string base_dir  = server_.root_dir() + "/" + username_;
-    string full_path = base_dir + "/" + rel_path;
-    uint64_t old_size = file_size(full_path);
-    uint64_t additional = size > old_size ? size - old_size : 0;
+void ClientSession::finish_upload(InBody &b) {
+    if (!b.sink->settled()) {
+        settling_.push_back(b.id);
+        pause_io(Direction::In);
+        return;
+    }
+    TRACE_SPAN("upload", "finish");
+    cur_id_    = b.id;
+    last_code_ = 0;
 
-    if (!server_.quota_mgr().can_allocate(username_, additional)) {
-        send_line(sockfd_, "ERR 403 Quota exceeded");
-        return true;
+    bool ok;
+    {
+        TRACE_SPAN("disk", "sink_finish"); // ghi nốt phần còn trong buffer
+        ok = b.sink->finish();
+    }
+    // CRC client gửi khác CRC tính lúc nhận: byte hỏng trên đường đi, không commit.
+    bool bad_crc = b.has_crc && b.sink->checksumming() && b.sink->crc() != b.expect_crc;
+    int64_t crc = received_crc(b, b.part_len);
+    b.sink.reset();
+    if (::close(b.fd) != 0) ok = false;
+    b.fd = -1;
+    if (ok && b.compressed) server_.add_logical_in(b.size);
+
+    if (ok && bad_crc) {
+        if (b.part) {
+            server_.uploads().reject_part(b.upload_id, b.part_offset, b.part_len);
+        } else if (!b.chunk && !b.recipe && !b.delta) {
+            // Giữ phần đã có từ trước body này: client nối lại từ part_offset.
+            server_.uploads().park(b.upload_id, b.part_offset,
+                                   b.crc_known ? (int64_t)b.base_crc : -1);
+        } else {
+            ::unlink(b.tmp_path.c_str());
+            if (!b.chunk) server_.uploads().finish(b.upload_id);
+        }
+        server_.logger().log(username_, "CHECKSUM_MISMATCH " + b.rel_path);
+        reply(422, "Checksum mismatch");
+    } else if (b.chunk) {
+        string err;
+        if (!ok) {
+            ::unlink(b.tmp_path.c_str());
+            reply(500, "Write error");
+        } else if (!server_.chunk_store()->add_chunk(b.tmp_path, b.hash, b.size, err)) {
+            reply(400, err);
+        } else {
+            reply(200, "Chunk stored");
+        }
+    } else if (b.recipe) {
+        if (!ok) {
+            ::unlink(b.tmp_path.c_str());
+            server_.uploads().finish(b.upload_id);
+            reply(500, "Write error");
+        } else {
+            CommitInfo c = commit_info(b.rel_path, b.full_path, b.size, b.old_size,
+                                       b.upload_id);
+            string recipe = b.tmp_path;
+            start_job(&b, true, [c, recipe](BgJob &job) { commit_recipe(c, recipe, job); });
+            return;
+        }
+    } else if (b.delta) {
+        if (!ok) {
+            ::unlink(b.tmp_path.c_str());
+            server_.uploads().finish(b.upload_id);
+            reply(500, "Write error");
+        } else {
+            commit_delta(b);
+            return;
+        }
+    } else if (b.part) {
+        // Đoạn của upload song song: chỉ ghi nhận, commit khi UPLOAD_COMMIT.
+        server_.uploads().end_part(b.upload_id, b.part_offset, ok ? b.part_len : 0, crc);
+        if (ok) reply(200, "Part stored");
+        else reply(500, "Write error");
+    } else if (!ok) {
+        ::unlink(b.tmp_path.c_str());
+        server_.uploads().finish(b.upload_id);
+        reply(500, "Write error");
+    } else {
+        // Đổi tên thì làm ngay; có chunk store (cắt chunk + SHA-256 cả file,
+        // hoặc chờ DB bỏ danh sách chunk cũ) thì chạy nền.
+        CommitInfo c = commit_info(b.rel_path, b.full_path, b.size, b.old_size, b.upload_id);
+        string tmp   = b.tmp_path;
+        bool is_text = b.is_text;
+        start_job(&b, server_.chunk_store() != nullptr,
+                  [c, tmp, crc, is_text](BgJob &job) {
+            if (!commit_file(c, tmp, crc)) {
+                job.code = 500;
+                job.msg  = "Commit failed";
+                return;
+            }
+            job.code = 200;
+            job.msg  = is_text ? "Text file updated" : "Upload completed";
+            job.log  = string(is_text ? "PUT_TEXT " : "UPLOAD ") + c.rel_path + " size=" +
+                       to_string(c.size);
+        });
+        return;
     }
+    metrics::record_command(b.op, metrics::now_ns() - b.started_ns, last_code_ >= 400,
+                            b.part_len);
+    TRACE_ASYNC("stream", op_name(b.op), b.started_ns, stream_key(b.id));
+    recvs_.erase(b.id);
+}
 
-    string tmp_path  = full_path + ".tmp";
+// Đổi tên file tạm thành file thật (atomic), cập nhật usage và metadata rồi
+// trả phần quota giữ chỗ của upload.
+// Với chunk store: cắt file tạm vào store thay vì đổi tên (file rỗng vẫn là
+// file thường).
+bool ClientSession::commit_file(const CommitInfo &c, const string &tmp_path, int64_t crc) {
+    ChunkStore *store = c.server->chunk_store();
+    string err;
+    bool ok;
+    if (store && c.size > 0) {
+        metrics::PhaseTimer timer(metrics::Phase::Disk);
+        TRACE_SPAN("disk", "chunk_import");
+        ok = store->import_file(c.user_id, c.rel_path, tmp_path, err);
+        ::unlink(tmp_path.c_str());
+        // Bản file thường cũ (nếu có) không còn được đọc tới.
+        if (ok) ::unlink(c.full_path.c_str());
+    } else {
+        {
+            metrics::PhaseTimer timer(metrics::Phase::Disk);
+            TRACE_SPAN("disk", "rename");
+            ok = ::rename(tmp_path.c_str(), c.full_path.c_str()) == 0;
+        }
+        if (!ok) ::unlink(tmp_path.c_str());
+        else if (store) store->remove_file(c.user_id, c.rel_path, err);
+    }
+    if (!ok) {
+        c.server->uploads().finish(c.upload_id);
+        return false;
+    }
+    account_commit(c, crc);
+    return true;
+}
 
-    ::mkdir(server_.root_dir().c_str(), 0755);
-    ::mkdir(base_dir.c_str(), 0755);
+// File mới đã vào chỗ: chuyển phần quota giữ chỗ của upload thành usage theo
+// kích thước logic, cập nhật metadata (kèm CRC32C để download sau gửi được mà
+// không đọc lại file).
+void ClientSession::account_commit(const CommitInfo &c, int64_t crc) {
+    FileServer &server = *c.server;
+    int64_t delta = static_cast<int64_t>(c.size) - static_cast<int64_t>(c.old_size);
+    uint64_t new_used = server.uploads().commit(c.upload_id, c.user_id, delta);
 
-    ofstream ofs(tmp_path, ios::binary);
-    if (!ofs) {
-        send_line(sockfd_, "ERR 500 Cannot open temp file");
-        return true;
-    }
+    string err;
+    server.db().update_used_bytes(c.user_id, new_used, err);
+    // Lưu metadata file (kích thước, đường dẫn, CRC) để thống kê và kiểm tra.
+    server.db().upsert_file_entry(c.user_id, c.rel_path, c.size, false, crc, err);
+    server.content_cache().invalidate(c.user_id, c.rel_path);
+}
 
-    send_line(sockfd_, "OK 100 Ready to receive");
+// CRC32C của phần file tạm đã ghi sau received byte của body b (đoạn song
+// song: của riêng đoạn). -1 nếu không biết (tắt checksum, nối lại lệch chỗ).
+int64_t ClientSession::received_crc(const InBody &b, uint64_t received) const {
+    if (!b.sink || !b.sink->checksumming() || !b.crc_known) return -1;
+    return crc32c_combine(b.base_crc, b.sink->crc(), received);
+}
 
-    const size_t BUF_SIZE = 64 * 1024;
-    vector<char> buf(BUF_SIZE);
-    uint64_t remaining = size;
+// CRC đã lưu khi commit, chỉ khi kích thước vẫn khớp file hiện tại.
+int64_t ClientSession::stored_crc(const string &rel_path, uint64_t size) {
+    uint64_t stored_size = 0;
+    uint32_t crc = 0;
+    string err;
+    if (!server_.db().get_file_crc(user_id_, rel_path, stored_size, crc, err)) return -1;
+    return stored_size == size ? (int64_t)crc : -1;
+}
 
-    while (remaining > 0) {
-        size_t chunk = remaining > BUF_SIZE ? BUF_SIZE : (size_t)remaining;
-        if (!recv_exact(sockfd_, buf.data(), chunk)) {
-            send_line(sockfd_, "ERR 500 Receive error");
-            return false;
+// enc: client nhận được body nén (v2) theo codec/level của lệnh; server chỉ
+// nén khi mẫu thử của đoạn cần gửi nén được.
+// File nhỏ đi qua ContentCache: body không nén được xếp luôn sau reply, đi
+// cùng 1 lần send, không mở/đọc file.
+bool ClientSession::begin_send(const string &rel_path, const string &full_path,
+                               uint64_t offset, uint64_t size, uint64_t total, uint64_t tag,
+                               const string &action, const vector<ChunkRef> *chunks,
+                               const Request *enc) {
+    if (!can_open_stream()) return true;
+
+    unique_ptr<OutBody> b(new OutBody);
+    CompressedSource::Reader read;
+    CachedFile cached;
+    shared_ptr<const ChunkFiles> files;
+    if (load_cached(rel_path, full_path, total, tag, chunks, cached)) {
+        shared_ptr<const string> data = cached.data;
+        read = [data](uint64_t off, char *buf, size_t len) {
+            memcpy(buf, data->data() + off, len);
+            return true;
+        };
+    } else if (chunks) {
+        // Mở mọi chunk trước reply: file bị ghi đè giữa chừng không làm đứt body.
+        files = server_.chunk_store()->open_range(*chunks, offset, size);
+        if (!files) {
+            reply(409, "File changed, retry");
+            return true;
         }
-        ofs.write(buf.data(), (streamsize)chunk);
-        if (!ofs) {
-            send_line(sockfd_, "ERR 500 Write error");
+        read = [files](uint64_t off, char *buf, size_t len) {
+            return files->read(off, buf, len);
+        };
+    } else {
+        b->fd = ::open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (b->fd < 0) {
+            reply(500, "Cannot open file");
             return true;
         }
-        remaining -= chunk;
-        server_.add_bytes_in(chunk);
+        int fd = b->fd;
+        read = [fd](uint64_t off, char *buf, size_t len) {
+            return ::pread(fd, buf, len, (off_t)off) == (ssize_t)len;
+        };
     }
-    ofs.close();
 
-    ::rename(tmp_path.c_str(), full_path.c_str());
-    int64_t delta = static_cast<int64_t>(size) - static_cast<int64_t>(old_size);
-    server_.quota_mgr().adjust_usage(username_, delta);
+    Codec codec = enc && v2_ ? (Codec)enc->codec : Codec::None;
+    if (codec != Codec::None &&
+        (!codec_available(codec) ||
+         !worth_compressing([&](uint64_t off, char *buf, size_t len) {
+             return read(offset + off, buf, len);
+         }, size))) {
+        codec = Codec::None;
+    }
+    int64_t crc = !crc_ ? -1 : cached.data ? (int64_t)cached.crc : stored_crc(rel_path, total);
+    if (cached.data && codec == Codec::None) {
+        reply_body(size, total, codec, crc);
+        queue_memory_body(*cached.data, offset, size);
+        server_.logger().log(username_, action + " " + rel_path + " size=" + to_string(size));
+        return true;
+    }
+    if (codec != Codec::None) {
+        if (b->fd >= 0) advise_sequential(b->fd, offset, size);
+        b->src.reset(new CompressedSource(read, offset, size, make_encoder(codec, enc->level),
+                                          xfer_.io_eventfd));
+        b->compressed = true;
+    } else if (chunks) {
+        b->src = server_.chunk_store()->open_source(files, offset, size, xfer_);
+    } else {
+        b->src = make_file_source(b->fd, offset, size, xfer_);
+    }
 
-    string err;
-    uint64_t used = server_.quota_mgr().used(username_);
-    server_.db().update_used_bytes(user_id_, used, err);
-    // Lưu metadata file (kích thước, đường dẫn) để thống kê.
-    server_.db().upsert_file_entry(user_id_, rel_path, size, false, err);
+    b->rel_path = rel_path;
+    b->action   = action;
+    b->size     = size;
+    b->id       = cur_id_;
+    b->end_sent = !v2_;
+    b->op         = cmd_op_;
+    b->started_ns = cmd_start_;
+    cmd_deferred_ = true;
+
+    reply_body(size, total, codec, crc);
+    sends_.push_back(move(b));
+    return true;
+}
 
-    server_.logger().log(username_, "UPLOAD " + rel_path + " size=" + to_string(size));
-    send_line(sockfd_, "OK 200 Upload completed");
+// Nội dung file (total byte) từ cache; miss thì đọc cả file rồi đưa vào cache.
+// false: không dùng cache (tắt, file lớn, đọc lỗi hoặc file vừa bị thay).
+bool ClientSession::load_cached(const string &rel_path, const string &full_path,
+                                uint64_t total, uint64_t tag,
+                                const vector<ChunkRef> *chunks, CachedFile &out) {
+    ContentCache &cache = server_.content_cache();
+    if (!cache.enabled() || total > cache.max_file()) return false;
+    if (cache.get(user_id_, rel_path, total, tag, out)) return true;
+
+    string data(total, '\0');
+    if (chunks) {
+        if (!server_.chunk_store()->read_range(*chunks, 0, &data[0], total)) return false;
+    } else {
+        metrics::PhaseTimer timer(metrics::Phase::Disk);
+        TRACE_SPAN("disk", "cache_fill");
+        int fd = ::open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st{};
+        bool ok = ::fstat(fd, &st) == 0 && (uint64_t)st.st_size == total &&
+                  file_tag(st) == tag;
+        for (uint64_t got = 0; ok && got < total;) {
+            ssize_t n = ::pread(fd, &data[got], total - got, (off_t)got);
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+            if (ok) got += (uint64_t)n;
+        }
+        ::close(fd);
+        if (!ok) return false;
+    }
+    out.crc  = crc32c(0, data.data(), data.size());
+    out.data = make_shared<const string>(move(data));
+    cache.put(user_id_, rel_path, tag, out);
     return true;
 }
 
-bool ClientSession::cmd_download(const vector<string> &tokens) {
-    if (tokens.size() < 2) {
-        send_line(sockfd_, "ERR 400 Usage: DOWNLOAD <path>");
+// Body từ bộ nhớ xếp thẳng vào buffer gửi ngay sau reply (v2: cắt frame DATA).
+void ClientSession::queue_memory_body(const string &data, uint64_t offset, uint64_t size) {
+    if (!v2_) {
+        conn_.queue(data.data() + offset, size);
+    } else {
+        uint64_t sent = 0;
+        do {
+            FrameHeader h;
+            h.opcode = OP_DATA;
+            h.id     = cur_id_;
+            h.length = (uint32_t)min<uint64_t>(size - sent, DATA_CHUNK);
+            if (sent + h.length == size) h.flags = FLAG_END;
+            conn_.queue_header(h);
+            conn_.queue(data.data() + offset + sent, h.length);
+            sent += h.length;
+        } while (sent < size);
+    }
+    // Gửi ngay cùng reply (file nhỏ, lệnh tương tác), chỉ ghi nợ vào shaper.
+    charge(Direction::Out, size);
+    server_.add_bytes_out(size);
+    server_.add_logical_out(size);
+    cmd_bytes_ += size;
+}
+
+// Chuẩn bị frame kế tiếp của body. v1 gửi cả body thô như 1 frame không
+// header; v2 cắt thành frame DATA, nhỏ hơn khi có nhiều download xen nhau.
+// v2 lấy token của shaper cho cả frame trước khi gửi (frame đã bắt đầu thì
+// reply khác không chen vào được, không được dừng giữa chừng chờ token).
+// false: shaper hết token, chờ tới wake_ns_.
+bool ClientSession::start_frame(OutBody &b) {
+    uint64_t left = b.src->remaining();
+    if (!v2_) {
+        b.in_frame   = true;
+        b.hdr_off    = 0;
+        b.hdr_len    = 0;
+        b.frame_left = left;
+        b.frame_len  = left;
         return true;
     }
 
-    string rel_path  = tokens[1];
-    string full_path = server_.root_dir() + "/" + username_ + "/" + rel_path;
+    uint64_t chunk = shape(Direction::Out, sends_.size() > 1 ? MUX_CHUNK : DATA_CHUNK);
+    if (chunk == 0) return false;
+    b.in_frame = true;
+    b.hdr_off  = 0;
+    b.hdr_len  = 0;
+    FrameHeader h;
+    h.opcode = OP_DATA;
+    h.id     = b.id;
+    h.length = (uint32_t)b.src->frame_size(chunk, b.end_sent);
+    if (b.end_sent) h.flags = FLAG_END;
+    encode_header(h, b.hdr);
+    b.hdr_len    = FRAME_HEADER_SIZE;
+    b.frame_left = h.length;
+    b.frame_len  = h.length;
+    charge(Direction::Out, h.length);
+    return true;
+}
 
-    uint64_t size = file_size(full_path);
-    if (size == 0) {
-        send_line(sockfd_, "ERR 404 File not found or empty");
+// Gửi tiếp frame đang dở của b (luôn là sends_.front()).
+// 1: xong frame, 0: socket đầy, 2: shaper hết token (v1) hoặc chờ đĩa, -1: lỗi (file bị
+// cắt ngắn giữa chừng thì không thể giữ đúng framing, phải đóng kết nối).
+// Các download v2 chia kết nối theo deficit round robin: stream ở đầu hàng
+// gửi tiếp frame khi còn deficit, hết thì được cộng quantum và về cuối hàng,
+// nên frame nén nhỏ không làm stream chịu thiệt về số byte.
+int ClientSession::send_frame(OutBody &b) {
+    while (b.hdr_off < b.hdr_len) {
+        ssize_t n = ::send(sockfd_, b.hdr + b.hdr_off, b.hdr_len - b.hdr_off,
+                           b.frame_left > 0 ? MSG_MORE : 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        b.hdr_off += (size_t)n;
+    }
+    while (b.frame_left > 0) {
+        // v2 đã lấy token cho cả frame ở start_frame.
+        uint64_t allow = v2_ ? b.frame_left : shape(Direction::Out, b.frame_left);
+        if (allow == 0) return 2;
+        ssize_t n = b.src->send_to(sockfd_, allow);
+        if (n < 0) return -1;
+        if (n == 0) {
+            if (!b.src->io_pending()) return 0;
+            pause_io(Direction::Out);
+            return 2;
+        }
+        if (!v2_) charge(Direction::Out, (uint64_t)n);
+        b.frame_left -= (uint64_t)n;
+        server_.add_bytes_out((uint64_t)n);
+        if (!b.compressed) server_.add_logical_out((uint64_t)n);
+    }
+
+    // Xong frame: kết thúc nếu là frame cuối, còn deficit thì giữ lượt,
+    // không thì về cuối hàng đợi.
+    b.in_frame = false;
+    b.deficit -= (int64_t)b.frame_len;
+    if (!b.end_sent && b.deficit > 0) return 1;
+    unique_ptr<OutBody> cur = move(sends_.front());
+    sends_.pop_front();
+    if (cur->end_sent) {
+        finish_send(*cur);
+    } else {
+        cur->deficit += MUX_CHUNK;
+        sends_.push_back(move(cur));
+    }
+    return 1;
+}
+
+void ClientSession::finish_send(OutBody &b) {
+    if (b.compressed) server_.add_logical_out(b.size);
+    b.src.reset();
+    if (b.fd >= 0) ::close(b.fd);
+    b.fd = -1;
+    server_.logger().log(username_, b.action + " " + b.rel_path + " size=" + to_string(b.size));
+    metrics::record_command(b.op, metrics::now_ns() - b.started_ns, false, b.size);
+    TRACE_ASYNC("stream", op_name(b.op), b.started_ns, stream_key(b.id));
+}
+
+bool ClientSession::cmd_upload(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: UPLOAD <path> <size>");
         return true;
     }
+    return begin_upload(req.path, req.size, false, req);
+}
 
-    ifstream ifs(full_path, ios::binary);
-    if (!ifs) {
-        send_line(sockfd_, "ERR 500 Cannot open file");
+bool ClientSession::cmd_download(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: DOWNLOAD <path> [<offset> <len>]");
         return true;
     }
 
-    send_line(sockfd_, "OK 100 " + to_string(size));
+    const string &rel_path = req.path;
+    uint64_t size = 0, tag = 0;
+    vector<ChunkRef> chunks;
+    if (!stat_file(rel_path, size, &chunks, &tag) || size == 0) {
+        reply(404, "File not found or empty");
+        return true;
+    }
+    // DOWNLOAD <path> <offset> <len>: len = 0 hoặc vượt cuối file => đến hết file.
+    if (req.offset > size) {
+        reply(416, "Range not satisfiable");
+        return true;
+    }
+    uint64_t len = size - req.offset;
+    if (req.length > 0 && req.length < len) len = req.length;
+    return begin_send(rel_path, user_path(rel_path), req.offset, len, size, tag, "DOWNLOAD",
+                      chunks.empty() ? nullptr : &chunks, &req);
+}
 
-    const size_t BUF_SIZE = 64 * 1024;
-    vector<char> buf(BUF_SIZE);
-    uint64_t remaining = size;
+bool ClientSession::cmd_get_text(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: GET_TEXT <path>");
+        return true;
+    }
 
-    while (remaining > 0) {
-        size_t chunk = remaining > BUF_SIZE ? BUF_SIZE : (size_t)remaining;
-        ifs.read(buf.data(), (streamsize)chunk);
-        streamsize got = ifs.gcount();
-        if (got <= 0) break;
+    const string &rel_path = req.path;
+    if (!is_txt_file(rel_path)) {
+        reply(415, "Only .txt allowed");
+        return true;
+    }
 
-        if (!send_all(sockfd_, buf.data(), (size_t)got)) {
-            return false;
-        }
-        remaining -= (uint64_t)got;
-        server_.add_bytes_out((uint64_t)got);
+    uint64_t size = 0, tag = 0;
+    vector<ChunkRef> chunks;
+    if (!stat_file(rel_path, size, &chunks, &tag)) {
+        reply(404, "File not found");
+        return true;
+    }
+    return begin_send(rel_path, user_path(rel_path), 0, size, size, tag, "GET_TEXT",
+                      chunks.empty() ? nullptr : &chunks, &req);
+}
+
+bool ClientSession::cmd_put_text(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: PUT_TEXT <path> <size>");
+        return true;
     }
 
-    server_.logger().log(username_, "DOWNLOAD " + rel_path + " size=" + to_string(size));
+    const string &rel_path = req.path;
+    if (!is_txt_file(rel_path)) {
+        reply(415, "Only .txt allowed");
+        return true;
+    }
+    return begin_upload(rel_path, req.size, true, req);
+}
+
+bool ClientSession::cmd_stats() {
+    string msg = "active=" + to_string(server_.active_users()) +
+                 " bytes_in=" + to_string(server_.bytes_in()) +
+                 " bytes_out=" + to_string(server_.bytes_out()) +
+                 " logical_in=" + to_string(server_.logical_in()) +
+                 " logical_out=" + to_string(server_.logical_out());
+    if (ChunkStore *store = server_.chunk_store()) {
+        msg += " chunk_stored=" + to_string(store->bytes_stored()) +
+               " chunk_deduped=" + to_string(store->bytes_deduped());
+    }
+    const ContentCache &cache = server_.content_cache();
+    if (cache.enabled()) {
+        msg += " cache_hits=" + to_string(cache.hits()) +
+               " cache_misses=" + to_string(cache.misses()) +
+               " cache_evictions=" + to_string(cache.evictions()) +
+               " cache_bytes=" + to_string(cache.bytes());
+    }
+    msg += " log_dropped=" + to_string(server_.logger().dropped());
+    msg += metrics::stats_text(metrics::snapshot());
+    reply(200, msg);
+    server_.logger().log(username_, "STATS");
     return true;
 }
 
-bool ClientSession::cmd_get_text(const vector<string> &tokens) {
-    if (tokens.size() < 2) {
-        send_line(sockfd_, "ERR 400 Usage: GET_TEXT <path>");
+// "OK 200 <committed> <size> active|parked": client nối tiếp từ <committed>.
+bool ClientSession::cmd_upload_status(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: UPLOAD_STATUS <upload_id>");
+        return true;
+    }
+    PartialUpload u;
+    if (!server_.uploads().get(req.upload_id, username_, u)) {
+        reply(404, "Unknown upload");
         return true;
     }
+    MsgBuf msg;
+    msg.add(u.committed).add(' ').add(u.size).add(u.active ? " active" : " parked");
+    send_reply(200, msg.view(), u.committed);
+    return true;
+}
 
-    string rel_path  = tokens[1];
-    if (!is_txt_file(rel_path)) {
-        send_line(sockfd_, "ERR 415 Only .txt allowed");
+// Nhận tiếp body từ offset (<= phần đã ghi); phần sau offset trong file tạm
+// bị cắt bỏ. Sau "OK 100" client gửi size - offset byte còn lại.
+bool ClientSession::cmd_upload_resume(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: UPLOAD_RESUME <upload_id> <offset>");
         return true;
     }
+    if (!can_open_stream()) return true;
 
-    string full_path = server_.root_dir() + "/" + username_ + "/" + rel_path;
+    PartialUpload u;
+    int code = server_.uploads().resume(req.upload_id, username_, u);
+    if (code == 404) {
+        reply(404, "Unknown upload");
+        return true;
+    }
+    if (code == 409) {
+        reply(409, "Upload in progress");
+        return true;
+    }
+    if (code == 400) {
+        reply(400, "Parallel upload: use UPLOAD_PART");
+        return true;
+    }
+    if (req.offset > u.committed) {
+        server_.uploads().park(u.id, u.committed, u.crc_ok ? (int64_t)u.crc : -1);
+        reply(416, "Offset beyond committed size");
+        return true;
+    }
 
-    ifstream ifs(full_path);
-    if (!ifs) {
-        send_line(sockfd_, "ERR 404 File not found");
+    int fd = ::open(u.tmp_path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || ::ftruncate(fd, (off_t)req.offset) != 0) {
+        if (fd >= 0) ::close(fd);
+        ::unlink(u.tmp_path.c_str());
+        server_.uploads().finish(u.id);
+        reply(500, "Cannot open temp file");
+        return true;
+    }
+    server_.logger().log(username_, "UPLOAD_RESUME " + u.rel_path + " offset=" + to_string(req.offset));
+    return open_in_body(u, fd, req.offset, u.size - req.offset, false);
+}
+
+// UPLOAD_OPEN <path> <size> -> "OK 200 <upload_id>": mở upload song song, sau
+// đó client gửi các UPLOAD_PART qua 1 hay nhiều kết nối rồi UPLOAD_COMMIT.
+bool ClientSession::cmd_upload_open(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: UPLOAD_OPEN <path> <size>");
         return true;
     }
 
-    string content((istreambuf_iterator<char>(ifs)),
-                   istreambuf_iterator<char>());
+    PartialUpload u;
+    if (!register_upload(u, req.path, req.size, false, true)) return true;
 
-    uint64_t size = content.size();
-    send_line(sockfd_, "OK 100 " + to_string(size));
-    if (!send_all(sockfd_, content.data(), content.size())) {
-        return false;
+    int fd = ::open(u.tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && preallocate(fd, u.size);
+    if (fd >= 0 && ::close(fd) != 0) ok = false;
+    if (!ok) {
+        ::unlink(u.tmp_path.c_str());
+        server_.uploads().finish(u.id);
+        reply(507, "Cannot allocate temp file");
+        return true;
     }
-    server_.add_bytes_out(size);
-    server_.logger().log(username_, "GET_TEXT " + rel_path + " size=" + to_string(size));
+
+    server_.logger().log(username_, "UPLOAD_OPEN " + u.rel_path + " size=" + to_string(u.size));
+    MsgBuf msg;
+    msg.add(u.id);
+    send_reply(200, msg.view(), u.id);
     return true;
 }
 
-bool ClientSession::cmd_put_text(const vector<string> &tokens) {
-    if (tokens.size() < 3) {
-        send_line(sockfd_, "ERR 400 Usage: PUT_TEXT <path> <size>");
+// UPLOAD_PART <upload_id> <offset> <len>: nhận len byte, ghi vào file tạm tại
+// offset. Các đoạn có thể đến song song từ nhiều kết nối, theo thứ tự bất kỳ.
+bool ClientSession::cmd_upload_part(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: UPLOAD_PART <upload_id> <offset> <len>");
         return true;
     }
+    if (!can_open_stream()) return true;
 
-    string rel_path = tokens[1];
-    if (!is_txt_file(rel_path)) {
-        send_line(sockfd_, "ERR 415 Only .txt allowed");
+    PartialUpload u;
+    int code = server_.uploads().begin_part(req.upload_id, username_, req.offset,
+                                            req.length, u);
+    if (code == 404) {
+        reply(404, "Unknown upload");
+        return true;
+    }
+    if (code == 409) {
+        reply(409, "Upload is committing");
+        return true;
+    }
+    if (code == 416) {
+        reply(416, "Range outside file");
         return true;
     }
 
-    uint64_t size   = stoull(tokens[2]);
+    int fd = ::open(u.tmp_path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        server_.uploads().end_part(u.id, req.offset, 0, -1);
+        reply(500, "Cannot open temp file");
+        return true;
+    }
+    return open_in_body(u, fd, req.offset, req.length, true);
+}
 
-    string base_dir  = server_.root_dir() + "/" + username_;
-    string full_path = base_dir + "/" + rel_path;
-    uint64_t old_size = file_size(full_path);
-    uint64_t additional = size > old_size ? size - old_size : 0;
+// UPLOAD_COMMIT <upload_id>: chỉ khi mọi đoạn đã về mới đổi tên file tạm
+// thành file thật (atomic); thiếu đoạn thì 409, client gửi bù rồi commit lại.
+bool ClientSession::cmd_upload_commit(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: UPLOAD_COMMIT <upload_id>");
+        return true;
+    }
 
-    if (!server_.quota_mgr().can_allocate(username_, additional)) {
-        send_line(sockfd_, "ERR 403 Quota exceeded");
+    PartialUpload u;
+    int code = server_.uploads().begin_commit(req.upload_id, username_, u);
+    if (code == 404) {
+        reply(404, "Unknown upload");
+        return true;
+    }
+    if (code == 409) {
+        reply(409, "Missing ranges");
         return true;
     }
 
-    string tmp_path  = full_path + ".tmp";
+    // Các đoạn nối kín file: CRC của đoạn duy nhất còn lại là CRC cả file.
+    int64_t crc = -1;
+    if (u.crc_ok && u.size == 0) crc = 0;
+    else if (u.crc_ok && u.ranges.size() == 1) crc = u.ranges.begin()->second.crc;
+    CommitInfo c = commit_info(u.rel_path, u.full_path, u.size, u.old_size, u.id);
+    string tmp   = u.tmp_path;
+    start_job(nullptr, server_.chunk_store() != nullptr, [c, tmp, crc](BgJob &job) {
+        if (!commit_file(c, tmp, crc)) {
+            job.code = 500;
+            job.msg  = "Commit failed";
+            return;
+        }
+        job.code = 200;
+        job.msg  = "Upload completed";
+        job.log  = "UPLOAD " + c.rel_path + " size=" + to_string(c.size) + " parallel";
+    });
+    return true;
+}
 
-    ::mkdir(server_.root_dir().c_str(), 0755);
-    ::mkdir(base_dir.c_str(), 0755);
+// HAVE_CHUNKS <hash>... -> "OK 200 <bits>": bit thứ i = '1' nếu server đã có
+// chunk thứ i, client chỉ cần PUT_CHUNK các chunk còn thiếu.
+bool ClientSession::cmd_have_chunks(const Request &req) {
+    ChunkStore *store = server_.chunk_store();
+    if (!store) {
+        reply(501, "Chunk store disabled");
+        return true;
+    }
+    if (!req.valid || req.hashes.empty() || req.hashes.size() > MAX_HAVE_CHUNKS) {
+        reply(400, "Usage: HAVE_CHUNKS <hash>... (max " + to_string(MAX_HAVE_CHUNKS) + ")");
+        return true;
+    }
+
+    string bits;
+    bits.reserve(req.hashes.size());
+    for (const auto &h : req.hashes) {
+        bits += ChunkStore::valid_hash(h) && store->has_chunk(h) ? '1' : '0';
+    }
+    reply(200, bits);
+    return true;
+}
 
-    ofstream ofs(tmp_path);
-    if (!ofs) {
-        send_line(sockfd_, "ERR 500 Cannot open temp file");
+// PUT_CHUNK <hash> <size>: nhận nội dung 1 chunk vào store. Chunk đã có thì
+// trả 200 ngay, client không gửi body.
+bool ClientSession::cmd_put_chunk(const Request &req) {
+    ChunkStore *store = server_.chunk_store();
+    if (!store) {
+        reply(501, "Chunk store disabled");
+        return true;
+    }
+    if (!req.valid || !ChunkStore::valid_hash(req.hashes[0])) {
+        reply(400, "Usage: PUT_CHUNK <sha256> <size>");
+        return true;
+    }
+    if (req.size == 0 || req.size > CDC_MAX_SIZE) {
+        reply(413, "Chunk too large");
+        return true;
+    }
+    if (store->has_chunk(req.hashes[0])) {
+        reply(200, "Chunk exists");
         return true;
     }
+    if (!can_open_stream()) return true;
+
+    PartialUpload u;
+    u.tmp_path = store->temp_path();
+    u.size     = req.size;
+    int fd = ::open(u.tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        reply(500, "Cannot open temp file");
+        return true;
+    }
+    open_in_body(u, fd, 0, req.size, false);
+    InBody &b = *recvs_[cur_id_];
+    b.chunk = true;
+    b.hash  = req.hashes[0];
+    return true;
+}
 
-    send_line(sockfd_, "OK 100 Ready to receive");
+// UPLOAD_RECIPE <path> <size> <count>: body là count mục (sha256 32 byte +
+// size u64 big-endian). Mọi chunk phải có sẵn trong store; quota tính theo
+// size như upload thường.
+bool ClientSession::cmd_upload_recipe(const Request &req) {
+    if (!server_.chunk_store()) {
+        reply(501, "Chunk store disabled");
+        return true;
+    }
+    if (!req.valid || req.length == 0 || req.length > MAX_RECIPE_CHUNKS) {
+        reply(400, "Usage: UPLOAD_RECIPE <path> <size> <count>");
+        return true;
+    }
+    if (!can_open_stream()) return true;
 
-    const size_t BUF_SIZE = 64 * 1024;
-    vector<char> buf(BUF_SIZE);
-    uint64_t remaining = size;
+    PartialUpload u;
+    if (!register_upload(u, req.path, req.size, false, false)) return true;
 
-    while (remaining > 0) {
-        size_t chunk = remaining > BUF_SIZE ? BUF_SIZE : (size_t)remaining;
-        if (!recv_exact(sockfd_, buf.data(), chunk)) {
-            send_line(sockfd_, "ERR 500 Receive error");
-            return false;
-        }
-        ofs.write(buf.data(), (streamsize)chunk);
-        if (!ofs) {
-            send_line(sockfd_, "ERR 500 Write error");
-            return true;
-        }
-        remaining -= chunk;
-        server_.add_bytes_in(chunk);
+    int fd = ::open(u.tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        server_.uploads().finish(u.id);
+        reply(500, "Cannot open temp file");
+        return true;
     }
-    ofs.close();
+    open_in_body(u, fd, 0, req.length * RECIPE_ENTRY, false);
+    recvs_[cur_id_]->recipe = true;
+    return true;
+}
 
-    ::rename(tmp_path.c_str(), full_path.c_str());
-    int64_t delta = static_cast<int64_t>(size) - static_cast<int64_t>(old_size);
-    int64_t new_used = server_.quota_mgr().adjust_usage(username_, delta);
+// Chạy nền: đọc danh sách chunk, kiểm tra store có đủ rồi ghi metadata.
+void ClientSession::commit_recipe(const CommitInfo &c, const string &recipe_path, BgJob &job) {
+    string body;
+    {
+        ifstream in(recipe_path, ios::binary);
+        body.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    ::unlink(recipe_path.c_str());
+
+    vector<ChunkRef> chunks;
+    uint64_t total = 0;
+    bool ok = body.size() % RECIPE_ENTRY == 0;
+    for (size_t off = 0; ok && off < body.size(); off += RECIPE_ENTRY) {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(body.data() + off);
+        ChunkRef c;
+        c.hash = digest_to_hex(p);
+        for (int i = 0; i < 8; ++i) c.size = (c.size << 8) | p[Sha256::DIGEST_SIZE + i];
+        ok = c.size > 0 && c.size <= CDC_MAX_SIZE;
+        total += c.size;
+        chunks.push_back(move(c));
+    }
+    if (!ok || total != c.size) {
+        c.server->uploads().finish(c.upload_id);
+        job.code = 400;
+        job.msg  = "Bad recipe";
+        return;
+    }
 
     string err;
-    server_.db().update_used_bytes(user_id_, static_cast<uint64_t>(new_used), err);
-    server_.db().upsert_file_entry(user_id_, rel_path, size, false, err);
+    vector<string> missing;
+    if (!c.server->chunk_store()->commit_recipe(c.user_id, c.rel_path, c.size, chunks, missing,
+                                                err)) {
+        c.server->uploads().finish(c.upload_id);
+        job.code = missing.empty() ? 500 : 409;
+        job.msg  = missing.empty() ? "Commit failed"
+                                   : "Missing chunks " + to_string(missing.size());
+        return;
+    }
+    ::unlink(c.full_path.c_str());
+    // Chunk đã kiểm bằng SHA-256; CRC cả file không có sẵn.
+    account_commit(c, -1);
+    job.code = 200;
+    job.msg  = "Upload completed";
+    job.log  = "UPLOAD " + c.rel_path + " size=" + to_string(c.size) +
+               " dedup chunks=" + to_string(chunks.size());
+}
 
-    server_.logger().log(username_, "PUT_TEXT " + rel_path + " size=" + to_string(size));
-    send_line(sockfd_, "OK 200 Text file updated");
+// SIGNATURE <path> -> "OK 100 <len>" + body chữ ký từng block của file hiện
+// tại (common/Delta.hpp). Client dò file mới theo chữ ký rồi UPLOAD_DELTA.
+bool ClientSession::cmd_signature(const Request &req) {
+    if (!req.valid) {
+        reply(400, "Usage: SIGNATURE <path>");
+        return true;
+    }
+    if (!can_open_stream()) return true;
+
+    uint64_t size = 0;
+    int fd = -1;
+    BasisReader read;
+    if (!open_basis(req.path, size, fd, read)) {
+        reply(404, "File not found");
+        return true;
+    }
+
+    // Chữ ký sinh dần trong lúc gửi; fd của file cũ đóng khi body xong.
+    unique_ptr<OutBody> b(new OutBody);
+    b->fd       = fd;
+    b->src.reset(new SignatureSource(size, move(read), xfer_.io_eventfd));
+    b->size     = b->src->remaining();
+    b->rel_path = req.path;
+    b->action   = "SIGNATURE";
+    b->id       = cur_id_;
+    b->end_sent = !v2_;
+    b->op         = cmd_op_;
+    b->started_ns = cmd_start_;
+    cmd_deferred_ = true;
+
+    reply_body(b->size, b->size);
+    sends_.push_back(move(b));
     return true;
 }
 
-bool ClientSession::cmd_stats() {
-    string msg = "OK 200 active=" + to_string(server_.active_users()) +
-                 " bytes_in=" + to_string(server_.bytes_in()) +
-                 " bytes_out=" + to_string(server_.bytes_out());
-    send_line(sockfd_, msg);
-    server_.logger().log(username_, "STATS");
+// UPLOAD_DELTA <path> <size> <delta_len>: body là delta (delta_len byte) so
+// với file hiện tại; server dựng file mới vào .tmp rồi commit như upload
+// thường (đổi tên atomic, quota tính theo size).
+bool ClientSession::cmd_upload_delta(const Request &req) {
+    if (!req.valid || req.length < DELTA_HEADER_SIZE) {
+        reply(400, "Usage: UPLOAD_DELTA <path> <size> <delta_len>");
+        return true;
+    }
+    if (req.length > DELTA_HEADER_SIZE + req.size + req.size / 16 + DELTA_SLACK) {
+        reply(413, "Delta too large");
+        return true;
+    }
+    if (!can_open_stream()) return true;
+
+    PartialUpload u;
+    if (!register_upload(u, req.path, req.size, is_txt_file(req.path), false)) return true;
+
+    // Body delta nằm cạnh file tạm; .tmp dành cho file dựng lại.
+    u.tmp_path = u.full_path + ".delta";
+    int fd = ::open(u.tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        server_.uploads().finish(u.id);
+        reply(500, "Cannot open temp file");
+        return true;
+    }
+    open_in_body(u, fd, 0, req.length, false);
+    recvs_[cur_id_]->delta = true;
     return true;
 }
+
+// Mở file cũ ngay (chunk của nó được giữ tới khi dựng xong), còn việc dựng
+// file mới (đọc mọi block được tham chiếu, ghi + CRC cả file) và commit chạy
+// nền; reply khi job xong.
+void ClientSession::commit_delta(InBody &b) {
+    uint64_t basis_size = 0;
+    int basis_fd = -1;
+    BasisReader read;
+    // Chưa có file: delta chỉ được chứa literal.
+    if (!open_basis(b.rel_path, basis_size, basis_fd, read)) {
+        basis_size = 0;
+        read = [](uint64_t, char *, size_t) { return false; };
+    }
+
+    CommitInfo c = commit_info(b.rel_path, b.full_path, b.size, b.old_size, b.upload_id);
+    string delta_path = b.tmp_path;
+    bool is_text      = b.is_text;
+    uint64_t delta_len = b.part_len;
+    start_job(&b, true, [c, delta_path, basis_size, basis_fd, read, is_text,
+                         delta_len](BgJob &job) {
+        string out_path = c.full_path + ".tmp";
+        int in  = ::open(delta_path.c_str(), O_RDONLY | O_CLOEXEC);
+        int out = ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        uint32_t crc = 0;
+        int code;
+        {
+            TRACE_SPAN("disk", "apply_delta");
+            code = in < 0 || out < 0 ? 500 : apply_delta(in, basis_size, read, out, c.size, &crc);
+        }
+        if (in >= 0) ::close(in);
+        if (out >= 0 && ::close(out) != 0 && code == 0) code = 500;
+        if (basis_fd >= 0) ::close(basis_fd);
+        ::unlink(delta_path.c_str());
+
+        if (code != 0) {
+            ::unlink(out_path.c_str());
+            c.server->uploads().finish(c.upload_id);
+            job.code = code;
+            job.msg  = code == 409 ? "Basis changed" : code == 400 ? "Bad delta" : "Write error";
+            return;
+        }
+        if (!commit_file(c, out_path, crc)) {
+            job.code = 500;
+            job.msg  = "Commit failed";
+            return;
+        }
+        job.code = 200;
+        job.msg  = is_text ? "Text file updated" : "Upload completed";
+        job.log  = string(is_text ? "PUT_TEXT " : "UPLOAD ") + c.rel_path + " size=" +
+                   to_string(c.size) + " delta=" + to_string(delta_len);
+    });
+}
@@ -2,32 +2,246 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <memory>
+#include <map>
+#include <deque>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include "Transfer.hpp"
+#include "UploadTable.hpp"
+#include "ContentCache.hpp"
+#include "Shaper.hpp"
+#include "../common/Protocol.hpp"
+#include "../common/Chunker.hpp"
+#include "../common/Delta.hpp"
 
 using namespace std;
 
 class FileServer;
 
+// Session là một state machine: đọc lệnh theo dòng, nhận/gửi body theo từng
+// phần. Cùng một code chạy được ở 2 chế độ:
+//  - thread-per-connection: socket blocking, run() chạy đến khi client ngắt.
+//  - epoll: socket non-blocking, EventLoop gọi on_readable()/on_writable().
+// Ở v1 mỗi lúc chỉ có 1 body; ở v2 nhiều upload/download chạy song song trên
+// cùng kết nối, phân biệt bằng request id (stream id) của frame DATA.
 class ClientSession {
 public:
-    ClientSession(int sockfd, FileServer &server);
+    // io_eventfd: eventfd của EventLoop nhận completion io_uring (xem io_wait()).
+    ClientSession(int sockfd, FileServer &server, int io_eventfd = -1);
+    ~ClientSession();
+
+    // Chế độ thread-per-connection.
     void run();
 
+    // Chế độ epoll. Trả về false khi session cần đóng.
+    bool on_readable();
+    bool on_writable();
+
+    int fd() const { return sockfd_; }
+    // Shaper hết token: thời điểm cần gọi lại on_writable() (0 = không chờ).
+    uint64_t wake_ns() const { return wake_ns_; }
+    // Body đang chờ io_uring: gọi lại on_writable() khi io_eventfd báo.
+    bool io_wait() const { return io_wait_; }
+
 private:
-    bool handle_command(const string &line);
-    bool cmd_auth(const vector<string> &tokens);
-    bool cmd_register(const vector<string> &tokens);
-    bool cmd_upload(const vector<string> &tokens);
-    bool cmd_download(const vector<string> &tokens);
-    bool cmd_get_text(const vector<string> &tokens);
-    bool cmd_put_text(const vector<string> &tokens);
+    // Body đang nhận cho UPLOAD / PUT_TEXT.
+    struct InBody {
+        string   rel_path;
+        string   full_path;
+        string   tmp_path;
+        uint64_t size      = 0;
+        uint64_t old_size  = 0;
+        uint64_t remaining = 0;
+        bool     is_text   = false;
+        uint32_t id        = 0;
+        uint64_t upload_id = 0;      // khóa trong UploadTable (UPLOAD_RESUME)
+        bool     part      = false;  // 1 đoạn của upload song song (UPLOAD_PART)
+        uint64_t part_offset = 0;
+        uint64_t part_len    = 0;
+        bool     chunk     = false;  // PUT_CHUNK: nội dung 1 chunk, hash để kiểm tra
+        bool     recipe    = false;  // UPLOAD_RECIPE: body là danh sách chunk
+        bool     delta     = false;  // UPLOAD_DELTA: body là delta so với file cũ
+        bool     compressed = false; // body nén (v2): frame không tính vào remaining
+        uint32_t base_crc   = 0;     // CRC32C của [0, part_offset) khi nối tiếp
+        bool     crc_known  = true;  // base_crc đúng với phần đầu file tạm
+        bool     has_crc    = false; // client gửi CRC của body (frame FLAG_CRC)
+        uint32_t expect_crc = 0;
+        string   hash;
+        uint64_t frame_left = 0;     // byte còn lại của frame DATA hiện tại
+        bool     end_seen   = false; // đã gặp FLAG_END (v1: luôn true)
+        proto::Op op        = proto::Op::None; // lệnh mở body, đo độ trễ khi xong
+        uint64_t started_ns = 0;
+        int      fd        = -1;
+        unique_ptr<BodySink> sink;
+    };
+
+    // Body đang gửi cho DOWNLOAD / GET_TEXT.
+    struct OutBody {
+        string   rel_path;
+        string   action;
+        uint64_t size      = 0;
+        uint32_t id        = 0;
+        uint64_t frame_left = 0;
+        bool     end_sent   = false;
+        bool     in_frame   = false; // frame đã bắt đầu gửi, chưa xong
+        bool     compressed = false;
+        uint64_t frame_len  = 0;
+        int64_t  deficit    = 0;     // byte còn được gửi trong lượt DRR hiện tại (v2)
+        char     hdr[proto::FRAME_HEADER_SIZE];
+        size_t   hdr_len    = 0;     // v1 không có header frame
+        size_t   hdr_off    = 0;
+        proto::Op op        = proto::Op::None;
+        uint64_t started_ns = 0;
+        int      fd        = -1;
+        unique_ptr<BodySource> src;
+    };
+
+    // Việc tốn thời gian khi kết thúc lệnh (commit vào chunk store, dựng file
+    // từ delta): chạy trên run_worker, reply gửi từ loop khi done. Job chỉ
+    // dùng dữ liệu đã chép nên vẫn chạy xong dù session đã đóng.
+    struct BgJob {
+        atomic<bool> done{false};
+        int      code = 0;
+        string   msg;
+        string   log;            // dòng log khi thành công
+        uint32_t id   = 0;       // request id của reply
+        bool     body = false;   // giữ chỗ stream recvs_[id] tới khi reply
+        proto::Op op  = proto::Op::None;
+        uint64_t started_ns = 0;
+        uint64_t bytes      = 0;
+    };
+
+    // Thông tin upload cần cho commit, chép ra khỏi session.
+    struct CommitInfo {
+        FileServer *server    = nullptr;
+        int      user_id      = 0;
+        string   rel_path;
+        string   full_path;
+        uint64_t size         = 0;
+        uint64_t old_size     = 0;
+        uint64_t upload_id    = 0;
+    };
+
+    bool drive();
+    int  read_input(int flags = 0);
+    bool process_input();
+    bool flush_output();
+    bool has_input_work() const;
+    void reply(int code, string_view msg);
+    void reply_body(uint64_t size, uint64_t total, Codec codec = Codec::None,
+                    int64_t crc = -1);
+    void reply_ready(uint64_t upload_id);
+    // Reply của lệnh hiện tại (cur_id_); size: số đầu của msg (v2).
+    void send_reply(int code, string_view msg, uint64_t size = 0);
+    uint64_t shape(Direction d, uint64_t want);
+    void     charge(Direction d, uint64_t n);
+
+    bool begin_data_frame(const proto::FrameHeader &h);
+    bool end_body_crc(const proto::FrameHeader &h, const string &payload);
+    bool feed_body();
+    void finish_upload(InBody &b);
+    bool settle_uploads();
+    CommitInfo commit_info(const string &rel_path, const string &full_path, uint64_t size,
+                           uint64_t old_size, uint64_t upload_id) const;
+    // background = false hoặc socket blocking: chạy work tại chỗ.
+    void start_job(InBody *b, bool background, function<void(BgJob &)> work);
+    void end_job();
+    void pause_io(Direction d);
+    static void drop_upload(UploadTable &uploads, InBody &b, bool ok, int64_t crc);
+    bool start_frame(OutBody &b);
+    int  send_frame(OutBody &b);
+    void finish_send(OutBody &b);
+    bool can_open_stream();
+    void close_bodies();
+    // id async của stream trong trace: duy nhất trong số kết nối đang mở.
+    uint64_t stream_key(uint32_t id) const { return (uint64_t)sockfd_ << 32 | id; }
+
+    bool handle_command(string_view line);
+    bool dispatch(const proto::Request &req);
+    bool run_command(const proto::Request &req);
+    bool cmd_hello(const vector<string> &tokens);
+    bool cmd_auth(const proto::Request &req);
+    bool cmd_register(const proto::Request &req);
+    bool cmd_upload(const proto::Request &req);
+    bool cmd_download(const proto::Request &req);
+    bool cmd_get_text(const proto::Request &req);
+    bool cmd_put_text(const proto::Request &req);
     bool cmd_stats();
+    bool cmd_upload_status(const proto::Request &req);
+    bool cmd_upload_resume(const proto::Request &req);
+    bool cmd_upload_open(const proto::Request &req);
+    bool cmd_upload_part(const proto::Request &req);
+    bool cmd_upload_commit(const proto::Request &req);
+    bool cmd_have_chunks(const proto::Request &req);
+    bool cmd_put_chunk(const proto::Request &req);
+    bool cmd_upload_recipe(const proto::Request &req);
+    bool cmd_signature(const proto::Request &req);
+    bool cmd_upload_delta(const proto::Request &req);
+
+    bool begin_upload(const string &rel_path, uint64_t size, bool is_text,
+                      const proto::Request &req);
+    bool register_upload(PartialUpload &u, const string &rel_path, uint64_t size,
+                         bool is_text, bool parallel);
+    bool open_in_body(const PartialUpload &u, int fd, uint64_t offset, uint64_t len,
+                      bool part);
+    // Chạy được trên thread nền (chỉ dùng c, không đụng session).
+    static bool commit_file(const CommitInfo &c, const string &tmp_path, int64_t crc);
+    static void commit_recipe(const CommitInfo &c, const string &recipe_path, BgJob &job);
+    void commit_delta(InBody &b);
+    static void account_commit(const CommitInfo &c, int64_t crc);
+    int64_t received_crc(const InBody &b, uint64_t received) const;
+    int64_t stored_crc(const string &rel_path, uint64_t size);
+    bool begin_send(const string &rel_path, const string &full_path,
+                    uint64_t offset, uint64_t size, uint64_t total, uint64_t tag,
+                    const string &action, const vector<ChunkRef> *chunks = nullptr,
+                    const proto::Request *enc = nullptr);
+    bool load_cached(const string &rel_path, const string &full_path, uint64_t total,
+                     uint64_t tag, const vector<ChunkRef> *chunks, CachedFile &out);
+    void queue_memory_body(const string &data, uint64_t offset, uint64_t size);
 
     bool ensure_authenticated();
     uint64_t file_size(const string &path);
+    const string &user_path(const string &rel_path);
+    bool stat_file(const string &rel_path, uint64_t &size, vector<ChunkRef> *chunks,
+                   uint64_t *tag = nullptr);
+    bool open_basis(const string &rel_path, uint64_t &size, int &fd, BasisReader &read);
 
     int sockfd_;
     FileServer &server_;
     string username_;
     int user_id_ = 0;
     bool authenticated_ = false;
+
+    bool    closing_ = false; // đóng sau khi gửi hết reply đang chờ
+    bool    v2_      = false; // đã bắt tay HELLO v2: lệnh/reply là frame nhị phân
+    bool    crc_     = false; // HELLO có "crc32c": reply body kèm CRC của file
+    uint32_t cur_id_ = 0;     // request id của lệnh đang xử lý (v2)
+    bool    out_blocked_ = false; // lần flush gần nhất dừng vì socket đầy
+    Shaper::SessionLink shape_;
+    uint64_t wake_ns_    = 0;     // shaper cho gửi/nhận tiếp lúc này
+    bool     io_wait_    = false; // chờ completion io_uring
+    // Body chờ token shaper hoặc chờ đĩa: không phải chờ socket.
+    bool     rx_paused_  = false;
+    bool     tx_paused_  = false;
+    // Đo lệnh đang xử lý: lệnh mở body được ghi nhận khi body xong (deferred).
+    proto::Op cmd_op_      = proto::Op::None;
+    uint64_t  cmd_start_   = 0;
+    uint64_t  cmd_bytes_   = 0;
+    bool      cmd_deferred_ = false;
+    int       last_code_   = 0;  // mã reply gần nhất
+    proto::Conn conn_;
+    // Dùng lại giữa các lệnh để đường lệnh không cấp phát: Request đã parse,
+    // payload frame v2, đường dẫn root_dir/<user>/<path> (xem user_path).
+    proto::Request req_;
+    string frame_buf_;
+    string path_buf_;
+
+    TransferOptions xfer_;
+    map<uint32_t, unique_ptr<InBody>> recvs_; // upload đang mở, theo stream id
+    InBody *rx_ = nullptr;                    // upload nhận payload frame hiện tại
+    deque<unique_ptr<OutBody>> sends_;        // download đang mở, xoay vòng mỗi frame
+    vector<uint32_t> settling_;               // upload đủ body, chờ ghi io_uring xong
+    shared_ptr<BgJob> bg_;                    // commit đang chạy nền, chưa reply
 };
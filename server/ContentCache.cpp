@@ -0,0 +1,85 @@
+// ===== file: server/ContentCache.cpp =====
+#include "ContentCache.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace {
+const size_t SHARDS = 16;
+} // namespace
+
+ContentCache::ContentCache(uint64_t capacity, uint64_t max_file)
+    : capacity_(capacity),
+      max_file_(min(max_file, capacity / SHARDS)),
+      shard_capacity_(capacity / SHARDS) {
+    for (size_t i = 0; i < SHARDS; ++i) shards_.emplace_back(new Shard);
+}
+
+// id là số, không chứa '/': "id/path" không trùng nhau giữa các user.
+string ContentCache::make_key(int user_id, const string &path) {
+    return to_string(user_id) + "/" + path;
+}
+
+ContentCache::Shard &ContentCache::shard_for(const string &key) {
+    return *shards_[hash<string>()(key) % shards_.size()];
+}
+
+void ContentCache::erase_locked(Shard &s, list<Entry>::iterator it) {
+    uint64_t n = it->file.data->size();
+    s.bytes -= n;
+    bytes_ -= n;
+    s.index.erase(it->key);
+    s.lru.erase(it);
+}
+
+bool ContentCache::get(int user_id, const string &path, uint64_t size, uint64_t tag,
+                       CachedFile &out) {
+    if (!enabled()) return false;
+    string key = make_key(user_id, path);
+    Shard &s = shard_for(key);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.index.find(key);
+    if (it == s.index.end()) {
+        ++misses_;
+        return false;
+    }
+    if (it->second->tag != tag || it->second->file.data->size() != size) {
+        erase_locked(s, it->second);
+        ++misses_;
+        return false;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    out = it->second->file;
+    ++hits_;
+    return true;
+}
+
+void ContentCache::put(int user_id, const string &path, uint64_t tag, const CachedFile &file) {
+    uint64_t n = file.data->size();
+    if (!enabled() || n > max_file_) return;
+    string key = make_key(user_id, path);
+    Shard &s = shard_for(key);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) erase_locked(s, it->second);
+    while (!s.lru.empty() && s.bytes + n > shard_capacity_) {
+        erase_locked(s, prev(s.lru.end()));
+        ++evictions_;
+    }
+    Entry e;
+    e.key  = key;
+    e.tag  = tag;
+    e.file = file;
+    s.lru.push_front(move(e));
+    s.index[key] = s.lru.begin();
+    s.bytes += n;
+    bytes_ += n;
+}
+
+void ContentCache::invalidate(int user_id, const string &path) {
+    if (!enabled()) return;
+    string key = make_key(user_id, path);
+    Shard &s = shard_for(key);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) erase_locked(s, it->second);
+}
@@ -0,0 +1,71 @@
+// ===== file: server/ContentCache.hpp =====
+#pragma once
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Nội dung 1 file nhỏ trong cache. data dùng chung giữa cache và các session
+// đang gửi nên entry bị loại giữa chừng cũng không ảnh hưởng.
+struct CachedFile {
+    shared_ptr<const string> data;
+    uint32_t crc = 0; // CRC32C của cả file
+};
+
+// Cache nội dung file nhỏ hay được GET_TEXT/DOWNLOAD, giới hạn theo tổng byte.
+// Chia shard theo hash của khóa, mỗi shard 1 mutex + danh sách LRU riêng để
+// các event loop không tranh nhau 1 khóa. Khóa là (user, đường dẫn); entry
+// chỉ dùng được khi (size, tag) còn khớp với file hiện tại (tag: mtime của
+// file thường, dấu vân tay danh sách chunk khi ở chunk store), ngoài ra commit
+// nào ghi đè đường dẫn cũng xóa entry ngay.
+class ContentCache {
+public:
+    // capacity = 0: tắt cache. File lớn hơn max_file không được cache.
+    ContentCache(uint64_t capacity, uint64_t max_file);
+
+    bool enabled() const { return capacity_ > 0; }
+    uint64_t max_file() const { return max_file_; }
+
+    // Hit: out nhận nội dung. Entry cũ (size/tag lệch) bị bỏ và tính là miss.
+    bool get(int user_id, const string &path, uint64_t size, uint64_t tag, CachedFile &out);
+    // Thêm/thay entry, loại các entry ít dùng nhất của shard nếu quá dung lượng.
+    void put(int user_id, const string &path, uint64_t tag, const CachedFile &file);
+    void invalidate(int user_id, const string &path);
+
+    uint64_t hits()      const { return hits_.load(); }
+    uint64_t misses()    const { return misses_.load(); }
+    uint64_t evictions() const { return evictions_.load(); }
+    uint64_t bytes()     const { return bytes_.load(); }
+
+private:
+    struct Entry {
+        string     key;
+        uint64_t   tag = 0;
+        CachedFile file;
+    };
+    struct Shard {
+        mutex mtx;
+        list<Entry> lru; // đầu = dùng gần nhất
+        unordered_map<string, list<Entry>::iterator> index;
+        uint64_t bytes = 0;
+    };
+
+    static string make_key(int user_id, const string &path);
+    Shard &shard_for(const string &key);
+    void erase_locked(Shard &s, list<Entry>::iterator it);
+
+    uint64_t capacity_;
+    uint64_t max_file_;
+    uint64_t shard_capacity_;
+    vector<unique_ptr<Shard>> shards_;
+    atomic<uint64_t> hits_{0};
+    atomic<uint64_t> misses_{0};
+    atomic<uint64_t> evictions_{0};
+    atomic<uint64_t> bytes_{0};
+};
@@ -1,7 +1,9 @@
 // ===== file: server/Db.hpp =====
 #pragma once
 #include <string>
+#include <vector>
 #include <cstdint>
+#include "../common/Chunker.hpp"
 
 using namespace std;
 
@@ -38,9 +40,47 @@ public:
                              uint64_t quota_bytes,
                              string &err) = 0;
 
+    // crc32c: CRC của nội dung file, -1 = chưa biết (lưu NULL).
     virtual bool upsert_file_entry(int owner_id,
                                    const string &path,
                                    uint64_t size_bytes,
                                    bool is_folder,
+                                   int64_t crc32c,
                                    string &err) = 0;
+
+    // CRC32C đã lưu lúc commit cùng kích thước lúc đó. false: không có file
+    // hoặc CRC chưa biết (err rỗng), hoặc lỗi DB.
+    virtual bool get_file_crc(int owner_id,
+                              const string &path,
+                              uint64_t &size_bytes,
+                              uint32_t &crc32c,
+                              string &err) = 0;
+
+    // ---- Chunk store ----
+    // Danh sách chunk của file. false: file không nằm trong chunk store
+    // (err rỗng) hoặc lỗi DB.
+    virtual bool get_file_chunks(int owner_id,
+                                 const string &path,
+                                 uint64_t &size_bytes,
+                                 vector<ChunkRef> &chunks,
+                                 string &err) = 0;
+
+    // Thay danh sách chunk của file (nguyên tử): tăng refcount chunk mới,
+    // giảm refcount chunk cũ; released nhận các chunk về 0 để xóa khỏi đĩa.
+    // chunks rỗng = file không còn nằm trong chunk store.
+    virtual bool put_file_chunks(int owner_id,
+                                 const string &path,
+                                 uint64_t size_bytes,
+                                 const vector<ChunkRef> &chunks,
+                                 vector<string> &released,
+                                 string &err) = 0;
+
+    // Số file đang tham chiếu chunk (0 nếu chưa có).
+    virtual bool get_chunk_refcount(const string &hash,
+                                    uint64_t &refcount,
+                                    string &err) = 0;
+
+    // Các thay đổi có thể được commit theo lô sau khi hàm trả về; chờ tới khi
+    // mọi thay đổi đã gọi trước đó nằm trên đĩa. false: lô chứa chúng bị lỗi.
+    virtual bool sync(string &err) = 0;
 };
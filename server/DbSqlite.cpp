@@ -1,22 +1,284 @@
 // ===== file: server/DbSqlite.cpp =====
 #include "DbSqlite.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 #include <iostream>
 
-DbSqlite::DbSqlite(const string &db_path) : db_path_(db_path) {
-    if (sqlite3_open(db_path_.c_str(), &db_) != SQLITE_OK) {
+StmtCache::~StmtCache() {
+    for (auto &kv : stmts_) sqlite3_finalize(kv.second);
+}
+
+sqlite3_stmt *StmtCache::get(const char *sql) {
+    auto it = stmts_.find(sql);
+    if (it != stmts_.end()) return it->second;
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK) {
+        return nullptr;
+    }
+    stmts_.emplace(sql, stmt);
+    return stmt;
+}
+
+void StmtCache::release(sqlite3_stmt *stmt) {
+    if (!stmt) return;
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+DbSqlite::DbSqlite(const string &db_path, const GroupCommitOptions &opt, size_t readers)
+    : db_path_(db_path), opt_(opt) {
+    if (opt_.max_batch == 0) opt_.max_batch = 1;
+    // Mọi truy cập db_ đã qua conn_mtx_, không cần mutex riêng của SQLite.
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+    if (sqlite3_open_v2(db_path_.c_str(), &db_, flags, nullptr) != SQLITE_OK) {
         cerr << "Cannot open SQLite: " << sqlite3_errmsg(db_) << "\n";
     } else {
+        // WAL: COMMIT chỉ ghi nối vào file -wal, 1 fsync cho cả lô.
         char *errmsg = nullptr;
-        sqlite3_exec(db_, "PRAGMA foreign_keys = ON;", nullptr, nullptr, &errmsg);
+        sqlite3_exec(db_,
+                     "PRAGMA journal_mode = WAL;"
+                     "PRAGMA synchronous = FULL;"
+                     "PRAGMA foreign_keys = ON;",
+                     nullptr, nullptr, &errmsg);
         if (errmsg) sqlite3_free(errmsg);
+        sqlite3_busy_timeout(db_, 5000);
+        open_readers(readers);
     }
+    stmts_.reset(new StmtCache(db_));
+    writer_ = thread([this]() { writer_loop(); });
 }
 
 DbSqlite::~DbSqlite() {
+    {
+        lock_guard<mutex> lock(mtx_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    writer_.join(); // commit nốt lô đang mở
+    for (auto &r : readers_) {
+        r->stmts.reset();
+        sqlite3_close(r->db);
+    }
+    stmts_.reset();
     if (db_) sqlite3_close(db_);
 }
 
+// WAL cho người đọc chạy song song với nhau và với writer; mỗi connection chỉ
+// 1 thread dùng tại 1 thời điểm.
+void DbSqlite::open_readers(size_t n) {
+    if (n == 0) n = thread::hardware_concurrency();
+    if (n == 0) n = 1;
+    for (size_t i = 0; i < n; ++i) {
+        sqlite3 *db = nullptr;
+        int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+        if (sqlite3_open_v2(db_path_.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+            cerr << "Cannot open SQLite reader: " << sqlite3_errmsg(db) << "\n";
+            sqlite3_close(db);
+            break;
+        }
+        sqlite3_busy_timeout(db, 5000);
+        unique_ptr<ReadConn> r(new ReadConn);
+        r->db = db;
+        r->stmts.reset(new StmtCache(db));
+        free_readers_.push_back(r.get());
+        readers_.push_back(move(r));
+    }
+}
+
+DbSqlite::ReadLease::ReadLease(DbSqlite &db) : owner_(db) {
+    if (db.readers_.empty()) {
+        writer_lock_ = unique_lock<mutex>(db.conn_mtx_);
+        return;
+    }
+    unique_lock<mutex> lock(db.pool_mtx_);
+    db.pool_cv_.wait(lock, [&]() { return !db.free_readers_.empty(); });
+    conn_ = db.free_readers_.back();
+    db.free_readers_.pop_back();
+}
+
+DbSqlite::ReadLease::~ReadLease() {
+    if (!conn_) return;
+    {
+        lock_guard<mutex> lock(owner_.pool_mtx_);
+        owner_.free_readers_.push_back(conn_);
+    }
+    owner_.pool_cv_.notify_one();
+}
+
+sqlite3 *DbSqlite::ReadLease::db() const {
+    return conn_ ? conn_->db : owner_.db_;
+}
+
+StmtCache &DbSqlite::ReadLease::stmts() const {
+    return conn_ ? *conn_->stmts : *owner_.stmts_;
+}
+
+// Giữ mtx_.
+uint64_t DbSqlite::enqueue(function<bool(OpResult &)> run, shared_ptr<OpResult> result) {
+    Op op;
+    op.seq    = ++queued_seq_;
+    op.run    = move(run);
+    op.result = move(result);
+    queue_.push_back(move(op));
+    wake_.notify_one();
+    return queued_seq_;
+}
+
+// Chờ writer chạy xong thay đổi seq (không chờ COMMIT); lock giữ mtx_.
+bool DbSqlite::wait_applied(unique_lock<mutex> &lock, uint64_t seq, const OpResult &result,
+                            string &err) {
+    committed_.wait(lock, [&]() { return applied_seq_ >= seq; });
+    if (!result.ok) err = result.err;
+    return result.ok;
+}
+
+string DbSqlite::file_key(int owner_id, const string &path) {
+    string key = to_string(owner_id);
+    key += '/';
+    key += path;
+    return key;
+}
+
+// Giữ mtx_. chunks: danh sách chunk mới, nullptr = không đổi.
+void DbSqlite::pend_file(uint64_t seq, int owner_id, const string &path, uint64_t size_bytes,
+                         int64_t crc32c, const vector<ChunkRef> *chunks) {
+    PendingFile &p = pending_[file_key(owner_id, path)];
+    p.seq  = seq;
+    p.size = size_bytes;
+    p.crc  = crc32c;
+    if (chunks) {
+        p.has_chunks = true;
+        p.chunks     = *chunks;
+    }
+}
+
+// Chạy thay đổi theo thứ tự xếp hàng trong lô đang mở, COMMIT khi lô đủ, hết
+// max_delay_ms hoặc có người sync. mtx_ chỉ giữ lúc lấy hàng đợi và công bố
+// tiến độ, không giữ qua SQL hay fsync của COMMIT.
+void DbSqlite::writer_loop() {
+    vector<Op> batch; // đã chạy trong lô đang mở, chạy lại nếu COMMIT lỗi
+    vector<pair<uint64_t, string>> failed;
+    bool in_txn = false;
+    unique_lock<mutex> lock(mtx_);
+    while (true) {
+        wake_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) break; // stop_, lô trước đã commit
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(opt_.max_delay_ms);
+        while (true) {
+            deque<Op> ops;
+            ops.swap(queue_);
+            uint64_t last = ops.back().seq;
+            lock.unlock();
+            apply_ops(ops, batch, in_txn, failed);
+            lock.lock();
+            applied_seq_ = last;
+            committed_.notify_all();
+            if (stop_ || sync_waiters_ > 0 || batch.size() >= opt_.max_batch) break;
+            if (!wake_.wait_until(lock, deadline, [this]() {
+                    return stop_ || sync_waiters_ > 0 || !queue_.empty();
+                })) {
+                break;
+            }
+            if (queue_.empty()) break;
+        }
+
+        uint64_t last = applied_seq_;
+        lock.unlock();
+        commit_batch(batch, in_txn, failed);
+        lock.lock();
+        durable_seq_ = last;
+        for (auto &f : failed) {
+            failures_.push_back(move(f));
+            if (failures_.size() > 64) failures_.pop_front();
+        }
+        failed.clear();
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (it->second.seq <= last) it = pending_.erase(it);
+            else ++it;
+        }
+        committed_.notify_all();
+    }
+}
+
+void DbSqlite::apply_ops(deque<Op> &ops, vector<Op> &batch, bool &in_txn,
+                         vector<pair<uint64_t, string>> &failed) {
+    lock_guard<mutex> conn(conn_mtx_);
+    for (Op &op : ops) {
+        if (!in_txn) {
+            string err;
+            // Không mở được lô thì thay đổi tự commit riêng.
+            in_txn = exec("BEGIN IMMEDIATE;", err);
+            if (!in_txn) cerr << "DB cannot begin batch: " << err << "\n";
+        }
+        OpResult scratch;
+        OpResult &r = op.result ? *op.result : scratch;
+        r.ok = op.run(r);
+        if (!r.ok) {
+            failed.emplace_back(op.seq, r.err);
+            if (!op.result) cerr << "DB write failed: " << r.err << "\n";
+        }
+        if (r.ok && in_txn) batch.push_back(move(op));
+        // Một số lỗi (đĩa đầy, I/O) làm SQLite tự rollback cả transaction.
+        if (in_txn && sqlite3_get_autocommit(db_)) {
+            in_txn = false;
+            cerr << "DB batch rolled back, retrying " << batch.size() << " changes\n";
+            replay(batch, failed);
+        }
+    }
+}
+
+void DbSqlite::commit_batch(vector<Op> &batch, bool &in_txn,
+                            vector<pair<uint64_t, string>> &failed) {
+    if (!in_txn) return;
+    lock_guard<mutex> conn(conn_mtx_);
+    in_txn = false;
+    string err;
+    if (exec("COMMIT;", err)) {
+        batch.clear();
+        return;
+    }
+    string ignored;
+    exec("ROLLBACK;", ignored);
+    // Người gọi đã được báo thành công: không bỏ cả lô mà chạy lại từng thay đổi.
+    cerr << "DB group commit failed, retrying " << batch.size() << " changes: " << err << "\n";
+    replay(batch, failed);
+}
+
+// Giữ conn_mtx_, ngoài transaction: mỗi thay đổi tự commit.
+void DbSqlite::replay(vector<Op> &batch, vector<pair<uint64_t, string>> &failed) {
+    for (Op &op : batch) {
+        OpResult r;
+        if (!op.run(r)) {
+            cerr << "DB change lost: " << r.err << "\n";
+            failed.emplace_back(op.seq, r.err);
+        }
+    }
+    batch.clear();
+}
+
+// Mọi thay đổi xếp hàng trước lời gọi này được commit ngay (không chờ
+// max_delay_ms).
+bool DbSqlite::sync(string &err) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "sync");
+    unique_lock<mutex> lock(mtx_);
+    uint64_t from = durable_seq_;
+    uint64_t seq  = queued_seq_;
+    ++sync_waiters_;
+    wake_.notify_one();
+    committed_.wait(lock, [&]() { return durable_seq_ >= seq; });
+    --sync_waiters_;
+    for (const auto &f : failures_) {
+        if (f.first > from && f.first <= seq) {
+            err = f.second;
+            return false;
+        }
+    }
+    return true;
+}
+
 bool DbSqlite::init_schema(string &err) {
+    lock_guard<mutex> lock(conn_mtx_);
     const char *sql = R"SQL(
 PRAGMA foreign_keys = ON;
 
@@ -35,6 +297,7 @@ CREATE TABLE IF NOT EXISTS file_entry (
     path        TEXT NOT NULL,
     size_bytes  INTEGER NOT NULL,
     is_folder   INTEGER NOT NULL DEFAULT 0,
+    crc32c      INTEGER,
     created_at  DATETIME DEFAULT CURRENT_TIMESTAMP,
     updated_at  DATETIME DEFAULT CURRENT_TIMESTAMP,
     FOREIGN KEY(owner_id) REFERENCES app_user(id) ON DELETE CASCADE
@@ -63,6 +326,21 @@ CREATE TABLE IF NOT EXISTS audit_log (
 
 CREATE UNIQUE INDEX IF NOT EXISTS idx_file_entry_owner_path
     ON file_entry(owner_id, path);
+
+CREATE TABLE IF NOT EXISTS chunk (
+    hash        TEXT PRIMARY KEY,
+    size_bytes  INTEGER NOT NULL,
+    refcount    INTEGER NOT NULL DEFAULT 0
+);
+
+CREATE TABLE IF NOT EXISTS file_chunk (
+    file_id     INTEGER NOT NULL,
+    seq         INTEGER NOT NULL,
+    hash        TEXT NOT NULL,
+    PRIMARY KEY(file_id, seq),
+    FOREIGN KEY(file_id) REFERENCES file_entry(id) ON DELETE CASCADE,
+    FOREIGN KEY(hash) REFERENCES chunk(hash)
+);
 )SQL";
 
     char *errmsg = nullptr;
@@ -72,125 +350,273 @@ CREATE UNIQUE INDEX IF NOT EXISTS idx_file_entry_owner_path
         if (errmsg) sqlite3_free(errmsg);
         return false;
     }
+
+    // DB tạo từ bản cũ chưa có cột crc32c.
+    bool found = false;
+    if (!has_column("file_entry", "crc32c", found, err)) return false;
+    if (!found && !exec("ALTER TABLE file_entry ADD COLUMN crc32c INTEGER;", err)) return false;
     return true;
 }
 
 bool DbSqlite::get_user_by_username(const string &username,
                                     UserRecord &out,
                                     string &err) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "get_user_by_username");
+    // Tài khoản được sync lúc REGISTER nên đọc bản đã commit là đủ.
+    ReadLease r(*this);
     const char *sql =
         "SELECT id, username, password_hash, quota_bytes, used_bytes "
         "FROM app_user WHERE username = ?;";
 
-    sqlite3_stmt *stmt = nullptr;
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        err = sqlite3_errmsg(db_);
+    Stmt stmt(r.stmts(), sql);
+    if (!stmt) {
+        err = sqlite3_errmsg(r.db());
         return false;
     }
 
     sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW) {
         out.id            = sqlite3_column_int(stmt, 0);
         out.username      = (const char*)sqlite3_column_text(stmt, 1);
         out.password_hash = (const char*)sqlite3_column_text(stmt, 2);
         out.quota_bytes   = (uint64_t)sqlite3_column_int64(stmt, 3);
         out.used_bytes    = (uint64_t)sqlite3_column_int64(stmt, 4);
-        sqlite3_finalize(stmt);
         return true;
     } else if (rc == SQLITE_DONE) {
-        sqlite3_finalize(stmt);
         return false;
     } else {
-        err = sqlite3_errmsg(db_);
-        sqlite3_finalize(stmt);
+        err = sqlite3_errmsg(r.db());
         return false;
     }
 }
 
+// Thay đổi chỉ được xếp hàng: lỗi lúc writer chạy được ghi log và báo qua
+// sync, không qua err.
 bool DbSqlite::update_used_bytes(int user_id,
                                  uint64_t used_bytes,
-                                 string &err) {
-    const char *sql =
-        "UPDATE app_user SET used_bytes = ? WHERE id = ?;";
+                                 string & /*err*/) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "update_used_bytes");
+    lock_guard<mutex> lock(mtx_);
+    enqueue([this, user_id, used_bytes](OpResult &r) {
+        const char *sql =
+            "UPDATE app_user SET used_bytes = ? WHERE id = ?;";
 
-    sqlite3_stmt *stmt = nullptr;
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        err = sqlite3_errmsg(db_);
-        return false;
-    }
+        Stmt stmt(*stmts_, sql);
+        if (!stmt) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
 
-    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)used_bytes);
-    sqlite3_bind_int(stmt, 2, user_id);
+        sqlite3_bind_int64(stmt, 1, (sqlite3_int64)used_bytes);
+        sqlite3_bind_int(stmt, 2, user_id);
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        err = sqlite3_errmsg(db_);
-        sqlite3_finalize(stmt);
-        return false;
-    }
-    sqlite3_finalize(stmt);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
+        return true;
+    });
     return true;
 }
 
+// Chờ writer chạy (không chờ COMMIT) để báo được tên đã có.
 bool DbSqlite::create_user(const string &username,
                            const string &password_hash,
                            uint64_t quota_bytes,
                            string &err) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "create_user");
+    auto result = make_shared<OpResult>();
+    unique_lock<mutex> lock(mtx_);
+    uint64_t seq = enqueue([this, username, password_hash, quota_bytes](OpResult &r) {
+        const char *sql =
+            "INSERT INTO app_user (username, password_hash, quota_bytes, used_bytes) "
+            "VALUES (?, ?, ?, 0);";
+
+        Stmt stmt(*stmts_, sql);
+        if (!stmt) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
+
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, password_hash.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, (sqlite3_int64)quota_bytes);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
+        return true;
+    }, result);
+    return wait_applied(lock, seq, *result, err);
+}
+
+bool DbSqlite::insert_log(int user_id,
+                          const string &action,
+                          const string &detail,
+                          const string &remote_ip,
+                          string & /*err*/) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "insert_log");
+    lock_guard<mutex> lock(mtx_);
+    enqueue([this, user_id, action, detail, remote_ip](OpResult &r) {
+        const char *sql =
+            "INSERT INTO audit_log (user_id, action, detail, remote_ip) "
+            "VALUES (?, ?, ?, ?);";
+
+        Stmt stmt(*stmts_, sql);
+        if (!stmt) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
+
+        if (user_id > 0)
+            sqlite3_bind_int(stmt, 1, user_id);
+        else
+            sqlite3_bind_null(stmt, 1);
+
+        sqlite3_bind_text(stmt, 2, action.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 3, detail.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 4, remote_ip.c_str(), -1, SQLITE_TRANSIENT);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
+        return true;
+    });
+    return true;
+}
+
+bool DbSqlite::upsert_file_entry(int owner_id,
+                                 const string &path,
+                                 uint64_t size_bytes,
+                                 bool is_folder,
+                                 int64_t crc32c,
+                                 string & /*err*/) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "upsert_file_entry");
+    lock_guard<mutex> lock(mtx_);
+    uint64_t seq = enqueue([this, owner_id, path, size_bytes, is_folder, crc32c](OpResult &r) {
+        return upsert_locked(owner_id, path, size_bytes, is_folder, crc32c, r.err);
+    });
+    pend_file(seq, owner_id, path, size_bytes, crc32c, nullptr);
+    return true;
+}
+
+// Giữ conn_mtx_.
+bool DbSqlite::upsert_locked(int owner_id,
+                             const string &path,
+                             uint64_t size_bytes,
+                             bool is_folder,
+                             int64_t crc32c,
+                             string &err) {
     const char *sql =
-        "INSERT INTO app_user (username, password_hash, quota_bytes, used_bytes) "
-        "VALUES (?, ?, ?, 0);";
+        "INSERT INTO file_entry (owner_id, path, size_bytes, is_folder, crc32c) "
+        "VALUES (?, ?, ?, ?, ?) "
+        "ON CONFLICT(owner_id, path) DO UPDATE SET "
+        "size_bytes = excluded.size_bytes, "
+        "is_folder = excluded.is_folder, "
+        "crc32c = excluded.crc32c, "
+        "updated_at = CURRENT_TIMESTAMP;";
 
-    sqlite3_stmt *stmt = nullptr;
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
+    Stmt stmt(*stmts_, sql);
+    if (!stmt) {
         err = sqlite3_errmsg(db_);
         return false;
     }
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, password_hash.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)quota_bytes);
+    sqlite3_bind_int(stmt, 1, owner_id);
+    sqlite3_bind_text(stmt, 2, path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)size_bytes);
+    sqlite3_bind_int(stmt, 4, is_folder ? 1 : 0);
+    if (crc32c >= 0)
+        sqlite3_bind_int64(stmt, 5, (sqlite3_int64)crc32c);
+    else
+        sqlite3_bind_null(stmt, 5);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
         err = sqlite3_errmsg(db_);
-        sqlite3_finalize(stmt);
         return false;
     }
-    sqlite3_finalize(stmt);
     return true;
 }
 
-bool DbSqlite::insert_log(int user_id,
-                          const string &action,
-                          const string &detail,
-                          const string &remote_ip,
-                          string &err) {
+bool DbSqlite::get_file_crc(int owner_id,
+                            const string &path,
+                            uint64_t &size_bytes,
+                            uint32_t &crc32c,
+                            string &err) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "get_file_crc");
+    {
+        lock_guard<mutex> lock(mtx_);
+        if (!pending_.empty()) {
+            auto it = pending_.find(file_key(owner_id, path));
+            if (it != pending_.end()) {
+                if (it->second.crc < 0) return false;
+                size_bytes = it->second.size;
+                crc32c     = (uint32_t)it->second.crc;
+                return true;
+            }
+        }
+    }
+
+    ReadLease r(*this);
     const char *sql =
-        "INSERT INTO audit_log (user_id, action, detail, remote_ip) "
-        "VALUES (?, ?, ?, ?);";
+        "SELECT size_bytes, crc32c FROM file_entry "
+        "WHERE owner_id = ? AND path = ? AND crc32c IS NOT NULL;";
 
-    sqlite3_stmt *stmt = nullptr;
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        err = sqlite3_errmsg(db_);
+    Stmt stmt(r.stmts(), sql);
+    if (!stmt) {
+        err = sqlite3_errmsg(r.db());
         return false;
     }
 
-    if (user_id > 0)
-        sqlite3_bind_int(stmt, 1, user_id);
-    else
-        sqlite3_bind_null(stmt, 1);
+    sqlite3_bind_int(stmt, 1, owner_id);
+    sqlite3_bind_text(stmt, 2, path.c_str(), -1, SQLITE_TRANSIENT);
+
+    int rc = sqlite3_step(stmt);
+    bool found = rc == SQLITE_ROW;
+    if (found) {
+        size_bytes = (uint64_t)sqlite3_column_int64(stmt, 0);
+        crc32c     = (uint32_t)sqlite3_column_int64(stmt, 1);
+    } else if (rc != SQLITE_DONE) {
+        err = sqlite3_errmsg(r.db());
+    }
+    return found;
+}
 
-    sqlite3_bind_text(stmt, 2, action.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, detail.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 4, remote_ip.c_str(), -1, SQLITE_TRANSIENT);
+bool DbSqlite::exec(const char *sql, string &err) {
+    char *errmsg = nullptr;
+    int rc = sqlite3_exec(db_, sql, nullptr, nullptr, &errmsg);
+    if (rc != SQLITE_OK) {
+        err = errmsg ? errmsg : "Unknown SQLite error";
+        if (errmsg) sqlite3_free(errmsg);
+        return false;
+    }
+    return true;
+}
 
-    rc = sqlite3_step(stmt);
+bool DbSqlite::has_column(const char *table, const char *column, bool &found, string &err) {
+    string sql = string("PRAGMA table_info(") + table + ");";
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        err = sqlite3_errmsg(db_);
+        return false;
+    }
+    found = false;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *name = (const char*)sqlite3_column_text(stmt, 1);
+        if (name && string(name) == column) found = true;
+    }
     if (rc != SQLITE_DONE) {
         err = sqlite3_errmsg(db_);
         sqlite3_finalize(stmt);
@@ -200,37 +626,209 @@ bool DbSqlite::insert_log(int user_id,
     return true;
 }
 
-bool DbSqlite::upsert_file_entry(int owner_id,
-                                 const string &path,
-                                 uint64_t size_bytes,
-                                 bool is_folder,
-                                 string &err) {
+bool DbSqlite::get_file_chunks(int owner_id,
+                               const string &path,
+                               uint64_t &size_bytes,
+                               vector<ChunkRef> &chunks,
+                               string &err) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "get_file_chunks");
+    PendingFile p;
+    bool pending = false;
+    {
+        lock_guard<mutex> lock(mtx_);
+        if (!pending_.empty()) {
+            auto it = pending_.find(file_key(owner_id, path));
+            if (it != pending_.end()) {
+                p       = it->second;
+                pending = true;
+            }
+        }
+    }
+    if (pending && p.has_chunks) {
+        size_bytes = p.size;
+        chunks     = move(p.chunks);
+        return !chunks.empty();
+    }
+
+    ReadLease r(*this);
     const char *sql =
-        "INSERT INTO file_entry (owner_id, path, size_bytes, is_folder) "
-        "VALUES (?, ?, ?, ?) "
-        "ON CONFLICT(owner_id, path) DO UPDATE SET "
-        "size_bytes = excluded.size_bytes, "
-        "is_folder = excluded.is_folder, "
-        "updated_at = CURRENT_TIMESTAMP;";
+        "SELECT f.size_bytes, c.hash, c.size_bytes "
+        "FROM file_entry f "
+        "JOIN file_chunk fc ON fc.file_id = f.id "
+        "JOIN chunk c ON c.hash = fc.hash "
+        "WHERE f.owner_id = ? AND f.path = ? "
+        "ORDER BY fc.seq;";
 
-    sqlite3_stmt *stmt = nullptr;
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        err = sqlite3_errmsg(db_);
+    Stmt stmt(r.stmts(), sql);
+    if (!stmt) {
+        err = sqlite3_errmsg(r.db());
         return false;
     }
 
     sqlite3_bind_int(stmt, 1, owner_id);
     sqlite3_bind_text(stmt, 2, path.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)size_bytes);
-    sqlite3_bind_int(stmt, 4, is_folder ? 1 : 0);
 
-    rc = sqlite3_step(stmt);
+    chunks.clear();
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        size_bytes = (uint64_t)sqlite3_column_int64(stmt, 0);
+        ChunkRef c;
+        c.hash = (const char*)sqlite3_column_text(stmt, 1);
+        c.size = (uint64_t)sqlite3_column_int64(stmt, 2);
+        chunks.push_back(c);
+    }
     if (rc != SQLITE_DONE) {
+        err = sqlite3_errmsg(r.db());
+        return false;
+    }
+    // Kích thước mới đang chờ commit, danh sách chunk không đổi.
+    if (pending) size_bytes = p.size;
+    return !chunks.empty();
+}
+
+// Chờ writer chạy (không chờ COMMIT) để biết chunk nào về 0.
+bool DbSqlite::put_file_chunks(int owner_id,
+                               const string &path,
+                               uint64_t size_bytes,
+                               const vector<ChunkRef> &chunks,
+                               vector<string> &released,
+                               string &err) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "put_file_chunks");
+    auto result = make_shared<OpResult>();
+    unique_lock<mutex> lock(mtx_);
+    uint64_t seq = enqueue([this, owner_id, path, size_bytes, chunks](OpResult &r) {
+        // Savepoint: lỗi giữa chừng chỉ bỏ phần của file này, không bỏ cả lô.
+        if (!exec("SAVEPOINT put_chunks;", r.err)) return false;
+        if (!put_file_chunks_locked(owner_id, path, size_bytes, chunks, r.released, r.err)) {
+            string ignored;
+            exec("ROLLBACK TO put_chunks;", ignored);
+            exec("RELEASE put_chunks;", ignored);
+            r.released.clear();
+            return false;
+        }
+        return exec("RELEASE put_chunks;", r.err);
+    }, result);
+    pend_file(seq, owner_id, path, size_bytes, -1, &chunks);
+    if (!wait_applied(lock, seq, *result, err)) {
+        auto it = pending_.find(file_key(owner_id, path));
+        if (it != pending_.end() && it->second.seq == seq) pending_.erase(it);
+        return false;
+    }
+    released = move(result->released);
+    return true;
+}
+
+// Giữ conn_mtx_.
+bool DbSqlite::put_file_chunks_locked(int owner_id,
+                                      const string &path,
+                                      uint64_t size_bytes,
+                                      const vector<ChunkRef> &chunks,
+                                      vector<string> &released,
+                                      string &err) {
+    // CRC do người gọi ghi lại sau khi commit (account_commit).
+    if (!upsert_locked(owner_id, path, size_bytes, false, -1, err)) return false;
+
+    sqlite3_stmt *stmt = nullptr;
+    auto fail = [&]() {
         err = sqlite3_errmsg(db_);
-        sqlite3_finalize(stmt);
+        StmtCache::release(stmt);
         return false;
+    };
+    auto prepare = [&](const char *sql) {
+        StmtCache::release(stmt);
+        stmt = stmts_->get(sql);
+        return stmt != nullptr;
+    };
+
+    if (!prepare("SELECT id FROM file_entry WHERE owner_id = ? AND path = ?;")) return fail();
+    sqlite3_bind_int(stmt, 1, owner_id);
+    sqlite3_bind_text(stmt, 2, path.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) != SQLITE_ROW) return fail();
+    sqlite3_int64 file_id = sqlite3_column_int64(stmt, 0);
+
+    // Chunk của bản cũ: giảm refcount, nhớ lại để xem chunk nào về 0.
+    vector<string> old_hashes;
+    if (!prepare("SELECT hash FROM file_chunk WHERE file_id = ?;")) return fail();
+    sqlite3_bind_int64(stmt, 1, file_id);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        old_hashes.push_back((const char*)sqlite3_column_text(stmt, 0));
     }
-    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return fail();
+
+    if (!prepare("UPDATE chunk SET refcount = refcount - 1 WHERE hash = ?;")) return fail();
+    for (const auto &h : old_hashes) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_text(stmt, 1, h.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) != SQLITE_DONE) return fail();
+    }
+
+    if (!prepare("DELETE FROM file_chunk WHERE file_id = ?;")) return fail();
+    sqlite3_bind_int64(stmt, 1, file_id);
+    if (sqlite3_step(stmt) != SQLITE_DONE) return fail();
+
+    if (!prepare("INSERT INTO chunk (hash, size_bytes, refcount) VALUES (?, ?, 1) "
+                 "ON CONFLICT(hash) DO UPDATE SET refcount = refcount + 1;")) return fail();
+    for (const auto &c : chunks) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_text(stmt, 1, c.hash.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)c.size);
+        if (sqlite3_step(stmt) != SQLITE_DONE) return fail();
+    }
+
+    if (!prepare("INSERT INTO file_chunk (file_id, seq, hash) VALUES (?, ?, ?);")) return fail();
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, file_id);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)i);
+        sqlite3_bind_text(stmt, 3, chunks[i].hash.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) != SQLITE_DONE) return fail();
+    }
+
+    // Chunk cũ không còn file nào dùng: xóa dòng, trả về để xóa file chunk.
+    if (!prepare("DELETE FROM chunk WHERE hash = ? AND refcount <= 0;")) return fail();
+    for (const auto &h : old_hashes) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_text(stmt, 1, h.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) != SQLITE_DONE) return fail();
+        if (sqlite3_changes(db_) > 0) released.push_back(h);
+    }
+    StmtCache::release(stmt);
+    return true;
+}
+
+// Chạy trên writer: thấy cả thay đổi chưa commit.
+bool DbSqlite::get_chunk_refcount(const string &hash,
+                                  uint64_t &refcount,
+                                  string &err) {
+    metrics::PhaseTimer timer(metrics::Phase::Db);
+    TRACE_SPAN("db", "get_chunk_refcount");
+    auto result = make_shared<OpResult>();
+    unique_lock<mutex> lock(mtx_);
+    uint64_t seq = enqueue([this, hash](OpResult &r) {
+        const char *sql = "SELECT refcount FROM chunk WHERE hash = ?;";
+
+        Stmt stmt(*stmts_, sql);
+        if (!stmt) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
+
+        sqlite3_bind_text(stmt, 1, hash.c_str(), -1, SQLITE_TRANSIENT);
+
+        r.count = 0;
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            r.count = (uint64_t)sqlite3_column_int64(stmt, 0);
+        } else if (rc != SQLITE_DONE) {
+            r.err = sqlite3_errmsg(db_);
+            return false;
+        }
+        return true;
+    }, result);
+    if (!wait_applied(lock, seq, *result, err)) return false;
+    refcount = result->count;
     return true;
 }
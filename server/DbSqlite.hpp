@@ -2,12 +2,64 @@
 #pragma once
 #include "Db.hpp"
 #include <sqlite3.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <unordered_map>
 
 using namespace std;
 
+// Câu lệnh đã prepare của 1 connection, prepare 1 lần rồi dùng lại. Key là
+// địa chỉ chuỗi SQL (không dựng string mỗi truy vấn), nên sql phải là chuỗi
+// literal/tĩnh: mỗi chỗ gọi luôn đưa cùng 1 con trỏ.
+class StmtCache {
+public:
+    explicit StmtCache(sqlite3 *db) : db_(db) {}
+    ~StmtCache();
+
+    // nullptr nếu prepare lỗi (sqlite3_errmsg của connection cho biết lý do).
+    sqlite3_stmt *get(const char *sql);
+    // Trả statement về trạng thái sẵn dùng (reset + bỏ bind).
+    static void release(sqlite3_stmt *stmt);
+
+private:
+    sqlite3 *db_;
+    unordered_map<const char *, sqlite3_stmt *> stmts_;
+};
+
+// Statement lấy từ cache trong 1 scope, tự release khi ra khỏi scope (không
+// để SELECT dở giữ snapshot của connection).
+class Stmt {
+public:
+    Stmt(StmtCache &cache, const char *sql) : stmt_(cache.get(sql)) {}
+    ~Stmt() { StmtCache::release(stmt_); }
+    Stmt(const Stmt &) = delete;
+    Stmt &operator=(const Stmt &) = delete;
+
+    operator sqlite3_stmt *() const { return stmt_; }
+
+private:
+    sqlite3_stmt *stmt_;
+};
+
+// Group commit: thay đổi được xếp hàng cho writer thread (người gọi không chờ
+// SQLite), writer chạy chúng trong transaction đang mở của lô và COMMIT cả lô
+// khi đủ max_batch thay đổi hoặc sau max_delay_ms kể từ thay đổi đầu lô.
+struct GroupCommitOptions {
+    size_t max_batch    = 128;
+    int    max_delay_ms = 5; // 0 = commit ngay khi writer thức dậy
+};
+
 class DbSqlite : public Db {
 public:
-    explicit DbSqlite(const string &db_path);
+    // readers: số connection chỉ đọc cho truy vấn không cần thấy lô chưa
+    // commit (đăng nhập, liệt kê); 0 = theo số core.
+    explicit DbSqlite(const string &db_path, const GroupCommitOptions &opt = {},
+                      size_t readers = 0);
     ~DbSqlite() override;
 
     bool init_schema(string &err) override;
@@ -35,9 +87,130 @@ public:
                            const string &path,
                            uint64_t size_bytes,
                            bool is_folder,
+                           int64_t crc32c,
                            string &err) override;
 
+    bool get_file_crc(int owner_id,
+                      const string &path,
+                      uint64_t &size_bytes,
+                      uint32_t &crc32c,
+                      string &err) override;
+
+    bool get_file_chunks(int owner_id,
+                         const string &path,
+                         uint64_t &size_bytes,
+                         vector<ChunkRef> &chunks,
+                         string &err) override;
+
+    bool put_file_chunks(int owner_id,
+                         const string &path,
+                         uint64_t size_bytes,
+                         const vector<ChunkRef> &chunks,
+                         vector<string> &released,
+                         string &err) override;
+
+    bool get_chunk_refcount(const string &hash,
+                            uint64_t &refcount,
+                            string &err) override;
+
+    bool sync(string &err) override;
+
 private:
+    // Kết quả lần chạy đầu của 1 thay đổi (lần chạy lại sau COMMIT lỗi không
+    // ghi vào đây).
+    struct OpResult {
+        bool ok = false;
+        string err;
+        vector<string> released; // put_file_chunks
+        uint64_t count = 0;      // get_chunk_refcount
+    };
+
+    // 1 thay đổi chờ writer thread; run chạy trên db_ khi giữ conn_mtx_.
+    struct Op {
+        uint64_t seq = 0;
+        function<bool(OpResult &)> run;
+        shared_ptr<OpResult> result; // null = người gọi không chờ
+    };
+
+    // file_entry/file_chunk đã xếp hàng mà chưa commit: connection đọc chưa
+    // thấy, nên get_file_crc/get_file_chunks đọc ở đây trước.
+    struct PendingFile {
+        uint64_t seq  = 0;
+        uint64_t size = 0;
+        int64_t  crc  = -1;
+        bool has_chunks = false;
+        vector<ChunkRef> chunks;
+    };
+
+    struct ReadConn {
+        sqlite3 *db = nullptr;
+        unique_ptr<StmtCache> stmts;
+    };
+
+    // Mượn 1 connection đọc trong pool; pool rỗng thì dùng connection ghi.
+    class ReadLease {
+    public:
+        explicit ReadLease(DbSqlite &db);
+        ~ReadLease();
+        sqlite3 *db() const;
+        StmtCache &stmts() const;
+
+    private:
+        DbSqlite &owner_;
+        ReadConn *conn_ = nullptr;
+        unique_lock<mutex> writer_lock_;
+    };
+
+    void open_readers(size_t n);
+    uint64_t enqueue(function<bool(OpResult &)> run, shared_ptr<OpResult> result = nullptr);
+    bool wait_applied(unique_lock<mutex> &lock, uint64_t seq, const OpResult &result,
+                      string &err);
+    void pend_file(uint64_t seq, int owner_id, const string &path, uint64_t size_bytes,
+                   int64_t crc32c, const vector<ChunkRef> *chunks);
+    static string file_key(int owner_id, const string &path);
+    void writer_loop();
+    void apply_ops(deque<Op> &ops, vector<Op> &batch, bool &in_txn,
+                   vector<pair<uint64_t, string>> &failed);
+    void commit_batch(vector<Op> &batch, bool &in_txn, vector<pair<uint64_t, string>> &failed);
+    void replay(vector<Op> &batch, vector<pair<uint64_t, string>> &failed);
+    bool upsert_locked(int owner_id,
+                       const string &path,
+                       uint64_t size_bytes,
+                       bool is_folder,
+                       int64_t crc32c,
+                       string &err);
+
+    bool exec(const char *sql, string &err);
+    bool has_column(const char *table, const char *column, bool &found, string &err);
+    bool put_file_chunks_locked(int owner_id,
+                                const string &path,
+                                uint64_t size_bytes,
+                                const vector<ChunkRef> &chunks,
+                                vector<string> &released,
+                                string &err);
+
     string db_path_;
     sqlite3 *db_ = nullptr;
+
+    unique_ptr<StmtCache> stmts_; // của db_, chỉ dùng khi giữ conn_mtx_
+    mutex conn_mtx_;              // giữ db_: writer thread, init_schema, ReadLease dự phòng
+
+    vector<unique_ptr<ReadConn>> readers_;
+    vector<ReadConn *> free_readers_;
+    mutex pool_mtx_;
+    condition_variable pool_cv_;
+
+    GroupCommitOptions opt_;
+    mutex mtx_;                    // giữ hàng đợi, số thứ tự, pending_; không giữ khi chạy SQL
+    condition_variable wake_;      // writer: có thay đổi mới / có người sync / dừng
+    condition_variable committed_; // applied_seq_ hoặc durable_seq_ tăng
+    deque<Op> queue_;
+    uint64_t queued_seq_  = 0;     // thay đổi cuối đã xếp hàng
+    uint64_t applied_seq_ = 0;     // thay đổi cuối writer đã chạy (có thể chưa commit)
+    uint64_t durable_seq_ = 0;     // thay đổi cuối đã COMMIT (hoặc chạy lại xong)
+    deque<pair<uint64_t, string>> failures_; // thay đổi bị mất gần đây, cho sync
+    unordered_map<string, PendingFile> pending_;
+    int      sync_waiters_ = 0;
+    bool     stop_ = false;
+    thread   writer_;
 };
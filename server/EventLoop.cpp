@@ -0,0 +1,209 @@
+// ===== file: server/EventLoop.cpp =====
+#include "EventLoop.hpp"
+#include "ClientSession.hpp"
+#include "FileServer.hpp"
+#include "Metrics.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+using namespace std;
+
+EventLoop::EventLoop(FileServer &server) : server_(server) {}
+
+EventLoop::~EventLoop() {
+    for (auto &kv : sessions_) {
+        ::close(kv.first);
+        server_.dec_active();
+    }
+    sessions_.clear();
+    if (wakefd_ >= 0) ::close(wakefd_);
+    if (epfd_ >= 0) ::close(epfd_);
+}
+
+#ifdef __linux__
+
+bool EventLoop::init(string &err) {
+    epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0) {
+        err = string("epoll_create1: ") + strerror(errno);
+        return false;
+    }
+    wakefd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd_ < 0) {
+        err = string("eventfd: ") + strerror(errno);
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events  = EPOLLIN;
+    ev.data.fd = wakefd_;
+    if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev) < 0) {
+        err = string("epoll_ctl: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::add_connection(int fd) {
+    {
+        lock_guard<mutex> lock(pending_mtx_);
+        pending_.push_back(fd);
+    }
+    uint64_t one = 1;
+    ssize_t n = ::write(wakefd_, &one, sizeof(one));
+    (void)n;
+}
+
+void EventLoop::drain_pending() {
+    uint64_t cnt;
+    while (::read(wakefd_, &cnt, sizeof(cnt)) > 0) {}
+
+    vector<int> fds;
+    {
+        lock_guard<mutex> lock(pending_mtx_);
+        fds.swap(pending_);
+    }
+
+    for (int fd : fds) {
+        epoll_event ev{};
+        ev.events  = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            ::close(fd);
+            continue;
+        }
+        server_.inc_active();
+        sessions_[fd] = make_unique<ClientSession>(fd, server_, wakefd_);
+    }
+}
+
+void EventLoop::close_session(int fd) {
+    auto it = sessions_.find(fd);
+    if (it == sessions_.end()) return;
+    ::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    sessions_.erase(it);
+    io_waiting_.erase(fd);
+    scheduled_.erase(fd);
+    ::close(fd);
+    server_.dec_active();
+}
+
+// Shaper bắt session chờ: không có sự kiện epoll nào báo lúc có token lại,
+// nên hẹn giờ gọi lại drive(). Hẹn cũ (session đã chạy lại và đổi wake_ns)
+// bị bỏ qua khi tới hạn; wake_ns không đổi thì không hẹn thêm lần nữa.
+// Session chờ io_uring thì được gọi lại ở wake_io() khi wakefd_ báo.
+void EventLoop::schedule(int fd, const ClientSession &s) {
+    uint64_t at = s.wake_ns();
+    if (at != 0) {
+        auto r = scheduled_.emplace(fd, at);
+        if (r.second || r.first->second != at) {
+            r.first->second = at;
+            timers_.push(Timer(at, fd));
+        }
+    }
+    if (s.io_wait()) io_waiting_.insert(fd);
+    else io_waiting_.erase(fd);
+}
+
+// wakefd_ không cho biết completion của ring nào: thử lại mọi session đang
+// chờ, session chưa xong thì tự đăng ký chờ tiếp.
+void EventLoop::wake_io() {
+    vector<int> fds(io_waiting_.begin(), io_waiting_.end());
+    for (int fd : fds) {
+        auto it = sessions_.find(fd);
+        if (it == sessions_.end() || !it->second->io_wait()) continue;
+        if (!it->second->on_writable()) close_session(fd);
+        else schedule(fd, *it->second);
+    }
+}
+
+void EventLoop::run_timers() {
+    uint64_t now = metrics::now_ns();
+    vector<Timer> due;
+    while (!timers_.empty() && timers_.top().first <= now) {
+        due.push_back(timers_.top());
+        timers_.pop();
+    }
+    for (const Timer &t : due) {
+        auto sc = scheduled_.find(t.second);
+        if (sc != scheduled_.end() && sc->second == t.first) scheduled_.erase(sc);
+        auto it = sessions_.find(t.second);
+        if (it == sessions_.end() || it->second->wake_ns() != t.first) continue;
+        if (!it->second->on_writable()) close_session(t.second);
+        else schedule(t.second, *it->second);
+    }
+}
+
+// Timeout (ms) cho epoll_wait: tới hẹn sớm nhất, làm tròn lên; -1 nếu không có.
+int EventLoop::next_timeout() const {
+    if (timers_.empty()) return -1;
+    uint64_t now = metrics::now_ns(), at = timers_.top().first;
+    if (at <= now) return 0;
+    uint64_t ms = (at - now + 999999) / 1000000;
+    return ms > 1000 ? 1000 : (int)ms;
+}
+
+void EventLoop::run() {
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        int n = ::epoll_wait(epfd_, events, MAX_EVENTS, next_timeout());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakefd_) {
+                drain_pending();
+                wake_io();
+                continue;
+            }
+
+            auto it = sessions_.find(fd);
+            if (it == sessions_.end()) continue;
+
+            // Edge-triggered: session tự đọc/ghi đến EAGAIN; lỗi/hangup cũng
+            // đi qua drive() để đọc nốt dữ liệu còn lại rồi mới đóng.
+            uint32_t e = events[i].events;
+            bool ok = true;
+            if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                ok = it->second->on_readable();
+            } else if (e & EPOLLOUT) {
+                ok = it->second->on_writable();
+            }
+            if (!ok) close_session(fd);
+            else schedule(fd, *it->second);
+        }
+        run_timers();
+    }
+}
+
+#else // !__linux__
+
+bool EventLoop::init(string &err) {
+    err = "epoll is only available on Linux";
+    return false;
+}
+
+void EventLoop::add_connection(int fd) { ::close(fd); }
+void EventLoop::drain_pending() {}
+void EventLoop::close_session(int) {}
+void EventLoop::schedule(int, const ClientSession &) {}
+void EventLoop::run_timers() {}
+void EventLoop::wake_io() {}
+int  EventLoop::next_timeout() const { return -1; }
+void EventLoop::run() {}
+
+#endif
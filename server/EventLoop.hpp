@@ -0,0 +1,55 @@
+// ===== file: server/EventLoop.hpp =====
+#pragma once
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+class FileServer;
+class ClientSession;
+
+// Reactor epoll edge-triggered: mỗi EventLoop chạy trên 1 thread và sở hữu
+// các session được giao cho nó, nên session không cần khóa.
+class EventLoop {
+public:
+    explicit EventLoop(FileServer &server);
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    bool init(string &err);
+    void run();
+
+    // Giao socket (đã non-blocking) cho loop; gọi được từ thread khác.
+    void add_connection(int fd);
+
+private:
+    void drain_pending();
+    void close_session(int fd);
+    void schedule(int fd, const ClientSession &s);
+    void run_timers();
+    void wake_io();
+    int  next_timeout() const;
+
+    FileServer &server_;
+    int epfd_   = -1;
+    // Báo có kết nối mới (add_connection) và có completion io_uring (mọi ring
+    // của session trong loop đăng ký cùng eventfd này).
+    int wakefd_ = -1;
+
+    mutex pending_mtx_;
+    vector<int> pending_;
+    unordered_map<int, unique_ptr<ClientSession>> sessions_;
+    // Session đang chờ token của shaper: (wake_ns, fd), sớm nhất ở đầu.
+    using Timer = pair<uint64_t, int>;
+    priority_queue<Timer, vector<Timer>, greater<Timer>> timers_;
+    unordered_map<int, uint64_t> scheduled_; // wake_ns đã có trong timers_ theo fd
+    unordered_set<int> io_waiting_; // session chờ completion io_uring
+};
@@ -2,32 +2,67 @@
 #include "FileServer.hpp"
 #include "ClientSession.hpp"
 #include "DbSqlite.hpp"
+#include "EventLoop.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "../common/Crc32c.hpp"
+#include "../common/Protocol.hpp"
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <csignal>
 #include <thread>
+#include <vector>
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
 
-FileServer::FileServer(const string &root_dir, int port)
-    : root_dir_(root_dir),
-      port_(port),
-      logger_("server.log") {
+namespace {
+// Nâng giới hạn fd lên mức hard limit để giữ được hàng chục nghìn kết nối.
+void raise_fd_limit() {
+    rlimit rl{};
+    if (::getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+} // namespace
+
+FileServer::FileServer(const ServerConfig &cfg)
+    : cfg_(cfg),
+      logger_("server.log", cfg.log),
+      uploads_(quota_mgr_),
+      cache_(cfg.cache_bytes, cfg.cache_max_file) {
+
+    transfer_opts_.use_uring    = cfg_.use_uring;
+    transfer_opts_.use_sendfile = cfg_.use_sendfile;
+    transfer_opts_.use_splice   = cfg_.use_splice;
+    transfer_opts_.checksum     = cfg_.checksum;
+    shaper_.set_limits(cfg_.shaping);
 
-    db_ = make_unique<DbSqlite>("fileshare.db");
+    db_ = make_unique<DbSqlite>("fileshare.db", cfg_.db_commit, (size_t)max(cfg_.db_readers, 0));
     string err;
     if (!db_->init_schema(err)) {
         cerr << "DB init failed: " << err << "\n";
     }
+
+    if (cfg_.chunk_store) {
+        chunks_ = make_unique<ChunkStore>(cfg_.root_dir, *db_);
+        chunks_->init();
+    }
 }
 
-void FileServer::run() {
+int FileServer::open_listener(in_addr_t host, int port) {
     int listenfd = ::socket(AF_INET, SOCK_STREAM, 0);
     if (listenfd < 0) {
         perror("socket");
-        return;
+        return -1;
     }
 
     int opt = 1;
@@ -35,22 +70,145 @@ void FileServer::run() {
 
     sockaddr_in addr{};
     addr.sin_family      = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port        = htons(port_);
+    addr.sin_addr.s_addr = htonl(host);
+    addr.sin_port        = htons(port);
 
     if (::bind(listenfd, (sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("bind");
         close(listenfd);
-        return;
+        return -1;
     }
 
-    if (::listen(listenfd, 16) < 0) {
+    if (::listen(listenfd, SOMAXCONN) < 0) {
         perror("listen");
         close(listenfd);
-        return;
+        return -1;
+    }
+    return listenfd;
+}
+
+void FileServer::run() {
+    // Client ngắt giữa chừng không được làm chết cả server.
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
+    int listenfd = open_listener(INADDR_ANY, cfg_.port);
+    if (listenfd < 0) return;
+
+    cout << "Server listening on port " << cfg_.port << "\n";
+    if (cfg_.checksum) cout << "Checksum: crc32c (" << crc32c_impl() << ")\n";
+
+    trace::enable(cfg_.trace_spans);
+    if (cfg_.metrics_port > 0) {
+        int metricsfd = open_listener(INADDR_LOOPBACK, cfg_.metrics_port);
+        if (metricsfd >= 0) {
+            cout << "Metrics: http://127.0.0.1:" << cfg_.metrics_port << "/metrics\n";
+            thread([this, metricsfd]() { run_metrics(metricsfd); }).detach();
+        }
     }
 
-    cout << "Server listening on port " << port_ << "\n";
+    if (cfg_.io_mode == IoMode::Epoll) {
+        run_epoll(listenfd);
+    } else {
+        run_threads(listenfd);
+    }
+
+    close(listenfd);
+}
+
+// Endpoint Prometheus: mỗi kết nối đọc đầu request HTTP rồi nhận toàn bộ số
+// liệu dạng text; "GET /trace" nhận span trong ring (--trace) dạng Chrome
+// trace-event JSON; "/shaping" xem/đổi giới hạn băng thông. Chỉ nghe 127.0.0.1.
+void FileServer::run_metrics(int listenfd) {
+    while (true) {
+        int fd = ::accept4(listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR) perror("accept metrics");
+            continue;
+        }
+        timeval tv{1, 0}; // client chậm không giữ thread quá 1s
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        string head;
+        char buf[1024];
+        while (head.find("\r\n\r\n") == string::npos &&
+               head.find("\n\n") == string::npos && head.size() < 8192) {
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            head.append(buf, (size_t)n);
+        }
+
+        bool want_trace = head.compare(0, 11, "GET /trace ") == 0;
+        bool want_shaping = head.compare(0, 12, "GET /shaping") == 0 ||
+                            head.compare(0, 13, "POST /shaping") == 0;
+        string body = want_trace ? trace::dump_json()
+                    : want_shaping ? shaping_request(head) : metrics_text();
+        string resp = string("HTTP/1.0 200 OK\r\n") +
+                      (want_trace ? "Content-Type: application/json\r\n"
+                                  : "Content-Type: text/plain; version=0.0.4\r\n") +
+                      "Content-Length: " + to_string(body.size()) + "\r\n"
+                      "Connection: close\r\n\r\n" + body;
+        proto::send_all(fd, resp.data(), resp.size());
+        ::close(fd);
+    }
+}
+
+string FileServer::metrics_text() {
+    string out = metrics::prometheus_text(metrics::snapshot());
+    auto counter = [&](const char *name, const char *help, uint64_t v) {
+        out += string("# HELP ") + name + " " + help + "\n# TYPE " + name + " counter\n" +
+               name + " " + to_string(v) + "\n";
+    };
+    counter("fileshare_bytes_in_total", "Bytes received on the wire.", bytes_in());
+    counter("fileshare_bytes_out_total", "Bytes sent on the wire.", bytes_out());
+    counter("fileshare_logical_in_total", "Body bytes received before decompression.", logical_in());
+    counter("fileshare_logical_out_total", "Body bytes sent before compression.", logical_out());
+    counter("fileshare_log_dropped_total", "Log lines dropped because the queue was full.",
+            logger_.dropped());
+    counter("fileshare_shaping_throttled_in_total",
+            "Times an upload body waited for bandwidth tokens.", shaper_.throttled(Direction::In));
+    counter("fileshare_shaping_throttled_out_total",
+            "Times a download body waited for bandwidth tokens.", shaper_.throttled(Direction::Out));
+    out += "# HELP fileshare_active_sessions Open client connections, authenticated or not.\n"
+           "# TYPE fileshare_active_sessions gauge\n"
+           "fileshare_active_sessions " + to_string(active_users()) + "\n";
+    return out;
+}
+
+// "POST /shaping?global=KiB&user=KiB&session=KiB&user_sessions=N" đổi các
+// giới hạn có trong query (rate theo KiB/s, 0 = bỏ giới hạn), áp ngay cho mọi
+// transfer đang chạy. Cả GET lẫn POST trả về giá trị hiện tại.
+string FileServer::shaping_request(const string &head) {
+    ShapingLimits l = shaper_.limits();
+    string target = head.substr(0, head.find_first_of("\r\n"));
+    size_t q = target.find('?');
+    if (target.compare(0, 5, "POST ") == 0 && q != string::npos) {
+        string query = target.substr(q + 1, target.find(' ', q) - q - 1);
+        size_t pos = 0;
+        while (pos < query.size()) {
+            size_t amp = query.find('&', pos);
+            string kv  = query.substr(pos, amp == string::npos ? string::npos : amp - pos);
+            pos = amp == string::npos ? query.size() : amp + 1;
+            size_t eq = kv.find('=');
+            uint64_t v;
+            if (eq == string::npos || !proto::parse_u64(string_view(kv).substr(eq + 1), v)) continue;
+            string key = kv.substr(0, eq);
+            if (key == "global")             l.global_rate   = v << 10;
+            else if (key == "user")          l.user_rate     = v << 10;
+            else if (key == "session")       l.session_rate  = v << 10;
+            else if (key == "user_sessions") l.user_sessions = (uint32_t)v;
+        }
+        shaper_.set_limits(l);
+    }
+    return "global=" + to_string(l.global_rate >> 10) + " user=" + to_string(l.user_rate >> 10) +
+           " session=" + to_string(l.session_rate >> 10) +
+           " user_sessions=" + to_string(l.user_sessions) + "\n";
+}
+
+void FileServer::run_threads(int listenfd) {
+    cout << "I/O mode: thread-per-connection\n";
 
     while (true) {
         sockaddr_in cli{};
@@ -69,6 +227,49 @@ void FileServer::run() {
             close(connfd);
         }).detach();
     }
+}
 
-    close(listenfd);
+void FileServer::run_epoll(int listenfd) {
+    int n = cfg_.loop_threads;
+    if (n <= 0) n = (int)thread::hardware_concurrency();
+    if (n <= 0) n = 1;
+
+    vector<unique_ptr<EventLoop>> loops;
+    for (int i = 0; i < n; ++i) {
+        auto loop = make_unique<EventLoop>(*this);
+        string err;
+        if (!loop->init(err)) {
+            cerr << "Event loop init failed (" << err
+                 << "), falling back to thread-per-connection\n";
+            run_threads(listenfd);
+            return;
+        }
+        loops.push_back(std::move(loop));
+    }
+
+    for (auto &loop : loops) {
+        EventLoop *lp = loop.get();
+        thread([lp]() { lp->run(); }).detach();
+    }
+
+    cout << "I/O mode: epoll, " << n << " loop thread(s)\n";
+
+    size_t next = 0;
+    while (true) {
+        sockaddr_in cli{};
+        socklen_t len = sizeof(cli);
+        int connfd = ::accept(listenfd, (sockaddr*)&cli, &len);
+        if (connfd < 0) {
+            perror("accept");
+            continue;
+        }
+
+        int flags = fcntl(connfd, F_GETFL, 0);
+        fcntl(connfd, F_SETFL, flags | O_NONBLOCK);
+        int one = 1;
+        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        loops[next]->add_connection(connfd);
+        next = (next + 1) % loops.size();
+    }
 }
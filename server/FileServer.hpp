@@ -3,40 +3,95 @@
 #include <string>
 #include <atomic>
 #include <memory>
+#include <netinet/in.h>
 #include "Logger.hpp"
 #include "QuotaManager.hpp"
-#include "Db.hpp"
+#include "UploadTable.hpp"
+#include "ChunkStore.hpp"
+#include "ContentCache.hpp"
+#include "DbSqlite.hpp"
+#include "Transfer.hpp"
+#include "Shaper.hpp"
 
 using namespace std;
 
+enum class IoMode {
+    Threads, // thread-per-connection, socket blocking (cách cũ, để so sánh)
+    Epoll    // N event loop epoll edge-triggered
+};
+
+struct ServerConfig {
+    string root_dir     = "./data";
+    int    port         = 5051;
+    IoMode io_mode      = IoMode::Epoll;
+    int    loop_threads = 0; // 0 = theo số core
+    bool   use_uring    = true; // io_uring cho body lớn nếu build kèm liburing
+    bool   use_sendfile = true; // download zero-copy (Linux)
+    bool   use_splice   = true; // upload zero-copy (Linux), chỉ khi tắt checksum
+    bool   checksum     = true; // CRC32C cho body upload, lưu vào file_entry
+    bool   chunk_store  = false; // lưu file vào kho chunk dùng chung (dedup)
+    uint64_t cache_bytes    = 64ull << 20; // cache nội dung file nhỏ, 0 = tắt
+    uint64_t cache_max_file = 256 << 10;   // file lớn hơn thì không cache
+    GroupCommitOptions db_commit; // gom các thay đổi metadata vào 1 lần COMMIT
+    int    db_readers   = 0; // connection SQLite chỉ đọc, 0 = theo số core
+    LogOptions log;              // server.log ghi nền, xoay file
+    int    metrics_port = 0; // endpoint Prometheus trên 127.0.0.1, 0 = tắt
+    size_t trace_spans  = 0; // span giữ trong ring mỗi thread (GET /trace), 0 = tắt
+    ShapingLimits shaping;   // giới hạn băng thông / số session, đổi được qua POST /shaping
+};
+
 class FileServer {
 public:
-    FileServer(const string &root_dir, int port);
+    explicit FileServer(const ServerConfig &cfg);
 
     void run();
 
     Logger& logger() { return logger_; }
     QuotaManager& quota_mgr() { return quota_mgr_; }
+    UploadTable& uploads() { return uploads_; }
+    ContentCache& content_cache() { return cache_; }
+    Shaper& shaper() { return shaper_; }
     Db& db() { return *db_; }
+    // nullptr khi chạy với --store=files.
+    ChunkStore* chunk_store() { return chunks_.get(); }
 
     void add_bytes_in(uint64_t n)  { bytes_in_  += n; }
     void add_bytes_out(uint64_t n) { bytes_out_ += n; }
+    // Byte nội dung của body (trước nén / sau giải nén); bytes_in/out là byte trên dây.
+    void add_logical_in(uint64_t n)  { logical_in_  += n; }
+    void add_logical_out(uint64_t n) { logical_out_ += n; }
     void inc_active()              { ++active_users_; }
     void dec_active()              { --active_users_; }
 
     uint64_t bytes_in()  const { return bytes_in_.load(); }
     uint64_t bytes_out() const { return bytes_out_.load(); }
+    uint64_t logical_in()  const { return logical_in_.load(); }
+    uint64_t logical_out() const { return logical_out_.load(); }
     int active_users()   const { return active_users_.load(); }
 
-    const string& root_dir() const { return root_dir_; }
+    const string& root_dir() const { return cfg_.root_dir; }
+    const TransferOptions& transfer_options() const { return transfer_opts_; }
 
 private:
-    string root_dir_;
-    int port_;
+    int  open_listener(in_addr_t host, int port);
+    void run_threads(int listenfd);
+    void run_epoll(int listenfd);
+    void run_metrics(int listenfd);
+    string metrics_text();
+    string shaping_request(const string &head);
+
+    ServerConfig cfg_;
+    TransferOptions transfer_opts_;
     Logger logger_;
     QuotaManager quota_mgr_;
+    UploadTable  uploads_;
+    ContentCache cache_;
+    Shaper       shaper_;
     atomic<uint64_t> bytes_in_{0};
     atomic<uint64_t> bytes_out_{0};
+    atomic<uint64_t> logical_in_{0};
+    atomic<uint64_t> logical_out_{0};
     atomic<int>      active_users_{0};
     unique_ptr<Db>   db_;
+    unique_ptr<ChunkStore> chunks_;
 };
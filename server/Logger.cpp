@@ -1,20 +1,159 @@
 // ===== file: server/Logger.cpp =====
 #include "Logger.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <chrono>
 
-Logger::Logger(const string &filename) {
-    out_.open(filename, ios::app);
+namespace {
+const size_t FLUSH_BYTES = 64 * 1024;
+} // namespace
+
+Logger::Logger(const string &filename, const LogOptions &opt)
+    : filename_(filename), opt_(opt) {
+    size_t n = 2;
+    while (n < opt_.queue_lines) n <<= 1;
+    slots_.reset(new Slot[n]);
+    mask_ = n - 1;
+    for (size_t i = 0; i < n; ++i) slots_[i].seq.store(i, memory_order_relaxed);
+
+    open_file();
+    writer_ = thread([this]() { writer_loop(); });
+}
+
+Logger::~Logger() {
+    stop_ = true;
+    wake_.notify_one();
+    writer_.join(); // ghi nốt hàng đợi
+    if (fd_ >= 0) ::close(fd_);
 }
 
 void Logger::log(const string &user, const string &msg) {
-    if (!out_) return;
+    time_t now = ::time(nullptr);
+    while (!try_push(now, user, msg)) {
+        if (!opt_.block_when_full) {
+            dropped_.fetch_add(1, memory_order_relaxed);
+            dropped_total_.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        wake_.notify_one();
+        this_thread::yield();
+    }
+    // Đầy quá nửa: đánh thức writer sớm thay vì chờ hết flush_ms.
+    size_t used = head_.load(memory_order_relaxed) - tail_.load(memory_order_relaxed);
+    if (used > mask_ / 2) wake_.notify_one();
+}
+
+// Hàng đợi vòng có giới hạn của Vyukov: seq của ô cho biết ô đang trống cho
+// lượt pos (seq == pos) hay đã có dữ liệu chờ đọc (seq == pos + 1).
+bool Logger::try_push(time_t when, const string &user, const string &msg) {
+    size_t pos = head_.load(memory_order_relaxed);
+    Slot *s;
+    while (true) {
+        s = &slots_[pos & mask_];
+        size_t seq = s->seq.load(memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (head_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            return false; // đầy
+        } else {
+            pos = head_.load(memory_order_relaxed);
+        }
+    }
+    // Writer chỉ clear() chuỗi nên gán lại dùng vùng nhớ cũ, không cấp phát.
+    s->when = when;
+    s->user = user;
+    s->msg  = msg;
+    s->seq.store(pos + 1, memory_order_release);
+    return true;
+}
+
+void Logger::writer_loop() {
+    string buf;
+    buf.reserve(FLUSH_BYTES * 2);
+    time_t ts_sec = (time_t)-1;
+    char ts[32] = {0};
+    auto last_flush = chrono::steady_clock::now();
 
-    auto now = chrono::system_clock::now();
-    auto tt  = chrono::system_clock::to_time_t(now);
-    tm tmv{};
-    localtime_r(&tt, &tmv);
+    while (true) {
+        bool stopping = stop_.load();
+        size_t tail = tail_.load(memory_order_relaxed);
+        while (true) {
+            Slot &s = slots_[tail & mask_];
+            if (s.seq.load(memory_order_acquire) != tail + 1) break;
+            if (s.when != ts_sec) {
+                ts_sec = s.when;
+                tm tmv{};
+                localtime_r(&ts_sec, &tmv);
+                strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tmv);
+            }
+            buf += ts;
+            buf += " [";
+            buf += s.user;
+            buf += "] ";
+            buf += s.msg;
+            buf += '\n';
+            s.user.clear();
+            s.msg.clear();
+            s.seq.store(tail + mask_ + 1, memory_order_release);
+            tail_.store(++tail, memory_order_relaxed);
+            if (buf.size() >= FLUSH_BYTES) write_out(buf);
+        }
+
+        uint64_t dropped = dropped_.exchange(0, memory_order_relaxed);
+        if (dropped > 0) {
+            buf += "[logger] dropped " + to_string(dropped) + " line(s), queue full\n";
+        }
+
+        auto now = chrono::steady_clock::now();
+        if (!buf.empty() &&
+            (stopping || now - last_flush >= chrono::milliseconds(opt_.flush_ms))) {
+            write_out(buf);
+        }
+        if (buf.empty()) last_flush = now;
+        if (stopping) break;
+
+        unique_lock<mutex> lock(wake_mtx_);
+        wake_.wait_for(lock, chrono::milliseconds(opt_.flush_ms > 0 ? opt_.flush_ms : 1));
+    }
+}
+
+void Logger::write_out(string &buf) {
+    if (fd_ >= 0) {
+        bool by_size = opt_.rotate_bytes > 0 && file_size_ > 0 &&
+                       file_size_ + buf.size() > opt_.rotate_bytes;
+        bool by_age  = opt_.rotate_hours > 0 &&
+                       ::time(nullptr) - opened_at_ >= (time_t)opt_.rotate_hours * 3600;
+        if (by_size || by_age) rotate();
+    }
+    size_t off = 0;
+    while (fd_ >= 0 && off < buf.size()) {
+        ssize_t n = ::write(fd_, buf.data() + off, buf.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += (size_t)n;
+    }
+    file_size_ += off;
+    buf.clear();
+}
+
+void Logger::open_file() {
+    fd_ = ::open(filename_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st{};
+    file_size_ = fd_ >= 0 && ::fstat(fd_, &st) == 0 ? (uint64_t)st.st_size : 0;
+    opened_at_ = ::time(nullptr);
+}
 
-    lock_guard<mutex> lock(mtx_);
-    out_ << put_time(&tmv, "%Y-%m-%d %H:%M:%S")
-         << " [" << user << "] " << msg << "\n";
-    out_.flush();
+// server.log -> server.log.1 -> ... -> server.log.<keep_files>, bản cũ nhất bị bỏ.
+void Logger::rotate() {
+    ::close(fd_);
+    for (int i = opt_.keep_files - 1; i >= 1; --i) {
+        ::rename((filename_ + "." + to_string(i)).c_str(),
+                 (filename_ + "." + to_string(i + 1)).c_str());
+    }
+    if (opt_.keep_files > 0) ::rename(filename_.c_str(), (filename_ + ".1").c_str());
+    else ::unlink(filename_.c_str());
+    open_file();
 }
@@ -1,19 +1,65 @@
 // ===== file: server/Logger.hpp =====
 #pragma once
-#include <fstream>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <string>
-#include <chrono>
-#include <iomanip>
+#include <thread>
+#include <ctime>
+#include <cstdint>
 
 using namespace std;
 
+struct LogOptions {
+    size_t   queue_lines     = 8192;        // làm tròn lên lũy thừa của 2
+    bool     block_when_full = false;       // false: bỏ dòng (đếm lại), true: chờ
+    int      flush_ms        = 100;         // dòng nằm trong bộ nhớ tối đa chừng này
+    uint64_t rotate_bytes    = 64ull << 20; // 0 = không xoay theo kích thước
+    int      rotate_hours    = 0;           // 0 = không xoay theo thời gian
+    int      keep_files      = 5;           // server.log.1 .. server.log.N
+};
+
+// log() chỉ đẩy dòng vào hàng đợi vòng MPSC không khóa; writer thread định
+// dạng thời gian (cache theo giây), gom dòng và ghi 1 lần mỗi flush_ms hoặc
+// khi đủ 64 KiB, xoay file theo kích thước/thời gian.
 class Logger {
 public:
-    explicit Logger(const string &filename);
+    explicit Logger(const string &filename, const LogOptions &opt = {});
+    ~Logger();
+
     void log(const string &user, const string &msg);
+    uint64_t dropped() const { return dropped_total_.load(memory_order_relaxed); }
 
 private:
-    ofstream out_;
-    mutex mtx_;
+    struct Slot {
+        atomic<size_t> seq{0};
+        time_t when = 0;
+        string user;
+        string msg;
+    };
+
+    bool try_push(time_t when, const string &user, const string &msg);
+    void writer_loop();
+    void write_out(string &buf);
+    void open_file();
+    void rotate();
+
+    string filename_;
+    LogOptions opt_;
+    int      fd_ = -1;
+    uint64_t file_size_ = 0;
+    time_t   opened_at_ = 0;
+
+    unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) atomic<size_t> head_{0}; // vị trí ghi kế tiếp (producer)
+    alignas(64) atomic<size_t> tail_{0}; // vị trí đọc kế tiếp (chỉ writer ghi)
+    atomic<uint64_t> dropped_{0};        // chưa báo trong file
+    atomic<uint64_t> dropped_total_{0};
+
+    atomic<bool> stop_{false};
+    mutex wake_mtx_;
+    condition_variable wake_;
+    thread writer_;
 };
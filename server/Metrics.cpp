@@ -0,0 +1,266 @@
+// ===== file: server/Metrics.cpp =====
+#include "Metrics.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+
+namespace metrics {
+
+namespace {
+const size_t SERIES    = OP_COUNT + PHASE_COUNT;
+const int    MAX_CODE  = 600;
+
+struct Shard {
+    atomic<uint64_t> hist[SERIES][BUCKETS];
+    atomic<uint64_t> count[SERIES];
+    atomic<uint64_t> sum_ns[SERIES];
+    atomic<uint64_t> errors[OP_COUNT];
+    atomic<uint64_t> bytes[OP_COUNT];
+    atomic<uint64_t> codes[MAX_CODE];
+};
+
+// Shard của thread đã thoát được dùng lại (số liệu giữ nguyên), nên chế độ
+// thread-per-connection không tạo thêm shard cho mỗi kết nối.
+struct Registry {
+    mutex mtx;
+    vector<unique_ptr<Shard>> all;
+    vector<Shard *> free;
+};
+
+Registry &registry() {
+    static Registry *r = new Registry; // sống tới sau destructor thread_local
+    return *r;
+}
+
+struct Lease {
+    Shard *shard = nullptr;
+    ~Lease() {
+        if (!shard) return;
+        Registry &r = registry();
+        lock_guard<mutex> lock(r.mtx);
+        r.free.push_back(shard);
+    }
+};
+
+Shard &local() {
+    static thread_local Lease lease;
+    if (!lease.shard) {
+        Registry &r = registry();
+        lock_guard<mutex> lock(r.mtx);
+        if (!r.free.empty()) {
+            lease.shard = r.free.back();
+            r.free.pop_back();
+        } else {
+            r.all.emplace_back(new Shard()); // value-init: mọi bộ đếm = 0
+            lease.shard = r.all.back().get();
+        }
+    }
+    return *lease.shard;
+}
+
+// Chỉ thread sở hữu shard ghi.
+inline void bump(atomic<uint64_t> &c, uint64_t v = 1) {
+    c.store(c.load(memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+void record(size_t series, uint64_t ns) {
+    Shard &s = local();
+    bump(s.hist[series][bucket_of(ns)]);
+    bump(s.count[series]);
+    bump(s.sum_ns[series], ns);
+}
+
+string lower_name(proto::Op op) {
+    string n = proto::op_name(op);
+    for (char &c : n) c = (char)tolower((unsigned char)c);
+    return n;
+}
+
+const char *PHASE_NAMES[PHASE_COUNT] = {"db", "disk"};
+
+string seconds(uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", (double)ns / 1e9);
+    return buf;
+}
+
+// Cận "le" của histogram Prometheus (giây).
+const double LE_BOUNDS[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+                            0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+void prom_histogram(string &out, const string &name, const string &label,
+                    const Series &s) {
+    for (double le : LE_BOUNDS) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%g", le);
+        out += name + "_bucket{" + label + ",le=\"" + buf + "\"} " +
+               to_string(s.count_le((uint64_t)(le * 1e9))) + "\n";
+    }
+    out += name + "_bucket{" + label + ",le=\"+Inf\"} " + to_string(s.count) + "\n";
+    out += name + "_sum{" + label + "} " + seconds(s.sum_ns) + "\n";
+    out += name + "_count{" + label + "} " + to_string(s.count) + "\n";
+}
+
+void prom_quantiles(string &out, const string &name, const string &label,
+                    const Series &s) {
+    for (double q : QUANTILES) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%g", q);
+        out += name + "{" + label + ",quantile=\"" + buf + "\"} " +
+               seconds(s.quantile(q)) + "\n";
+    }
+}
+} // namespace
+
+size_t bucket_of(uint64_t ns) {
+    if (ns < 16) return (size_t)ns;
+    int e = 63 - __builtin_clzll(ns);
+    if (e > 40) return BUCKETS - 1;
+    return (size_t)(e - 3) * 16 + ((ns >> (e - 4)) & 15);
+}
+
+uint64_t bucket_lower(size_t idx) {
+    if (idx < 16) return idx;
+    int e = (int)(idx / 16) + 3;
+    return (uint64_t)(16 + idx % 16) << (e - 4);
+}
+
+uint64_t bucket_upper(size_t idx) {
+    if (idx < 16) return idx;
+    int e = (int)(idx / 16) + 3;
+    return bucket_lower(idx) + ((uint64_t)1 << (e - 4)) - 1;
+}
+
+void record_command(proto::Op op, uint64_t ns, bool error, uint64_t bytes) {
+    size_t i = (size_t)op;
+    if (i >= OP_COUNT) return;
+    record(i, ns);
+    Shard &s = local();
+    if (error) bump(s.errors[i]);
+    if (bytes) bump(s.bytes[i], bytes);
+}
+
+void record_phase(Phase phase, uint64_t ns) {
+    record(OP_COUNT + (size_t)phase, ns);
+}
+
+void record_reply(int code) {
+    if (code >= 400 && code < MAX_CODE) bump(local().codes[code]);
+}
+
+uint64_t Series::quantile(double q) const {
+    if (count == 0) return 0;
+    uint64_t target = (uint64_t)(q * (double)count);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= target) return (bucket_lower(i) + bucket_upper(i)) / 2;
+    }
+    return bucket_upper(BUCKETS - 1);
+}
+
+uint64_t Series::count_le(uint64_t ns) const {
+    uint64_t n = 0;
+    for (size_t i = 0; i < BUCKETS && bucket_upper(i) <= ns; ++i) n += buckets[i];
+    return n;
+}
+
+Snapshot snapshot() {
+    Snapshot out;
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.mtx);
+    for (const auto &sp : r.all) {
+        const Shard &s = *sp;
+        for (size_t k = 0; k < SERIES; ++k) {
+            Series &dst = k < OP_COUNT ? out.ops[k] : out.phases[k - OP_COUNT];
+            dst.count  += s.count[k].load(memory_order_relaxed);
+            dst.sum_ns += s.sum_ns[k].load(memory_order_relaxed);
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                dst.buckets[b] += s.hist[k][b].load(memory_order_relaxed);
+            }
+            if (k < OP_COUNT) {
+                dst.errors += s.errors[k].load(memory_order_relaxed);
+                dst.bytes  += s.bytes[k].load(memory_order_relaxed);
+            }
+        }
+        for (int c = 400; c < MAX_CODE; ++c) {
+            uint64_t n = s.codes[c].load(memory_order_relaxed);
+            if (n) out.replies[c] += n;
+        }
+    }
+    return out;
+}
+
+string stats_text(const Snapshot &s) {
+    string out;
+    auto series = [&](const string &name, const Series &x, bool with_err) {
+        if (x.count == 0) return;
+        out += " " + name + "_n=" + to_string(x.count) +
+               " " + name + "_p50_us=" + to_string(x.quantile(0.5) / 1000) +
+               " " + name + "_p99_us=" + to_string(x.quantile(0.99) / 1000) +
+               " " + name + "_p999_us=" + to_string(x.quantile(0.999) / 1000);
+        if (with_err) out += " " + name + "_err=" + to_string(x.errors);
+    };
+    for (size_t i = 1; i < OP_COUNT; ++i) series(lower_name((proto::Op)i), s.ops[i], true);
+    for (size_t i = 0; i < PHASE_COUNT; ++i) series(PHASE_NAMES[i], s.phases[i], false);
+    if (!s.replies.empty()) {
+        out += " errors=";
+        bool first = true;
+        for (const auto &kv : s.replies) {
+            if (!first) out += ",";
+            out += to_string(kv.first) + ":" + to_string(kv.second);
+            first = false;
+        }
+    }
+    return out;
+}
+
+string prometheus_text(const Snapshot &s) {
+    string out;
+    out += "# HELP fileshare_command_duration_seconds Time from command dispatch to its final reply or body end.\n"
+           "# TYPE fileshare_command_duration_seconds histogram\n";
+    for (size_t i = 1; i < OP_COUNT; ++i) {
+        if (s.ops[i].count == 0) continue;
+        prom_histogram(out, "fileshare_command_duration_seconds",
+                       string("op=\"") + proto::op_name((proto::Op)i) + "\"", s.ops[i]);
+    }
+    out += "# HELP fileshare_command_latency_seconds Command latency quantiles since start.\n"
+           "# TYPE fileshare_command_latency_seconds gauge\n";
+    for (size_t i = 1; i < OP_COUNT; ++i) {
+        if (s.ops[i].count == 0) continue;
+        prom_quantiles(out, "fileshare_command_latency_seconds",
+                       string("op=\"") + proto::op_name((proto::Op)i) + "\"", s.ops[i]);
+    }
+    out += "# HELP fileshare_command_errors_total Commands that ended with an error reply.\n"
+           "# TYPE fileshare_command_errors_total counter\n";
+    for (size_t i = 1; i < OP_COUNT; ++i) {
+        if (s.ops[i].count == 0) continue;
+        out += string("fileshare_command_errors_total{op=\"") + proto::op_name((proto::Op)i) +
+               "\"} " + to_string(s.ops[i].errors) + "\n";
+    }
+    out += "# HELP fileshare_command_bytes_total Body bytes moved by completed commands.\n"
+           "# TYPE fileshare_command_bytes_total counter\n";
+    for (size_t i = 1; i < OP_COUNT; ++i) {
+        if (s.ops[i].bytes == 0) continue;
+        out += string("fileshare_command_bytes_total{op=\"") + proto::op_name((proto::Op)i) +
+               "\"} " + to_string(s.ops[i].bytes) + "\n";
+    }
+    out += "# HELP fileshare_phase_duration_seconds Time spent in the database and on disk.\n"
+           "# TYPE fileshare_phase_duration_seconds histogram\n";
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        prom_histogram(out, "fileshare_phase_duration_seconds",
+                       string("phase=\"") + PHASE_NAMES[i] + "\"", s.phases[i]);
+    }
+    out += "# HELP fileshare_reply_errors_total Error replies by code.\n"
+           "# TYPE fileshare_reply_errors_total counter\n";
+    for (const auto &kv : s.replies) {
+        out += "fileshare_reply_errors_total{code=\"" + to_string(kv.first) + "\"} " +
+               to_string(kv.second) + "\n";
+    }
+    return out;
+}
+
+} // namespace metrics
@@ -0,0 +1,82 @@
+// ===== file: server/Metrics.hpp =====
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include "../common/Protocol.hpp"
+
+using namespace std;
+
+// Số liệu độ trễ của server. Mỗi thread ghi vào shard riêng (chỉ 1 thread
+// ghi nên không cần lệnh atomic đọc-sửa-ghi, không khóa); snapshot() cộng
+// các shard khi có người hỏi (STATS, endpoint Prometheus).
+namespace metrics {
+
+// Giai đoạn đo riêng, bên trong độ trễ của lệnh.
+enum class Phase : uint8_t {
+    Db   = 0, // lời gọi Db (SQLite)
+    Disk = 1, // pread/pwrite của đường buffer, rename/cắt chunk lúc commit
+};
+const size_t PHASE_COUNT = 2;
+const size_t OP_COUNT    = proto::OP_COUNT;
+
+// Histogram kiểu HDR theo ns: 16 ô trên mỗi lũy thừa 2 (sai số ≤ 6.25%),
+// tới 2^41 ns (~37 phút), giá trị lớn hơn dồn vào ô cuối.
+const size_t BUCKETS = 38 * 16;
+size_t   bucket_of(uint64_t ns);
+uint64_t bucket_lower(size_t idx);
+uint64_t bucket_upper(size_t idx);
+
+inline uint64_t now_ns() {
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Lệnh xong (reply cuối hoặc hết body): độ trễ từ lúc dispatch, byte body.
+void record_command(proto::Op op, uint64_t ns, bool error, uint64_t bytes);
+void record_phase(Phase phase, uint64_t ns);
+// Reply lỗi (>= 400), đếm theo mã.
+void record_reply(int code);
+
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase) : phase_(phase), start_(now_ns()) {}
+    ~PhaseTimer() { record_phase(phase_, now_ns() - start_); }
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+    Phase    phase_;
+    uint64_t start_;
+};
+
+struct Series {
+    uint64_t count  = 0;
+    uint64_t sum_ns = 0;
+    uint64_t errors = 0;
+    uint64_t bytes  = 0;
+    vector<uint64_t> buckets = vector<uint64_t>(BUCKETS, 0);
+
+    // Giá trị (ns) tại phân vị q (0..1), 0 nếu chưa có mẫu.
+    uint64_t quantile(double q) const;
+    // Số mẫu <= ns (theo cận trên của ô).
+    uint64_t count_le(uint64_t ns) const;
+};
+
+struct Snapshot {
+    Series ops[OP_COUNT];
+    Series phases[PHASE_COUNT];
+    map<int, uint64_t> replies; // mã lỗi -> số lần
+};
+
+Snapshot snapshot();
+
+// Phần thêm vào reply STATS: "<op>_n= <op>_p50_us= <op>_p99_us= <op>_p999_us=
+// <op>_err=" cho các lệnh đã chạy, db_/disk_ tương tự, "errors=<mã>:<n>,...".
+string stats_text(const Snapshot &s);
+// Định dạng text của Prometheus (histogram + phân vị + bộ đếm).
+string prometheus_text(const Snapshot &s);
+
+} // namespace metrics
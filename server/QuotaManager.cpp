@@ -1,33 +1,42 @@
 // ===== file: server/QuotaManager.cpp =====
 #include "QuotaManager.hpp"
 
-void QuotaManager::set_limit(const string &user, uint64_t max_bytes) {
-    lock_guard<mutex> lock(mtx_);
-    quotas_[user].max_bytes = max_bytes;
+void UserQuota::load_usage(uint64_t used_bytes) {
+    bool expected = false;
+    if (!loaded_.compare_exchange_strong(expected, true)) return;
+    used_.fetch_add(used_bytes, memory_order_relaxed);
+    charged_.fetch_add(used_bytes, memory_order_relaxed);
 }
 
-bool QuotaManager::can_allocate(const string &user, uint64_t additional_bytes) {
-    lock_guard<mutex> lock(mtx_);
-    auto &q = quotas_[user];
-    if (q.max_bytes == 0) return true;
-    return (q.used_bytes + additional_bytes <= q.max_bytes);
+bool UserQuota::reserve(uint64_t bytes) {
+    uint64_t cur = charged_.load(memory_order_relaxed);
+    while (true) {
+        uint64_t max = max_bytes_.load(memory_order_relaxed);
+        if (max != 0 && (cur > max || bytes > max - cur)) return false;
+        if (charged_.compare_exchange_weak(cur, cur + bytes, memory_order_relaxed)) return true;
+    }
 }
 
-void QuotaManager::add_usage(const string &user, uint64_t delta) {
-    lock_guard<mutex> lock(mtx_);
-    quotas_[user].used_bytes += delta;
+void UserQuota::release(uint64_t bytes) {
+    charged_.fetch_sub(bytes, memory_order_relaxed);
 }
 
-int64_t QuotaManager::adjust_usage(const string &user, int64_t delta) {
-    lock_guard<mutex> lock(mtx_);
-    auto &q = quotas_[user];
-    int64_t new_used = static_cast<int64_t>(q.used_bytes) + delta;
-    if (new_used < 0) new_used = 0;
-    q.used_bytes = static_cast<uint64_t>(new_used);
+uint64_t UserQuota::commit(uint64_t reserved, int64_t delta) {
+    uint64_t old_used = used_.load(memory_order_relaxed);
+    uint64_t new_used;
+    do {
+        int64_t v = static_cast<int64_t>(old_used) + delta;
+        new_used = v < 0 ? 0 : static_cast<uint64_t>(v);
+    } while (!used_.compare_exchange_weak(old_used, new_used, memory_order_relaxed));
+    // charged = used + giữ chỗ: cộng phần usage thực tăng, bỏ phần giữ chỗ.
+    charged_.fetch_add(new_used - old_used - reserved, memory_order_relaxed);
     return new_used;
 }
 
-uint64_t QuotaManager::used(const string &user) {
-    lock_guard<mutex> lock(mtx_);
-    return quotas_[user].used_bytes;
+UserQuota &QuotaManager::account(int user_id) {
+    Shard &s = shards_[(size_t)(unsigned)user_id % SHARDS];
+    lock_guard<mutex> lock(s.mtx);
+    unique_ptr<UserQuota> &q = s.users[user_id];
+    if (!q) q.reset(new UserQuota);
+    return *q;
 }
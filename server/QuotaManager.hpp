@@ -1,27 +1,52 @@
 // ===== file: server/QuotaManager.hpp =====
 #pragma once
 #include <unordered_map>
+#include <memory>
 #include <mutex>
-#include <string>
+#include <atomic>
 #include <cstdint>
 
 using namespace std;
 
-struct UserQuota {
-    uint64_t used_bytes = 0;
-    uint64_t max_bytes  = 0; // 0 = unlimited
+// Quota của 1 user, chỉ dùng atomic. charged = used + phần giữ chỗ của các
+// upload chưa commit; mọi lần giữ chỗ so charged với max bằng CAS nên nhiều
+// upload cùng lúc không vượt quota được.
+class UserQuota {
+public:
+    void set_limit(uint64_t max_bytes) { max_bytes_.store(max_bytes, memory_order_relaxed); }
+    // Nạp usage từ DB ở lần đăng nhập đầu; các lần sau giữ số trong bộ nhớ
+    // (đăng nhập lại để nối upload không bị cộng dồn).
+    void load_usage(uint64_t used_bytes);
+    // Giữ chỗ cho upload đang chạy/đang chờ nối lại; false nếu vượt quota.
+    bool reserve(uint64_t bytes);
+    void release(uint64_t bytes);
+    // Upload commit: usage += delta (không âm), trả phần đã giữ chỗ trong
+    // cùng 1 bước. Trả về usage mới.
+    uint64_t commit(uint64_t reserved, int64_t delta);
+
+    uint64_t used() const     { return used_.load(memory_order_relaxed); }
+    uint64_t reserved() const { return charged_.load(memory_order_relaxed) - used(); }
+    uint64_t limit() const    { return max_bytes_.load(memory_order_relaxed); }
+
+private:
+    atomic<uint64_t> max_bytes_{0}; // 0 = unlimited
+    atomic<uint64_t> used_{0};
+    atomic<uint64_t> charged_{0};
+    atomic<bool>     loaded_{false};
 };
 
+// Tài khoản quota theo user id (DB), chia shard: chỉ lần tra đầu của mỗi
+// session lấy khóa shard, sau đó session giữ tham chiếu và chỉ đụng atomic.
 class QuotaManager {
 public:
-    void set_limit(const string &user, uint64_t max_bytes);
-    bool can_allocate(const string &user, uint64_t additional_bytes);
-    void add_usage(const string &user, uint64_t delta);
-    // Điều chỉnh usage với delta âm/dương, trả về giá trị mới (không âm).
-    int64_t adjust_usage(const string &user, int64_t delta);
-    uint64_t used(const string &user);
+    // Tạo nếu chưa có; tham chiếu sống suốt đời server.
+    UserQuota &account(int user_id);
 
 private:
-    mutex mtx_;
-    unordered_map<string, UserQuota> quotas_;
+    static const size_t SHARDS = 64;
+    struct Shard {
+        mutex mtx;
+        unordered_map<int, unique_ptr<UserQuota>> users;
+    };
+    Shard shards_[SHARDS];
 };
@@ -0,0 +1,207 @@
+// ===== file: server/Shaper.cpp =====
+#include "Shaper.hpp"
+#include <algorithm>
+
+namespace {
+const int64_t  MIN_BURST    = 16 * 1024;    // bucket tích được ít nhất chừng này
+const int64_t  MIN_GRANT    = 4 * 1024;     // không gửi lắt nhắt dưới mức này
+const uint64_t MIN_QUANTUM  = 16 * 1024;    // quantum DRR tối thiểu
+const uint64_t IDLE_NS      = 100000000;    // user không xin token quá 100ms: hết backlog
+const uint64_t DRR_RETRY_NS = 5000000;      // user đã hết phần của vòng: thử lại sau 5ms
+
+// ~100ms theo rate.
+int64_t burst_of(uint64_t rate) {
+    return max((int64_t)(rate / 10), MIN_BURST);
+}
+
+// Mỗi vòng DRR ~10ms theo rate của server.
+uint64_t quantum_of(uint64_t rate) {
+    return max(rate / 100, MIN_QUANTUM);
+}
+} // namespace
+
+uint64_t TokenBucket::available(uint64_t rate, uint64_t now) {
+    if (rate == 0) return UINT64_MAX;
+    int64_t burst = burst_of(rate);
+    if (now > last_ns_) {
+        double add = (double)(now - last_ns_) * (double)rate / 1e9;
+        if ((double)tokens_ + add >= (double)burst) {
+            tokens_  = burst;
+            last_ns_ = now;
+        } else if (add >= 1) {
+            // Chỉ tiến last_ns_ đúng phần thời gian đã đổi ra token, phần lẻ
+            // để dành cho lần sau (rate thấp, gọi dày vẫn nạp đủ).
+            int64_t n = (int64_t)add;
+            tokens_  += n;
+            last_ns_ += (uint64_t)((double)n * 1e9 / (double)rate);
+        }
+    }
+    return tokens_ >= MIN_GRANT ? (uint64_t)tokens_ : 0;
+}
+
+uint64_t TokenBucket::ready_at(uint64_t rate, uint64_t now) const {
+    if (rate == 0 || tokens_ >= MIN_GRANT) return now;
+    uint64_t at = last_ns_ + (uint64_t)((double)(MIN_GRANT - tokens_) * 1e9 / (double)rate) + 1;
+    return max(at, now + 1);
+}
+
+void Shaper::set_limits(const ShapingLimits &l) {
+    global_rate_.store(l.global_rate, memory_order_relaxed);
+    user_rate_.store(l.user_rate, memory_order_relaxed);
+    session_rate_.store(l.session_rate, memory_order_relaxed);
+    user_sessions_.store(l.user_sessions, memory_order_relaxed);
+}
+
+ShapingLimits Shaper::limits() const {
+    ShapingLimits l;
+    l.global_rate   = global_rate_.load(memory_order_relaxed);
+    l.user_rate     = user_rate_.load(memory_order_relaxed);
+    l.session_rate  = session_rate_.load(memory_order_relaxed);
+    l.user_sessions = user_sessions_.load(memory_order_relaxed);
+    return l;
+}
+
+bool Shaper::attach(SessionLink &s, int user_id) {
+    if (s.user && s.user_id == user_id) return true;
+    detach(s);
+
+    UserLink *u;
+    {
+        lock_guard<mutex> lock(users_mtx_);
+        unique_ptr<UserLink> &p = users_[user_id];
+        if (!p) p.reset(new UserLink);
+        u = p.get();
+    }
+    uint32_t cur = u->sessions.load(memory_order_relaxed);
+    do {
+        uint32_t max = user_sessions_.load(memory_order_relaxed);
+        if (max != 0 && cur >= max) return false;
+    } while (!u->sessions.compare_exchange_weak(cur, cur + 1, memory_order_relaxed));
+    s.user    = u;
+    s.user_id = user_id;
+    return true;
+}
+
+void Shaper::detach(SessionLink &s) {
+    if (!s.user) return;
+    for (int i = 0; i < 2; ++i) {
+        if (!s.in_drr[i]) continue;
+        lock_guard<mutex> lock(links_[i].mtx);
+        leave_drr(s, i);
+    }
+    s.user->sessions.fetch_sub(1, memory_order_relaxed);
+    s.user = nullptr;
+}
+
+uint64_t Shaper::wait(Direction d, uint64_t at, uint64_t &wake) {
+    throttled_[(int)d].fetch_add(1, memory_order_relaxed);
+    wake = at;
+    return 0;
+}
+
+void Shaper::leave_drr(SessionLink &s, int i) {
+    if (!s.in_drr[i]) return;
+    s.in_drr[i] = false;
+    --s.user->dir[i].in_drr;
+}
+
+void Shaper::enter_drr(SessionLink &s, int i) {
+    if (s.in_drr[i]) return;
+    s.in_drr[i] = true;
+    ++s.user->dir[i].in_drr;
+}
+
+uint64_t Shaper::grant(SessionLink &s, Direction d, uint64_t want, uint64_t now,
+                       uint64_t &wake) {
+    int i = (int)d;
+    uint64_t srate = session_rate_.load(memory_order_relaxed);
+    uint64_t urate = user_rate_.load(memory_order_relaxed);
+    uint64_t grate = global_rate_.load(memory_order_relaxed);
+    uint64_t n = min(want, s.bucket[i].available(srate, now));
+    if (n == 0) {
+        // Chờ bucket riêng thì không được giữ vòng DRR của user khác, trừ khi
+        // session khác của user vẫn đang xin token server.
+        if (s.user && grate != 0) {
+            lock_guard<mutex> lock(links_[i].mtx);
+            leave_drr(s, i);
+            if (s.user->dir[i].in_drr == 0) s.user->dir[i].last_ns = 0;
+        }
+        return wait(d, s.bucket[i].ready_at(srate, now), wake);
+    }
+    if (!s.user || (urate == 0 && grate == 0)) return n;
+
+    Link &l = links_[i];
+    lock_guard<mutex> lock(l.mtx);
+    UserLink::State &u = s.user->dir[i];
+    n = min(n, u.bucket.available(urate, now));
+    if (n == 0) {
+        u.last_ns = 0;
+        return wait(d, u.bucket.ready_at(urate, now), wake);
+    }
+    if (grate != 0) {
+        enter_drr(s, i);
+        n = min(n, drr_credit(l, u, grate, now));
+        if (n == 0) return wait(d, now + DRR_RETRY_NS, wake);
+        n = min(n, l.global.available(grate, now));
+        if (n == 0) return wait(d, l.global.ready_at(grate, now), wake);
+    }
+    return n;
+}
+
+void Shaper::charge(SessionLink &s, Direction d, uint64_t n) {
+    int i = (int)d;
+    if (session_rate_.load(memory_order_relaxed) != 0) s.bucket[i].charge(n);
+
+    bool by_user   = user_rate_.load(memory_order_relaxed) != 0;
+    bool by_global = global_rate_.load(memory_order_relaxed) != 0;
+    if (!s.user || (!by_user && !by_global)) return;
+
+    Link &l = links_[i];
+    lock_guard<mutex> lock(l.mtx);
+    UserLink::State &u = s.user->dir[i];
+    if (by_user) u.bucket.charge(n);
+    if (by_global) {
+        l.global.charge(n);
+        u.deficit -= (int64_t)n;
+    }
+}
+
+// Phần còn được lấy trong vòng DRR hiện tại (gọi khi đang giữ l.mtx).
+uint64_t Shaper::drr_credit(Link &l, UserLink::State &u, uint64_t rate, uint64_t now) {
+    u.last_ns = now;
+    if (!u.listed) {
+        l.active.push_back(&u);
+        u.listed = true;
+    }
+    int64_t quantum = (int64_t)quantum_of(rate);
+    if (u.round != l.round) {
+        u.round   = l.round;
+        u.deficit = min(u.deficit, (int64_t)0) + quantum;
+    }
+    if (u.deficit <= 0) {
+        if (others_pending(l, &u, now)) return 0;
+        // Không user nào khác còn phần trong vòng này: sang vòng mới.
+        ++l.round;
+        u.round   = l.round;
+        u.deficit = quantum;
+    }
+    return (uint64_t)u.deficit;
+}
+
+// Còn user khác có backlog chưa dùng hết phần của vòng hiện tại. Bỏ khỏi danh
+// sách các user đã lâu không xin token.
+bool Shaper::others_pending(Link &l, const UserLink::State *self, uint64_t now) {
+    bool pending = false;
+    for (size_t i = 0; i < l.active.size();) {
+        UserLink::State *v = l.active[i];
+        if (v->last_ns == 0 || v->last_ns + IDLE_NS < now) {
+            v->listed = false;
+            l.active[i] = l.active.back();
+            l.active.pop_back();
+            continue;
+        }
+        if (v != self && (v->round != l.round || v->deficit > 0)) pending = true;
+        ++i;
+    }
+    return pending;
+}
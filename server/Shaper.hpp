@@ -0,0 +1,112 @@
+// ===== file: server/Shaper.hpp =====
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// Giới hạn băng thông body theo byte/s (0 = không giới hạn), áp riêng cho
+// mỗi chiều (upload, download).
+struct ShapingLimits {
+    uint64_t global_rate   = 0; // cả server
+    uint64_t user_rate     = 0; // mọi session của 1 user cộng lại
+    uint64_t session_rate  = 0; // 1 kết nối
+    uint32_t user_sessions = 0; // session đồng thời tối đa của 1 user, 0 = không giới hạn
+};
+
+enum class Direction : uint8_t { In = 0, Out = 1 }; // body upload / download
+
+// Token bucket nạp rate byte/s, tích tối đa ~100ms. tokens âm là nợ: byte đã
+// gửi trước (body nằm sẵn trong bộ nhớ, frame lấy token trước khi gửi) phải
+// trả xong mới được gửi tiếp. Không thread-safe.
+class TokenBucket {
+public:
+    // Token dùng được ngay; 0 nếu chưa đủ 1 lượt gửi tối thiểu.
+    uint64_t available(uint64_t rate, uint64_t now);
+    // Lúc available() sẽ khác 0.
+    uint64_t ready_at(uint64_t rate, uint64_t now) const;
+    void charge(uint64_t n) { tokens_ -= (int64_t)n; }
+
+private:
+    int64_t  tokens_  = 0;
+    uint64_t last_ns_ = 0;
+};
+
+// Shaping phân cấp: 1 lần gửi/nhận phải qua bucket của session, của user và
+// của server. Khi bucket server là chỗ nghẽn, các user đang chờ chia nó theo
+// deficit round robin: mỗi vòng mỗi user có backlog được 1 quantum byte, vòng
+// mới chỉ bắt đầu khi không còn user nào chưa dùng hết phần của mình, nên
+// user kéo file lớn không lấn được user tương tác. Giới hạn đổi được lúc chạy.
+class Shaper {
+public:
+    // Phần của 1 user dùng chung giữa các session, sống suốt đời server.
+    // Trường trong dir[] được bảo vệ bởi khóa của chiều tương ứng.
+    struct UserLink {
+        struct State {
+            TokenBucket bucket;
+            int64_t  deficit = 0; // byte còn được lấy trong vòng DRR hiện tại
+            uint64_t round   = 0;
+            uint64_t last_ns = 0; // lần cuối cần token server (0 = không chờ)
+            uint32_t in_drr  = 0; // số session đang xin token server (SessionLink::in_drr)
+            bool     listed  = false;
+        };
+        atomic<uint32_t> sessions{0};
+        State dir[2];
+    };
+
+    // Trạng thái của 1 session, chỉ thread của session dùng.
+    struct SessionLink {
+        TokenBucket bucket[2];
+        UserLink   *user    = nullptr;
+        int         user_id = 0;
+        bool        in_drr[2] = {false, false}; // đang xin token server (khóa của chiều)
+    };
+
+    void set_limits(const ShapingLimits &l);
+    ShapingLimits limits() const;
+
+    // Gắn session vào user (AUTH); false nếu user đã đủ số session. Hạ
+    // user_sessions lúc chạy không đóng các session đang có.
+    bool attach(SessionLink &s, int user_id);
+    void detach(SessionLink &s);
+
+    // Số byte (≤ want) được gửi/nhận ngay qua mọi tầng; 0 thì wake = lúc thử lại.
+    uint64_t grant(SessionLink &s, Direction d, uint64_t want, uint64_t now, uint64_t &wake);
+    // Trừ n byte đã gửi/nhận ở mọi tầng đang bật (được phép thành nợ).
+    void charge(SessionLink &s, Direction d, uint64_t n);
+
+    // Số lần grant trả 0 (để theo dõi mức nghẽn).
+    uint64_t throttled(Direction d) const {
+        return throttled_[(int)d].load(memory_order_relaxed);
+    }
+
+private:
+    // 1 chiều: bucket của server và vòng DRR giữa các user đang chờ nó.
+    struct Link {
+        mutex mtx;
+        TokenBucket global;
+        uint64_t round = 0;
+        vector<UserLink::State*> active;
+    };
+
+    uint64_t wait(Direction d, uint64_t at, uint64_t &wake);
+    // Session rời/vào nhóm đang xin token server của user (giữ khóa chiều i).
+    static void leave_drr(SessionLink &s, int i);
+    static void enter_drr(SessionLink &s, int i);
+    uint64_t drr_credit(Link &l, UserLink::State &u, uint64_t rate, uint64_t now);
+    bool others_pending(Link &l, const UserLink::State *self, uint64_t now);
+
+    atomic<uint64_t> global_rate_{0};
+    atomic<uint64_t> user_rate_{0};
+    atomic<uint64_t> session_rate_{0};
+    atomic<uint32_t> user_sessions_{0};
+    atomic<uint64_t> throttled_[2] = {{0}, {0}};
+
+    Link links_[2];
+    mutex users_mtx_;
+    unordered_map<int, unique_ptr<UserLink>> users_;
+};
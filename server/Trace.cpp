@@ -0,0 +1,190 @@
+// ===== file: server/Trace.cpp =====
+#include "Trace.hpp"
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if FILESHARE_HAVE_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+extern "C" {
+// Công cụ gắn probe tăng biến này (quy ước semaphore của systemtap).
+__extension__ unsigned short fileshare_span_semaphore
+    __attribute__((unused)) __attribute__((section(".probes")));
+}
+#endif
+
+namespace trace {
+
+atomic<bool> g_ring_on{false};
+
+namespace {
+size_t g_spans = 0;
+
+// Ô của ring, đọc/ghi kiểu seqlock: seq lẻ = đang ghi, 2*pos+2 = span thứ pos
+// đã ghi xong. Người đọc thấy seq đổi trong lúc đọc thì bỏ ô đó.
+struct Slot {
+    atomic<uint64_t> seq{0};
+    atomic<uint64_t> cat{0};
+    atomic<uint64_t> name{0};
+    atomic<uint64_t> start{0};
+    atomic<uint64_t> dur{0};
+    atomic<uint64_t> id{0};
+    atomic<uint64_t> meta{0}; // tid << 1 | async
+};
+
+struct Ring {
+    unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    atomic<uint64_t> head{0}; // chỉ thread sở hữu ghi
+};
+
+// Ring của thread đã thoát được thread mới dùng lại; span cũ giữ tid của nó.
+struct Registry {
+    mutex mtx;
+    vector<unique_ptr<Ring>> all;
+    vector<Ring *> free;
+};
+
+Registry &registry() {
+    static Registry *r = new Registry; // sống tới sau destructor thread_local
+    return *r;
+}
+
+struct Lease {
+    Ring    *ring = nullptr;
+    uint64_t tid  = 0;
+    ~Lease() {
+        if (!ring) return;
+        Registry &r = registry();
+        lock_guard<mutex> lock(r.mtx);
+        r.free.push_back(ring);
+    }
+};
+
+Lease &local() {
+    static thread_local Lease lease;
+    if (!lease.ring) {
+        lease.tid = (uint64_t)::syscall(SYS_gettid);
+        Registry &r = registry();
+        lock_guard<mutex> lock(r.mtx);
+        if (!r.free.empty()) {
+            lease.ring = r.free.back();
+            r.free.pop_back();
+        } else {
+            unique_ptr<Ring> ring(new Ring);
+            ring->slots.reset(new Slot[g_spans]);
+            ring->mask = g_spans - 1;
+            lease.ring = ring.get();
+            r.all.push_back(move(ring));
+        }
+    }
+    return lease;
+}
+
+void append_us(string &out, uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%03llu", (unsigned long long)(ns / 1000),
+             (unsigned long long)(ns % 1000));
+    out += buf;
+}
+
+struct Event {
+    const char *cat;
+    const char *name;
+    uint64_t start, dur, id, meta;
+};
+} // namespace
+
+void enable(size_t spans_per_thread) {
+    if (spans_per_thread == 0) return;
+    size_t n = 2;
+    while (n < spans_per_thread) n <<= 1;
+    g_spans = n;
+    g_ring_on.store(true, memory_order_relaxed);
+}
+
+void emit(const char *cat, const char *name, uint64_t start_ns, uint64_t dur_ns,
+          uint64_t id, bool async) {
+#if FILESHARE_HAVE_SDT
+    STAP_PROBE4(fileshare, span, cat, name, start_ns, dur_ns);
+#endif
+    if (!g_ring_on.load(memory_order_relaxed)) return;
+    Lease &l = local();
+    Ring &r = *l.ring;
+    uint64_t pos = r.head.load(memory_order_relaxed);
+    Slot &s = r.slots[pos & r.mask];
+    s.seq.store(2 * pos + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s.cat.store((uint64_t)(uintptr_t)cat, memory_order_relaxed);
+    s.name.store((uint64_t)(uintptr_t)name, memory_order_relaxed);
+    s.start.store(start_ns, memory_order_relaxed);
+    s.dur.store(dur_ns, memory_order_relaxed);
+    s.id.store(id, memory_order_relaxed);
+    s.meta.store(l.tid << 1 | (async ? 1 : 0), memory_order_relaxed);
+    s.seq.store(2 * pos + 2, memory_order_release);
+    r.head.store(pos + 1, memory_order_release);
+}
+
+string dump_json() {
+    vector<Event> events;
+    {
+        Registry &reg = registry();
+        lock_guard<mutex> lock(reg.mtx);
+        for (const auto &rp : reg.all) {
+            const Ring &r = *rp;
+            uint64_t head = r.head.load(memory_order_acquire);
+            uint64_t from = head > r.mask + 1 ? head - (r.mask + 1) : 0;
+            for (uint64_t pos = from; pos < head; ++pos) {
+                const Slot &s = r.slots[pos & r.mask];
+                uint64_t seq = s.seq.load(memory_order_acquire);
+                if (seq != 2 * pos + 2) continue; // đã bị đè
+                Event e;
+                e.cat   = (const char *)(uintptr_t)s.cat.load(memory_order_relaxed);
+                e.name  = (const char *)(uintptr_t)s.name.load(memory_order_relaxed);
+                e.start = s.start.load(memory_order_relaxed);
+                e.dur   = s.dur.load(memory_order_relaxed);
+                e.id    = s.id.load(memory_order_relaxed);
+                e.meta  = s.meta.load(memory_order_relaxed);
+                atomic_thread_fence(memory_order_acquire);
+                if (s.seq.load(memory_order_relaxed) != seq) continue;
+                events.push_back(e);
+            }
+        }
+    }
+
+    // Span lồng nhau (ph "X") trên từng thread; stream upload/download xen kẽ
+    // nên dùng cặp async "b"/"e" theo id.
+    string pid = to_string(::getpid());
+    string out = "{\"traceEvents\":[";
+    bool first = true;
+    auto begin = [&](const Event &e, const char *ph) {
+        if (!first) out += ",";
+        first = false;
+        out += string("{\"name\":\"") + e.name + "\",\"cat\":\"" + e.cat + "\",\"ph\":\"" + ph +
+               "\",\"pid\":" + pid + ",\"tid\":" + to_string(e.meta >> 1) + ",\"ts\":";
+    };
+    for (const Event &e : events) {
+        if (e.meta & 1) {
+            begin(e, "b");
+            append_us(out, e.start);
+            out += ",\"id\":" + to_string(e.id) + "}";
+            begin(e, "e");
+            append_us(out, e.start + e.dur);
+            out += ",\"id\":" + to_string(e.id) + "}";
+        } else {
+            begin(e, "X");
+            append_us(out, e.start);
+            out += ",\"dur\":";
+            append_us(out, e.dur);
+            out += ",\"args\":{\"id\":" + to_string(e.id) + "}}";
+        }
+    }
+    out += "],\"displayTimeUnit\":\"ns\"}\n";
+    return out;
+}
+
+} // namespace trace
@@ -0,0 +1,86 @@
+// ===== file: server/Trace.hpp =====
+#pragma once
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include "Metrics.hpp"
+
+using namespace std;
+
+// Span theo giai đoạn của lệnh (mạng, đĩa, DB, quota...). Mỗi thread ghi vào
+// ring nhị phân riêng, đầy thì đè span cũ nhất; dump_json() xuất các span còn
+// trong ring dạng Chrome trace-event (chrome://tracing, ui.perfetto.dev).
+// Build với -DFILESHARE_TRACE=0 thì các macro TRACE_* biến mất hoàn toàn.
+// Có <sys/sdt.h> (FILESHARE_HAVE_SDT): mỗi span còn là probe USDT
+// fileshare:span(cat, name, start_ns, dur_ns), bật khi bpftrace/perf gắn vào
+// kể cả lúc ring tắt.
+
+#ifndef FILESHARE_TRACE
+#define FILESHARE_TRACE 1
+#endif
+
+#if FILESHARE_HAVE_SDT
+extern "C" unsigned short fileshare_span_semaphore;
+#endif
+
+namespace trace {
+
+extern atomic<bool> g_ring_on;
+
+// Bật ring với spans_per_thread span mỗi thread (làm tròn lên lũy thừa 2).
+// Gọi 1 lần lúc khởi động, trước khi các thread chạy.
+void enable(size_t spans_per_thread);
+
+// Có nơi nhận span: ring bật hoặc probe USDT đang được gắn.
+inline bool active() {
+#if FILESHARE_HAVE_SDT
+    if (fileshare_span_semaphore) return true;
+#endif
+    return g_ring_on.load(memory_order_relaxed);
+}
+
+// cat/name phải là chuỗi tĩnh: ring chỉ lưu con trỏ. async: span không lồng
+// trong span khác của thread (stream upload/download xen kẽ nhau), id phân biệt.
+void emit(const char *cat, const char *name, uint64_t start_ns, uint64_t dur_ns,
+          uint64_t id = 0, bool async = false);
+
+// Span của 1 khối lệnh: từ constructor tới destructor.
+class Span {
+public:
+    Span(const char *cat, const char *name, uint64_t id = 0)
+        : cat_(cat), name_(name), id_(id), start_(active() ? metrics::now_ns() : 0) {}
+    ~Span() {
+        if (start_) emit(cat_, name_, start_, metrics::now_ns() - start_, id_);
+    }
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+private:
+    const char *cat_;
+    const char *name_;
+    uint64_t    id_;
+    uint64_t    start_;
+};
+
+// {"traceEvents":[...]} của mọi span còn trong các ring.
+string dump_json();
+
+} // namespace trace
+
+#if FILESHARE_TRACE
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT2(a, b)
+#define TRACE_SPAN(cat, name) trace::Span TRACE_CONCAT(trace_span_, __LINE__)(cat, name)
+#define TRACE_SPAN_ID(cat, name, id) \
+    trace::Span TRACE_CONCAT(trace_span_, __LINE__)(cat, name, id)
+#define TRACE_ASYNC(cat, name, start_ns, id)                                         \
+    do {                                                                             \
+        if (trace::active()) {                                                       \
+            trace::emit(cat, name, start_ns, metrics::now_ns() - (start_ns), id, true); \
+        }                                                                            \
+    } while (0)
+#else
+#define TRACE_SPAN(cat, name)                ((void)0)
+#define TRACE_SPAN_ID(cat, name, id)         ((void)0)
+#define TRACE_ASYNC(cat, name, start_ns, id) ((void)0)
+#endif
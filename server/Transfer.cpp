@@ -0,0 +1,462 @@
+// ===== file: server/Transfer.cpp =====
+#include "Transfer.hpp"
+#include "UringIo.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#endif
+
+using namespace std;
+
+namespace {
+const size_t BUF_SIZE = 64 * 1024;
+// Body nhỏ hơn ngưỡng này không đáng chi phí dựng ring io_uring.
+const uint64_t URING_MIN_SIZE = 1024 * 1024;
+// Body nhỏ đọc qua buffer rẻ hơn dựng/gỡ mapping.
+const uint64_t MMAP_MIN_SIZE = 256 * 1024;
+const size_t   MMAP_WINDOW   = 8 * 1024 * 1024;
+// Body nhỏ thường đã nằm trọn trong buffer lệnh, không cần tạo pipe.
+const uint64_t SPLICE_MIN_SIZE = 64 * 1024;
+// Số lần đọc input (mỗi lần BUF_SIZE * 4) tối đa cho 1 frame nén: input nén
+// rất tốt (file toàn 0) có thể cần hàng trăm MiB mới đủ 1 frame đầy.
+const int COMPRESS_READS_PER_FRAME = 4;
+} // namespace
+
+ssize_t BodySink::recv_from(int sockfd, uint64_t max) {
+    static thread_local vector<char> scratch(BUF_SIZE);
+    size_t want = max < scratch.size() ? (size_t)max : scratch.size();
+    ssize_t n;
+    do {
+        n = ::recv(sockfd, scratch.data(), want, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        write(scratch.data(), (size_t)n);
+        return n;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    return -1;
+}
+
+void PlainFileSink::write(const char *p, size_t n) {
+    checksum(p, n);
+    metrics::PhaseTimer timer(metrics::Phase::Disk);
+    TRACE_SPAN("disk", "pwrite");
+    while (n > 0 && !failed_) {
+        ssize_t w = ::pwrite(fd_, p, n, (off_t)offset_);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            failed_ = true;
+            break;
+        }
+        p += w;
+        n -= (size_t)w;
+        offset_ += (uint64_t)w;
+    }
+}
+
+PlainFileSource::PlainFileSource(int fd, uint64_t offset, uint64_t size)
+    : fd_(fd), offset_(offset), remaining_(size) {}
+
+ssize_t PlainFileSource::send_to(int sockfd, uint64_t max) {
+    if (buf_off_ == buf_len_) {
+        if (remaining_ == 0) return 0;
+        if (buf_.empty()) buf_.resize(BUF_SIZE);
+        size_t chunk = remaining_ > BUF_SIZE ? BUF_SIZE : (size_t)remaining_;
+        ssize_t got;
+        {
+            metrics::PhaseTimer timer(metrics::Phase::Disk);
+            TRACE_SPAN("disk", "pread");
+            do {
+                got = ::pread(fd_, buf_.data(), chunk, (off_t)offset_);
+            } while (got < 0 && errno == EINTR);
+        }
+        if (got <= 0) return -1;
+        offset_ += (uint64_t)got;
+        buf_off_ = 0;
+        buf_len_ = (size_t)got;
+    }
+
+    size_t want = buf_len_ - buf_off_;
+    if (want > max) want = (size_t)max;
+    ssize_t n;
+    do {
+        n = ::send(sockfd, buf_.data() + buf_off_, want, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    buf_off_   += (size_t)n;
+    remaining_ -= (uint64_t)n;
+    return n;
+}
+
+MmapFileSource::~MmapFileSource() {
+    unmap();
+}
+
+void MmapFileSource::unmap() {
+    if (map_) ::munmap(map_, map_len_);
+    map_ = nullptr;
+    map_len_ = 0;
+}
+
+// Cửa sổ kế tiếp bắt đầu ở trang chứa offset_ (mmap cần offset chia hết trang).
+bool MmapFileSource::map_window() {
+    unmap();
+    static const uint64_t page = (uint64_t)::sysconf(_SC_PAGESIZE);
+    uint64_t start = offset_ - offset_ % page;
+    map_off_ = (size_t)(offset_ - start);
+    map_len_ = (size_t)min<uint64_t>(MMAP_WINDOW, map_off_ + remaining_);
+    void *p = ::mmap(nullptr, map_len_, PROT_READ, MAP_SHARED, fd_, (off_t)start);
+    if (p == MAP_FAILED) {
+        map_len_ = 0;
+        return false;
+    }
+    map_ = static_cast<char *>(p);
+    ::madvise(map_, map_len_, MADV_SEQUENTIAL);
+    return true;
+}
+
+ssize_t MmapFileSource::send_to(int sockfd, uint64_t max) {
+    if (remaining_ == 0) return 0;
+    if (map_off_ == map_len_ && !map_window()) return -1;
+
+    size_t want = map_len_ - map_off_;
+    if (want > max) want = (size_t)max;
+    ssize_t n;
+    do {
+        n = ::send(sockfd, map_ + map_off_, want, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    map_off_   += (size_t)n;
+    offset_    += (uint64_t)n;
+    remaining_ -= (uint64_t)n;
+    if (remaining_ == 0) unmap();
+    return n;
+}
+
+#ifdef __linux__
+ssize_t SendfileSource::send_to(int sockfd, uint64_t max) {
+    // Giới hạn mỗi lần gọi để 1 transfer không giữ loop quá lâu.
+    uint64_t limit = max < remaining_ ? max : remaining_;
+    size_t chunk = limit > 4 * BUF_SIZE ? 4 * BUF_SIZE : (size_t)limit;
+    off_t off = (off_t)offset_;
+    ssize_t n;
+    do {
+        n = ::sendfile(sockfd, fd_, &off, chunk);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (n == 0) return -1; // file bị cắt ngắn
+    offset_    += (uint64_t)n;
+    remaining_ -= (uint64_t)n;
+    return n;
+}
+
+SpliceFileSink::~SpliceFileSink() {
+    if (pipe_[0] >= 0) ::close(pipe_[0]);
+    if (pipe_[1] >= 0) ::close(pipe_[1]);
+}
+
+bool SpliceFileSink::init() {
+    if (::pipe2(pipe_, O_CLOEXEC) != 0) return false;
+    ::fcntl(pipe_[1], F_SETPIPE_SZ, (int)(4 * BUF_SIZE));
+    return true;
+}
+
+void SpliceFileSink::write(const char *p, size_t n) {
+    while (n > 0 && !failed_) {
+        ssize_t w = ::pwrite(fd_, p, n, (off_t)offset_);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            failed_ = true;
+            break;
+        }
+        p += w;
+        n -= (size_t)w;
+        offset_ += (uint64_t)w;
+    }
+}
+
+// Rút phần còn trong pipe qua bộ nhớ rồi ghi thường (write() tự bỏ qua khi đã
+// lỗi ghi); cần để giữ đúng framing của luồng lệnh.
+void SpliceFileSink::drain_pipe(size_t n) {
+    char buf[16 * 1024];
+    while (n > 0) {
+        ssize_t r = ::read(pipe_[0], buf, n < sizeof(buf) ? n : sizeof(buf));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        write(buf, (size_t)r);
+        n -= (size_t)r;
+    }
+}
+
+ssize_t SpliceFileSink::recv_from(int sockfd, uint64_t max) {
+    if (fallback_) return BodySink::recv_from(sockfd, max);
+
+    size_t want = max < 4 * BUF_SIZE ? (size_t)max : 4 * BUF_SIZE;
+    ssize_t n;
+    do {
+        n = ::splice(sockfd, nullptr, pipe_[1], nullptr, want,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINVAL || errno == ENOSYS) {
+            fallback_ = true;
+            return BodySink::recv_from(sockfd, max);
+        }
+        return -1;
+    }
+    if (n == 0) return -1;
+
+    size_t left = (size_t)n;
+    while (left > 0 && !failed_) {
+        loff_t off = (loff_t)offset_;
+        ssize_t w = ::splice(pipe_[0], nullptr, fd_, &off, left, SPLICE_F_MOVE);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            fallback_ = true; // file đích không nhận splice
+            break;
+        }
+        if (w <= 0) {
+            failed_ = true;
+            break;
+        }
+        offset_ = (uint64_t)off;
+        left -= (size_t)w;
+    }
+    if (left > 0) drain_pipe(left);
+    return n;
+}
+#endif
+
+uint64_t BodySource::frame_size(uint64_t max, bool &last) {
+    uint64_t left = remaining();
+    last = left <= max;
+    return last ? left : max;
+}
+
+ssize_t SignatureSource::send_to(int sockfd, uint64_t max) {
+    pending_ = false;
+    if (remaining_ == 0) return 0;
+    if (off_ == buf_.size()) {
+        if (wake_fd_ >= 0 && !turn_) {
+            turn_    = true;
+            pending_ = true;
+            uint64_t one = 1;
+            ssize_t w = ::write(wake_fd_, &one, sizeof(one));
+            (void)w;
+            return 0;
+        }
+        turn_ = false;
+        buf_.clear();
+        off_ = 0;
+        metrics::PhaseTimer timer(metrics::Phase::Disk);
+        TRACE_SPAN("disk", "signature");
+        // File cũ bị cắt ngắn giữa chừng: không đủ byte như đã báo trong reply.
+        if (sig_.done() || !sig_.next(buf_) || buf_.empty()) return -1;
+    }
+    size_t want = buf_.size() - off_;
+    if (want > max) want = (size_t)max;
+    ssize_t n;
+    do {
+        n = ::send(sockfd, buf_.data() + off_, want, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    off_       += (size_t)n;
+    remaining_ -= (uint64_t)n;
+    return n;
+}
+
+// Giải nén theo lát nhỏ: 1 frame toàn số 0 có thể nở ra hàng trăm MB, kiểm
+// tra size sau mỗi lát để không phình bộ nhớ.
+void CompressedSink::write(const char *p, size_t n) {
+    const size_t slice = 16 * 1024;
+    while (n > 0 && !failed_) {
+        size_t take = n < slice ? n : slice;
+        out_.clear();
+        if (!dec_->update(p, take, out_) || written_ + out_.size() > size_) {
+            failed_ = true;
+            break;
+        }
+        checksum(out_.data(), out_.size());
+        inner_->write(out_.data(), out_.size());
+        written_ += out_.size();
+        p += take;
+        n -= take;
+    }
+}
+
+bool CompressedSink::finish() {
+    bool ok = inner_->finish();
+    return ok && !failed_ && dec_->finished() && written_ == size_;
+}
+
+void CompressedSource::produce() {
+    static thread_local vector<char> buf(BUF_SIZE * 4);
+    if (out_off_ > 0) {
+        out_.erase(0, out_off_);
+        out_off_ = 0;
+    }
+    if (left_ == 0) {
+        if (!enc_->finish(out_)) failed_ = true;
+        done_ = true;
+        return;
+    }
+    size_t n = left_ < buf.size() ? (size_t)left_ : buf.size();
+    if (!read_(offset_, buf.data(), n) || !enc_->update(buf.data(), n, out_)) {
+        failed_ = true;
+        done_   = true;
+        return;
+    }
+    offset_ += n;
+    left_   -= n;
+    ++reads_;
+}
+
+// Hết hạn mức đọc thì gửi frame ngắn hơn max (chỉ đọc tiếp khi chưa có byte
+// nén nào, vì frame DATA rỗng không kết thúc body).
+uint64_t CompressedSource::frame_size(uint64_t max, bool &last) {
+    reads_ = 0;
+    while (!done_ && pending() < max) {
+        if (reads_ >= COMPRESS_READS_PER_FRAME && pending() > 0) break;
+        produce();
+    }
+    last = done_ && pending() <= max;
+    return pending() < max ? pending() : max;
+}
+
+ssize_t CompressedSource::send_to(int sockfd, uint64_t max) {
+    if (failed_) return -1;
+    yielded_ = false;
+    if (wake_fd_ >= 0 && reads_ >= COMPRESS_READS_PER_FRAME) {
+        reads_   = 0;
+        yielded_ = true;
+        uint64_t one = 1;
+        ssize_t w = ::write(wake_fd_, &one, sizeof(one));
+        (void)w;
+        return 0;
+    }
+    if (pending() == 0 && !done_) produce();
+    size_t want = pending();
+    if (want > max) want = (size_t)max;
+    if (want == 0) return 0;
+    ssize_t n;
+    do {
+        n = ::send(sockfd, out_.data() + out_off_, want, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    out_off_ += (size_t)n;
+    return n;
+}
+
+unique_ptr<BodySink> make_file_sink(int fd, uint64_t offset, uint64_t size,
+                                    const TransferOptions &opt) {
+#ifdef __linux__
+    if (opt.use_splice && !opt.checksum && size >= SPLICE_MIN_SIZE) {
+        auto sink = make_unique<SpliceFileSink>(fd, offset);
+        if (sink->init()) return sink;
+    }
+#endif
+    unique_ptr<BodySink> sink;
+    if (opt.use_uring && size >= URING_MIN_SIZE) {
+        sink = make_uring_file_sink(fd, offset, opt.io_eventfd);
+    }
+    if (!sink) sink = make_unique<PlainFileSink>(fd, offset);
+    if (opt.checksum) sink->enable_checksum();
+    return sink;
+}
+
+unique_ptr<BodySource> make_file_source(int fd, uint64_t offset, uint64_t size,
+                                        const TransferOptions &opt) {
+    advise_sequential(fd, offset, size);
+#ifdef __linux__
+    if (opt.use_sendfile) return make_unique<SendfileSource>(fd, offset, size);
+#endif
+    if (opt.use_uring && size >= URING_MIN_SIZE) {
+        auto src = make_uring_file_source(fd, offset, size, opt.io_eventfd);
+        if (src) return src;
+    }
+    if (size >= MMAP_MIN_SIZE) return make_unique<MmapFileSource>(fd, offset, size);
+    return make_unique<PlainFileSource>(fd, offset, size);
+}
+
+namespace {
+// Thread của run_detached/run_worker, khởi động lần đầu cần tới và sống tới
+// hết process.
+struct Detached {
+    explicit Detached(unsigned n) : threads(n) {}
+
+    mutex mtx;
+    condition_variable cv;
+    deque<function<void()>> jobs;
+    unsigned threads;
+    bool started = false;
+
+    void push(function<void()> job) {
+        {
+            lock_guard<mutex> lock(mtx);
+            jobs.push_back(move(job));
+            if (!started) {
+                for (unsigned i = 0; i < threads; ++i) thread([this] { loop(); }).detach();
+                started = true;
+            }
+        }
+        cv.notify_one();
+    }
+
+    void loop() {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(mtx);
+                cv.wait(lock, [this] { return !jobs.empty(); });
+                job = move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+} // namespace
+
+void run_detached(function<void()> job) {
+    static Detached *d = new Detached(1);
+    d->push(move(job));
+}
+
+void run_worker(function<void()> job) {
+    static Detached *d = new Detached(max(2u, thread::hardware_concurrency()));
+    d->push(move(job));
+}
+
+void advise_sequential(int fd, uint64_t offset, uint64_t len) {
+#ifdef __linux__
+    ::posix_fadvise(fd, (off_t)offset, (off_t)len, POSIX_FADV_SEQUENTIAL);
+#else
+    (void)fd;
+    (void)offset;
+    (void)len;
+#endif
+}
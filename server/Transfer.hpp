@@ -0,0 +1,267 @@
+// ===== file: server/Transfer.hpp =====
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+#include <sys/types.h>
+#include "../common/Compress.hpp"
+#include "../common/Crc32c.hpp"
+#include "../common/Delta.hpp"
+
+using namespace std;
+
+// Đích của body upload: nhận dữ liệu theo thứ tự và ghi vào file tạm.
+class BodySink {
+public:
+    virtual ~BodySink() = default;
+
+    // Ghi n byte đã có trong bộ nhớ (phần body đọc kèm dòng lệnh).
+    virtual void write(const char *p, size_t n) = 0;
+
+    // Đọc tiếp tối đa max byte thẳng từ socket vào sink.
+    // >0: số byte đã nhận, 0: socket chưa có dữ liệu (EAGAIN) hoặc đang chờ
+    // đĩa (io_pending()), -1: đóng/lỗi.
+    virtual ssize_t recv_from(int sockfd, uint64_t max);
+    // recv_from vừa trả 0 vì chưa có buffer rảnh (io_uring), không phải vì
+    // socket: gọi lại khi TransferOptions::io_eventfd báo.
+    virtual bool io_pending() const { return false; }
+
+    // Gửi nốt phần đang gom xuống đĩa, không chờ. false: còn lệnh ghi đang
+    // chạy, gọi lại khi io_eventfd báo; true: finish() không phải chờ.
+    virtual bool settled() { return true; }
+    // Đẩy nốt dữ liệu đang chờ xuống đĩa. false nếu có lỗi ghi ở bất kỳ đâu.
+    virtual bool finish() = 0;
+
+    // CRC32C của mọi byte sink đã nhận, tính ngay khi byte đi qua bộ nhớ.
+    void enable_checksum() { checksum_ = true; }
+    bool checksumming() const { return checksum_; }
+    uint32_t crc() const { return crc_; }
+
+protected:
+    void checksum(const char *p, size_t n) {
+        if (checksum_) crc_ = crc32c(crc_, p, n);
+    }
+
+private:
+    bool     checksum_ = false;
+    uint32_t crc_      = 0;
+};
+
+// Nguồn của body download: đọc file và gửi ra socket.
+class BodySource {
+public:
+    virtual ~BodySource() = default;
+
+    // Gửi tiếp tối đa max byte body. >0: số byte đã gửi, 0: socket đầy
+    // (EAGAIN) hoặc đang chờ đĩa (io_pending()), -1: lỗi (file bị cắt ngắn
+    // hoặc socket lỗi).
+    virtual ssize_t send_to(int sockfd, uint64_t max) = 0;
+    // send_to vừa trả 0 vì đĩa chưa đọc xong (io_uring), không phải vì socket
+    // đầy: gọi lại khi TransferOptions::io_eventfd báo.
+    virtual bool io_pending() const { return false; }
+
+    virtual uint64_t remaining() const = 0;
+
+    // Byte gửi được trong frame v2 kế tiếp (≤ max); last = đây là phần cuối.
+    // Mặc định: nguồn biết trước kích thước. Nguồn nén chỉ biết dần.
+    virtual uint64_t frame_size(uint64_t max, bool &last);
+};
+
+struct TransferOptions {
+    bool use_uring    = true;
+    bool use_sendfile = true;
+    bool use_splice   = true;
+    bool checksum     = true;  // tính CRC32C của body upload
+    // eventfd của EventLoop, được báo khi có completion io_uring; -1 (socket
+    // blocking): chờ completion tại chỗ.
+    int  io_eventfd   = -1;
+};
+
+// Chọn backend phù hợp. Download: sendfile (zero-copy) > io_uring > mmap >
+// đọc/ghi thường, nên io_uring chỉ dùng cho download khi tắt sendfile.
+// Upload: splice > io_uring > ghi thường; splice không đưa byte lên bộ nhớ
+// nên không tính được CRC, chỉ dùng khi tắt checksum.
+// Sink/source không sở hữu fd; sink ghi từ offset (nối tiếp upload dở).
+unique_ptr<BodySink>   make_file_sink(int fd, uint64_t offset, uint64_t size,
+                                      const TransferOptions &opt);
+unique_ptr<BodySource> make_file_source(int fd, uint64_t offset, uint64_t size,
+                                        const TransferOptions &opt);
+
+// Chạy job trên 1 thread nền dùng chung: việc phải chờ đĩa khi đóng transfer
+// (I/O io_uring còn dở) không được chặn EventLoop.
+void run_detached(function<void()> job);
+
+// Chạy job trên pool thread nền (số thread theo số core): việc nặng về đĩa/CPU
+// khi kết thúc lệnh (nhập file vào chunk store, dựng file từ delta) không
+// được chặn EventLoop. Job tự báo xong cho session (eventfd của loop).
+void run_worker(function<void()> job);
+
+// Báo kernel [offset, offset+len) của fd sẽ được đọc tuần tự (readahead lớn).
+void advise_sequential(int fd, uint64_t offset, uint64_t len);
+
+// Backend mặc định: pwrite()/pread() + send() qua buffer 64 KiB.
+class PlainFileSink : public BodySink {
+public:
+    PlainFileSink(int fd, uint64_t offset) : fd_(fd), offset_(offset) {}
+    void write(const char *p, size_t n) override;
+    bool finish() override { return !failed_; }
+
+private:
+    int  fd_;
+    uint64_t offset_;
+    bool failed_ = false;
+};
+
+class PlainFileSource : public BodySource {
+public:
+    PlainFileSource(int fd, uint64_t offset, uint64_t size);
+    ssize_t send_to(int sockfd, uint64_t max) override;
+    uint64_t remaining() const override { return remaining_; }
+
+private:
+    int fd_;
+    uint64_t offset_;
+    uint64_t remaining_;
+    vector<char> buf_;
+    size_t buf_off_ = 0;
+    size_t buf_len_ = 0;
+};
+
+// send() thẳng từ file map vào bộ nhớ, không copy qua buffer. Map từng cửa
+// sổ 8 MiB (MADV_SEQUENTIAL) và gỡ khi gửi xong nên bộ nhớ không phụ thuộc
+// kích thước file hay số người đọc. File chỉ bị thay bằng rename, không bị cắt
+// ngắn tại chỗ, nên không gặp SIGBUS khi đang gửi.
+class MmapFileSource : public BodySource {
+public:
+    MmapFileSource(int fd, uint64_t offset, uint64_t size)
+        : fd_(fd), offset_(offset), remaining_(size) {}
+    ~MmapFileSource() override;
+
+    ssize_t send_to(int sockfd, uint64_t max) override;
+    uint64_t remaining() const override { return remaining_; }
+
+private:
+    bool map_window();
+    void unmap();
+
+    int fd_;
+    uint64_t offset_;
+    uint64_t remaining_;
+    char  *map_     = nullptr;
+    size_t map_len_ = 0;
+    size_t map_off_ = 0; // vị trí của offset_ trong cửa sổ
+};
+
+// Chữ ký delta của file cũ, sinh dần từng lô khi buffer gửi hết: mỗi lô đọc
+// + hash ≤ 1 MiB file. Chữ ký nhỏ nên socket hiếm khi đầy; với wake_fd (eventfd
+// của EventLoop) source nhường loop sau mỗi lô (io_pending, tự báo wake_fd)
+// để file lớn không chặn các session khác.
+class SignatureSource : public BodySource {
+public:
+    SignatureSource(uint64_t file_size, BasisReader read, int wake_fd)
+        : sig_(file_size, move(read)), remaining_(sig_.size()), wake_fd_(wake_fd) {}
+    ssize_t send_to(int sockfd, uint64_t max) override;
+    uint64_t remaining() const override { return remaining_; }
+    bool io_pending() const override { return pending_; }
+
+private:
+    SignatureWriter sig_;
+    uint64_t remaining_;
+    int      wake_fd_;
+    string   buf_;
+    size_t   off_     = 0;
+    bool     turn_    = true;  // được sinh lô kế tiếp ngay
+    bool     pending_ = false;
+};
+
+// Upload nén: giải nén từng phần rồi ghi qua sink bên trong. Body giải nén
+// phải đúng size byte và luồng nén phải kết thúc, nếu không finish() lỗi.
+// CRC (nếu bật) tính trên byte sau giải nén.
+class CompressedSink : public BodySink {
+public:
+    CompressedSink(unique_ptr<BodySink> inner, unique_ptr<Decoder> dec, uint64_t size)
+        : inner_(move(inner)), dec_(move(dec)), size_(size) {}
+    void write(const char *p, size_t n) override;
+    bool settled() override { return inner_->settled(); }
+    bool finish() override;
+
+private:
+    unique_ptr<BodySink> inner_;
+    unique_ptr<Decoder>  dec_;
+    uint64_t size_;
+    uint64_t written_ = 0;
+    string   out_;
+    bool     failed_ = false;
+};
+
+// Download nén: đọc [offset, offset+size) qua read, nén dần vào buffer.
+// remaining() chỉ là phần đã nén sẵn (+1 khi chưa nén xong). Mỗi frame chỉ
+// đọc một số khối input; input nén quá tốt thì frame ngắn hơn, và với wake_fd
+// (eventfd của EventLoop) source nhường loop sau mỗi lượt như SignatureSource.
+class CompressedSource : public BodySource {
+public:
+    using Reader = function<bool(uint64_t off, char *buf, size_t len)>;
+    CompressedSource(Reader read, uint64_t offset, uint64_t size, unique_ptr<Encoder> enc,
+                     int wake_fd = -1)
+        : read_(move(read)), offset_(offset), left_(size), enc_(move(enc)), wake_fd_(wake_fd) {}
+    ssize_t send_to(int sockfd, uint64_t max) override;
+    uint64_t remaining() const override { return pending() + (done_ ? 0 : 1); }
+    uint64_t frame_size(uint64_t max, bool &last) override;
+    bool io_pending() const override { return yielded_; }
+
+private:
+    uint64_t pending() const { return out_.size() - out_off_; }
+    void produce();
+
+    Reader   read_;
+    uint64_t offset_;
+    uint64_t left_;
+    unique_ptr<Encoder> enc_;
+    int      wake_fd_;
+    string   out_;
+    size_t   out_off_ = 0;
+    int      reads_   = 0;     // số lần đọc input từ lần nhường loop trước
+    bool     done_    = false;
+    bool     failed_  = false;
+    bool     yielded_ = false;
+};
+
+#ifdef __linux__
+// Download zero-copy: sendfile(2) từ page cache thẳng ra socket.
+class SendfileSource : public BodySource {
+public:
+    SendfileSource(int fd, uint64_t offset, uint64_t size)
+        : fd_(fd), offset_(offset), remaining_(size) {}
+    ssize_t send_to(int sockfd, uint64_t max) override;
+    uint64_t remaining() const override { return remaining_; }
+
+private:
+    int fd_;
+    uint64_t offset_;
+    uint64_t remaining_;
+};
+
+// Upload zero-copy: socket -> pipe -> file bằng splice(2). Nếu cặp fd không
+// hỗ trợ splice thì tự chuyển sang recv + write cho phần còn lại.
+class SpliceFileSink : public BodySink {
+public:
+    SpliceFileSink(int fd, uint64_t offset) : fd_(fd), offset_(offset) {}
+    ~SpliceFileSink() override;
+
+    bool init();
+    void write(const char *p, size_t n) override;
+    ssize_t recv_from(int sockfd, uint64_t max) override;
+    bool finish() override { return !failed_; }
+
+private:
+    void drain_pipe(size_t n);
+
+    int  fd_;
+    int  pipe_[2] = {-1, -1};
+    uint64_t offset_;
+    bool failed_   = false;
+    bool fallback_ = false;
+};
+#endif
@@ -0,0 +1,284 @@
+// ===== file: server/UploadTable.cpp =====
+#include "UploadTable.hpp"
+#include "QuotaManager.hpp"
+#include "Trace.hpp"
+#include "../common/Crc32c.hpp"
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+namespace {
+const time_t PARKED_TTL      = 24 * 3600; // upload dở quá hạn này thì bỏ
+const time_t EXPIRE_INTERVAL = 60;        // mỗi shard dọn upload quá hạn tối đa 1 lần/khoảng này
+
+bool expired(const PartialUpload &u, time_t now) {
+    bool idle = !u.active && u.writers == 0 && !u.committing;
+    return idle && now - u.touched > PARKED_TTL;
+}
+} // namespace
+
+UploadTable::UploadTable(QuotaManager &quota) : quota_(quota) {
+    random_device rd;
+    for (auto &s : shards_) s.rng.seed(rd());
+}
+
+size_t UploadTable::shard_index(const string &full_path) {
+    return std::hash<string>()(full_path) % SHARDS;
+}
+
+int UploadTable::start(PartialUpload &u) {
+    TRACE_SPAN("quota", "start_upload"); // gồm chờ khóa shard
+    size_t idx = shard_index(u.full_path);
+    Shard &s = shards_[idx];
+    time_t now = ::time(nullptr);
+    vector<Expired> expired_list;
+    string stale; // file tạm của bản cũ cùng đích
+    int code = 0;
+    {
+        lock_guard<mutex> lock(s.mtx);
+        collect_expired_locked(s, now, expired_list);
+
+        auto p = s.by_path.find(u.full_path);
+        if (p != s.by_path.end()) {
+            auto it = s.uploads.find(p->second);
+            const PartialUpload &old = it->second;
+            if (old.active || old.writers > 0 || old.committing || old.expiring) {
+                code = 409;
+            } else {
+                // Client bắt đầu lại từ đầu thay vì nối tiếp: bỏ bản cũ.
+                stale = old.tmp_path;
+                quota_.account(old.user_id).release(old.reserved);
+                erase_locked(s, it);
+            }
+        }
+
+        if (code == 0) {
+            u.reserved = u.size > u.old_size ? u.size - u.old_size : 0;
+            if (!quota_.account(u.user_id).reserve(u.reserved)) code = 403;
+        }
+        if (code == 0) {
+            // Giữ trong khoảng int64 cho client dễ xử lý; các bit thấp là shard.
+            do {
+                u.id = (s.rng() >> 1) / SHARDS * SHARDS + idx;
+            } while (u.id == 0 || s.uploads.count(u.id));
+            u.committed = 0;
+            u.crc       = 0;
+            u.crc_ok    = true;
+            u.active    = !u.parallel;
+            u.expiring  = false;
+            u.touched   = now;
+            s.uploads[u.id] = u;
+            s.by_path[u.full_path] = u.id;
+        }
+    }
+    // Caller mở (O_TRUNC) file tạm mới sau khi start trả về nên xóa bản cũ ở
+    // đây không đụng tới nó, kể cả khi cùng đường dẫn.
+    if (!stale.empty()) ::unlink(stale.c_str());
+    drop_expired(s, expired_list);
+    return code;
+}
+
+int UploadTable::resume(uint64_t id, const string &user, PartialUpload &out) {
+    Shard &s = shard_of(id);
+    time_t now = ::time(nullptr);
+    vector<Expired> expired_list;
+    int code = 0;
+    {
+        lock_guard<mutex> lock(s.mtx);
+        collect_expired_locked(s, now, expired_list);
+        auto it = s.uploads.find(id);
+        if (it == s.uploads.end() || it->second.user != user || it->second.expiring ||
+            expired(it->second, now)) {
+            code = 404;
+        } else if (it->second.parallel) {
+            code = 400;
+        } else if (it->second.active) {
+            code = 409;
+        } else {
+            it->second.active = true;
+            out = it->second;
+        }
+    }
+    drop_expired(s, expired_list);
+    return code;
+}
+
+int UploadTable::begin_part(uint64_t id, const string &user, uint64_t offset, uint64_t len,
+                            PartialUpload &out) {
+    Shard &s = shard_of(id);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.uploads.find(id);
+    if (it == s.uploads.end() || it->second.user != user || !it->second.parallel ||
+        it->second.expiring) {
+        return 404;
+    }
+    PartialUpload &u = it->second;
+    if (u.committing) return 409;
+    if (offset > u.size || len > u.size - offset) return 416;
+    ++u.writers;
+    u.touched = ::time(nullptr);
+    out = u;
+    return 0;
+}
+
+void UploadTable::end_part(uint64_t id, uint64_t offset, uint64_t written, int64_t crc) {
+    Shard &s = shard_of(id);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.uploads.find(id);
+    if (it == s.uploads.end()) return;
+    PartialUpload &u = it->second;
+    --u.writers;
+    u.touched = ::time(nullptr);
+    if (written == 0) return;
+    if (crc < 0) u.crc_ok = false;
+
+    // Gộp [offset, end) với các đoạn chạm/chồng lên nó. CRC chỉ ghép được khi
+    // 2 đoạn nối đuôi nhau; chồng lên nhau thì không biết byte nào thắng.
+    uint64_t start = offset, end = offset + written;
+    uint32_t c = (uint32_t)crc;
+    auto r = u.ranges.upper_bound(start);
+    if (r != u.ranges.begin()) {
+        auto prev = std::prev(r);
+        if (prev->second.end >= start) r = prev;
+    }
+    while (r != u.ranges.end() && r->first <= end) {
+        if (r->second.end == start) {
+            c = crc32c_combine(r->second.crc, c, end - start);
+        } else if (r->first == end) {
+            c = crc32c_combine(c, r->second.crc, r->second.end - r->first);
+        } else {
+            u.crc_ok = false;
+        }
+        start = min(start, r->first);
+        end   = max(end, r->second.end);
+        r = u.ranges.erase(r);
+    }
+    u.ranges[start] = UploadRange{end, c};
+
+    u.committed = 0;
+    for (const auto &kv : u.ranges) u.committed += kv.second.end - kv.first;
+}
+
+void UploadTable::reject_part(uint64_t id, uint64_t offset, uint64_t len) {
+    Shard &s = shard_of(id);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.uploads.find(id);
+    if (it == s.uploads.end()) return;
+    PartialUpload &u = it->second;
+    --u.writers;
+    u.touched = ::time(nullptr);
+
+    // Cắt [offset, end) khỏi các đoạn đã có; phần còn lại của đoạn bị cắt
+    // không còn CRC riêng.
+    uint64_t end = offset + len;
+    auto r = u.ranges.upper_bound(offset);
+    if (r != u.ranges.begin() && std::prev(r)->second.end > offset) r = std::prev(r);
+    while (r != u.ranges.end() && r->first < end) {
+        uint64_t a = r->first, b = r->second.end;
+        r = u.ranges.erase(r);
+        if (a < offset) {
+            u.ranges[a] = UploadRange{offset, 0};
+            u.crc_ok = false;
+        }
+        if (b > end) {
+            r = u.ranges.emplace(end, UploadRange{b, 0}).first;
+            u.crc_ok = false;
+            break;
+        }
+    }
+
+    u.committed = 0;
+    for (const auto &kv : u.ranges) u.committed += kv.second.end - kv.first;
+}
+
+int UploadTable::begin_commit(uint64_t id, const string &user, PartialUpload &out) {
+    Shard &s = shard_of(id);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.uploads.find(id);
+    if (it == s.uploads.end() || it->second.user != user || !it->second.parallel ||
+        it->second.expiring) {
+        return 404;
+    }
+    PartialUpload &u = it->second;
+    if (u.committing || u.writers > 0 || u.committed != u.size) return 409;
+    u.committing = true;
+    out = u;
+    return 0;
+}
+
+bool UploadTable::get(uint64_t id, const string &user, PartialUpload &out) {
+    Shard &s = shard_of(id);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.uploads.find(id);
+    if (it == s.uploads.end() || it->second.user != user || it->second.expiring) return false;
+    out = it->second;
+    return true;
+}
+
+void UploadTable::park(uint64_t id, uint64_t committed, int64_t crc) {
+    Shard &s = shard_of(id);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.uploads.find(id);
+    if (it == s.uploads.end()) return;
+    it->second.active    = false;
+    it->second.committed = committed;
+    it->second.crc       = (uint32_t)crc;
+    it->second.crc_ok    = crc >= 0;
+    it->second.touched   = ::time(nullptr);
+}
+
+void UploadTable::finish(uint64_t id) {
+    Shard &s = shard_of(id);
+    lock_guard<mutex> lock(s.mtx);
+    auto it = s.uploads.find(id);
+    if (it == s.uploads.end()) return;
+    quota_.account(it->second.user_id).release(it->second.reserved);
+    erase_locked(s, it);
+}
+
+uint64_t UploadTable::commit(uint64_t id, int user_id, int64_t delta) {
+    TRACE_SPAN("quota", "commit");
+    uint64_t reserved = 0;
+    {
+        Shard &s = shard_of(id);
+        lock_guard<mutex> lock(s.mtx);
+        auto it = s.uploads.find(id);
+        if (it != s.uploads.end()) {
+            reserved = it->second.reserved;
+            erase_locked(s, it);
+        }
+    }
+    return quota_.account(user_id).commit(reserved, delta);
+}
+
+void UploadTable::erase_locked(Shard &s, Map::iterator it) {
+    auto p = s.by_path.find(it->second.full_path);
+    if (p != s.by_path.end() && p->second == it->first) s.by_path.erase(p);
+    s.uploads.erase(it);
+}
+
+// Upload quá hạn vẫn nằm trong bảng (expiring, chặn upload mới cùng đích)
+// tới khi file tạm đã bị xóa, để không xóa nhầm file tạm của upload sau.
+void UploadTable::collect_expired_locked(Shard &s, time_t now, vector<Expired> &out) {
+    if (now < s.next_expire) return;
+    s.next_expire = now + EXPIRE_INTERVAL;
+    for (auto &kv : s.uploads) {
+        PartialUpload &u = kv.second;
+        if (u.expiring || !expired(u, now)) continue;
+        u.expiring = true;
+        out.push_back(Expired{kv.first, u.tmp_path});
+    }
+}
+
+void UploadTable::drop_expired(Shard &s, const vector<Expired> &expired_list) {
+    if (expired_list.empty()) return;
+    for (const auto &e : expired_list) ::unlink(e.tmp_path.c_str());
+    lock_guard<mutex> lock(s.mtx);
+    for (const auto &e : expired_list) {
+        auto it = s.uploads.find(e.id);
+        if (it == s.uploads.end()) continue;
+        quota_.account(it->second.user_id).release(it->second.reserved);
+        erase_locked(s, it);
+    }
+}
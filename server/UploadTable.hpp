@@ -0,0 +1,114 @@
+// ===== file: server/UploadTable.hpp =====
+#pragma once
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+using namespace std;
+
+class QuotaManager;
+
+// Upload chưa commit. Khi kết nối đứt, file tạm và phần quota đã giữ chỗ
+// được giữ lại để client nối tiếp (UPLOAD_RESUME) từ offset đã ghi, kể cả
+// trên kết nối khác. Upload song song (UPLOAD_OPEN) nhận các đoạn bất kỳ qua
+// nhiều kết nối (UPLOAD_PART) và chỉ commit khi đã phủ kín file.
+// CRC32C của phần đã ghi được giữ theo để khi commit có CRC cả file mà không
+// phải đọc lại (ghép bằng crc32c_combine).
+struct UploadRange {
+    uint64_t end = 0;
+    uint32_t crc = 0;
+};
+
+struct PartialUpload {
+    uint64_t id        = 0;
+    string   user;
+    int      user_id   = 0;
+    string   rel_path;
+    string   full_path;
+    string   tmp_path;
+    uint64_t size      = 0;
+    uint64_t old_size  = 0;
+    uint64_t reserved  = 0;     // quota đã giữ chỗ
+    uint64_t committed = 0;     // số byte đầu file tạm đã ghi xong
+    uint32_t crc       = 0;     // CRC32C của [0, committed) (upload tuần tự)
+    bool     crc_ok    = true;  // false: không còn biết CRC (đoạn chồng nhau,
+                                // nối lại trước chỗ đã ghi, tắt checksum)
+    bool     is_text   = false;
+    bool     active    = false; // đang có session nhận body
+    time_t   touched   = 0;
+    bool     parallel   = false;
+    int      writers    = 0;     // parallel: số UPLOAD_PART đang nhận
+    bool     committing = false;
+    bool     expiring   = false; // quá hạn, đang xóa file tạm
+    map<uint64_t, UploadRange> ranges; // parallel: các đoạn đã ghi [đầu, cuối), đã gộp
+};
+
+// Chia shard theo đích (full_path); id mang số shard ở các bit thấp nên tra
+// theo id hay theo đích đều chỉ khóa 1 shard. Upload quá hạn được dọn dần
+// (mỗi shard tối đa 1 lần/phút, khi có upload mới/nối lại) và file tạm bị
+// xóa sau khi nhả khóa.
+class UploadTable {
+public:
+    explicit UploadTable(QuotaManager &quota);
+
+    // Upload mới: giữ chỗ quota, cấp id (u.id, u.reserved được điền).
+    // 0: ok, 403: vượt quota, 409: đích đang có upload khác chạy.
+    // Upload cùng đích đang chờ nối lại thì bị thay thế.
+    int start(PartialUpload &u);
+    // Nhận lại upload đang chờ để gửi tiếp. 0: ok, 404: không có, 409: đang
+    // chạy, 400: là upload song song.
+    int resume(uint64_t id, const string &user, PartialUpload &out);
+    // Upload song song: nhận đoạn [offset, offset+len). 0: ok, 404: không có,
+    // 409: đang commit, 416: vượt size.
+    int begin_part(uint64_t id, const string &user, uint64_t offset, uint64_t len,
+                   PartialUpload &out);
+    // crc: CRC32C của written byte đã ghi, -1 = không biết.
+    void end_part(uint64_t id, uint64_t offset, uint64_t written, int64_t crc);
+    // Đoạn nhận hỏng (sai CRC): phần đã ghi trong [offset, offset+len) không
+    // còn đáng tin, bỏ khỏi các đoạn đã có để client gửi lại.
+    void reject_part(uint64_t id, uint64_t offset, uint64_t len);
+    // Khóa upload song song để commit. 0: ok, 404: không có, 409: còn thiếu
+    // đoạn hoặc đang có đoạn nhận dở.
+    int begin_commit(uint64_t id, const string &user, PartialUpload &out);
+    bool get(uint64_t id, const string &user, PartialUpload &out);
+    // Kết nối đứt giữa chừng: giữ lại để nối tiếp. crc của [0, committed), -1
+    // = không biết.
+    void park(uint64_t id, uint64_t committed, int64_t crc);
+    // Bỏ hẳn: trả phần quota giữ chỗ (file tạm do caller lo).
+    void finish(uint64_t id);
+    // File mới đã vào chỗ: usage += delta và trả phần giữ chỗ trong 1 bước
+    // (không có lúc nào usage mới lẫn phần giữ chỗ cùng bị tính). Trả về
+    // usage mới của user.
+    uint64_t commit(uint64_t id, int user_id, int64_t delta);
+
+private:
+    static const size_t SHARDS = 64;
+    using Map = unordered_map<uint64_t, PartialUpload>;
+    struct Shard {
+        mutex mtx;
+        Map uploads;
+        unordered_map<string, uint64_t> by_path; // full_path -> id
+        mt19937_64 rng;
+        time_t next_expire = 0;
+    };
+    struct Expired {
+        uint64_t id;
+        string   tmp_path;
+    };
+
+    static size_t shard_index(const string &full_path);
+    Shard &shard_of(uint64_t id) { return shards_[id % SHARDS]; }
+    void erase_locked(Shard &s, Map::iterator it);
+    // Đánh dấu expiring các upload quá hạn của shard (nếu đến lượt dọn).
+    void collect_expired_locked(Shard &s, time_t now, vector<Expired> &out);
+    // Ngoài khóa: xóa file tạm rồi bỏ hẳn các upload đã đánh dấu.
+    void drop_expired(Shard &s, const vector<Expired> &expired);
+
+    QuotaManager &quota_;
+    Shard shards_[SHARDS];
+};
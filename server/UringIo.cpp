@@ -0,0 +1,384 @@
+// ===== file: server/UringIo.cpp =====
+#include "UringIo.hpp"
+
+#ifdef FILESHARE_HAVE_URING
+
+#include <liburing.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+using namespace std;
+
+namespace {
+
+const unsigned QUEUE_DEPTH = 8;          // số lệnh file đồng thời mỗi transfer
+const size_t   URING_BUF   = 256 * 1024; // kích thước mỗi buffer đăng ký
+
+// Ring + bộ buffer đăng ký dùng chung cho sink và source.
+class Ring {
+public:
+    ~Ring() {
+        if (ok_) io_uring_queue_exit(&ring_);
+        for (auto &iov : iovs_) free(iov.iov_base);
+    }
+
+    bool init(int eventfd) {
+        if (io_uring_queue_init(QUEUE_DEPTH, &ring_, 0) < 0) return false;
+        ok_ = true;
+        if (eventfd >= 0 && io_uring_register_eventfd(&ring_, eventfd) < 0) return false;
+        for (unsigned i = 0; i < QUEUE_DEPTH; ++i) {
+            void *p = nullptr;
+            if (posix_memalign(&p, 4096, URING_BUF) != 0) return false;
+            iovs_.push_back(iovec{p, URING_BUF});
+        }
+        // Đăng ký buffer có thể thất bại (RLIMIT_MEMLOCK); khi đó vẫn dùng
+        // lệnh read/write thường trên cùng các buffer.
+        fixed_ = io_uring_register_buffers(&ring_, iovs_.data(),
+                                           (unsigned)iovs_.size()) == 0;
+        return true;
+    }
+
+    char *buf(int idx) { return static_cast<char*>(iovs_[idx].iov_base); }
+    unsigned count() const { return (unsigned)iovs_.size(); }
+
+    void prep_write(int fd, int idx, size_t off_in_buf, size_t len, uint64_t file_off) {
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+        char *p = buf(idx) + off_in_buf;
+        if (fixed_) io_uring_prep_write_fixed(sqe, fd, p, (unsigned)len, file_off, idx);
+        else        io_uring_prep_write(sqe, fd, p, (unsigned)len, file_off);
+        io_uring_sqe_set_data(sqe, (void*)(uintptr_t)idx);
+        io_uring_submit(&ring_);
+    }
+
+    void prep_read(int fd, int idx, size_t len, uint64_t file_off) {
+        io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+        if (fixed_) io_uring_prep_read_fixed(sqe, fd, buf(idx), (unsigned)len, file_off, idx);
+        else        io_uring_prep_read(sqe, fd, buf(idx), (unsigned)len, file_off);
+        io_uring_sqe_set_data(sqe, (void*)(uintptr_t)idx);
+        io_uring_submit(&ring_);
+    }
+
+    // Lấy 1 completion; wait=false thì trả về false nếu chưa có.
+    bool reap(bool wait, int &idx, int &res) {
+        io_uring_cqe *cqe = nullptr;
+        int rc = wait ? io_uring_wait_cqe(&ring_, &cqe) : io_uring_peek_cqe(&ring_, &cqe);
+        if (rc < 0 || !cqe) return false;
+        idx = (int)(uintptr_t)io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        io_uring_cqe_seen(&ring_, cqe);
+        return true;
+    }
+
+private:
+    io_uring ring_{};
+    vector<iovec> iovs_;
+    bool ok_    = false;
+    bool fixed_ = false;
+};
+
+// Transfer đóng khi còn lệnh chạy: kernel vẫn ghi/đọc vào buffer của ring,
+// nên ring chỉ được gỡ sau khi hết completion. Việc chờ đó chạy trên thread
+// nền để không chặn EventLoop.
+void retire(unique_ptr<Ring> ring, int inflight) {
+    if (inflight == 0) return;
+    shared_ptr<Ring> hold(move(ring));
+    run_detached([hold, inflight] {
+        int idx, res;
+        for (int i = 0; i < inflight && hold->reap(true, idx, res); ++i) {}
+    });
+}
+
+struct Slot {
+    size_t   len      = 0; // byte hợp lệ trong buffer
+    size_t   done     = 0; // sink: đã ghi xong; source: đã gửi ra socket
+    uint64_t file_off = 0;
+    bool     busy     = false;
+    bool     ready    = false; // source: lệnh đọc đã hoàn tất
+};
+
+class UringFileSink : public BodySink {
+public:
+    UringFileSink(int fd, uint64_t offset, int eventfd)
+        : fd_(fd), file_off_(offset), block_(eventfd < 0), ring_(new Ring) {}
+    ~UringFileSink() override { retire(move(ring_), inflight_); }
+
+    bool init(int eventfd) {
+        if (!ring_->init(eventfd)) return false;
+        slots_.resize(ring_->count());
+        return true;
+    }
+
+    // Mọi buffer đều đang ghi: ghi thẳng bằng pwrite (vùng file khác với các
+    // lệnh đang chạy) thay vì chờ completion.
+    void write(const char *p, size_t n) override {
+        checksum(p, n);
+        while (n > 0 && !failed_) {
+            int idx = current(block_);
+            if (idx < 0) {
+                if (!failed_) write_direct(p, n);
+                return;
+            }
+            Slot &s = slots_[idx];
+            size_t take = min(n, URING_BUF - s.len);
+            memcpy(ring_->buf(idx) + s.len, p, take);
+            s.len += take;
+            p += take;
+            n -= take;
+            if (s.len == URING_BUF) submit_current();
+        }
+    }
+
+    // Nhận thẳng vào buffer đăng ký, không qua buffer trung gian. Chưa có
+    // buffer rảnh thì không đọc socket, chờ eventfd.
+    ssize_t recv_from(int sockfd, uint64_t max) override {
+        pending_ = false;
+        int idx = current(block_);
+        if (idx < 0) {
+            if (failed_) return -1;
+            pending_ = true;
+            return 0;
+        }
+        Slot &s = slots_[idx];
+        size_t want = min((size_t)min<uint64_t>(max, URING_BUF), URING_BUF - s.len);
+        ssize_t n;
+        do {
+            n = ::recv(sockfd, ring_->buf(idx) + s.len, want, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        if (n == 0) return -1;
+        // Byte vừa nhận còn nóng trong cache: tính CRC ngay tại chỗ.
+        checksum(ring_->buf(idx) + s.len, (size_t)n);
+        s.len += (size_t)n;
+        if (s.len == URING_BUF) submit_current();
+        return n;
+    }
+
+    bool io_pending() const override { return pending_; }
+
+    bool settled() override {
+        if (cur_ >= 0 && slots_[cur_].len > 0) submit_current();
+        if (block_) drain();
+        else reap(false);
+        return inflight_ == 0;
+    }
+
+    bool finish() override {
+        if (cur_ >= 0 && slots_[cur_].len > 0) submit_current();
+        drain();
+        return !failed_;
+    }
+
+private:
+    // Buffer đang gom dữ liệu; -1 nếu mọi buffer đều đang ghi (wait: chờ 1
+    // completion thay vì trả -1).
+    int current(bool wait) {
+        if (cur_ >= 0) return cur_;
+        reap(false);
+        while (true) {
+            for (int i = 0; i < (int)slots_.size(); ++i) {
+                if (!slots_[i].busy) {
+                    slots_[i] = Slot{};
+                    cur_ = i;
+                    return cur_;
+                }
+            }
+            if (!wait) return -1;
+            if (!reap(true)) {
+                failed_ = true;
+                return -1;
+            }
+        }
+    }
+
+    void submit_current() {
+        Slot &s = slots_[cur_];
+        s.busy     = true;
+        s.file_off = file_off_;
+        file_off_ += s.len;
+        ring_->prep_write(fd_, cur_, 0, s.len, s.file_off);
+        ++inflight_;
+        cur_ = -1;
+    }
+
+    void write_direct(const char *p, size_t n) {
+        while (n > 0) {
+            ssize_t w = ::pwrite(fd_, p, n, (off_t)file_off_);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                failed_ = true;
+                return;
+            }
+            p += w;
+            n -= (size_t)w;
+            file_off_ += (uint64_t)w;
+        }
+    }
+
+    bool reap(bool wait) {
+        int idx, res;
+        bool got = false;
+        while (inflight_ > 0 && ring_->reap(wait && !got, idx, res)) {
+            got = true;
+            --inflight_;
+            Slot &s = slots_[idx];
+            if (res <= 0) {
+                failed_ = true;
+                s.busy = false;
+                continue;
+            }
+            s.done += (size_t)res;
+            if (s.done < s.len) {
+                // Ghi thiếu: gửi lại phần còn lại.
+                ring_->prep_write(fd_, idx, s.done, s.len - s.done, s.file_off + s.done);
+                ++inflight_;
+            } else {
+                s.busy = false;
+            }
+        }
+        return got;
+    }
+
+    void drain() {
+        while (inflight_ > 0) {
+            if (!reap(true)) break;
+        }
+    }
+
+    int fd_;
+    uint64_t file_off_;
+    bool block_;
+    unique_ptr<Ring> ring_;
+    vector<Slot> slots_;
+    int cur_ = -1;
+    int inflight_ = 0;
+    bool failed_  = false;
+    bool pending_ = false;
+};
+
+class UringFileSource : public BodySource {
+public:
+    UringFileSource(int fd, uint64_t offset, uint64_t size, int eventfd)
+        : fd_(fd), read_off_(offset), end_(offset + size), remaining_(size),
+          block_(eventfd < 0), ring_(new Ring) {}
+    ~UringFileSource() override { retire(move(ring_), inflight_); }
+
+    bool init(int eventfd) {
+        if (!ring_->init(eventfd)) return false;
+        slots_.resize(ring_->count());
+        refill();
+        return true;
+    }
+
+    ssize_t send_to(int sockfd, uint64_t max) override {
+        pending_ = false;
+        if (order_.empty()) return remaining_ == 0 ? 0 : -1;
+        int idx = order_.front();
+        if (!slots_[idx].ready) reap(false);
+        while (!slots_[idx].ready) {
+            // Đĩa chưa đọc xong buffer kế tiếp: chờ eventfd, không chặn loop.
+            if (!block_) {
+                pending_ = true;
+                return 0;
+            }
+            if (!reap(true)) return -1;
+        }
+        Slot &s = slots_[idx];
+        if (s.len == 0) return -1; // file bị cắt ngắn
+
+        size_t want = (size_t)min<uint64_t>(s.len - s.done, max);
+        ssize_t n;
+        do {
+            n = ::send(sockfd, ring_->buf(idx) + s.done, want, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+        s.done     += (size_t)n;
+        remaining_ -= (uint64_t)n;
+        if (s.done == s.len) {
+            s = Slot{};
+            order_.pop_front();
+            refill();
+        }
+        reap(false);
+        return n;
+    }
+
+    uint64_t remaining() const override { return remaining_; }
+    bool io_pending() const override { return pending_; }
+
+private:
+    // Đọc trước vào mọi buffer rảnh.
+    void refill() {
+        for (int i = 0; i < (int)slots_.size() && read_off_ < end_; ++i) {
+            if (slots_[i].busy) continue;
+            Slot &s = slots_[i];
+            s = Slot{};
+            s.busy     = true;
+            s.file_off = read_off_;
+            s.len      = (size_t)min<uint64_t>(URING_BUF, end_ - read_off_);
+            read_off_ += s.len;
+            ring_->prep_read(fd_, i, s.len, s.file_off);
+            ++inflight_;
+            order_.push_back(i);
+        }
+    }
+
+    bool reap(bool wait) {
+        int idx, res;
+        bool got = false;
+        while (inflight_ > 0 && ring_->reap(wait && !got, idx, res)) {
+            got = true;
+            --inflight_;
+            Slot &s = slots_[idx];
+            if (res < 0) res = 0;
+            if ((size_t)res < s.len && res > 0) {
+                // Đọc thiếu (hiếm): đọc nốt đồng bộ để giữ đúng thứ tự.
+                ssize_t more = ::pread(fd_, ring_->buf(idx) + res, s.len - (size_t)res,
+                                       (off_t)(s.file_off + (uint64_t)res));
+                if (more > 0) res += (int)more;
+            }
+            if ((size_t)res < s.len) s.len = 0; // báo lỗi ở send_to
+            s.ready = true;
+        }
+        return got;
+    }
+
+    int fd_;
+    uint64_t read_off_;
+    uint64_t end_;
+    uint64_t remaining_;
+    bool block_;
+    unique_ptr<Ring> ring_;
+    vector<Slot> slots_;
+    deque<int> order_;
+    int inflight_ = 0;
+    bool pending_ = false;
+};
+
+} // namespace
+
+unique_ptr<BodySink> make_uring_file_sink(int fd, uint64_t offset, int eventfd) {
+    auto sink = make_unique<UringFileSink>(fd, offset, eventfd);
+    if (!sink->init(eventfd)) return nullptr;
+    return sink;
+}
+
+unique_ptr<BodySource> make_uring_file_source(int fd, uint64_t offset, uint64_t size,
+                                              int eventfd) {
+    auto src = make_unique<UringFileSource>(fd, offset, size, eventfd);
+    if (!src->init(eventfd)) return nullptr;
+    return src;
+}
+
+#else // !FILESHARE_HAVE_URING
+
+unique_ptr<BodySink> make_uring_file_sink(int, uint64_t, int) { return nullptr; }
+unique_ptr<BodySource> make_uring_file_source(int, uint64_t, uint64_t, int) { return nullptr; }
+
+#endif
@@ -0,0 +1,15 @@
+// ===== file: server/UringIo.hpp =====
+#pragma once
+#include "Transfer.hpp"
+
+// Backend io_uring cho body (cần liburing, build với FILESHARE_HAVE_URING).
+// Giữ nhiều lệnh đọc/ghi file trong hàng đợi trên các buffer đã đăng ký, để
+// đĩa và mạng chạy chồng lên nhau thay vì lần lượt.
+// eventfd >= 0 (EventLoop): không bao giờ chờ completion trên thread gọi; khi
+// buffer kế tiếp chưa xong thì send_to/recv_from trả 0 kèm io_pending(), ring
+// báo eventfd lúc có completion. eventfd < 0 (socket blocking): chờ tại chỗ.
+// Trả về nullptr nếu không dùng được (không build kèm, kernel không hỗ trợ...),
+// khi đó caller quay về backend thường.
+unique_ptr<BodySink>   make_uring_file_sink(int fd, uint64_t offset, int eventfd);
+unique_ptr<BodySource> make_uring_file_source(int fd, uint64_t offset, uint64_t size,
+                                              int eventfd);
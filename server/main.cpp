@@ -1,15 +1,89 @@
 // ===== file: server/main.cpp =====
 #include "FileServer.hpp"
 #include <string>
+#include <cstring>
+#include <iostream>
 
 using namespace std;
 
+static void usage(const char *prog) {
+    cerr << "Usage: " << prog << " [port] [--io=epoll|threads] [--loops=N] [--uring=on|off]\n"
+         << "       [--sendfile=on|off] [--splice=on|off] [--store=files|chunks]\n"
+         << "       [--checksum=on|off] [--cache=MiB] [--db-batch=N] [--db-delay=ms]\n"
+         << "       [--db-readers=N] [--log-full=drop|block] [--log-rotate=MiB]\n"
+         << "       [--log-rotate-age=hours] [--metrics-port=N] [--trace=N]\n"
+         << "       [--rate-global=KiB/s] [--rate-user=KiB/s] [--rate-session=KiB/s]\n"
+         << "       [--user-sessions=N]\n";
+}
+
 int main(int argc, char *argv[]) {
-    string root_dir = "./data";
-    int port = 5051;
-    if (argc > 1) port = stoi(argv[1]);
+    ServerConfig cfg;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--io=epoll") {
+            cfg.io_mode = IoMode::Epoll;
+        } else if (arg == "--io=threads") {
+            cfg.io_mode = IoMode::Threads;
+        } else if (arg.rfind("--loops=", 0) == 0) {
+            cfg.loop_threads = stoi(arg.substr(strlen("--loops=")));
+        } else if (arg == "--uring=on") {
+            cfg.use_uring = true;
+        } else if (arg == "--uring=off") {
+            cfg.use_uring = false;
+        } else if (arg == "--sendfile=on") {
+            cfg.use_sendfile = true;
+        } else if (arg == "--sendfile=off") {
+            cfg.use_sendfile = false;
+        } else if (arg == "--splice=on") {
+            cfg.use_splice = true;
+        } else if (arg == "--splice=off") {
+            cfg.use_splice = false;
+        } else if (arg == "--checksum=on") {
+            cfg.checksum = true;
+        } else if (arg == "--checksum=off") {
+            cfg.checksum = false;
+        } else if (arg.rfind("--cache=", 0) == 0) {
+            cfg.cache_bytes = stoull(arg.substr(strlen("--cache="))) << 20;
+        } else if (arg.rfind("--db-batch=", 0) == 0) {
+            cfg.db_commit.max_batch = stoul(arg.substr(strlen("--db-batch=")));
+        } else if (arg.rfind("--db-delay=", 0) == 0) {
+            cfg.db_commit.max_delay_ms = stoi(arg.substr(strlen("--db-delay=")));
+        } else if (arg.rfind("--db-readers=", 0) == 0) {
+            cfg.db_readers = stoi(arg.substr(strlen("--db-readers=")));
+        } else if (arg == "--log-full=drop") {
+            cfg.log.block_when_full = false;
+        } else if (arg == "--log-full=block") {
+            cfg.log.block_when_full = true;
+        } else if (arg.rfind("--log-rotate=", 0) == 0) {
+            cfg.log.rotate_bytes = stoull(arg.substr(strlen("--log-rotate="))) << 20;
+        } else if (arg.rfind("--log-rotate-age=", 0) == 0) {
+            cfg.log.rotate_hours = stoi(arg.substr(strlen("--log-rotate-age=")));
+        } else if (arg.rfind("--metrics-port=", 0) == 0) {
+            cfg.metrics_port = stoi(arg.substr(strlen("--metrics-port=")));
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            cfg.trace_spans = stoull(arg.substr(strlen("--trace=")));
+        } else if (arg.rfind("--rate-global=", 0) == 0) {
+            cfg.shaping.global_rate = stoull(arg.substr(strlen("--rate-global="))) << 10;
+        } else if (arg.rfind("--rate-user=", 0) == 0) {
+            cfg.shaping.user_rate = stoull(arg.substr(strlen("--rate-user="))) << 10;
+        } else if (arg.rfind("--rate-session=", 0) == 0) {
+            cfg.shaping.session_rate = stoull(arg.substr(strlen("--rate-session="))) << 10;
+        } else if (arg.rfind("--user-sessions=", 0) == 0) {
+            cfg.shaping.user_sessions = (uint32_t)stoul(arg.substr(strlen("--user-sessions=")));
+        } else if (arg == "--store=files") {
+            cfg.chunk_store = false;
+        } else if (arg == "--store=chunks") {
+            cfg.chunk_store = true;
+        } else if (!arg.empty() && arg[0] != '-') {
+            cfg.port = stoi(arg);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
-    FileServer server(root_dir, port);
+    FileServer server(cfg);
     server.run();
     return 0;
 }